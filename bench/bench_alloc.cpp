@@ -0,0 +1,41 @@
+#include <stdlib.h>
+#include <atomic>
+
+#include "bench_alloc.h"
+
+static std::atomic<size_t> allocs_cnt{0};
+
+extern "C" {
+    void* __real_malloc(size_t size);
+    void* __real_calloc(size_t cnt, size_t size);
+    void* __real_realloc(void* ptr, size_t size);
+    void  __real_free(void* ptr);
+
+    void* __wrap_malloc(size_t size);
+    void* __wrap_calloc(size_t cnt, size_t size);
+    void* __wrap_realloc(void* ptr, size_t size);
+    void  __wrap_free(void* ptr);
+}
+
+void* __wrap_malloc(size_t size) {
+    allocs_cnt.fetch_add(1, std::memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t cnt, size_t size) {
+    allocs_cnt.fetch_add(1, std::memory_order_relaxed);
+    return __real_calloc(cnt, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    allocs_cnt.fetch_add(1, std::memory_order_relaxed);
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void* ptr) {
+    __real_free(ptr);
+}
+
+size_t bench_allocs_cnt() {
+    return allocs_cnt.load(std::memory_order_relaxed);
+}
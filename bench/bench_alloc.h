@@ -0,0 +1,9 @@
+#ifndef BENCH_ALLOC_H_INCLUDED
+#define BENCH_ALLOC_H_INCLUDED
+
+#include <stddef.h>
+
+/* Counts malloc/calloc/realloc calls of the linked tree code (-Wl,--wrap). */
+size_t bench_allocs_cnt();
+
+#endif
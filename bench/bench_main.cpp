@@ -0,0 +1,405 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench_alloc.h"
+#include "tree_operations.h"
+#include "tree_info.h"
+#include "forest_info.h"
+#include "forest_operations.h"
+#include "error_handler.h"
+#include "differentiator.h"
+#include "tree_file_io.h"
+#include "tex_io.h"
+#include "input_parser.h"
+#include "teylor.h"
+#include "expr_generator.h"
+#include "metrics.h"
+#include "file_operations.h"
+
+static const size_t BENCH_MAX_SIZES     = 16;
+static const size_t BENCH_DEFAULT_SIZES[] = {64, 512, 4096};
+static const double BENCH_DEFAULT_MIN_MS  = 200;
+static const size_t BENCH_MAX_ITERS       = 1 << 24;
+static const double BENCH_EVAL_POINT      = 0.7;
+static const char*  BENCH_SERIALIZE_PATH  = "bench_serialize.tree";
+
+static const size_t BENCH_VARS_CNT        = 2;
+static const size_t BENCH_DEFAULT_SEED    = 1;
+
+static const char* BENCH_SHAPE_NAMES[] = {"random", "chain", "wide", "nested", "poly"};
+static const size_t BENCH_SHAPES_CNT   = sizeof(BENCH_SHAPE_NAMES) / sizeof(BENCH_SHAPE_NAMES[0]);
+
+//================================================================================
+
+struct bench_ctx_t {
+    forest_t forest;
+    tree_t*  tree;      /* parsed expression */
+    tree_t*  diff_tree; /* its raw derivative, input for optimize */
+    tree_t*  scratch;
+    size_t   x_idx;
+    char*    expr;
+};
+
+struct bench_meter_t {
+    long long ns;
+    size_t    allocs;
+    long long start_ns;
+    size_t    start_allocs;
+};
+
+struct bench_result_t {
+    const char* op;
+    size_t      size;
+    size_t      nodes;
+    size_t      iters;
+    double      ns_per_op;
+    double      nodes_per_sec;
+    double      allocs_per_op;
+};
+
+typedef void (*bench_op_func_t)(bench_ctx_t* ctx, bench_meter_t* meter);
+
+struct bench_op_t {
+    const char*     name;
+    bench_op_func_t func;
+    bool            is_on_diff; /* nodes are counted in diff_tree */
+};
+
+//================================================================================
+
+static long long bench_now_ns() {
+    timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void bench_meter_start(bench_meter_t* meter) {
+    meter->start_allocs = bench_allocs_cnt();
+    meter->start_ns     = bench_now_ns();
+}
+
+static void bench_meter_stop(bench_meter_t* meter) {
+    meter->ns     += bench_now_ns() - meter->start_ns;
+    meter->allocs += bench_allocs_cnt() - meter->start_allocs;
+}
+
+static void bench_fail(const char* what) {
+    fprintf(stderr, "tree_bench: %s failed\n", what);
+    exit(EXIT_FAILURE);
+}
+
+static void bench_clear_tree(tree_t* tree) {
+    destroy_node_recursive(tree->root, nullptr);
+    tree->root = nullptr;
+    tree->size = 0;
+}
+
+//================================================================================
+
+static void bench_op_parse(bench_ctx_t* ctx, bench_meter_t* meter) {
+    const char* str = ctx->expr;
+    bench_meter_start(meter);
+    tree_node_t* root = get_g(ctx->scratch, &str);
+    bench_meter_stop(meter);
+    if(!root) bench_fail("get_g");
+    destroy_node_recursive(root, nullptr);
+}
+
+static void bench_op_diff(bench_ctx_t* ctx, bench_meter_t* meter) {
+    bench_meter_start(meter);
+    tree_node_t* root = get_diff(ctx->tree->root, {&ctx->x_idx, 1});
+    bench_meter_stop(meter);
+    if(!root) bench_fail("get_diff");
+    destroy_node_recursive(root, nullptr);
+}
+
+static void bench_op_optimize(bench_ctx_t* ctx, bench_meter_t* meter) {
+    error_code error = ERROR_NO;
+    ctx->scratch->root = subtree_deep_copy(ctx->diff_tree->root, &error);
+    ctx->scratch->size = ctx->diff_tree->size;
+    if(error != ERROR_NO) bench_fail("subtree_deep_copy");
+
+    bench_meter_start(meter);
+    error |= tree_optimize(ctx->scratch);
+    bench_meter_stop(meter);
+    if(error != ERROR_NO) bench_fail("tree_optimize");
+    bench_clear_tree(ctx->scratch);
+}
+
+static void bench_op_eval(bench_ctx_t* ctx, bench_meter_t* meter) {
+    bench_meter_start(meter);
+    volatile var_val_type ans = calculate_tree(ctx->tree, false);
+    bench_meter_stop(meter);
+    (void)ans;
+}
+
+static void bench_op_write(bench_ctx_t* ctx, bench_meter_t* meter) {
+    bench_meter_start(meter);
+    error_code error = tree_write_to_file(ctx->tree, BENCH_SERIALIZE_PATH);
+    bench_meter_stop(meter);
+    if(error != ERROR_NO) bench_fail("tree_write_to_file");
+}
+
+static void bench_op_read(bench_ctx_t* ctx, bench_meter_t* meter) {
+    bench_meter_start(meter);
+    error_code error = tree_read_from_file(ctx->scratch, BENCH_SERIALIZE_PATH);
+    bench_meter_stop(meter);
+    if(error != ERROR_NO) bench_fail("tree_read_from_file");
+
+    /* all var names already live in the shared var_stack, the buffer is not referenced */
+    bench_clear_tree(ctx->scratch);
+    free((void*)ctx->scratch->buff.ptr);
+    ctx->scratch->buff = {nullptr, 0};
+}
+
+/* the recursive reader tree_parse_from_buffer replaced, file reading included as in "read" */
+static void bench_op_read_step(bench_ctx_t* ctx, bench_meter_t* meter) {
+    string_t buff = {};
+    bench_meter_start(meter);
+    error_code error = read_file_to_buffer_by_name(&buff, BENCH_SERIALIZE_PATH);
+    ctx->scratch->buff = {buff.ptr, buff.len};
+    if(error == ERROR_NO) error = tree_parse_from_buffer_stepwise(ctx->scratch);
+    bench_meter_stop(meter);
+    if(error != ERROR_NO) bench_fail("tree_parse_from_buffer_stepwise");
+
+    bench_clear_tree(ctx->scratch);
+    free(buff.ptr);
+    ctx->scratch->buff = {nullptr, 0};
+}
+
+static void bench_op_tex(bench_ctx_t* ctx, bench_meter_t* meter) {
+    bench_meter_start(meter);
+    error_code error = print_tex_expr(ctx->tree, ctx->tree->root, nullptr);
+    bench_meter_stop(meter);
+    if(error != ERROR_NO) bench_fail("print_tex_expr");
+}
+
+static void bench_op_teylor(bench_ctx_t* ctx, bench_meter_t* meter) {
+    bench_meter_start(meter);
+    error_code error = ERROR_NO;
+    tree_t* teylor = make_teylor(&ctx->forest, ctx->tree, ctx->x_idx, 0, &error);
+    bench_meter_stop(meter);
+    if(!teylor || error != ERROR_NO) bench_fail("make_teylor");
+    forest_delete_tree(&ctx->forest, teylor);
+}
+
+static const bench_op_t BENCH_OPS[] = {
+    {"parse",    &bench_op_parse,    false},
+    {"diff",     &bench_op_diff,     false},
+    {"optimize", &bench_op_optimize, true},
+    {"eval",     &bench_op_eval,     false},
+    {"write",    &bench_op_write,    false},
+    {"read",     &bench_op_read,     false},
+    {"read_step", &bench_op_read_step, false},
+    {"tex",      &bench_op_tex,      false},
+    {"teylor",   &bench_op_teylor,   false},
+};
+static const size_t BENCH_OPS_CNT = sizeof(BENCH_OPS) / sizeof(BENCH_OPS[0]);
+
+//================================================================================
+
+static void bench_ctx_init(bench_ctx_t* ctx, const expr_gen_opts_t* gen_opts) {
+    error_code error = ERROR_NO;
+    error |= forest_init(&ctx->forest ON_DEBUG(, VER_INIT));
+    ctx->forest.tex_file = fopen("/dev/null", "w");
+    if(error != ERROR_NO || !ctx->forest.tex_file) bench_fail("forest_init");
+
+    ctx->tree      = forest_add_tree(&ctx->forest, &error);
+    ctx->diff_tree = forest_add_tree(&ctx->forest, &error);
+    ctx->scratch   = forest_add_tree(&ctx->forest, &error);
+    if(error != ERROR_NO) bench_fail("forest_add_tree");
+
+    ctx->expr = expr_generate_text(ctx->tree, gen_opts, &error);
+    if(!ctx->expr) bench_fail("expr_generate_text");
+    const char* str = ctx->expr;
+    tree_node_t* root = get_g(ctx->tree, &str);
+    if(!root) bench_fail("get_g");
+    tree_replace_root(ctx->tree, root);
+
+    ctx->x_idx = (size_t)get_var_idx({"x", 1}, ctx->tree->var_stack);
+    for(size_t i = 0; i < ctx->tree->var_stack->size; i++) put_var_val(ctx->tree, i, BENCH_EVAL_POINT);
+
+    tree_replace_root(ctx->diff_tree, get_diff(ctx->tree->root, {&ctx->x_idx, 1}));
+
+    /* the read ops need the file even if "write" is not run */
+    if(tree_write_to_file(ctx->tree, BENCH_SERIALIZE_PATH) != ERROR_NO) bench_fail("tree_write_to_file");
+}
+
+static void bench_ctx_dest(bench_ctx_t* ctx) {
+    fclose(ctx->forest.tex_file);
+    ctx->forest.tex_file = nullptr;
+    forest_dest(&ctx->forest);
+    free(ctx->expr);
+    remove(BENCH_SERIALIZE_PATH);
+}
+
+static bench_result_t bench_run_op(bench_ctx_t* ctx, const bench_op_t* op, size_t size, double min_ms) {
+    bench_meter_t meter = {};
+    op->func(ctx, &meter); /* warmup */
+
+    size_t    iters    = 1;
+    long long min_ns   = (long long)(min_ms * 1e6);
+    meter = {};
+    size_t    total_iters = 0;
+    while(meter.ns < min_ns && total_iters < BENCH_MAX_ITERS) {
+        for(size_t i = 0; i < iters; i++) op->func(ctx, &meter);
+        total_iters += iters;
+        iters *= 2;
+    }
+
+    size_t nodes = op->is_on_diff ? ctx->diff_tree->size : ctx->tree->size;
+    double ns_per_op = (double)meter.ns / (double)total_iters;
+    return {
+        .op            = op->name,
+        .size          = size,
+        .nodes         = nodes,
+        .iters         = total_iters,
+        .ns_per_op     = ns_per_op,
+        .nodes_per_sec = (double)nodes * 1e9 / ns_per_op,
+        .allocs_per_op = (double)meter.allocs / (double)total_iters,
+    };
+}
+
+//================================================================================
+
+static void bench_print_table(FILE* out, const bench_result_t* results, size_t results_cnt) {
+    fprintf(out, "%-10s %8s %8s %10s %14s %14s %12s\n",
+            "op", "size", "nodes", "iters", "ns/op", "nodes/sec", "allocs/op");
+    for(size_t i = 0; i < results_cnt; i++) {
+        const bench_result_t* res = &results[i];
+        fprintf(out, "%-10s %8zu %8zu %10zu %14.1f %14.4g %12.1f\n",
+                res->op, res->size, res->nodes, res->iters, res->ns_per_op, res->nodes_per_sec, res->allocs_per_op);
+    }
+}
+
+static error_code bench_write_json(const char* path, const bench_result_t* results, size_t results_cnt) {
+    FILE* out = fopen(path, "w");
+    if(!out) return ERROR_OPEN_FILE;
+
+    fprintf(out, "{\n  \"benchmarks\": [\n");
+    for(size_t i = 0; i < results_cnt; i++) {
+        const bench_result_t* res = &results[i];
+        fprintf(out, "    {\"op\": \"%s\", \"size\": %zu, \"nodes\": %zu, \"iters\": %zu, "
+                     "\"ns_per_op\": %.1f, \"nodes_per_sec\": %.6g, \"allocs_per_op\": %.2f}%s\n",
+                res->op, res->size, res->nodes, res->iters, res->ns_per_op, res->nodes_per_sec,
+                res->allocs_per_op, (i + 1 < results_cnt) ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+
+    fclose(out);
+    return ERROR_NO;
+}
+
+static size_t bench_parse_sizes(const char* str, size_t* sizes) {
+    size_t sizes_cnt = 0;
+    while(*str && sizes_cnt < BENCH_MAX_SIZES) {
+        char*  end  = nullptr;
+        size_t size = strtoul(str, &end, 10);
+        if(end == str || size == 0) return 0;
+        sizes[sizes_cnt++] = size;
+        str = (*end == ',') ? end + 1 : end;
+    }
+    return sizes_cnt;
+}
+
+/* "read,read_step" => mask of BENCH_OPS, 0 on an unknown name */
+static size_t bench_parse_ops(const char* str) {
+    size_t ops_mask = 0;
+    while(*str) {
+        size_t name_len = strcspn(str, ",");
+        size_t op       = 0;
+        while(op < BENCH_OPS_CNT && (strlen(BENCH_OPS[op].name) != name_len || strncmp(str, BENCH_OPS[op].name, name_len))) op++;
+        if(op == BENCH_OPS_CNT) return 0;
+        ops_mask |= (size_t)1 << op;
+        str += name_len;
+        if(*str == ',') str++;
+    }
+    return ops_mask;
+}
+
+static void bench_usage() {
+    fprintf(stderr, "usage: tree_bench [--json <path>] [--sizes <n,n,...>] [--min-time-ms <ms>] [--ops <op,op,...>]\n"
+                    "                  [--shape wide|random|chain|nested|poly] [--seed <n>] [--metrics]\n"
+                    "  size is the node count of the generated expression\n"
+                    "  --ops runs only the named ops, e.g. read,read_step on million node trees\n"
+                    "  --metrics prints phase timers and node counters to stderr (slows the run)\n");
+}
+
+int main(int argc, char** argv) {
+    const char* json_path = nullptr;
+    double      min_ms    = BENCH_DEFAULT_MIN_MS;
+    size_t      sizes[BENCH_MAX_SIZES] = {};
+    size_t      sizes_cnt = sizeof(BENCH_DEFAULT_SIZES) / sizeof(BENCH_DEFAULT_SIZES[0]);
+    size_t      ops_mask  = ((size_t)1 << BENCH_OPS_CNT) - 1;
+    expr_gen_opts_t gen_opts = {
+        .seed           = BENCH_DEFAULT_SEED,
+        .shape          = EXPR_SHAPE_WIDE_SUM,
+        .nodes_cnt      = 0,
+        .max_depth      = 0,
+        .vars_cnt       = BENCH_VARS_CNT,
+        .ops_mask       = 0,
+        .is_domain_safe = true,
+    };
+    memcpy(sizes, BENCH_DEFAULT_SIZES, sizeof(BENCH_DEFAULT_SIZES));
+
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "--json") && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if(!strcmp(argv[i], "--sizes") && i + 1 < argc) {
+            sizes_cnt = bench_parse_sizes(argv[++i], sizes);
+        } else if(!strcmp(argv[i], "--min-time-ms") && i + 1 < argc) {
+            min_ms = atof(argv[++i]);
+        } else if(!strcmp(argv[i], "--ops") && i + 1 < argc) {
+            ops_mask = bench_parse_ops(argv[++i]);
+        } else if(!strcmp(argv[i], "--metrics")) {
+            metrics_enable(true);
+        } else if(!strcmp(argv[i], "--seed") && i + 1 < argc) {
+            gen_opts.seed = strtoull(argv[++i], nullptr, 10);
+        } else if(!strcmp(argv[i], "--shape") && i + 1 < argc) {
+            const char* shape_name = argv[++i];
+            size_t shape = 0;
+            while(shape < BENCH_SHAPES_CNT && strcmp(shape_name, BENCH_SHAPE_NAMES[shape])) shape++;
+            if(shape == BENCH_SHAPES_CNT) {
+                bench_usage();
+                return EXIT_FAILURE;
+            }
+            gen_opts.shape = (expr_shape_t)shape;
+        } else {
+            bench_usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if(sizes_cnt == 0 || min_ms <= 0 || ops_mask == 0) {
+        bench_usage();
+        return EXIT_FAILURE;
+    }
+
+    size_t results_cnt = 0;
+    bench_result_t* results = (bench_result_t*)calloc(sizes_cnt * BENCH_OPS_CNT, sizeof(bench_result_t));
+    if(!results) bench_fail("calloc results");
+
+    for(size_t i = 0; i < sizes_cnt; i++) {
+        bench_ctx_t ctx = {};
+        gen_opts.nodes_cnt = sizes[i];
+        bench_ctx_init(&ctx, &gen_opts);
+        for(size_t j = 0; j < BENCH_OPS_CNT; j++) {
+            if(!(ops_mask & ((size_t)1 << j))) continue;
+            results[results_cnt++] = bench_run_op(&ctx, &BENCH_OPS[j], sizes[i], min_ms);
+        }
+        bench_ctx_dest(&ctx);
+    }
+
+    bench_print_table(stdout, results, results_cnt);
+    if(metrics_is_enabled()) metrics_dump(stderr, METRICS_FORMAT_TABLE);
+
+    int ret = EXIT_SUCCESS;
+    if(json_path && bench_write_json(json_path, results, results_cnt) != ERROR_NO) {
+        fprintf(stderr, "tree_bench: failed to write '%s'\n", json_path);
+        ret = EXIT_FAILURE;
+    }
+
+    free(results);
+    return ret;
+}
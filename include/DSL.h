@@ -2,11 +2,13 @@
 #define DSL_H_INCLUDED
 
 #include "debug_meta.h"
+#include "metrics.h"
 
-#define d(node) get_diff(node, args_arr ON_TEX_CREATION_DEBUG(, tree))
+#define d(node) get_diff_node(node, args_arr ON_TEX_CREATION_DEBUG(, tree))
 
-#define cpy(node) subtree_deep_copy(node, nullptr ON_DUMP_CREATION_DEBUG(, tree))
+#define cpy(node) (metrics_count(METRICS_DEEP_COPIES, 1), subtree_deep_copy(node, nullptr ON_DUMP_CREATION_DEBUG(, tree)))
 
+/* FUNC_TEMPLATE owns its children in both modes, so a failed node frees the operands built for it */
 #ifdef DUMP_CREATION_DEBUG
 #define c(val) \
     init_node_with_dump(CONSTANT, make_union_const(val), nullptr, nullptr, tree)
@@ -25,7 +27,7 @@
     init_node(VARIABLE, make_union_var(get_or_add_var_idx({var_name, strlen(var_name)}, 0, tree->var_stack, nullptr)), nullptr, nullptr)
 
 #define FUNC_TEMPLATE(op_code, left, right) \
-    init_node(FUNCTION, make_union_func(op_code), left, right)
+    init_node_taking(FUNCTION, make_union_func(op_code), left, right)
 #endif
 
 //================================================================================
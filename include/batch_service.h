@@ -0,0 +1,32 @@
+#ifndef BATCH_SERVICE_H_INCLUDED
+#define BATCH_SERVICE_H_INCLUDED
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "error_handler.h"
+
+/*
+ * One job per line:  <op> [spec] : <expr>
+ *   eval     x=1,y=2|x=3,y=4 : x * y + sin(x)    values at each point
+ *   diff     x,y             : x * y + sin(x)    derivative per var, default x
+ *   teylor   x=0.5           : sin(x) * x        Taylor polynomial at the point
+ *   simplify                 : 0 * x + 2 * 3     optimized expression
+ * Empty lines and lines starting with '#' are skipped.
+ *
+ * Output, one line per job in input order:
+ *   <line_no>\tok\t<result>   or   <line_no>\terror\t<message>
+ */
+
+struct batch_opts_t {
+    size_t threads_cnt; /* 0 => one per cpu                  */
+    size_t max_nodes;   /* node budget of each job, 0 => none */
+    size_t chunk_jobs;  /* jobs read ahead per round, 0 => default */
+    size_t cache_nodes; /* derivative cache shared by all workers, 0 => no cache */
+};
+
+const size_t BATCH_DEFAULT_CHUNK_JOBS = 256;
+
+error_code batch_service_run(FILE* in, FILE* out, const batch_opts_t* opts);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef DIFF_CACHE_H_INCLUDED
+#define DIFF_CACHE_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "node_info.h"
+#include "error_handler.h"
+#include "differentiator.h"
+
+/* subtrees smaller than this are cheaper to differentiate than to look up */
+const size_t DIFF_CACHE_MIN_NODES    = 4;
+const size_t DIFF_CACHE_MIN_BUCKETS  = 64;
+
+struct diff_cache_entry_t {
+    uint64_t            hash;        /* subtree hash mixed with the var set      */
+    tree_node_t*        key;         /* copy of the differentiated subtree       */
+    tree_node_t*        diff;        /* its raw derivative, as get_diff makes it */
+    size_t*             vars;        /* sorted args_arr, vars_cnt 0 => all vars  */
+    size_t              vars_cnt;
+    size_t              nodes_cnt;   /* key + diff                               */
+    diff_cache_entry_t* bucket_next;
+    diff_cache_entry_t* lru_prev;    /* towards the most recently used           */
+    diff_cache_entry_t* lru_next;
+};
+
+/* Entries only refer to var indices, so forests with the same var numbering may share one cache */
+struct diff_cache_t {
+    diff_cache_entry_t** buckets;
+    size_t               buckets_cnt; /* power of two */
+    diff_cache_entry_t*  lru_head;
+    diff_cache_entry_t*  lru_tail;
+    size_t               entries_cnt;
+    size_t               nodes_cnt;
+    size_t               max_nodes;   /* LRU entries are evicted above it */
+    size_t               hits;
+    size_t               misses;
+    size_t               evictions;
+    pthread_mutex_t      lock;
+};
+
+error_code diff_cache_init(diff_cache_t* cache, size_t max_nodes);
+void       diff_cache_dest(diff_cache_t* cache);
+void       diff_cache_clear(diff_cache_t* cache);
+
+uint64_t   diff_cache_key_hash(uint64_t subtree_hash, args_arr_t args_arr);
+
+/* On a hit *diff_out is a fresh copy owned by the caller (nullptr if the copy couldn't be made) */
+bool       diff_cache_lookup(diff_cache_t* cache, const tree_node_t* node, uint64_t key_hash,
+                             args_arr_t args_arr, tree_node_t** diff_out);
+/* node_size is the size of node, known to the caller from its hash index */
+void       diff_cache_store (diff_cache_t* cache, const tree_node_t* node, size_t node_size, uint64_t key_hash,
+                             args_arr_t args_arr, const tree_node_t* diff);
+
+/* get_diff consults the cache active in the calling thread */
+diff_cache_t* diff_cache_enter(diff_cache_t* cache);
+void          diff_cache_leave(diff_cache_t* prev_cache);
+diff_cache_t* diff_cache_active();
+
+#endif
@@ -12,11 +12,24 @@ struct args_arr_t {
 
 tree_node_t* get_diff(tree_node_t* node, args_arr_t args_arr ON_TEX_CREATION_DEBUG(, tree_t* tree));
 
+tree_node_t* get_diff_safe(tree_node_t* node, args_arr_t args_arr, node_budget_t* budget, error_code* error
+                           ON_TEX_CREATION_DEBUG(, tree_t* tree));
+
+size_t get_diff_size(const tree_node_t* node, args_arr_t args_arr);
+
 var_val_type calculate_tree(tree_t* tree, bool is_vars_given);
 
 error_code tree_optimize(tree_t* tree);
 
 tree_node_t* optimize_subtree_recursive(tree_node_t* node, error_code* error_ptr);
 
+// Same as optimize_subtree_recursive, and also returns subtree_hash of the result,
+// carried up from the children instead of rehashing the simplified tree
+tree_node_t* optimize_subtree_hashed(tree_node_t* node, error_code* error_ptr, uint64_t* hash);
+
 var_val_type calculate_nodes_recursive(tree_t* tree, tree_node_t* curr_node, error_code* error);
+
+var_val_type calculate_nodes_bound(const tree_node_t* curr_node, const var_bindings_t* bindings, error_code* error);
+
+var_val_type calculate_tree_bound(const tree_t* tree, const var_bindings_t* bindings, error_code* error);
 #endif
\ No newline at end of file
@@ -0,0 +1,38 @@
+#ifndef DUMP_PIPELINE_H_INCLUDED
+#define DUMP_PIPELINE_H_INCLUDED
+
+#include <stddef.h>
+
+#include "error_handler.h"
+
+/*
+ * Renders queued .dot sources to .svg on a pool of workers, at most max_jobs
+ * `dot` processes at once. Files are named by the hash of the dot text, so a
+ * graph already queued is never rendered twice and its svg path is known at
+ * submit time, before the render finishes.
+ */
+
+#define DUMP_PIPELINE_DIR "dumps"
+
+const size_t DUMP_PIPELINE_PATH_SIZE = 256;
+
+struct dump_pipeline_stats_t {
+    size_t submitted;
+    size_t deduplicated;
+    size_t rendered;
+    size_t failed;
+};
+
+/* max_jobs 0 => one per cpu; submit starts the pipeline with the default on first use */
+error_code dump_pipeline_start(size_t max_jobs);
+
+error_code dump_pipeline_submit(const char* dot_text, size_t dot_len, char* svg_path, size_t svg_path_size);
+
+/* waits until every queued render is done */
+void       dump_pipeline_flush();
+
+void       dump_pipeline_stop();
+
+dump_pipeline_stats_t dump_pipeline_stats();
+
+#endif
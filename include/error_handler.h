@@ -19,7 +19,13 @@ enum error_type {
 	ERROR_UNKNOWN_FUNC		 = 1 << 14,
 	ERROR_NO_INIT			 = 1 << 15,
 	ERROR_CLOSE_FILE		 = 1 << 16,
-	ERROR_GET_DIFF			 = 1 << 17
+	ERROR_GET_DIFF			 = 1 << 17,
+	ERROR_MEM_BUDGET		 = 1 << 18,
+	ERROR_SHARED_NODE		 = 1 << 19,
+	ERROR_BAD_ARITY			 = 1 << 20,
+	ERROR_NAN_CONST			 = 1 << 21,
+	ERROR_SIZE_MISMATCH		 = 1 << 22,
+	ERROR_NOT_FINITE		 = 1 << 23
 };
 
 typedef long error_code;
@@ -0,0 +1,38 @@
+#ifndef EXPR_GENERATOR_H_INCLUDED
+#define EXPR_GENERATOR_H_INCLUDED
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "tree_info.h"
+#include "error_handler.h"
+
+#define EXPR_OP_BIT(op_code) (1ull << (op_code))
+
+enum expr_shape_t {
+    EXPR_SHAPE_RANDOM     = 0,
+    EXPR_SHAPE_CHAIN      = 1, /* deep left-leaning chain of ops          */
+    EXPR_SHAPE_WIDE_SUM   = 2, /* sum of many shallow random terms        */
+    EXPR_SHAPE_NESTED     = 3, /* f1(f2(...fn(x))) of unary functions     */
+    EXPR_SHAPE_POLYNOMIAL = 4  /* sum of monomials over vars_cnt vars     */
+};
+
+struct expr_gen_opts_t {
+    uint64_t     seed;
+    expr_shape_t shape;
+    size_t       nodes_cnt;      /* approximate size of the result               */
+    size_t       max_depth;      /* 0 => unlimited                               */
+    size_t       vars_cnt;       /* 0 => 1, vars are named x, y, z, ...          */
+    uint64_t     ops_mask;       /* EXPR_OP_BIT of allowed ops, 0 => all ops     */
+    bool         is_domain_safe; /* guard ln, div, asin, ... args against NaN    */
+};
+
+const size_t EXPR_MAX_VARS = 16;
+
+tree_node_t* expr_generate(tree_t* tree, const expr_gen_opts_t* opts, error_code* error);
+
+char* expr_generate_text(tree_t* tree, const expr_gen_opts_t* opts, error_code* error);
+
+error_code expr_print_infix(FILE* out, const tree_t* tree, const tree_node_t* node);
+
+#endif
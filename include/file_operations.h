@@ -10,4 +10,7 @@ error_code read_file_to_buffer_by_name(string_t* buff, const char* filename);
 
 error_code read_file_to_buffer(FILE* filename, string_t* buff_str);
 
+/* writes to a closed pipe fail with EPIPE instead of killing the process */
+void ignore_sigpipe();
+
 #endif
\ No newline at end of file
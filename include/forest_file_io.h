@@ -0,0 +1,50 @@
+#ifndef FOREST_FILE_IO_H_INCLUDED
+#define FOREST_FILE_IO_H_INCLUDED
+
+#include <stddef.h>
+
+#include "error_handler.h"
+#include "forest_info.h"
+
+/*
+ * Forest files keep many named trees over one var table.
+ * Text:   "#forest_format 2", then "#vars N "x" "y" ...", then one tree per line:
+ *         "name" (+ ("x" nil nil) (1.5 nil nil))
+ *         then "#index N", N lines "offset len "name"" and "#index_at offset" last.
+ * Binary: magic, version, func and var name tables, then records prefixed by their byte
+ *         length, nodes in preorder. Then the index: per tree u64 offset, u64 len, name;
+ *         the file ends with the u64 index offset and "FORESTIX". Native byte order.
+ * Version 1 files have no index, they are still read; lazy opening scans them instead.
+ * The loader adds the file vars to the forest var_stack in file order (vars the forest already
+ * has keep their index), so the merged indices do not depend on threads. Then it finds the
+ * record bounds, parses the records with parallel_for and appends the trees to tree_list in
+ * file order. Tree and var names point into the file buffer, kept until forest_dest.
+ */
+
+#define FOREST_TEXT_MAGIC "#forest_format"
+const int FOREST_FILE_VERSION = 2;
+
+enum forest_file_format_t {
+    FOREST_FILE_TEXT,
+    FOREST_FILE_BINARY
+};
+
+error_code forest_write_to_file(const forest_t* forest, const char* filename, forest_file_format_t format);
+
+/* the format is taken from the file; threads_cnt 0 => one per cpu; one file per forest */
+error_code forest_read_from_file(forest_t* forest, const char* filename, size_t threads_cnt);
+
+/*
+ * Lazy mode: the file is mmap'ed, only the header and the index are read, every tree becomes
+ * a stub (is_stub, root nullptr, name set) and is parsed on first forest_load_tree. Loads of
+ * different trees may run in parallel. Stubs can not be written, load them first.
+ */
+error_code forest_open_lazy(forest_t* forest, const char* filename);
+/* no-op for a loaded tree; a broken record leaves the tree a stub */
+error_code forest_load_tree(forest_t* forest, tree_t* tree);
+error_code forest_load_all (forest_t* forest, size_t threads_cnt);
+/* nullptr if there is no such tree or it failed to load (then *error is set) */
+tree_t*    forest_find_tree(forest_t* forest, c_string_t name, error_code* error);
+void       forest_lazy_dest(forest_lazy_t* lazy);
+
+#endif
@@ -2,18 +2,30 @@
 #define FOREST_INFO_H_INCLUDED
 
 #include "debug_meta.h"
+#include "metrics.h"
+#include "node_info.h"
 #include "../libs/List/include/list_info.h"
 #include "../libs/StackDead-main/stack.h"
 
+struct diff_cache_t;
+struct forest_lazy_t;
+
 struct forest_t {
     list_t*    tree_list;
     c_string_t buff;
+    char*      file_buff;  /* forest file of forest_read_from_file: names of trees and vars point into it */
+    forest_lazy_t* lazy;   /* mapped file of forest_open_lazy, same role as file_buff */
     stack_t*   var_stack;
     ON_DEBUG(
         ver_info_t ver_info;
         FILE* dump_file;
     )
     FILE* tex_file;
+    FILE*            metrics_file; /* metrics are dumped here at forest_dest, nullptr => no dump */
+    metrics_format_t metrics_format;
+    node_budget_t    node_budget;  /* enforced by get_diff_safe and make_teylor, max_nodes 0 => unlimited */
+    diff_cache_t*    diff_cache;   /* not owned, may be shared by forests, nullptr => no caching */
+    size_t           threads_cnt;  /* for checks of its trees made by make_teylor, 0 => all online cpus */
     
 };
 
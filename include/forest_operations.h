@@ -21,10 +21,20 @@ tree_t* forest_add_tree(forest_t* forest, error_code* error_ptr);
 
 error_code forest_delete_tree(forest_t* forest, tree_t* tree);
 
+error_code forest_clear_trees(forest_t* forest);
+
 tree_t* forest_include_tree(forest_t* forest, tree_t* tree, error_code* error_ptr);
 
 error_code forest_exclude_tree(forest_t* forest, tree_t* tree);
 
 error_code forest_dest(forest_t* forest);
 
+error_code forest_set_metrics_output(forest_t* forest, FILE* metrics_file, metrics_format_t format);
+
+error_code forest_set_node_budget(forest_t* forest, size_t max_nodes);
+
+error_code forest_set_diff_cache(forest_t* forest, diff_cache_t* cache);
+
+error_code forest_set_threads_cnt(forest_t* forest, size_t threads_cnt);
+
 #endif
\ No newline at end of file
@@ -1,10 +1,74 @@
 #ifndef INPUT_PARSER_H_INCLUDED
 #define INPUT_PARSER_H_INCLUDED
 
+#include <stdio.h>
+
 #include "tree_info.h"
+#include "error_handler.h"
 
 #define CONSTANT_init(val) \
     init_node(CONSTANT, make_union_const(val), nullptr, nullptr);
 
 tree_node_t* get_g(tree_t* tree, const char** str);
-#endif
\ No newline at end of file
+
+//================================================================================
+/*
+ * Push parser for the get_g grammar. Text is fed in chunks of any size, a token may be
+ * split between chunks. Shunting-yard over explicit operand / operator stacks: memory
+ * follows the tree and its nesting, not the length of the text. Unlike get_g, text left
+ * after the expression is an error unless it follows the '$' terminator.
+ * New var names are interned for the whole run, so the var_stack may outlive the stream.
+ */
+
+const size_t EXPR_STREAM_CHUNK_SIZE = 1 << 16;
+
+enum expr_stream_token_t {
+    EXPR_STREAM_NONE,
+    EXPR_STREAM_NUM,
+    EXPR_STREAM_NAME
+};
+
+enum expr_stream_op_kind_t {
+    EXPR_STREAM_BINARY,
+    EXPR_STREAM_PAREN,
+    EXPR_STREAM_FUNC
+};
+
+struct expr_stream_op_t {
+    expr_stream_op_kind_t kind;
+    func_type_t           func;
+    size_t                argc;     /* EXPR_STREAM_FUNC only */
+    size_t                args_cnt; /* args closed by ',' so far */
+};
+
+struct expr_stream_t {
+    tree_t*             tree;
+    tree_node_t**       operands;
+    size_t              operands_cnt;
+    size_t              operands_cap;
+    expr_stream_op_t*   ops;
+    size_t              ops_cnt;
+    size_t              ops_cap;
+    char*               token;          /* number or name not finished in the last chunk */
+    size_t              token_len;
+    size_t              token_cap;
+    expr_stream_token_t token_kind;
+    size_t              pos;            /* bytes fed so far, for messages */
+    bool                is_operand_expected;
+    bool                is_func_pending; /* func name read, '(' must follow */
+    func_type_t         pending_func;
+    size_t              pending_argc;
+    bool                is_done;         /* '$' read, the rest of the input is ignored */
+    error_code          error;           /* sticky */
+};
+
+error_code   expr_stream_init  (expr_stream_t* stream, tree_t* tree);
+error_code   expr_stream_feed  (expr_stream_t* stream, const char* chunk, size_t len);
+/* nullptr and *error set if the text is not a whole expression; the root is owned by the caller */
+tree_node_t* expr_stream_finish(expr_stream_t* stream, error_code* error);
+error_code   expr_stream_dest  (expr_stream_t* stream);
+
+/* reads in until EOF in EXPR_STREAM_CHUNK_SIZE pieces, works on pipes */
+tree_node_t* get_g_from_file(tree_t* tree, FILE* in, error_code* error);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef INTERVAL_H_INCLUDED
+#define INTERVAL_H_INCLUDED
+
+#include <stddef.h>
+
+#include "tree_info.h"
+#include "error_handler.h"
+
+/*
+ * Enclosure of the finite values f takes over a box of var intervals.
+ * Bounds are rounded outwards, an infinite bound means f is unbounded there.
+ *   is_empty   - f has no finite value anywhere in the box, lo/hi are meaningless
+ *   is_partial - f may be undefined (nan or infinite) somewhere in the box
+ */
+struct interval_t {
+    double lo;
+    double hi;
+    bool   is_empty;
+    bool   is_partial;
+};
+
+struct interval_bindings_t {
+    interval_t* vals;
+    size_t      size;
+};
+
+interval_t interval_make(double lo, double hi);
+interval_t interval_empty();
+interval_t interval_union(interval_t a, interval_t b);
+
+/* no finite value at all: empty, or only +inf / only -inf */
+bool       interval_is_void(interval_t a);
+
+/* every var starts as the point of its current value in var_stack */
+error_code interval_bindings_init(interval_bindings_t* bindings, const stack_t* var_stack);
+error_code interval_bindings_dest(interval_bindings_t* bindings);
+interval_t bind_var_interval(interval_bindings_t* bindings, size_t var_idx, interval_t value);
+
+interval_t interval_nodes_eval(const tree_node_t* curr_node, const interval_bindings_t* bindings, error_code* error);
+
+interval_t interval_tree_eval(const tree_t* tree, const interval_bindings_t* bindings, error_code* error);
+
+#endif
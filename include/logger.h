@@ -2,7 +2,18 @@
 #define LOGGER_H_INCLUDED
 
 #include <stdio.h>
+#ifndef LOGGER_DISABLE /* bench build compiles logging out */
 #define LOGGER_ALL
+#endif
+
+/* Messages below this level are compiled out: -DLOGGER_MIN_LEVEL=1 drops LOGGER_DEBUG */
+#ifndef LOGGER_MIN_LEVEL
+#ifdef NDEBUG
+#define LOGGER_MIN_LEVEL 1
+#else
+#define LOGGER_MIN_LEVEL 0
+#endif
+#endif
 
 //==============================================================================
 
@@ -24,6 +35,11 @@ void logger_initialize_stream(FILE *stream); /* nullptr => stderr */
 int  logger_initialize_file(const char *path); 
 void logger_close();
 
+/* Messages go through a lock-free ring to a writer thread; errors are written before the call returns.
+   Set the output first, logger_close stops the thread and drains the ring */
+int  logger_start_async();
+void logger_flush();
+
 //------------------------------------------------------------------------------
 
 void logger_log_message(logger_mode_type mode,
@@ -33,15 +49,27 @@ void logger_log_message(logger_mode_type mode,
 
 //==============================================================================
 
-#ifdef LOGGER_ALL
+#if defined(LOGGER_ALL) && LOGGER_MIN_LEVEL <= 0
 #define LOGGER_DEBUG(...)   logger_log_message(LOGGER_MODE_DEBUG,   __FILE__, __LINE__, __VA_ARGS__)
-#define LOGGER_INFO(...)    logger_log_message(LOGGER_MODE_INFO,    __FILE__, __LINE__, __VA_ARGS__)
-#define LOGGER_WARNING(...) logger_log_message(LOGGER_MODE_WARNING, __FILE__, __LINE__, __VA_ARGS__)
-#define LOGGER_ERROR(...)   logger_log_message(LOGGER_MODE_ERROR,   __FILE__, __LINE__, __VA_ARGS__)
 #else
 #define LOGGER_DEBUG(...)   
+#endif
+
+#if defined(LOGGER_ALL) && LOGGER_MIN_LEVEL <= 1
+#define LOGGER_INFO(...)    logger_log_message(LOGGER_MODE_INFO,    __FILE__, __LINE__, __VA_ARGS__)
+#else
 #define LOGGER_INFO(...)    
+#endif
+
+#if defined(LOGGER_ALL) && LOGGER_MIN_LEVEL <= 2
+#define LOGGER_WARNING(...) logger_log_message(LOGGER_MODE_WARNING, __FILE__, __LINE__, __VA_ARGS__)
+#else
 #define LOGGER_WARNING(...)
+#endif
+
+#if defined(LOGGER_ALL) && LOGGER_MIN_LEVEL <= 3
+#define LOGGER_ERROR(...)   logger_log_message(LOGGER_MODE_ERROR,   __FILE__, __LINE__, __VA_ARGS__)
+#else
 #define LOGGER_ERROR(...)  
 #endif
 
@@ -4,8 +4,49 @@
 #include "tree_info.h"
 #include "error_handler.h"
 
+enum plot_data_format_t {
+    PLOT_DATA_TEXT   = 0,
+    PLOT_DATA_BINARY = 1
+};
+
+enum plot_sampling_t {
+    PLOT_SAMPLING_UNIFORM  = 0,
+    PLOT_SAMPLING_ADAPTIVE = 1  /* dots_cnt is the evaluations budget */
+};
+
+struct plot_session_t {
+    FILE*       gnu_pipe;
+    const char* out_dir;
+    size_t      plots_cnt;
+};
+
+struct plot_opts_t {
+    plot_data_format_t data_format;
+    size_t             threads_cnt; /* 0 => all online cpus */
+    plot_sampling_t    sampling;
+};
+
 error_code tree_plot_to_gnuplot(tree_t *treeData, size_t varIndex,
                                 double xMin, double xMax,
                                 size_t dotsCount, const char *dataPath, const char *pngPath);
 
-#endif
\ No newline at end of file
+error_code tree_plot_to_gnuplot_opts(const tree_t* tree, size_t var_idx,
+                                     double x_min, double x_max,
+                                     size_t dots_cnt, const char* data_path, const char* png_path,
+                                     plot_opts_t opts);
+
+error_code trees_plot_to_gnuplot(const tree_t* const* trees, const char* const* titles, size_t trees_cnt,
+                                 size_t var_idx, double x_min, double x_max,
+                                 size_t dots_cnt, const char* data_path, const char* png_path,
+                                 plot_opts_t opts);
+
+error_code plot_session_open(plot_session_t* session, const char* out_dir);
+
+error_code plot_session_plot(plot_session_t* session,
+                             const tree_t* const* trees, const char* const* titles, size_t trees_cnt,
+                             size_t var_idx, double x_min, double x_max, size_t dots_cnt,
+                             const char* png_name, plot_opts_t opts);
+
+error_code plot_session_close(plot_session_t* session);
+
+#endif
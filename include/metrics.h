@@ -0,0 +1,93 @@
+#ifndef METRICS_H_INCLUDED
+#define METRICS_H_INCLUDED
+
+#include <stdio.h>
+#include <stddef.h>
+#include <atomic>
+
+#include "error_handler.h"
+
+//================================================================================
+
+/* X(enum name, printed name) */
+#define METRICS_COUNTERS(X)                            \
+    X(METRICS_NODES_ALLOCATED,   "nodes_allocated")    \
+    X(METRICS_NODES_FREED,       "nodes_freed")        \
+    X(METRICS_NODES_FOLDED,      "nodes_folded")       \
+    X(METRICS_NODES_NEUTRAL,     "nodes_neutral")      \
+    X(METRICS_DEEP_COPIES,       "deep_copies")        \
+    X(METRICS_EVALUATIONS,       "evaluations")        \
+    X(METRICS_DIFF_CACHE_HITS,   "diff_cache_hits")    \
+    X(METRICS_DIFF_CACHE_MISSES, "diff_cache_misses")
+
+/* phases are timed inclusively: teylor time contains its diff and optimize time */
+#define METRICS_PHASES(X)                  \
+    X(METRICS_PHASE_DIFF,     "diff")      \
+    X(METRICS_PHASE_OPTIMIZE, "optimize")  \
+    X(METRICS_PHASE_EVAL,     "eval")      \
+    X(METRICS_PHASE_TEX,      "tex")       \
+    X(METRICS_PHASE_DUMP,     "dump")      \
+    X(METRICS_PHASE_TEYLOR,   "teylor")
+
+#define METRICS_ENUM_ITEM(name, str_name) name,
+
+enum metrics_counter_t {
+    METRICS_COUNTERS(METRICS_ENUM_ITEM)
+    METRICS_COUNTERS_CNT
+};
+
+enum metrics_phase_t {
+    METRICS_PHASES(METRICS_ENUM_ITEM)
+    METRICS_PHASES_CNT
+};
+
+#undef METRICS_ENUM_ITEM
+
+enum metrics_format_t {
+    METRICS_FORMAT_TABLE = 0,
+    METRICS_FORMAT_JSON  = 1
+};
+
+struct metrics_state_t {
+    std::atomic<bool>      is_enabled;
+    std::atomic<size_t>    counters[METRICS_COUNTERS_CNT];
+    std::atomic<long long> phase_ns[METRICS_PHASES_CNT];
+    std::atomic<size_t>    phase_calls[METRICS_PHASES_CNT];
+};
+
+extern metrics_state_t metrics_state;
+
+//================================================================================
+
+void       metrics_enable(bool is_enabled);
+void       metrics_reset();
+long long  metrics_now_ns();
+void       metrics_phase_add(metrics_phase_t phase, long long elapsed_ns);
+
+size_t     metrics_counter_get(metrics_counter_t counter);
+size_t     metrics_phase_calls(metrics_phase_t phase);
+long long  metrics_phase_ns(metrics_phase_t phase);
+
+error_code metrics_dump(FILE* out, metrics_format_t format);
+
+//--------------------------------------------------------------------------------
+/* Hot paths: a disabled metric costs one relaxed load */
+
+inline bool metrics_is_enabled() {
+    return metrics_state.is_enabled.load(std::memory_order_relaxed);
+}
+
+inline void metrics_count(metrics_counter_t counter, size_t value) {
+    if(metrics_is_enabled()) metrics_state.counters[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+/* 0 => metrics were off, the matching metrics_phase_end is a no-op */
+inline long long metrics_phase_begin() {
+    return metrics_is_enabled() ? metrics_now_ns() : 0;
+}
+
+inline void metrics_phase_end(metrics_phase_t phase, long long begin_ns) {
+    if(begin_ns) metrics_phase_add(phase, metrics_now_ns() - begin_ns);
+}
+
+#endif
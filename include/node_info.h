@@ -1,6 +1,8 @@
 #ifndef NODE_INFO_H_INCLUDED
 #define NODE_INFO_H_INCLUDED
 
+#include <stdint.h>
+
 #include "my_string.h"
 
 #define HANDLE_FUNC(name, ...) name,
@@ -20,6 +22,11 @@ struct variable_t {
     var_val_type val;
 };
 
+struct var_bindings_t {
+    var_val_type* vals;
+    size_t        size;
+};
+
 enum node_type_t {
     FUNCTION,
     CONSTANT,
@@ -36,9 +43,19 @@ union value_t {
 
 struct tree_node_t {
     node_type_t  type;
+    uint32_t     budget_id; /* node_budget_t::id it was counted by, 0 => none; fits the padding after type */
     value_t      value;
     tree_node_t* left;
     tree_node_t* right;
 };
 
+/* Caps the nodes alive at once among those allocated while the budget is active */
+struct node_budget_t {
+    size_t   max_nodes;   /* 0 => unlimited                       */
+    size_t   live_nodes;
+    size_t   peak_nodes;
+    uint32_t id;          /* given on the first node_budget_enter  */
+    bool     is_exceeded; /* sticky until the next node_budget_enter */
+};
+
 #endif
\ No newline at end of file
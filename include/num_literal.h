@@ -0,0 +1,23 @@
+#ifndef NUM_LITERAL_H_INCLUDED
+#define NUM_LITERAL_H_INCLUDED
+
+#include <stddef.h>
+
+/*
+ * Locale-independent double literals: digits [ '.' digits ] [ ('e' | 'E') [sign] digits ].
+ * No sign in front: the grammar has none. Correctly rounded: literals with at most 19
+ * significant digits and a small exponent take the exact Clinger fast path, the rest go
+ * to std::from_chars.
+ * num_literal_print writes the shortest text that scans back to the same bits (std::to_chars,
+ * Ryu in libstdc++), with a '-' in front of negative values; inf is written as 1e999.
+ */
+
+const size_t NUM_LITERAL_MAX_LEN = 32; /* "-2.2250738585072014e-308" and a NUL fit */
+
+/* chars consumed, 0 if str does not start with a digit; scanning stops at max_len or a NUL */
+size_t num_literal_scan(const char* str, size_t max_len, double* val);
+
+/* chars written to buf (NUM_LITERAL_MAX_LEN bytes, NUL terminated), 0 for nan */
+size_t num_literal_print(double val, char* buf);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef PARALLEL_H_INCLUDED
+#define PARALLEL_H_INCLUDED
+
+#include <stddef.h>
+
+#include "error_handler.h"
+
+typedef void (*parallel_task_func_t)(size_t task_idx, void* ctx);
+
+size_t parallel_threads_cnt();
+
+error_code parallel_for(size_t tasks_cnt, size_t threads_cnt, parallel_task_func_t task_func, void* ctx);
+
+#endif
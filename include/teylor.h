@@ -1,6 +1,60 @@
 #ifndef TEYLOR_H_INCLUDED
 #define TEYLOR_H_INCLUDED
 
-tree_t* make_teylor(forest_t* forest, tree_t* root_tree, size_t var_idx, const_val_type target_val);
+#include <stdio.h>
 
-#endif
\ No newline at end of file
+#include "tree_info.h"
+#include "forest_info.h"
+#include "error_handler.h"
+
+const size_t TEYLOR_PROFILE_MAX_ORDERS = 8;
+const size_t TEYLOR_MAX_ORDER          = 16; /* (n + 1)! still fits the factorial */
+const size_t TEYLOR_BOUND_PIECES       = 16; /* subintervals of the radius for the interval bound */
+const size_t TEYLOR_NODE_MEM_BYTES     = sizeof(tree_node_t) + 16; /* calloc chunk with glibc header */
+
+struct teylor_order_stats_t {
+    size_t    predicted_nodes;   /* get_diff_size before differentiating */
+    size_t    raw_nodes;         /* straight out of get_diff             */
+    size_t    optimized_nodes;
+    size_t    max_depth;
+    size_t    distinct_subtrees;
+    long long diff_ns;
+    long long optimize_ns;
+    size_t    mem_bytes;         /* estimate for the optimized tree      */
+};
+
+struct teylor_profile_t {
+    size_t               mem_budget;         /* in: bytes, 0 => no limit                     */
+    size_t               orders_cnt;         /* out: filled orders, [0] is the input tree    */
+    teylor_order_stats_t orders[TEYLOR_PROFILE_MAX_ORDERS];
+    size_t               live_nodes;         /* out: nodes of all trees made so far          */
+    size_t               predicted_peak_mem; /* out: bytes                                   */
+    bool                 is_rejected;        /* out: next order was predicted over mem_budget */
+};
+
+/*
+ * Lagrange remainder: |f(x) - P_n(x)| <= sup|f^(n+1)| * radius^(n+1) / (n+1)! on
+ * [target_val - radius, target_val + radius], with the sup taken by interval evaluation.
+ */
+struct teylor_bound_t {
+    const_val_type radius;     /* in: > 0                                                      */
+    size_t         order;      /* in: degree of the polynomial, 0 => the make_teylor default    */
+    double         tolerance;  /* in: > 0 => lowest degree up to max_order with remainder below */
+    size_t         max_order;  /* in: cap of the adaptive search, 0 => TEYLOR_MAX_ORDER         */
+    size_t         used_order; /* out: degree of the returned polynomial                       */
+    double         remainder;  /* out: INFINITY if f^(n+1) is not bounded on the interval      */
+};
+
+/* ERROR_MEM_BUDGET in *error tells an abort on forest->node_budget from other failures */
+tree_t* make_teylor(forest_t* forest, tree_t* root_tree, size_t var_idx, const_val_type target_val,
+                    error_code* error);
+
+tree_t* make_teylor_profiled(forest_t* forest, tree_t* root_tree, size_t var_idx, const_val_type target_val,
+                             teylor_profile_t* profile, error_code* error);
+
+tree_t* make_teylor_bounded(forest_t* forest, tree_t* root_tree, size_t var_idx, const_val_type target_val,
+                            teylor_bound_t* bound, error_code* error);
+
+error_code teylor_profile_dump(FILE* out, const teylor_profile_t* profile);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef TREE_CHECK_H_INCLUDED
+#define TREE_CHECK_H_INCLUDED
+
+#include <stddef.h>
+
+#include "tree_info.h"
+#include "error_handler.h"
+
+/*
+ * Structural integrity check cheap enough to run after every get_diff / tree_optimize.
+ * Writes no files; every kind of damage has its own error bit:
+ *   ERROR_SHARED_NODE       - a node is reachable twice (shared subtree or cycle)
+ *   ERROR_BAD_ARITY         - children do not match args_cnt of copy_past_file
+ *   ERROR_UNKNOWN_FUNC      - func code out of the copy_past_file table
+ *   ERROR_INVALID_STRUCTURE - unknown node type
+ *   ERROR_INCORRECT_INDEX   - var_idx out of var_stack
+ *   ERROR_NAN_CONST         - constant is nan
+ *   ERROR_SIZE_MISMATCH     - tree->size differs from the real count
+ * Big trees are split into subtrees walked by parallel_for over one shared visited set.
+ */
+
+struct tree_check_report_t {
+    size_t nodes_cnt;    /* distinct reachable nodes */
+    size_t shared_cnt;   /* extra references to already visited nodes */
+    size_t arity_cnt;
+    size_t bad_func_cnt;
+    size_t bad_type_cnt;
+    size_t var_idx_cnt;
+    size_t nan_cnt;
+    size_t tasks_cnt;
+};
+
+/* threads_cnt 0 => one per cpu, report may be nullptr */
+error_code tree_check(const tree_t* tree, size_t threads_cnt, tree_check_report_t* report);
+
+#endif
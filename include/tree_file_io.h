@@ -4,13 +4,40 @@
 #include "error_handler.h"
 #include "tree_info.h"
 
+/*
+ * Non-empty trees are written after a "#tree_format <version>" line. Version 1 files have
+ * no such line and integer constants only; they still load. Since version 2 constants are
+ * written with num_literal_print and read back bit for bit.
+ */
+#define TREE_FILE_MAGIC "#tree_format"
+const int TREE_FILE_VERSION = 2;
+
 error_code tree_read_from_file(tree_t* tree, const char* filename);
 error_code tree_write_to_file(const tree_t* tree, const char* filename);
 
 const char* tech_get_func_name_by_type(func_type_t func_type_value); //TODO что делать
 const char* get_func_name_by_type(func_type_t func_type_value);
 
+/*
+ * Single pass with an explicit stack, new vars are added to tree->var_stack. In debug builds
+ * with an open dump file it falls back to tree_parse_from_buffer_stepwise.
+ */
 error_code tree_parse_from_buffer(tree_t* tree);
+/* the recursive reader that dumps the buffer after every node (debug builds); the reference for benches */
+error_code tree_parse_from_buffer_stepwise(tree_t* tree);
+
+/* prefix text of tree->root without the header, "nil" for an empty tree */
+error_code tree_write_nodes(const tree_t* tree, FILE* file);
+
+/*
+ * Prefix text in [*curr_ref, end) to nodes with the tree_parse_from_buffer parser. Nothing is
+ * dumped and var_stack is only searched: an unknown var is ERROR_INCORRECT_INDEX, so several
+ * threads may parse against one var_stack. *curr_ref is moved past the node, *nodes_cnt grows by its size.
+ */
+tree_node_t* tree_parse_nodes(const char** curr_ref, const char* end, const stack_t* var_stack, size_t* nodes_cnt,
+                              error_code* error);
+
+bool tree_func_by_name(c_string_t name, func_type_t* func);
 
 
 
@@ -17,6 +17,8 @@ struct tree_t {
     stack_t*       var_stack;
     c_string_t     buff;
     size_t         list_idx;
+    c_string_t     name;      /* view into the forest file, empty unless read by forest_read_from_file */
+    bool           is_stub;   /* lazy forest: root not parsed yet, buff is the record; see forest_load_tree */
     ON_DEBUG(
         ver_info_t ver_info;
         FILE* const * dump_file;
@@ -1,6 +1,8 @@
 #ifndef TREE_OPERATIONS_H_INCLUDED
 #define TREE_OPERATIONS_H_INCLUDED
 
+#include <stdint.h>
+
 #include "tree_info.h"
 #include "error_handler.h"
 #include "asserts.h"
@@ -10,6 +12,13 @@
 error_code tree_init(tree_t* tree, stack_t* stack ON_DEBUG(, ver_info_t ver_info));
 
 tree_node_t* init_node(node_type_t node_type, value_t value, tree_node_t* left, tree_node_t* right);
+tree_node_t* init_node_taking(node_type_t node_type, value_t value, tree_node_t* left, tree_node_t* right);
+void node_free(tree_node_t* node);
+
+node_budget_t* node_budget_enter(node_budget_t* budget);
+void           node_budget_leave(node_budget_t* prev_budget);
+
+/* owns left and right like init_node_taking, then dumps the new node into tree */
 tree_node_t* init_node_with_dump(node_type_t node_type, value_t value, tree_node_t* left, tree_node_t* right, const tree_t* tree);
 
 error_code tree_destroy(tree_t* tree);
@@ -17,6 +26,48 @@ error_code tree_destroy(tree_t* tree);
 bool tree_is_empty(const tree_t* tree);
 size_t count_nodes_recursive(const tree_node_t* node);
 
+size_t subtree_max_depth(const tree_node_t* node);
+
+/*
+ * Structural hash: equal subtrees (constants compared bit for bit, -0.0 == 0.0) hash equally.
+ * Incremental: subtree_hash(node) == node_hash_combine(node, subtree_hash(left), subtree_hash(right)),
+ * so code that rebuilds a tree bottom up can carry the hashes along. None of these recurse.
+ */
+uint64_t subtree_hash(const tree_node_t* node); /* 0 if out of memory */
+uint64_t node_hash_combine(const tree_node_t* node, uint64_t left_hash, uint64_t right_hash);
+
+/* the primitives the structural hash is built of, for other keyed tables to share */
+uint64_t hash_mix(uint64_t hash, uint64_t value);
+uint64_t hash_bytes(const void* data, size_t len); /* FNV-1a */
+
+/* exact structural equality; false also if out of memory, so a hash match is never trusted alone */
+bool subtree_equal(const tree_node_t* first, const tree_node_t* second);
+
+struct subtree_hash_entry_t {
+    const tree_node_t* node;
+    uint64_t           hash;
+    size_t             size;  /* nodes in the subtree */
+};
+
+/* per node cache of hashes and sizes, keyed by address; valid while the subtree is not changed */
+struct subtree_hash_index_t {
+    subtree_hash_entry_t* slots;
+    size_t                slots_cap;
+    size_t                entries_cnt;
+};
+
+/* hash and size of root in one pass; every node gets into index unless it is nullptr.
+   Subtrees already in index are taken from it, not walked, so a later walk only pays for new nodes */
+error_code subtree_hash_walk(const tree_node_t* root, subtree_hash_index_t* index, uint64_t* hash, size_t* size);
+error_code subtree_hash_index_build(subtree_hash_index_t* index, const tree_node_t* root);
+const subtree_hash_entry_t* subtree_hash_index_find(const subtree_hash_index_t* index, const tree_node_t* node);
+void       subtree_hash_index_dest(subtree_hash_index_t* index);
+
+size_t count_distinct_subtrees(const tree_node_t* root, error_code* error);
+
+/* for explicit walk stacks that start as a local array: doubles *stack, the local one is copied, not freed */
+bool walk_stack_grow(void** stack, size_t* cap, const void* local_stack, size_t elem_size);
+
 error_code   tree_change_root(tree_t* tree, tree_node_t* node);
 tree_node_t* tree_init_root(tree_t* tree, node_type_t node_type, value_t value);
 tree_node_t* tree_insert_left(tree_t* tree, node_type_t node_type, value_t value, tree_node_t* parent);
@@ -40,6 +91,10 @@ var_val_type get_var_val(tree_t* tree, tree_node_t* node);
 error_code ask_for_vars(tree_t* tree);
 var_val_type put_var_val(tree_t* tree, size_t var_idx, var_val_type value);
 
+error_code   var_bindings_init(var_bindings_t* bindings, const stack_t* var_stack);
+error_code   var_bindings_dest(var_bindings_t* bindings);
+var_val_type bind_var_val(var_bindings_t* bindings, size_t var_idx, var_val_type value);
+
 inline tree_node_t* clone_node(const tree_node_t* node) {
     HARD_ASSERT(node != nullptr, "node is nullptr");
     return init_node(node->type, node->value, node->left, node->right);
@@ -12,6 +12,18 @@ enum tree_dump_mode_t {
     TREE_DUMP_IMG  = 2,
 };
 
+/* dumps walk at most max_depth levels and max_nodes nodes, the rest is summarized */
+struct tree_dump_limits_t {
+    size_t max_depth;
+    size_t max_nodes;
+};
+
+const size_t TREE_DUMP_DEFAULT_MAX_DEPTH = 64;
+const size_t TREE_DUMP_DEFAULT_MAX_NODES = 4096;
+
+/* 0 fields => defaults */
+void tree_dump_set_limits(tree_dump_limits_t limits);
+
 error_code tree_verify(const tree_t* tree,
                        ver_info_t ver_info,
                        tree_dump_mode_t mode,
@@ -0,0 +1,365 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "asserts.h"
+#include "logger.h"
+#include "error_handler.h"
+#include "tree_info.h"
+#include "tree_operations.h"
+#include "forest_info.h"
+#include "forest_operations.h"
+#include "differentiator.h"
+#include "input_parser.h"
+#include "teylor.h"
+#include "expr_generator.h"
+#include "num_literal.h"
+#include "parallel.h"
+#include "diff_cache.h"
+#include "tree_check.h"
+#include "batch_service.h"
+
+//================================================================================
+
+static const char BATCH_SPEC_DELIM = ':';
+
+/* one round: jobs are read ahead, solved by the pool, then written in order */
+struct batch_round_t {
+    char**              lines;
+    size_t*             line_nos;
+    char**              results;
+    size_t              jobs_cnt;
+    size_t              next_job;
+    const batch_opts_t* opts;
+    diff_cache_t*       diff_cache;
+};
+
+//================================================================================
+
+static char* batch_trim(char* str) {
+    while(isspace((unsigned char)*str)) str++;
+
+    char* end = str + strlen(str);
+    while(end > str && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return str;
+}
+
+static bool batch_parse_assign(char* assign, c_string_t* name, double* val) {
+    char* eq = strchr(assign, '=');
+    if(!eq) return false;
+    *eq = '\0';
+
+    char* name_str = batch_trim(assign);
+    char* val_str  = batch_trim(eq + 1);
+    char* val_end  = nullptr;
+    *val = strtod(val_str, &val_end);
+    if(*name_str == '\0' || val_end == val_str || *val_end != '\0') return false;
+
+    *name = {name_str, strlen(name_str)};
+    return true;
+}
+
+/* line is only the origin of reported columns */
+static tree_t* batch_parse_expr(forest_t* forest, const char* line, const char* expr, FILE* out) {
+    error_code error = ERROR_NO;
+    tree_t* tree = forest_add_tree(forest, &error);
+    if(error != ERROR_NO) {
+        fprintf(out, "error\tout of memory");
+        return nullptr;
+    }
+
+    const char*  cur  = expr;
+    tree_node_t* root = get_g(tree, &cur);
+    while(isspace((unsigned char)*cur)) cur++;
+    if(*cur == '$') cur++;
+    while(isspace((unsigned char)*cur)) cur++;
+
+    if(root == nullptr || *cur != '\0') {
+        destroy_node_recursive(root, nullptr);
+        fprintf(out, "error\tsyntax error at column %zu", (size_t)(cur - line) + 1);
+        return nullptr;
+    }
+    tree_replace_root(tree, root);
+    return tree;
+}
+
+//================================================================================
+
+static error_code batch_eval(FILE* out, tree_t* tree, char* spec) {
+    var_bindings_t bindings = {};
+    error_code error = var_bindings_init(&bindings, tree->var_stack);
+    if(error != ERROR_NO) return error;
+
+    char* point_save = nullptr;
+    char* point      = strtok_r(spec, "|", &point_save);
+    fprintf(out, "ok\t");
+    for(size_t point_idx = 0; point || point_idx == 0; point_idx++) {
+        for(size_t i = 0; i < bindings.size; i++) bindings.vals[i] = NAN;
+
+        char* assign_save = nullptr;
+        for(char* assign = point ? strtok_r(point, ",", &assign_save) : nullptr; assign;
+            assign = strtok_r(nullptr, ",", &assign_save)) {
+            c_string_t name = {};
+            double     val  = 0;
+            if(!batch_parse_assign(assign, &name, &val)) {
+                var_bindings_dest(&bindings);
+                return ERROR_INCORRECT_ARGS;
+            }
+            ssize_t var_idx = get_var_idx(name, tree->var_stack);
+            if(var_idx >= 0) bind_var_val(&bindings, (size_t)var_idx, val);
+        }
+
+        error_code   eval_error = ERROR_NO;
+        var_val_type val        = calculate_tree_bound(tree, &bindings, &eval_error);
+        char num_buff[NUM_LITERAL_MAX_LEN] = {};
+        if(num_literal_print(val, num_buff) == 0) fprintf(out, "%snan", point_idx ? " " : "");
+        else                                      fprintf(out, "%s%s",  point_idx ? " " : "", num_buff);
+        if(!point) break;
+        point = strtok_r(nullptr, "|", &point_save);
+    }
+
+    var_bindings_dest(&bindings);
+    return ERROR_NO;
+}
+
+static error_code batch_diff(FILE* out, forest_t* forest, tree_t* tree, char* spec) {
+    char default_var[] = "x";
+    if(*spec == '\0') spec = default_var;
+
+    fprintf(out, "ok\t");
+    char* var_save = nullptr;
+    size_t var_cnt = 0;
+    for(char* var = strtok_r(spec, ",", &var_save); var; var = strtok_r(nullptr, ",", &var_save), var_cnt++) {
+        var = batch_trim(var);
+        fprintf(out, "%s%s: ", var_cnt ? "; " : "", var);
+
+        ssize_t var_idx = get_var_idx({var, strlen(var)}, tree->var_stack);
+        if(var_idx < 0) {
+            fprintf(out, "0");
+            continue;
+        }
+
+        error_code error = ERROR_NO;
+        size_t diff_var = (size_t)var_idx;
+        tree_t* diff_tree = forest_add_tree(forest, &error);
+        if(error != ERROR_NO) return error;
+        tree_node_t* diff_root = get_diff_safe(tree->root, {&diff_var, 1}, &forest->node_budget, &error
+                                               ON_TEX_CREATION_DEBUG(, tree));
+        if(diff_root == nullptr) return error;
+
+        tree_replace_root(diff_tree, diff_root);
+        error |= tree_optimize(diff_tree);
+        error |= tree_check(diff_tree, 1, nullptr);
+        error |= expr_print_infix(out, diff_tree, diff_tree->root);
+        if(error != ERROR_NO) return error;
+    }
+    return ERROR_NO;
+}
+
+static bool batch_is_finite(const tree_node_t* node) {
+    if(!node) return true;
+    if(node->type == CONSTANT && !isfinite(node->value.constant)) return false;
+    return batch_is_finite(node->left) && batch_is_finite(node->right);
+}
+
+static error_code batch_teylor(FILE* out, forest_t* forest, tree_t* tree, char* spec) {
+    c_string_t var_name = {"x", 1};
+    double     x0       = 0;
+    if(*spec != '\0' && !batch_parse_assign(spec, &var_name, &x0)) return ERROR_INCORRECT_ARGS;
+
+    ssize_t var_idx = get_var_idx(var_name, tree->var_stack);
+    if(var_idx < 0) return ERROR_INCORRECT_ARGS;
+
+    error_code       error   = ERROR_NO;
+    teylor_profile_t profile = {};
+    tree_t* teylor_tree = make_teylor_profiled(forest, tree, (size_t)var_idx, x0, &profile, &error);
+    if(teylor_tree == nullptr) return error != ERROR_NO ? error : (error_code)ERROR_GET_DIFF;
+    /* the value and every coefficient are constants of the series */
+    if(!batch_is_finite(teylor_tree->root)) return ERROR_NOT_FINITE;
+
+    fprintf(out, "ok\t");
+    return expr_print_infix(out, teylor_tree, teylor_tree->root);
+}
+
+static error_code batch_simplify(FILE* out, tree_t* tree) {
+    error_code error = tree_optimize(tree);
+    error |= tree_check(tree, 1, nullptr);
+    if(error != ERROR_NO) return error;
+
+    fprintf(out, "ok\t");
+    return expr_print_infix(out, tree, tree->root);
+}
+
+//--------------------------------------------------------------------------------
+
+static const char* batch_error_str(error_code error) {
+    if(error & ERROR_MEM_BUDGET)     return "node budget exceeded";
+    if(error & ERROR_MEM_ALLOC)      return "out of memory";
+    if(error & ERROR_INCORRECT_ARGS) return "bad spec";
+    if(error & ERROR_UNKNOWN_FUNC)   return "unknown function";
+    if(error & ERROR_GET_DIFF)       return "differentiation failed";
+    if(error & ERROR_NOT_FINITE)     return "series is not finite";
+    if(error & (ERROR_SHARED_NODE | ERROR_BAD_ARITY | ERROR_NAN_CONST | ERROR_SIZE_MISMATCH)) return "corrupted tree";
+    return "internal error";
+}
+
+/* result text has no line number: the writer adds it */
+static void batch_run_job(forest_t* forest, char* line, FILE* out) {
+    char* delim = strchr(line, BATCH_SPEC_DELIM);
+    if(!delim) {
+        fprintf(out, "error\texpected '<op> [spec] %c <expr>'", BATCH_SPEC_DELIM);
+        return;
+    }
+    *delim = '\0';
+    char* expr = delim + 1;
+
+    char* head = batch_trim(line);
+    char* spec = head;
+    while(*spec && !isspace((unsigned char)*spec)) spec++;
+    if(*spec) *spec++ = '\0';
+    spec = batch_trim(spec);
+
+    tree_t* tree = batch_parse_expr(forest, line, expr, out);
+    if(!tree) return;
+
+    char*  result_text = nullptr;
+    size_t result_len  = 0;
+    FILE*  result_file = open_memstream(&result_text, &result_len);
+    if(!result_file) {
+        fprintf(out, "error\tout of memory");
+        return;
+    }
+
+    error_code error = ERROR_NO;
+    if     (strcmp(head, "eval")     == 0) error = batch_eval(result_file, tree, spec);
+    else if(strcmp(head, "diff")     == 0) error = batch_diff(result_file, forest, tree, spec);
+    else if(strcmp(head, "teylor")   == 0) error = batch_teylor(result_file, forest, tree, spec);
+    else if(strcmp(head, "simplify") == 0) error = batch_simplify(result_file, tree);
+    else                                   error = ERROR_INCORRECT_ARGS_CMD;
+    fclose(result_file);
+
+    if(error == ERROR_INCORRECT_ARGS_CMD) fprintf(out, "error\tunknown op '%s'", head);
+    else if(error != ERROR_NO)            fprintf(out, "error\t%s", batch_error_str(error));
+    else                                  fputs(result_text, out);
+    free(result_text);
+}
+
+//================================================================================
+
+/* jobs must not see each other's trees or vars */
+static void batch_forest_reset(forest_t* forest) {
+    forest_clear_trees(forest);
+
+    error_code error = ERROR_NO;
+    while(forest->var_stack->size > 0 && error == ERROR_NO) stack_pop(forest->var_stack, &error);
+}
+
+/* every pool task is a worker with its own forest, jobs are pulled one by one */
+static void batch_worker(size_t, void* ctx) {
+    batch_round_t* round = (batch_round_t*)ctx;
+
+    forest_t forest = {};
+    error_code error = forest_init(&forest ON_DEBUG(, VER_INIT));
+    forest_set_node_budget(&forest, round->opts->max_nodes);
+    forest_set_diff_cache(&forest, round->diff_cache);
+    forest_set_threads_cnt(&forest, 1); /* the workers already fill the pool */
+    diff_cache_t* prev_cache = diff_cache_enter(round->diff_cache);
+
+    while(true) {
+        size_t job_idx = __atomic_fetch_add(&round->next_job, 1, __ATOMIC_RELAXED);
+        if(job_idx >= round->jobs_cnt) break;
+
+        size_t result_len = 0;
+        FILE*  result     = open_memstream(&round->results[job_idx], &result_len);
+        if(!result) continue;
+
+        if(error != ERROR_NO) fprintf(result, "error\tforest init failed");
+        else {
+            batch_run_job(&forest, round->lines[job_idx], result);
+            batch_forest_reset(&forest);
+        }
+        fclose(result);
+    }
+
+    diff_cache_leave(prev_cache);
+    if(error == ERROR_NO) forest_dest(&forest);
+}
+
+static bool batch_is_job(const char* line) {
+    while(isspace((unsigned char)*line)) line++;
+    return *line != '\0' && *line != '#';
+}
+
+static error_code batch_round_run(batch_round_t* round, size_t threads_cnt, FILE* out) {
+    round->next_job = 0;
+    if(threads_cnt == 0) threads_cnt = parallel_threads_cnt();
+    if(threads_cnt > round->jobs_cnt) threads_cnt = round->jobs_cnt;
+
+    error_code error = parallel_for(threads_cnt, threads_cnt, batch_worker, round);
+
+    for(size_t i = 0; i < round->jobs_cnt; i++) {
+        fprintf(out, "%zu\t%s\n", round->line_nos[i], round->results[i] ? round->results[i] : "error\tout of memory");
+        free(round->results[i]);
+        free(round->lines[i]);
+        round->results[i] = nullptr;
+        round->lines[i]   = nullptr;
+    }
+    fflush(out);
+    round->jobs_cnt = 0;
+    return error;
+}
+
+error_code batch_service_run(FILE* in, FILE* out, const batch_opts_t* opts) {
+    HARD_ASSERT(in   != nullptr, "in is nullptr");
+    HARD_ASSERT(out  != nullptr, "out is nullptr");
+    HARD_ASSERT(opts != nullptr, "opts is nullptr");
+
+    LOGGER_DEBUG("batch_service_run: started");
+
+    size_t chunk_jobs = opts->chunk_jobs ? opts->chunk_jobs : BATCH_DEFAULT_CHUNK_JOBS;
+
+    batch_round_t round = {};
+    round.opts     = opts;
+    round.lines    = (char**) calloc(chunk_jobs, sizeof(char*));
+    round.line_nos = (size_t*)calloc(chunk_jobs, sizeof(size_t));
+    round.results  = (char**) calloc(chunk_jobs, sizeof(char*));
+    if(!round.lines || !round.line_nos || !round.results) {
+        LOGGER_ERROR("batch_service_run: calloc failed");
+        free(round.lines);
+        free(round.line_nos);
+        free(round.results);
+        return ERROR_MEM_ALLOC;
+    }
+
+    diff_cache_t diff_cache = {};
+    if(opts->cache_nodes && diff_cache_init(&diff_cache, opts->cache_nodes) == ERROR_NO) round.diff_cache = &diff_cache;
+
+    error_code error   = ERROR_NO;
+    char*      line    = nullptr;
+    size_t     line_sz = 0;
+    size_t     line_no = 0;
+    while(getline(&line, &line_sz, in) != -1) {
+        line_no++;
+        if(!batch_is_job(line)) continue;
+
+        line[strcspn(line, "\r\n")] = '\0';
+        round.lines[round.jobs_cnt]    = line;
+        round.line_nos[round.jobs_cnt] = line_no;
+        round.jobs_cnt++;
+        line    = nullptr;
+        line_sz = 0;
+
+        if(round.jobs_cnt == chunk_jobs) error |= batch_round_run(&round, opts->threads_cnt, out);
+    }
+    if(round.jobs_cnt) error |= batch_round_run(&round, opts->threads_cnt, out);
+
+    if(round.diff_cache) diff_cache_dest(round.diff_cache);
+    free(line);
+    free(round.lines);
+    free(round.line_nos);
+    free(round.results);
+    return error;
+}
@@ -0,0 +1,264 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "asserts.h"
+#include "logger.h"
+#include "tree_operations.h"
+#include "diff_cache.h"
+#include "metrics.h"
+
+//================================================================================
+
+static thread_local diff_cache_t* active_diff_cache = nullptr;
+
+diff_cache_t* diff_cache_enter(diff_cache_t* cache) {
+    diff_cache_t* prev_cache = active_diff_cache;
+    active_diff_cache = cache;
+    return prev_cache;
+}
+
+void diff_cache_leave(diff_cache_t* prev_cache) {
+    active_diff_cache = prev_cache;
+}
+
+diff_cache_t* diff_cache_active() {
+    return active_diff_cache;
+}
+
+//================================================================================
+
+error_code diff_cache_init(diff_cache_t* cache, size_t max_nodes) {
+    HARD_ASSERT(cache != nullptr, "cache is nullptr");
+
+    LOGGER_DEBUG("diff_cache_init: %zu nodes", max_nodes);
+
+    *cache = {};
+    cache->buckets = (diff_cache_entry_t**)calloc(DIFF_CACHE_MIN_BUCKETS, sizeof(diff_cache_entry_t*));
+    if(!cache->buckets) {
+        LOGGER_ERROR("diff_cache_init: calloc failed");
+        return ERROR_MEM_ALLOC;
+    }
+    cache->buckets_cnt = DIFF_CACHE_MIN_BUCKETS;
+    cache->max_nodes   = max_nodes;
+    pthread_mutex_init(&cache->lock, nullptr);
+    return ERROR_NO;
+}
+
+/* cache nodes are not charged to whatever node budget the caller runs under */
+static void diff_cache_entry_free(diff_cache_entry_t* entry) {
+    node_budget_t* prev_budget = node_budget_enter(nullptr);
+    destroy_node_recursive(entry->key,  nullptr);
+    destroy_node_recursive(entry->diff, nullptr);
+    node_budget_leave(prev_budget);
+
+    free(entry->vars);
+    free(entry);
+}
+
+static void diff_cache_free_entries(diff_cache_t* cache) {
+    diff_cache_entry_t* entry = cache->lru_head;
+    while(entry) {
+        diff_cache_entry_t* next = entry->lru_next;
+        diff_cache_entry_free(entry);
+        entry = next;
+    }
+    memset(cache->buckets, 0, cache->buckets_cnt * sizeof(diff_cache_entry_t*));
+    cache->lru_head    = nullptr;
+    cache->lru_tail    = nullptr;
+    cache->entries_cnt = 0;
+    cache->nodes_cnt   = 0;
+}
+
+void diff_cache_clear(diff_cache_t* cache) {
+    HARD_ASSERT(cache != nullptr, "cache is nullptr");
+
+    pthread_mutex_lock(&cache->lock);
+    diff_cache_free_entries(cache);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void diff_cache_dest(diff_cache_t* cache) {
+    if(!cache || !cache->buckets) return;
+
+    LOGGER_DEBUG("diff_cache_dest: %zu hits, %zu misses, %zu evictions",
+                 cache->hits, cache->misses, cache->evictions);
+
+    diff_cache_free_entries(cache);
+    free(cache->buckets);
+    cache->buckets = nullptr;
+    pthread_mutex_destroy(&cache->lock);
+}
+
+//================================================================================
+
+static void sort_vars(size_t* vars, size_t vars_cnt) {
+    for(size_t i = 1; i < vars_cnt; i++) {
+        size_t var = vars[i];
+        size_t j   = i;
+        for(; j > 0 && vars[j - 1] > var; j--) vars[j] = vars[j - 1];
+        vars[j] = var;
+    }
+}
+
+/* the var set is order-insensitive: args_arr {x, y} and {y, x} share entries */
+uint64_t diff_cache_key_hash(uint64_t subtree_hash, args_arr_t args_arr) {
+    uint64_t hash = hash_mix(subtree_hash, args_arr.size);
+    uint64_t vars_sum = 0, vars_xor = 0;
+    for(size_t i = 0; i < args_arr.size; i++) {
+        vars_sum += hash_mix(0, args_arr.arr[i]);
+        vars_xor ^= args_arr.arr[i] * 0xD6E8FEB86659FD93ull;
+    }
+    return hash_mix(hash_mix(hash, vars_sum), vars_xor);
+}
+
+static bool vars_equal(const diff_cache_entry_t* entry, args_arr_t args_arr) {
+    if(entry->vars_cnt != args_arr.size) return false;
+
+    for(size_t i = 0; i < args_arr.size; i++) {
+        bool is_found = false;
+        for(size_t j = 0; j < entry->vars_cnt && !is_found; j++) is_found = entry->vars[j] == args_arr.arr[i];
+        if(!is_found) return false;
+    }
+    return true;
+}
+
+static diff_cache_entry_t** diff_cache_find_slot(diff_cache_t* cache, const tree_node_t* node,
+                                                 uint64_t key_hash, args_arr_t args_arr) {
+    diff_cache_entry_t** slot = &cache->buckets[key_hash & (cache->buckets_cnt - 1)];
+    for(; *slot; slot = &(*slot)->bucket_next) {
+        diff_cache_entry_t* entry = *slot;
+        if(entry->hash == key_hash && vars_equal(entry, args_arr) && subtree_equal(entry->key, node)) break;
+    }
+    return slot;
+}
+
+//--------------------------------------------------------------------------------
+
+static void lru_unlink(diff_cache_t* cache, diff_cache_entry_t* entry) {
+    if(entry->lru_prev) entry->lru_prev->lru_next = entry->lru_next;
+    else                cache->lru_head           = entry->lru_next;
+    if(entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+    else                cache->lru_tail           = entry->lru_prev;
+    entry->lru_prev = entry->lru_next = nullptr;
+}
+
+static void lru_push_front(diff_cache_t* cache, diff_cache_entry_t* entry) {
+    entry->lru_prev = nullptr;
+    entry->lru_next = cache->lru_head;
+    if(cache->lru_head) cache->lru_head->lru_prev = entry;
+    else                cache->lru_tail           = entry;
+    cache->lru_head = entry;
+}
+
+static void diff_cache_evict_tail(diff_cache_t* cache) {
+    diff_cache_entry_t* victim = cache->lru_tail;
+    HARD_ASSERT(victim != nullptr, "evicting from an empty cache");
+
+    diff_cache_entry_t** slot = &cache->buckets[victim->hash & (cache->buckets_cnt - 1)];
+    while(*slot != victim) slot = &(*slot)->bucket_next;
+    *slot = victim->bucket_next;
+
+    lru_unlink(cache, victim);
+    cache->entries_cnt--;
+    cache->nodes_cnt -= victim->nodes_cnt;
+    cache->evictions++;
+    diff_cache_entry_free(victim);
+}
+
+static void diff_cache_grow(diff_cache_t* cache) {
+    size_t new_cnt = cache->buckets_cnt * 2;
+    diff_cache_entry_t** new_buckets = (diff_cache_entry_t**)calloc(new_cnt, sizeof(diff_cache_entry_t*));
+    if(!new_buckets) return; /* longer chains, still correct */
+
+    for(size_t i = 0; i < cache->buckets_cnt; i++) {
+        diff_cache_entry_t* entry = cache->buckets[i];
+        while(entry) {
+            diff_cache_entry_t* next = entry->bucket_next;
+            diff_cache_entry_t** slot = &new_buckets[entry->hash & (new_cnt - 1)];
+            entry->bucket_next = *slot;
+            *slot = entry;
+            entry = next;
+        }
+    }
+    free(cache->buckets);
+    cache->buckets     = new_buckets;
+    cache->buckets_cnt = new_cnt;
+}
+
+//================================================================================
+
+bool diff_cache_lookup(diff_cache_t* cache, const tree_node_t* node, uint64_t key_hash,
+                       args_arr_t args_arr, tree_node_t** diff_out) {
+    HARD_ASSERT(cache    != nullptr, "cache is nullptr");
+    HARD_ASSERT(diff_out != nullptr, "diff_out is nullptr");
+
+    pthread_mutex_lock(&cache->lock);
+    diff_cache_entry_t* entry = *diff_cache_find_slot(cache, node, key_hash, args_arr);
+    if(!entry) {
+        metrics_count(METRICS_DIFF_CACHE_MISSES, 1);
+        cache->misses++;
+        pthread_mutex_unlock(&cache->lock);
+        return false;
+    }
+
+    metrics_count(METRICS_DIFF_CACHE_HITS, 1);
+    cache->hits++;
+    lru_unlink(cache, entry);
+    lru_push_front(cache, entry);
+    /* copied under the lock: another thread may evict the entry right after */
+    *diff_out = subtree_deep_copy(entry->diff, nullptr ON_DUMP_CREATION_DEBUG(, nullptr));
+    pthread_mutex_unlock(&cache->lock);
+    return true;
+}
+
+void diff_cache_store(diff_cache_t* cache, const tree_node_t* node, size_t node_size, uint64_t key_hash,
+                      args_arr_t args_arr, const tree_node_t* diff) {
+    HARD_ASSERT(cache != nullptr, "cache is nullptr");
+
+    if(node_size > cache->max_nodes) return;
+    size_t nodes_cnt = node_size + count_nodes_recursive(diff);
+    if(nodes_cnt > cache->max_nodes) return;
+
+    diff_cache_entry_t* entry = (diff_cache_entry_t*)calloc(1, sizeof(diff_cache_entry_t));
+    size_t*             vars  = args_arr.size ? (size_t*)calloc(args_arr.size, sizeof(size_t)) : nullptr;
+    if(!entry || (args_arr.size && !vars)) {
+        free(entry);
+        free(vars);
+        return;
+    }
+    if(args_arr.size) memcpy(vars, args_arr.arr, args_arr.size * sizeof(size_t));
+    sort_vars(vars, args_arr.size);
+
+    error_code error = ERROR_NO;
+    node_budget_t* prev_budget = node_budget_enter(nullptr);
+    entry->key  = subtree_deep_copy(node, &error ON_DUMP_CREATION_DEBUG(, nullptr));
+    entry->diff = subtree_deep_copy(diff, &error ON_DUMP_CREATION_DEBUG(, nullptr));
+    node_budget_leave(prev_budget);
+
+    entry->hash      = key_hash;
+    entry->vars      = vars;
+    entry->vars_cnt  = args_arr.size;
+    entry->nodes_cnt = nodes_cnt;
+    if(error != ERROR_NO) {
+        diff_cache_entry_free(entry);
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    if(*diff_cache_find_slot(cache, node, key_hash, args_arr)) { /* stored by another thread meanwhile */
+        pthread_mutex_unlock(&cache->lock);
+        diff_cache_entry_free(entry);
+        return;
+    }
+
+    while(cache->nodes_cnt + nodes_cnt > cache->max_nodes) diff_cache_evict_tail(cache);
+
+    diff_cache_entry_t** bucket = &cache->buckets[key_hash & (cache->buckets_cnt - 1)];
+    entry->bucket_next = *bucket;
+    *bucket = entry;
+    lru_push_front(cache, entry);
+    cache->entries_cnt++;
+    cache->nodes_cnt += nodes_cnt;
+    if(cache->entries_cnt > cache->buckets_cnt) diff_cache_grow(cache);
+    pthread_mutex_unlock(&cache->lock);
+}
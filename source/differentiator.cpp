@@ -9,8 +9,11 @@
 #include "forest_info.h"
 #include "forest_operations.h"
 #include "tex_io.h"
+#include "metrics.h"
+#include "diff_cache.h"
 
 #include <math.h>
+#include <stdint.h>
 
 static const double CMP_PRECISION = 1e-9;
 
@@ -35,9 +38,40 @@ static bool check_in(size_t target, args_arr_t args_arr) {
         return c(num);                                                               \
     } while (0)
 
-tree_node_t* get_diff(tree_node_t* node,
-                      args_arr_t   args_arr
-                      ON_TEX_CREATION_DEBUG(, tree_t* tree))
+/* Structural hashes of the subtrees of the get_diff input, so that the cache lookup at every
+   level of the recursion is O(1) instead of rehashing the subtree.
+   Every level is looked up, but only the topmost subtree of each power-of-two size class on a
+   path is stored: a node then lies in O(log n) stored subtrees and filling the cache is O(n log n) */
+struct diff_cache_ctx_t {
+    diff_cache_t*        cache;
+    subtree_hash_index_t index;
+    size_t               parent_size; /* 0 at the get_diff root */
+};
+
+/* parent_size has a higher top bit than size iff their xor exceeds size */
+static bool diff_cache_is_boundary(size_t size, size_t parent_size) {
+    return parent_size == 0 || (size ^ parent_size) > size;
+}
+
+static thread_local diff_cache_ctx_t* active_diff_ctx = nullptr;
+
+static const subtree_hash_entry_t* diff_index_find(const tree_node_t* node) {
+    const diff_cache_ctx_t* ctx = active_diff_ctx;
+    if(!ctx || !node || node->type != FUNCTION) return nullptr;
+
+    const subtree_hash_entry_t* entry = subtree_hash_index_find(&ctx->index, node);
+    return entry && entry->size >= DIFF_CACHE_MIN_NODES ? entry : nullptr;
+}
+
+//--------------------------------------------------------------------------------
+
+static tree_node_t* get_diff_node(tree_node_t* node,
+                                  args_arr_t   args_arr
+                                  ON_TEX_CREATION_DEBUG(, tree_t* tree));
+
+static tree_node_t* get_diff_rule(tree_node_t* node,
+                                  args_arr_t   args_arr
+                                  ON_TEX_CREATION_DEBUG(, tree_t* tree))
 {
     HARD_ASSERT(args_arr.size == 0 || args_arr.arr != nullptr, "Wrong arg list");
 
@@ -45,15 +79,15 @@ tree_node_t* get_diff(tree_node_t* node,
         return nullptr;
 
     if (node->type == CONSTANT) {
-        print_tex_const_diff_comment(*tree->tex_file);
+        ON_TEX_CREATION_DEBUG(print_tex_const_diff_comment(*tree->tex_file);)
         MAKE_STEP(zero, 0);
     }
     if (node->type == VARIABLE) {
         if (args_arr.size == 0 || check_in(node->value.var_idx, args_arr)) {
-            print_tex_var_diff_comment(*tree->tex_file);
+            ON_TEX_CREATION_DEBUG(print_tex_var_diff_comment(*tree->tex_file);)
             MAKE_STEP(one, 1);
         }
-        print_tex_const_diff_comment(*tree->tex_file);
+        ON_TEX_CREATION_DEBUG(print_tex_const_diff_comment(*tree->tex_file);)
         MAKE_STEP(zero, 0);
     }
 
@@ -79,6 +113,74 @@ tree_node_t* get_diff(tree_node_t* node,
     #undef HANDLE_FUNC
 }
 
+static tree_node_t* get_diff_node(tree_node_t* node,
+                                  args_arr_t   args_arr
+                                  ON_TEX_CREATION_DEBUG(, tree_t* tree))
+{
+    const subtree_hash_entry_t* slot = diff_index_find(node);
+    if(!slot) return get_diff_rule(node, args_arr ON_TEX_CREATION_DEBUG(, tree));
+
+    uint64_t     key_hash = diff_cache_key_hash(slot->hash, args_arr);
+    tree_node_t* diff     = nullptr;
+    if(diff_cache_lookup(active_diff_ctx->cache, node, key_hash, args_arr, &diff)) return diff;
+
+    diff_cache_ctx_t* ctx         = active_diff_ctx;
+    size_t            parent_size = ctx->parent_size;
+    bool              is_stored   = diff_cache_is_boundary(slot->size, parent_size);
+    ctx->parent_size = slot->size;
+
+    diff = get_diff_rule(node, args_arr ON_TEX_CREATION_DEBUG(, tree));
+
+    ctx->parent_size = parent_size;
+    if(diff && is_stored) diff_cache_store(ctx->cache, node, slot->size, key_hash, args_arr, diff);
+    return diff;
+}
+
+tree_node_t* get_diff(tree_node_t* node,
+                      args_arr_t   args_arr
+                      ON_TEX_CREATION_DEBUG(, tree_t* tree))
+{
+    long long begin_ns = metrics_phase_begin();
+
+    diff_cache_ctx_t  ctx      = {};
+    diff_cache_ctx_t* prev_ctx = active_diff_ctx;
+    diff_cache_t*     cache    = diff_cache_active();
+    ctx.cache = cache;
+    if(cache && subtree_hash_index_build(&ctx.index, node) == ERROR_NO) active_diff_ctx = &ctx;
+    else                                                                active_diff_ctx = nullptr;
+
+    tree_node_t* diff = get_diff_node(node, args_arr ON_TEX_CREATION_DEBUG(, tree));
+
+    active_diff_ctx = prev_ctx;
+    subtree_hash_index_dest(&ctx.index);
+    metrics_phase_end(METRICS_PHASE_DIFF, begin_ns);
+    return diff;
+}
+
+/* get_diff under a node budget: a runaway derivative is freed and reported instead of eating all memory */
+tree_node_t* get_diff_safe(tree_node_t* node, args_arr_t args_arr, node_budget_t* budget, error_code* error
+                           ON_TEX_CREATION_DEBUG(, tree_t* tree))
+{
+    HARD_ASSERT(budget != nullptr, "budget is nullptr");
+    HARD_ASSERT(error  != nullptr, "error is nullptr");
+
+    node_budget_t* prev_budget = node_budget_enter(budget);
+    tree_node_t* diff = get_diff(node, args_arr ON_TEX_CREATION_DEBUG(, tree));
+    bool is_exceeded = budget->is_exceeded;
+    if(is_exceeded) {
+        destroy_node_recursive(diff, nullptr);
+        diff = nullptr;
+    }
+    node_budget_leave(prev_budget);
+
+    if(is_exceeded) {
+        LOGGER_ERROR("get_diff_safe: derivative exceeds budget of %zu nodes", budget->max_nodes);
+        *error |= ERROR_MEM_BUDGET;
+    }
+    else if(diff == nullptr && node != nullptr) *error |= ERROR_GET_DIFF;
+    return diff;
+}
+
 #undef MAKE_STEP
 
 //================================================================================
@@ -142,7 +244,10 @@ var_val_type calculate_tree(tree_t* tree, bool is_need_to_ask_vars) {
         }
     }
 
+    metrics_count(METRICS_EVALUATIONS, 1);
+    long long begin_ns = metrics_phase_begin();
     var_val_type ans = calculate_nodes_recursive(tree, tree->root, &error);
+    metrics_phase_end(METRICS_PHASE_EVAL, begin_ns);
     if(error != ERROR_NO) {
         LOGGER_ERROR("calculate_nodes_recursive failed");
         return nan("2");
@@ -153,6 +258,65 @@ var_val_type calculate_tree(tree_t* tree, bool is_need_to_ask_vars) {
 
 //================================================================================
 
+var_val_type calculate_nodes_bound(const tree_node_t* curr_node, const var_bindings_t* bindings, error_code* error) {
+    HARD_ASSERT(bindings != nullptr, "bindings is nullptr");
+    HARD_ASSERT(error    != nullptr, "Error is nullptr");
+
+    if(curr_node == nullptr) return nan("4");
+
+    switch(curr_node->type) {
+        case CONSTANT:
+            return curr_node->value.constant;
+        case VARIABLE:
+            if(curr_node->value.var_idx >= bindings->size) {
+                LOGGER_ERROR("calculate_nodes_bound: var_idx %zu is out of bindings", curr_node->value.var_idx);
+                *error |= ERROR_INCORRECT_INDEX;
+                return nan("6");
+            }
+            return bindings->vals[curr_node->value.var_idx];
+        case FUNCTION:
+            break;
+        default:
+            LOGGER_ERROR("Unknown node type");
+            return nan("3");
+    }
+
+    var_val_type left_val  = calculate_nodes_bound(curr_node->left, bindings, error);
+    var_val_type right_val = curr_node->right ? calculate_nodes_bound(curr_node->right, bindings, error) : 0;
+    if(isnan(left_val) || isnan(right_val)) return NAN;
+
+    #define HANDLE_FUNC(func_name, ...)                     \
+        case func_name:                                     \
+            return func_name##_func(left_val, right_val);
+
+    switch(curr_node->value.func) {
+        #include "copy_past_file"
+        default:
+            LOGGER_ERROR("Unknown func op_code");
+            return nan("5");
+    }
+
+    #undef HANDLE_FUNC
+}
+
+var_val_type calculate_tree_bound(const tree_t* tree, const var_bindings_t* bindings, error_code* error) {
+    HARD_ASSERT(tree     != nullptr, "tree is nullptr");
+    HARD_ASSERT(bindings != nullptr, "bindings is nullptr");
+    HARD_ASSERT(error    != nullptr, "error is nullptr");
+
+    metrics_count(METRICS_EVALUATIONS, 1);
+    long long begin_ns = metrics_phase_begin();
+    var_val_type ans = calculate_nodes_bound(tree->root, bindings, error);
+    metrics_phase_end(METRICS_PHASE_EVAL, begin_ns);
+    if(*error != ERROR_NO) {
+        LOGGER_ERROR("calculate_tree_bound: calculate_nodes_bound failed");
+        return nan("2");
+    }
+    return ans;
+}
+
+//================================================================================
+
 static int double_cmp(double a, double b) {
     if(fabs(a - b) < CMP_PRECISION) return 0;
     if(a - b       > CMP_PRECISION)  return 1;
@@ -170,12 +334,15 @@ static error_code handle_fixed_elem(tree_node_t* node, const_val_type constant_v
 
     error_code error = ERROR_NO;
 
+    size_t removed_cnt = 0;
     if (node->left) {
-        error |= destroy_node_recursive(node->left, nullptr);
+        error |= destroy_node_recursive(node->left, &removed_cnt);
+        metrics_count(METRICS_NODES_NEUTRAL, removed_cnt);
         node->left = nullptr;
     }
     if (node->right) {
-        error |= destroy_node_recursive(node->right, nullptr);
+        error |= destroy_node_recursive(node->right, &removed_cnt);
+        metrics_count(METRICS_NODES_NEUTRAL, removed_cnt);
         node->right = nullptr;
     }
 
@@ -198,14 +365,17 @@ static error_code handle_neutral_elem(tree_node_t* node,
 
     error_code error = ERROR_NO;
 
+    size_t removed_cnt = 0;
     if (child_drop_ptr != nullptr) {
-        error |= destroy_node_recursive(child_drop_ptr, nullptr);
+        error |= destroy_node_recursive(child_drop_ptr, &removed_cnt);
     }
 
     tree_node_t child_copy = *child_keep_ptr;
+    child_copy.budget_id   = node->budget_id; /* node stays the allocation its budget counted */
     *node = child_copy;
 
-    free(child_keep_ptr);
+    node_free(child_keep_ptr);
+    metrics_count(METRICS_NODES_NEUTRAL, removed_cnt + 1);
 
     if (error != ERROR_NO) {
         LOGGER_ERROR("handle_neutral_elem: destroy_node_recursive failed");
@@ -272,11 +442,14 @@ static error_code fold_constants_in_node(tree_node_t* node) {
 
     error_code error = ERROR_NO;
 
+    size_t removed_cnt = 0;
     if (left_ptr != nullptr) {
-        error |= destroy_node_recursive(left_ptr, nullptr);
+        error |= destroy_node_recursive(left_ptr, &removed_cnt);
+        metrics_count(METRICS_NODES_FOLDED, removed_cnt);
     }
     if (right_ptr != nullptr) {
-        error |= destroy_node_recursive(right_ptr, nullptr);
+        error |= destroy_node_recursive(right_ptr, &removed_cnt);
+        metrics_count(METRICS_NODES_FOLDED, removed_cnt);
     }
 
     node->left           = nullptr;
@@ -442,27 +615,116 @@ static error_code simplify_neutral_and_constant_elements(tree_node_t* node) {
 }
 
 //--------------------------------------------------------------------------------
-//TODO: 0^0
-tree_node_t* optimize_subtree_recursive(tree_node_t* node, error_code* error_ptr) {
-    HARD_ASSERT(error_ptr != nullptr, "optimize_subtree_recursive: error_ptr is nullptr");
+/* Hash of node after it was simplified, from the hashes its children had before.
+   The simplifications leave a node as it was, fold it into a leaf or move a child into it,
+   so the hash is always known without walking the subtree again */
+static uint64_t simplified_node_hash(const tree_node_t* node, const tree_node_t* old_left, const tree_node_t* old_right,
+                                     const tree_node_t* old_left_copy, const tree_node_t* old_right_copy,
+                                     uint64_t left_hash, uint64_t right_hash) {
+    uint64_t null_hash = subtree_hash(nullptr);
+    if (!node->left && !node->right) return node_hash_combine(node, null_hash, null_hash);
+    if (node->left == old_left && node->right == old_right) return node_hash_combine(node, left_hash, right_hash);
+
+    /* a neutral element was dropped and the node took the place of the other child */
+    if (old_left && node->left == old_left_copy->left && node->right == old_left_copy->right) return left_hash;
+    HARD_ASSERT(old_right && node->left == old_right_copy->left && node->right == old_right_copy->right,
+                "simplified_node_hash: unknown simplification");
+    return right_hash;
+}
 
-    if (node == nullptr) {
-        return nullptr;
-    }
+static const size_t OPTIMIZE_LOCAL_STACK = 32;
 
-    if (*error_ptr != ERROR_NO) {
-        return node;
-    }
+struct optimize_frame_t {
+    tree_node_t* node;
+    bool         is_expanded;
+};
 
-    if (node->type == FUNCTION) {
-        node->left  = optimize_subtree_recursive(node->left,  error_ptr);
-        node->right = optimize_subtree_recursive(node->right, error_ptr);
+/* Postorder walk with explicit stacks: an expanded frame is met again after both children,
+   whose subtree hashes are then on top of hashes. The nodes are simplified in place;
+   hashes are carried up only if root_hash is asked for */
+static tree_node_t* optimize_nodes(tree_node_t* root, error_code* error_ptr, uint64_t* root_hash) {
+    optimize_frame_t  local_frames[OPTIMIZE_LOCAL_STACK];
+    uint64_t          local_hashes[OPTIMIZE_LOCAL_STACK];
+    optimize_frame_t* frames     = local_frames;
+    uint64_t*         hashes     = local_hashes;
+    size_t            frames_cap = OPTIMIZE_LOCAL_STACK;
+    size_t            hashes_cap = OPTIMIZE_LOCAL_STACK;
+    size_t            frames_cnt = 0;
+    size_t            hashes_cnt = 0;
+    const uint64_t    null_hash  = subtree_hash(nullptr);
+
+    frames[frames_cnt++] = {root, false};
+    while (frames_cnt > 0 && *error_ptr == ERROR_NO) {
+        optimize_frame_t frame = frames[--frames_cnt];
+        tree_node_t*     node  = frame.node;
+
+        if (node && node->type == FUNCTION && !frame.is_expanded) {
+            if (frames_cnt + 3 > frames_cap &&
+                !walk_stack_grow((void**)&frames, &frames_cap, local_frames, sizeof(optimize_frame_t))) {
+                *error_ptr |= ERROR_MEM_ALLOC;
+                break;
+            }
+            frames[frames_cnt++] = {node, true};
+            frames[frames_cnt++] = {node->right, false};
+            frames[frames_cnt++] = {node->left,  false};
+            continue;
+        }
 
-        *error_ptr |= fold_constants_in_node(node);
-        *error_ptr |= simplify_neutral_and_constant_elements(node);
+        if (!root_hash) {
+            if (node && node->type == FUNCTION) {
+                *error_ptr |= fold_constants_in_node(node);
+                *error_ptr |= simplify_neutral_and_constant_elements(node);
+            }
+            continue;
+        }
+
+        uint64_t hash = null_hash;
+        if (node && node->type == FUNCTION) {
+            uint64_t right_hash = hashes[--hashes_cnt];
+            uint64_t left_hash  = hashes[--hashes_cnt];
+
+            tree_node_t* old_left  = node->left;
+            tree_node_t* old_right = node->right;
+            tree_node_t  old_left_copy  = old_left  ? *old_left  : tree_node_t{};
+            tree_node_t  old_right_copy = old_right ? *old_right : tree_node_t{};
+
+            *error_ptr |= fold_constants_in_node(node);
+            *error_ptr |= simplify_neutral_and_constant_elements(node);
+
+            hash = simplified_node_hash(node, old_left, old_right, &old_left_copy, &old_right_copy, left_hash, right_hash);
+        } else if (node) {
+            hash = node_hash_combine(node, null_hash, null_hash);
+        }
+
+        if (hashes_cnt == hashes_cap &&
+            !walk_stack_grow((void**)&hashes, &hashes_cap, local_hashes, sizeof(uint64_t))) {
+            *error_ptr |= ERROR_MEM_ALLOC;
+            break;
+        }
+        hashes[hashes_cnt++] = hash;
     }
 
-    return node;
+    if (root_hash && *error_ptr == ERROR_NO) *root_hash = hashes[0];
+    if (frames != local_frames) free(frames);
+    if (hashes != local_hashes) free(hashes);
+    return root;
+}
+
+//TODO: 0^0
+tree_node_t* optimize_subtree_recursive(tree_node_t* node, error_code* error_ptr) {
+    HARD_ASSERT(error_ptr != nullptr, "optimize_subtree_recursive: error_ptr is nullptr");
+
+    if (node == nullptr || *error_ptr != ERROR_NO) return node;
+    return optimize_nodes(node, error_ptr, nullptr);
+}
+
+tree_node_t* optimize_subtree_hashed(tree_node_t* node, error_code* error_ptr, uint64_t* hash) {
+    HARD_ASSERT(error_ptr != nullptr, "optimize_subtree_hashed: error_ptr is nullptr");
+    HARD_ASSERT(hash      != nullptr, "optimize_subtree_hashed: hash is nullptr");
+
+    *hash = subtree_hash(nullptr);
+    if (node == nullptr || *error_ptr != ERROR_NO) return node;
+    return optimize_nodes(node, error_ptr, hash);
 }
 
 //================================================================================
@@ -476,7 +738,9 @@ error_code tree_optimize(tree_t* tree) {
     }
 
     error_code error_value = ERROR_NO;
+    long long begin_ns = metrics_phase_begin();
     tree->root = optimize_subtree_recursive(tree->root, &error_value);
+    metrics_phase_end(METRICS_PHASE_OPTIMIZE, begin_ns);
 
     if (error_value != ERROR_NO) {
         LOGGER_ERROR("tree_optimize: optimize_subtree_recursive failed");
@@ -486,3 +750,49 @@ error_code tree_optimize(tree_t* tree) {
     tree->size = count_nodes_recursive(tree->root);
     return ERROR_NO;
 }
+
+//================================================================================
+// Dry run of get_diff: the same DSL rules, but every constructor yields the count of nodes it would allocate
+
+#undef FUNC_TEMPLATE
+#undef c
+#undef v
+#undef d
+#undef cpy
+
+static size_t diff_size_of(size_t size)    { return size; }
+static size_t diff_size_of(std::nullptr_t) { return 0; }
+
+#define FUNC_TEMPLATE(op_code, left, right) (1 + diff_size_of(left) + diff_size_of(right))
+#define c(val)                              ((size_t)1)
+#define v(var_name)                         ((size_t)1)
+#define d(node)                             get_diff_size(node, args_arr)
+#define cpy(node)                           count_nodes_recursive(node)
+
+size_t get_diff_size(const tree_node_t* node, args_arr_t args_arr) {
+    HARD_ASSERT(args_arr.size == 0 || args_arr.arr != nullptr, "Wrong arg list");
+
+    if (!node)                  return 0;
+    if (node->type != FUNCTION) return 1;
+
+    const tree_node_t* l = node->left;
+    const tree_node_t* r = node->right;
+
+    #define HANDLE_FUNC(op_code, str_name, impl_func, args_cnt, priority, pattern, rule_pattern, DSL_deriv) \
+        case op_code: return DSL_deriv;
+
+    switch (node->value.func) {
+        #include "copy_past_file"
+        default:
+            LOGGER_ERROR("get_diff_size: Unknown func");
+            return 0;
+    }
+
+    #undef HANDLE_FUNC
+}
+
+#undef FUNC_TEMPLATE
+#undef c
+#undef v
+#undef d
+#undef cpy
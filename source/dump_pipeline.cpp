@@ -0,0 +1,317 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "asserts.h"
+#include "logger.h"
+#include "parallel.h"
+#include "tree_operations.h"
+#include "dump_pipeline.h"
+
+//================================================================================
+
+static const size_t DUMP_PIPELINE_MAX_JOBS   = 64;
+static const size_t DUMP_PIPELINE_MIN_HASHES = 64;
+static const size_t DUMP_PIPELINE_CMD_SIZE   = 2 * DUMP_PIPELINE_PATH_SIZE + 32;
+
+struct dump_job_t {
+    char        dot_path[DUMP_PIPELINE_PATH_SIZE];
+    char        svg_path[DUMP_PIPELINE_PATH_SIZE];
+    uint64_t    hash;   /* its dedup entry, dropped if the svg is never made */
+    size_t      serial;
+    dump_job_t* next;
+};
+
+/* the text is kept to confirm a hash match: two graphs never share an svg by a hash collision */
+struct dot_entry_t {
+    uint64_t hash;   /* 0 marks a free slot               */
+    size_t   serial; /* tells apart texts with one hash   */
+    char*    text;
+    size_t   len;
+};
+
+struct dump_pipeline_t {
+    pthread_mutex_t       lock;
+    pthread_cond_t        has_job;
+    pthread_cond_t        is_idle;
+    dump_job_t*           queue_head;
+    dump_job_t*           queue_tail;
+    size_t                pending_cnt;  /* queued + rendering */
+    pthread_t             workers[DUMP_PIPELINE_MAX_JOBS];
+    size_t                workers_cnt;
+    bool                  is_started;
+    bool                  is_stopping;
+    dot_entry_t*          hashes;       /* open addressing, linear probing */
+    size_t                hashes_cap;
+    size_t                hashes_cnt;
+    dump_pipeline_stats_t stats;
+};
+
+static dump_pipeline_t pipeline = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+    nullptr, nullptr, 0, {}, 0, false, false, nullptr, 0, 0, {}
+};
+
+//================================================================================
+
+static uint64_t dot_text_hash(const char* text, size_t len) {
+    uint64_t hash = hash_bytes(text, len);
+    return hash ? hash : 1;
+}
+
+static size_t hashes_home(uint64_t hash, size_t cap) {
+    return (size_t)hash & (cap - 1);
+}
+
+static bool hashes_grow() {
+    size_t       new_cap    = pipeline.hashes_cap ? pipeline.hashes_cap * 2 : DUMP_PIPELINE_MIN_HASHES;
+    dot_entry_t* new_hashes = (dot_entry_t*)calloc(new_cap, sizeof(dot_entry_t));
+    if(!new_hashes) return false;
+
+    for(size_t i = 0; i < pipeline.hashes_cap; i++) {
+        if(!pipeline.hashes[i].hash) continue;
+        size_t slot = hashes_home(pipeline.hashes[i].hash, new_cap);
+        while(new_hashes[slot].hash) slot = (slot + 1) & (new_cap - 1);
+        new_hashes[slot] = pipeline.hashes[i];
+    }
+    free(pipeline.hashes);
+    pipeline.hashes     = new_hashes;
+    pipeline.hashes_cap = new_cap;
+    return true;
+}
+
+static void hashes_free() {
+    for(size_t i = 0; i < pipeline.hashes_cap; i++) free(pipeline.hashes[i].text);
+    free(pipeline.hashes);
+    pipeline.hashes     = nullptr;
+    pipeline.hashes_cap = 0;
+    pipeline.hashes_cnt = 0;
+}
+
+/* true if the text was not seen before, *serial names its files; called under the lock.
+   Out of memory the text is rendered as new and left out of the set */
+static bool hashes_insert(uint64_t hash, const char* text, size_t len, size_t* serial) {
+    *serial = 0;
+    if(2 * (pipeline.hashes_cnt + 1) > pipeline.hashes_cap && !hashes_grow()) return true;
+
+    size_t slot = hashes_home(hash, pipeline.hashes_cap);
+    for(; pipeline.hashes[slot].hash; slot = (slot + 1) & (pipeline.hashes_cap - 1)) {
+        const dot_entry_t* entry = &pipeline.hashes[slot];
+        if(entry->hash != hash) continue;
+        if(entry->len == len && memcmp(entry->text, text, len) == 0) {
+            *serial = entry->serial;
+            return false;
+        }
+        if(entry->serial >= *serial) *serial = entry->serial + 1;
+    }
+
+    char* copy = (char*)malloc(len ? len : 1);
+    if(!copy) return true;
+    memcpy(copy, text, len);
+    pipeline.hashes[slot] = {hash, *serial, copy, len};
+    pipeline.hashes_cnt++;
+    return true;
+}
+
+/* backward-shift deletion keeps every probe run unbroken; called under the lock */
+static void hashes_remove(uint64_t hash, size_t serial) {
+    if(!pipeline.hashes_cap) return;
+
+    size_t mask = pipeline.hashes_cap - 1;
+    size_t slot = hashes_home(hash, pipeline.hashes_cap);
+    for(; pipeline.hashes[slot].hash; slot = (slot + 1) & mask) {
+        if(pipeline.hashes[slot].hash == hash && pipeline.hashes[slot].serial == serial) break;
+    }
+    if(!pipeline.hashes[slot].hash) return;
+
+    free(pipeline.hashes[slot].text);
+    pipeline.hashes_cnt--;
+    size_t hole = slot;
+    for(size_t next = (hole + 1) & mask; pipeline.hashes[next].hash; next = (next + 1) & mask) {
+        size_t home = hashes_home(pipeline.hashes[next].hash, pipeline.hashes_cap);
+        if(((next - home) & mask) >= ((next - hole) & mask)) {
+            pipeline.hashes[hole] = pipeline.hashes[next];
+            hole = next;
+        }
+    }
+    pipeline.hashes[hole] = {};
+}
+
+//================================================================================
+
+static bool render_dot(const dump_job_t* job) {
+    char cmd[DUMP_PIPELINE_CMD_SIZE] = {};
+    snprintf(cmd, sizeof(cmd), "dot -Tsvg \"%s\" -o \"%s\"", job->dot_path, job->svg_path);
+    return system(cmd) == 0;
+}
+
+/* a failed job forgets its text, so the next submit of it tries again instead of linking a missing svg */
+static void job_done(dump_job_t* job, bool is_rendered) {
+    pthread_mutex_lock(&pipeline.lock);
+    if(is_rendered) pipeline.stats.rendered++;
+    else {
+        pipeline.stats.failed++;
+        hashes_remove(job->hash, job->serial);
+    }
+    if(--pipeline.pending_cnt == 0) pthread_cond_broadcast(&pipeline.is_idle);
+    pthread_mutex_unlock(&pipeline.lock);
+    free(job);
+}
+
+static void* dump_worker(void*) {
+    while(true) {
+        pthread_mutex_lock(&pipeline.lock);
+        while(!pipeline.queue_head && !pipeline.is_stopping) {
+            pthread_cond_wait(&pipeline.has_job, &pipeline.lock);
+        }
+        dump_job_t* job = pipeline.queue_head;
+        if(!job) {
+            pthread_mutex_unlock(&pipeline.lock);
+            break;
+        }
+        pipeline.queue_head = job->next;
+        if(!pipeline.queue_head) pipeline.queue_tail = nullptr;
+        pthread_mutex_unlock(&pipeline.lock);
+
+        bool is_rendered = render_dot(job);
+        if(!is_rendered) LOGGER_WARNING("dump_worker: dot failed for %s", job->dot_path);
+        job_done(job, is_rendered);
+    }
+    return nullptr;
+}
+
+//================================================================================
+
+static void dump_pipeline_at_exit() {
+    dump_pipeline_stop();
+}
+
+error_code dump_pipeline_start(size_t max_jobs) {
+    pthread_mutex_lock(&pipeline.lock);
+    if(pipeline.is_started) {
+        pthread_mutex_unlock(&pipeline.lock);
+        return ERROR_NO;
+    }
+
+    if(max_jobs == 0)                     max_jobs = parallel_threads_cnt();
+    if(max_jobs > DUMP_PIPELINE_MAX_JOBS) max_jobs = DUMP_PIPELINE_MAX_JOBS;
+
+    if(mkdir(DUMP_PIPELINE_DIR, 0755) != 0 && errno != EEXIST) {
+        LOGGER_WARNING("dump_pipeline_start: mkdir '%s' failed", DUMP_PIPELINE_DIR);
+    }
+    errno = 0;
+
+    static bool is_at_exit_set = false;
+    if(!is_at_exit_set) is_at_exit_set = atexit(dump_pipeline_at_exit) == 0;
+
+    pipeline.is_stopping = false;
+    pipeline.workers_cnt = 0;
+    for(size_t i = 0; i < max_jobs; i++) {
+        if(pthread_create(&pipeline.workers[i], nullptr, dump_worker, nullptr) != 0) {
+            LOGGER_WARNING("dump_pipeline_start: pthread_create failed, %zu workers", pipeline.workers_cnt);
+            break;
+        }
+        pipeline.workers_cnt++;
+    }
+    pipeline.is_started = true;
+    pthread_mutex_unlock(&pipeline.lock);
+
+    LOGGER_DEBUG("dump_pipeline_start: %zu workers", pipeline.workers_cnt);
+    return ERROR_NO;
+}
+
+error_code dump_pipeline_submit(const char* dot_text, size_t dot_len, char* svg_path, size_t svg_path_size) {
+    HARD_ASSERT(dot_text != nullptr, "dot_text is nullptr");
+    HARD_ASSERT(svg_path != nullptr, "svg_path is nullptr");
+
+    dump_pipeline_start(0); /* no-op once started, is_started is only read under the lock */
+
+    uint64_t    hash = dot_text_hash(dot_text, dot_len);
+    dump_job_t* job  = (dump_job_t*)calloc(1, sizeof(dump_job_t));
+    if(!job) {
+        LOGGER_ERROR("dump_pipeline_submit: calloc failed");
+        return ERROR_MEM_ALLOC;
+    }
+
+    size_t serial = 0;
+    pthread_mutex_lock(&pipeline.lock);
+    pipeline.stats.submitted++;
+    bool is_new = hashes_insert(hash, dot_text, dot_len, &serial);
+    if(!is_new) pipeline.stats.deduplicated++;
+    else        pipeline.pending_cnt++;
+    pthread_mutex_unlock(&pipeline.lock);
+
+    char name[48] = {};
+    if(serial) snprintf(name, sizeof(name), "graph_%016llx_%zu", (unsigned long long)hash, serial);
+    else       snprintf(name, sizeof(name), "graph_%016llx",     (unsigned long long)hash);
+    snprintf(job->dot_path, sizeof(job->dot_path), "%s/%s.dot", DUMP_PIPELINE_DIR, name);
+    snprintf(job->svg_path, sizeof(job->svg_path), "%s/%s.svg", DUMP_PIPELINE_DIR, name);
+    snprintf(svg_path, svg_path_size, "%s", job->svg_path);
+    job->hash   = hash;
+    job->serial = serial;
+
+    if(!is_new) {
+        free(job);
+        return ERROR_NO;
+    }
+
+    FILE* dot_file = fopen(job->dot_path, "w");
+    if(!dot_file || fwrite(dot_text, 1, dot_len, dot_file) != dot_len) {
+        LOGGER_ERROR("dump_pipeline_submit: writing '%s' failed", job->dot_path);
+        if(dot_file) fclose(dot_file);
+        job_done(job, false);
+        return ERROR_OPEN_FILE;
+    }
+    fclose(dot_file);
+
+    pthread_mutex_lock(&pipeline.lock);
+    /* no pool, or its workers may already be gone: render in place */
+    if(pipeline.workers_cnt == 0 || pipeline.is_stopping) {
+        pthread_mutex_unlock(&pipeline.lock);
+        job_done(job, render_dot(job));
+        return ERROR_NO;
+    }
+    if(pipeline.queue_tail) pipeline.queue_tail->next = job;
+    else                    pipeline.queue_head       = job;
+    pipeline.queue_tail = job;
+    pthread_cond_signal(&pipeline.has_job);
+    pthread_mutex_unlock(&pipeline.lock);
+    return ERROR_NO;
+}
+
+void dump_pipeline_flush() {
+    pthread_mutex_lock(&pipeline.lock);
+    while(pipeline.pending_cnt > 0) pthread_cond_wait(&pipeline.is_idle, &pipeline.lock);
+    pthread_mutex_unlock(&pipeline.lock);
+}
+
+void dump_pipeline_stop() {
+    pthread_mutex_lock(&pipeline.lock);
+    if(!pipeline.is_started) {
+        pthread_mutex_unlock(&pipeline.lock);
+        return;
+    }
+    pipeline.is_stopping = true;
+    pthread_cond_broadcast(&pipeline.has_job);
+    pthread_mutex_unlock(&pipeline.lock);
+
+    /* workers drain the queue before they see is_stopping */
+    for(size_t i = 0; i < pipeline.workers_cnt; i++) pthread_join(pipeline.workers[i], nullptr);
+
+    pthread_mutex_lock(&pipeline.lock);
+    hashes_free();
+    pipeline.workers_cnt = 0;
+    pipeline.is_started  = false;
+    pthread_mutex_unlock(&pipeline.lock);
+}
+
+dump_pipeline_stats_t dump_pipeline_stats() {
+    pthread_mutex_lock(&pipeline.lock);
+    dump_pipeline_stats_t stats = pipeline.stats;
+    pthread_mutex_unlock(&pipeline.lock);
+    return stats;
+}
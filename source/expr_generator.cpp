@@ -0,0 +1,447 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "asserts.h"
+#include "logger.h"
+#include "error_handler.h"
+#include "tree_info.h"
+#include "tree_operations.h"
+#include "num_literal.h"
+#include "expr_generator.h"
+
+static const char* EXPR_VAR_NAMES[EXPR_MAX_VARS] = {
+    "x", "y", "z", "t", "u", "v", "w", "a", "b", "c", "d", "f", "g", "h", "k", "m"
+};
+
+static const size_t EXPR_MAX_CONST      = 9;
+static const size_t EXPR_TERM_MIN_NODES = 3;
+static const size_t EXPR_TERM_MAX_NODES = 8;
+static const size_t EXPR_TERM_MAX_DEPTH = 3;
+static const size_t EXPR_MONOMIAL_MAX_DEGREE = 4;
+
+#define HANDLE_FUNC(op_code, str_name, impl_func, args_cnt, ...) + 1
+static const size_t EXPR_OPS_CNT = 0
+    #include "copy_past_file"
+;
+#undef HANDLE_FUNC
+
+//================================================================================
+
+struct expr_gen_t {
+    tree_t*     tree;
+    uint64_t    rng_state;
+    size_t      vars_idx[EXPR_MAX_VARS];
+    size_t      vars_cnt;
+    func_type_t unary_ops[EXPR_OPS_CNT];
+    size_t      unary_cnt;
+    func_type_t binary_ops[EXPR_OPS_CNT];
+    size_t      binary_cnt;
+    size_t      max_depth;
+    bool        is_domain_safe;
+    size_t      nodes_made;
+    error_code  error;
+};
+
+static uint64_t expr_rand(expr_gen_t* gen) {
+    /* splitmix64: stable across platforms, so a seed always gives the same tree */
+    uint64_t z = (gen->rng_state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static size_t expr_rand_range(expr_gen_t* gen, size_t lo, size_t hi) {
+    HARD_ASSERT(lo <= hi, "empty range");
+    return lo + (size_t)(expr_rand(gen) % (hi - lo + 1));
+}
+
+static size_t expr_func_args_cnt(func_type_t func) {
+    #define HANDLE_FUNC(op_code, str_name, impl_func, args_cnt, ...) \
+        case op_code: return (size_t)(args_cnt);
+
+    switch(func) {
+        #include "copy_past_file"
+        default:
+            LOGGER_ERROR("expr_func_args_cnt: unknown func");
+            return 0;
+    }
+
+    #undef HANDLE_FUNC
+}
+
+static const char* expr_func_name(func_type_t func) {
+    #define HANDLE_FUNC(op_code, str_name, ...) \
+        case op_code: return #str_name;
+
+    switch(func) {
+        #include "copy_past_file"
+        default:
+            LOGGER_ERROR("expr_func_name: unknown func");
+            return "?";
+    }
+
+    #undef HANDLE_FUNC
+}
+
+static error_code expr_gen_init(expr_gen_t* gen, tree_t* tree, const expr_gen_opts_t* opts) {
+    HARD_ASSERT(gen  != nullptr, "gen is nullptr");
+    HARD_ASSERT(tree != nullptr, "tree is nullptr");
+    HARD_ASSERT(opts != nullptr, "opts is nullptr");
+
+    *gen = {};
+    gen->tree           = tree;
+    gen->rng_state      = opts->seed;
+    gen->max_depth      = opts->max_depth;
+    gen->is_domain_safe = opts->is_domain_safe;
+
+    gen->vars_cnt = opts->vars_cnt ? opts->vars_cnt : 1;
+    if(gen->vars_cnt > EXPR_MAX_VARS) {
+        LOGGER_ERROR("expr_gen_init: vars_cnt %zu > %zu", gen->vars_cnt, EXPR_MAX_VARS);
+        return ERROR_INCORRECT_ARGS;
+    }
+
+    error_code error = ERROR_NO;
+    for(size_t i = 0; i < gen->vars_cnt; i++) {
+        gen->vars_idx[i] = get_or_add_var_idx({EXPR_VAR_NAMES[i], strlen(EXPR_VAR_NAMES[i])}, 0,
+                                              tree->var_stack, &error);
+        if(error != ERROR_NO) {
+            LOGGER_ERROR("expr_gen_init: failed to add var '%s'", EXPR_VAR_NAMES[i]);
+            return error;
+        }
+    }
+
+    uint64_t ops_mask = opts->ops_mask ? opts->ops_mask : ~0ull;
+    for(size_t op = 0; op < EXPR_OPS_CNT; op++) {
+        if(!(ops_mask & EXPR_OP_BIT(op))) continue;
+        func_type_t func = (func_type_t)op;
+        if(expr_func_args_cnt(func) == 1) gen->unary_ops[gen->unary_cnt++]   = func;
+        else                              gen->binary_ops[gen->binary_cnt++] = func;
+    }
+    if(gen->unary_cnt + gen->binary_cnt == 0) {
+        LOGGER_ERROR("expr_gen_init: ops_mask allows no known op");
+        return ERROR_INCORRECT_ARGS;
+    }
+    return ERROR_NO;
+}
+
+//================================================================================
+
+static tree_node_t* expr_make_node(expr_gen_t* gen, node_type_t type, value_t value,
+                                   tree_node_t* left, tree_node_t* right) {
+    if(gen->error != ERROR_NO) {
+        destroy_node_recursive(left,  nullptr);
+        destroy_node_recursive(right, nullptr);
+        return nullptr;
+    }
+
+    tree_node_t* node = init_node(type, value, left, right);
+    if(!node) {
+        LOGGER_ERROR("expr_make_node: init_node failed");
+        gen->error |= ERROR_MEM_ALLOC;
+        destroy_node_recursive(left,  nullptr);
+        destroy_node_recursive(right, nullptr);
+        return nullptr;
+    }
+    gen->nodes_made++;
+    return node;
+}
+
+static tree_node_t* expr_func(expr_gen_t* gen, func_type_t func, tree_node_t* left, tree_node_t* right) {
+    return expr_make_node(gen, FUNCTION, make_union_func(func), left, right);
+}
+
+static tree_node_t* expr_const(expr_gen_t* gen, const_val_type val) {
+    return expr_make_node(gen, CONSTANT, make_union_const(val), nullptr, nullptr);
+}
+
+static tree_node_t* expr_var(expr_gen_t* gen, size_t var_num) {
+    return expr_make_node(gen, VARIABLE, make_union_var(gen->vars_idx[var_num]), nullptr, nullptr);
+}
+
+static tree_node_t* expr_leaf(expr_gen_t* gen) {
+    if(expr_rand(gen) & 1) return expr_var(gen, expr_rand_range(gen, 0, gen->vars_cnt - 1));
+    return expr_const(gen, (const_val_type)expr_rand_range(gen, 1, EXPR_MAX_CONST));
+}
+
+/* exp(sin(u)) lies in [1/e, e]: positive and bounded whatever u is */
+static tree_node_t* expr_guard_positive(expr_gen_t* gen, tree_node_t* node) {
+    return expr_func(gen, EXP, expr_func(gen, SIN, node, nullptr), nullptr);
+}
+
+static tree_node_t* expr_guard_bounded(expr_gen_t* gen, tree_node_t* node) {
+    return expr_func(gen, SIN, node, nullptr);
+}
+
+/* Wraps args of domain-restricted or fast-growing funcs so that the value and all derivatives stay finite */
+static tree_node_t* expr_guarded_func(expr_gen_t* gen, func_type_t func, tree_node_t* left, tree_node_t* right) {
+    if(!gen->is_domain_safe) return expr_func(gen, func, left, right);
+
+    switch(func) {
+        case LN:
+            left  = expr_guard_positive(gen, left);
+            break;
+        case LOG:
+            left  = expr_func(gen, ADD, expr_guard_positive(gen, left), expr_const(gen, 1));
+            right = expr_guard_positive(gen, right);
+            break;
+        case DIV:
+            right = expr_guard_positive(gen, right);
+            break;
+        case POW:
+            left  = expr_guard_positive(gen, left);
+            right = expr_guard_bounded(gen, right);
+            break;
+        case ARCSIN:
+        case ARCCOS:
+            left  = expr_func(gen, DIV, expr_guard_bounded(gen, left), expr_const(gen, 2));
+            break;
+        case ARCCH:
+            left  = expr_func(gen, ADD, expr_guard_positive(gen, left), expr_const(gen, 1));
+            break;
+        case TAN:
+        case EXP:
+        case CH:
+        case SH:
+            left  = expr_guard_bounded(gen, left);
+            break;
+        case CTAN:
+            left  = expr_func(gen, ADD, expr_func(gen, DIV, expr_guard_bounded(gen, left), expr_const(gen, 2)),
+                                        expr_const(gen, 1));
+            break;
+        case ADD:
+        case SUB:
+        case MUL:
+        case SIN:
+        case COS:
+        case ARCTAN:
+        case ARCCTAN:
+        case ARCSH:
+            break;
+        default:
+            LOGGER_ERROR("expr_guarded_func: unknown func");
+            break;
+    }
+    return expr_func(gen, func, left, right);
+}
+
+//================================================================================
+
+static tree_node_t* expr_gen_random(expr_gen_t* gen, size_t budget, size_t depth, size_t max_depth) {
+    bool is_depth_over = max_depth && depth >= max_depth;
+    if(budget <= 1 || is_depth_over || gen->error != ERROR_NO) return expr_leaf(gen);
+
+    bool is_binary = gen->binary_cnt && budget >= 3 && (!gen->unary_cnt || (expr_rand(gen) % 3 != 0));
+    if(!is_binary && !gen->unary_cnt) return expr_leaf(gen);
+
+    if(!is_binary) {
+        func_type_t func = gen->unary_ops[expr_rand_range(gen, 0, gen->unary_cnt - 1)];
+        tree_node_t* child = expr_gen_random(gen, budget - 1, depth + 1, max_depth);
+        return expr_guarded_func(gen, func, child, nullptr);
+    }
+
+    func_type_t func = gen->binary_ops[expr_rand_range(gen, 0, gen->binary_cnt - 1)];
+    size_t left_budget = expr_rand_range(gen, 1, budget - 2);
+    tree_node_t* left  = expr_gen_random(gen, left_budget,              depth + 1, max_depth);
+    tree_node_t* right = expr_gen_random(gen, budget - 1 - left_budget, depth + 1, max_depth);
+    return expr_guarded_func(gen, func, left, right);
+}
+
+static tree_node_t* expr_gen_chain(expr_gen_t* gen, size_t nodes_cnt) {
+    tree_node_t* acc = expr_leaf(gen);
+    while(gen->nodes_made < nodes_cnt && gen->error == ERROR_NO) {
+        size_t op_idx = expr_rand_range(gen, 0, gen->unary_cnt + gen->binary_cnt - 1);
+        if(op_idx < gen->unary_cnt) acc = expr_guarded_func(gen, gen->unary_ops[op_idx], acc, nullptr);
+        else acc = expr_guarded_func(gen, gen->binary_ops[op_idx - gen->unary_cnt], acc, expr_leaf(gen));
+    }
+    return acc;
+}
+
+static tree_node_t* expr_gen_wide_sum(expr_gen_t* gen, size_t nodes_cnt) {
+    size_t term_depth = gen->max_depth ? gen->max_depth : EXPR_TERM_MAX_DEPTH;
+    tree_node_t* acc = expr_gen_random(gen, expr_rand_range(gen, EXPR_TERM_MIN_NODES, EXPR_TERM_MAX_NODES), 0, term_depth);
+    while(gen->nodes_made < nodes_cnt && gen->error == ERROR_NO) {
+        tree_node_t* term = expr_gen_random(gen, expr_rand_range(gen, EXPR_TERM_MIN_NODES, EXPR_TERM_MAX_NODES),
+                                            0, term_depth);
+        acc = expr_func(gen, ADD, acc, term);
+    }
+    return acc;
+}
+
+static tree_node_t* expr_gen_nested(expr_gen_t* gen, size_t nodes_cnt) {
+    if(!gen->unary_cnt) {
+        LOGGER_ERROR("expr_gen_nested: ops_mask allows no unary func");
+        gen->error |= ERROR_INCORRECT_ARGS;
+        return nullptr;
+    }
+
+    tree_node_t* acc = expr_var(gen, 0);
+    for(size_t depth = 0; gen->nodes_made < nodes_cnt && gen->error == ERROR_NO; depth++) {
+        if(gen->max_depth && depth >= gen->max_depth) break;
+        acc = expr_guarded_func(gen, gen->unary_ops[expr_rand_range(gen, 0, gen->unary_cnt - 1)], acc, nullptr);
+    }
+    return acc;
+}
+
+static tree_node_t* expr_gen_monomial(expr_gen_t* gen) {
+    tree_node_t* acc = expr_const(gen, (const_val_type)expr_rand_range(gen, 1, EXPR_MAX_CONST));
+    size_t degree = expr_rand_range(gen, 1, EXPR_MONOMIAL_MAX_DEGREE);
+    for(size_t i = 0; i < degree; i++) {
+        acc = expr_func(gen, MUL, acc, expr_var(gen, expr_rand_range(gen, 0, gen->vars_cnt - 1)));
+    }
+    return acc;
+}
+
+static tree_node_t* expr_gen_polynomial(expr_gen_t* gen, size_t nodes_cnt) {
+    tree_node_t* acc = expr_gen_monomial(gen);
+    while(gen->nodes_made < nodes_cnt && gen->error == ERROR_NO) {
+        acc = expr_func(gen, ADD, acc, expr_gen_monomial(gen));
+    }
+    return acc;
+}
+
+//================================================================================
+
+tree_node_t* expr_generate(tree_t* tree, const expr_gen_opts_t* opts, error_code* error) {
+    HARD_ASSERT(tree  != nullptr, "tree is nullptr");
+    HARD_ASSERT(opts  != nullptr, "opts is nullptr");
+    HARD_ASSERT(error != nullptr, "error is nullptr");
+
+    LOGGER_DEBUG("expr_generate: started, shape %d, %zu nodes", (int)opts->shape, opts->nodes_cnt);
+
+    expr_gen_t gen = {};
+    *error |= expr_gen_init(&gen, tree, opts);
+    if(*error != ERROR_NO) return nullptr;
+
+    size_t nodes_cnt = opts->nodes_cnt ? opts->nodes_cnt : 1;
+    tree_node_t* root = nullptr;
+    switch(opts->shape) {
+        case EXPR_SHAPE_RANDOM:     root = expr_gen_random(&gen, nodes_cnt, 0, gen.max_depth); break;
+        case EXPR_SHAPE_CHAIN:      root = expr_gen_chain(&gen, nodes_cnt);                    break;
+        case EXPR_SHAPE_WIDE_SUM:   root = expr_gen_wide_sum(&gen, nodes_cnt);                 break;
+        case EXPR_SHAPE_NESTED:     root = expr_gen_nested(&gen, nodes_cnt);                   break;
+        case EXPR_SHAPE_POLYNOMIAL: root = expr_gen_polynomial(&gen, nodes_cnt);               break;
+        default:
+            LOGGER_ERROR("expr_generate: unknown shape %d", (int)opts->shape);
+            gen.error |= ERROR_INCORRECT_ARGS;
+            break;
+    }
+
+    if(gen.error != ERROR_NO) {
+        destroy_node_recursive(root, nullptr);
+        *error |= gen.error;
+        return nullptr;
+    }
+    return root;
+}
+
+char* expr_generate_text(tree_t* tree, const expr_gen_opts_t* opts, error_code* error) {
+    HARD_ASSERT(tree  != nullptr, "tree is nullptr");
+    HARD_ASSERT(error != nullptr, "error is nullptr");
+
+    tree_node_t* root = expr_generate(tree, opts, error);
+    if(!root) return nullptr;
+
+    char*  text     = nullptr;
+    size_t text_len = 0;
+    FILE*  out      = open_memstream(&text, &text_len);
+    if(!out) {
+        LOGGER_ERROR("expr_generate_text: open_memstream failed");
+        destroy_node_recursive(root, nullptr);
+        *error |= ERROR_MEM_ALLOC;
+        return nullptr;
+    }
+
+    *error |= expr_print_infix(out, tree, root);
+    fputc('$', out);
+    fclose(out);
+    destroy_node_recursive(root, nullptr);
+
+    if(*error != ERROR_NO) {
+        free(text);
+        return nullptr;
+    }
+    return text;
+}
+
+//================================================================================
+
+error_code expr_print_infix(FILE* out, const tree_t* tree, const tree_node_t* node) {
+    HARD_ASSERT(out  != nullptr, "out is nullptr");
+    HARD_ASSERT(tree != nullptr, "tree is nullptr");
+
+    if(!node) {
+        LOGGER_ERROR("expr_print_infix: node is nullptr");
+        return ERROR_NULL_ARG;
+    }
+
+    error_code error = ERROR_NO;
+    switch(node->type) {
+        case CONSTANT: {
+            /* get_g has no unary minus: negative constants go in as (0 - c) */
+            const_val_type val = node->value.constant;
+            char num_buff[NUM_LITERAL_MAX_LEN] = {};
+            if(num_literal_print(val < 0 ? -val : val, num_buff) == 0) fputs("nan", out);
+            else if(val < 0)                                          fprintf(out, "(0 - %s)", num_buff);
+            else                                                      fputs(num_buff, out);
+            break;
+        }
+        case VARIABLE: {
+            if(node->value.var_idx >= tree->var_stack->size) {
+                LOGGER_ERROR("expr_print_infix: var_idx %zu is out of range", node->value.var_idx);
+                return ERROR_INCORRECT_INDEX;
+            }
+            c_string_t name = tree->var_stack->data[node->value.var_idx].str;
+            fprintf(out, "%.*s", (int)name.len, name.ptr);
+            break;
+        }
+        case FUNCTION: {
+            func_type_t func = node->value.func;
+            switch(func) {
+                case ADD:
+                case SUB:
+                case MUL:
+                case DIV:
+                case POW:
+                    fputc('(', out);
+                    error |= expr_print_infix(out, tree, node->left);
+                    fprintf(out, " %s ", expr_func_name(func));
+                    error |= expr_print_infix(out, tree, node->right);
+                    fputc(')', out);
+                    break;
+                case LOG:
+                case LN:
+                case EXP:
+                case SIN:
+                case COS:
+                case TAN:
+                case CTAN:
+                case ARCSIN:
+                case ARCCOS:
+                case ARCTAN:
+                case ARCCTAN:
+                case CH:
+                case SH:
+                case ARCSH:
+                case ARCCH:
+                    fprintf(out, "%s(", expr_func_name(func));
+                    error |= expr_print_infix(out, tree, node->left);
+                    if(expr_func_args_cnt(func) == 2) {
+                        fprintf(out, ", ");
+                        error |= expr_print_infix(out, tree, node->right);
+                    }
+                    fputc(')', out);
+                    break;
+                default:
+                    LOGGER_ERROR("expr_print_infix: unknown func");
+                    return ERROR_UNKNOWN_FUNC;
+            }
+            break;
+        }
+        default:
+            LOGGER_ERROR("expr_print_infix: unknown node type");
+            return ERROR_INVALID_STRUCTURE;
+    }
+    return error;
+}
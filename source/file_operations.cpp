@@ -7,6 +7,7 @@
 #include "file_operations.h"
 
 #include <errno.h>
+#include <signal.h>
 
 static long get_file_size(FILE* file) {
     if(file == nullptr) {
@@ -45,6 +46,7 @@ error_code read_file_to_buffer(FILE* file, string_t* buff_str) {
     if (bytes_read != (size_t)file_size) {
         LOGGER_ERROR("read_file_to_buffer: failed to read entire file");
         free(buffer);
+        fclose(file);
         return ERROR_OPEN_FILE;
     }
     
@@ -76,4 +78,11 @@ error_code read_file_to_buffer_by_name(string_t* buff, const char* filename) {
     }
 
     return error;
-}
\ No newline at end of file
+}
+
+void ignore_sigpipe() {
+    struct sigaction ignore_action = {};
+    ignore_action.sa_handler = SIG_IGN;
+    sigemptyset(&ignore_action.sa_mask);
+    if(sigaction(SIGPIPE, &ignore_action, nullptr) != 0) LOGGER_WARNING("ignore_sigpipe: sigaction failed");
+}
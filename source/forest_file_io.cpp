@@ -0,0 +1,923 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "asserts.h"
+#include "logger.h"
+#include "parallel.h"
+#include "tree_operations.h"
+#include "tree_file_io.h"
+#include "file_operations.h"
+#include "forest_operations.h"
+#include "forest_file_io.h"
+#include "my_string.h"
+
+//================================================================================
+
+static const char    FOREST_BIN_MAGIC[8]  = {'F', 'O', 'R', 'E', 'S', 'T', 'B', 'N'};
+static const char    FOREST_INDEX_MAGIC[8] = {'F', 'O', 'R', 'E', 'S', 'T', 'I', 'X'};
+static const char    FOREST_VARS_TAG[]    = "#vars";
+static const char    FOREST_INDEX_TAG[]   = "#index";
+static const char    FOREST_INDEX_AT_TAG[] = "#index_at";
+static const size_t  FOREST_MIN_RECORDS   = 64;
+static const size_t  FOREST_MIN_BIN_BUFF  = 256;
+static const uint8_t BIN_HAS_LEFT         = 1;
+static const uint8_t BIN_HAS_RIGHT        = 2;
+static const size_t  BIN_LOCAL_STACK      = 32;
+
+#define HANDLE_FUNC(op_code, ...) op_code,
+static const func_type_t ALL_FUNCS[] = {
+    #include "copy_past_file"
+};
+#undef HANDLE_FUNC
+
+static const size_t FUNCS_CNT = sizeof(ALL_FUNCS) / sizeof(ALL_FUNCS[0]);
+
+struct forest_record_t {
+    const char*  begin;
+    const char*  end;
+    c_string_t   name;
+    tree_node_t* root;
+    size_t       nodes_cnt;
+    error_code   error;
+};
+
+struct forest_load_t {
+    uint32_t         version;
+    forest_record_t* records;
+    size_t           records_cnt;
+    size_t           records_cap;
+    bool             is_binary;
+    const stack_t*   var_stack;
+    size_t*          var_map;    /* binary: file var idx -> var_stack idx      */
+    size_t           vars_cnt;
+    ssize_t*         func_map;   /* binary: file func code -> func_type_t, -1 */
+    size_t           funcs_cnt;
+};
+
+struct forest_lazy_t {
+    pthread_mutex_t lock;
+    void*           map;
+    size_t          map_len;
+    forest_load_t   load;   /* format and var / func maps, records is the index */
+};
+
+struct forest_index_entry_t {
+    uint64_t   offset;
+    uint64_t   len;
+    c_string_t name;
+};
+
+struct bin_reader_t {
+    const char* curr;
+    const char* end;
+};
+
+struct bin_buff_t {
+    char*  data;
+    size_t len;
+    size_t cap;
+};
+
+//================================================================================
+
+static bool bin_read(bin_reader_t* reader, void* dst, size_t len) {
+    if((size_t)(reader->end - reader->curr) < len) return false;
+    memcpy(dst, reader->curr, len);
+    reader->curr += len;
+    return true;
+}
+
+static bool bin_write(bin_buff_t* buff, const void* src, size_t len) {
+    if(len == 0) return true;
+    if(buff->len + len > buff->cap) {
+        size_t new_cap = buff->cap ? buff->cap : FOREST_MIN_BIN_BUFF;
+        while(new_cap < buff->len + len) new_cap *= 2;
+        char* new_data = (char*)realloc(buff->data, new_cap);
+        if(!new_data) return false;
+        buff->data = new_data;
+        buff->cap  = new_cap;
+    }
+    memcpy(buff->data + buff->len, src, len);
+    buff->len += len;
+    return true;
+}
+
+static bool bin_write_name(bin_buff_t* buff, c_string_t name) {
+    uint32_t len = (uint32_t)name.len;
+    return bin_write(buff, &len, sizeof(len)) && bin_write(buff, name.ptr, name.len);
+}
+
+static bool bin_write_node_value(bin_buff_t* buff, const tree_node_t* node) {
+    uint8_t type     = (uint8_t)node->type;
+    uint8_t children = (uint8_t)((node->left ? BIN_HAS_LEFT : 0) | (node->right ? BIN_HAS_RIGHT : 0));
+    if(!bin_write(buff, &type, sizeof(type)) || !bin_write(buff, &children, sizeof(children))) return false;
+
+    switch(node->type) {
+        case CONSTANT:
+            return bin_write(buff, &node->value.constant, sizeof(node->value.constant));
+        case VARIABLE: {
+            uint32_t var_idx = (uint32_t)node->value.var_idx;
+            return bin_write(buff, &var_idx, sizeof(var_idx));
+        }
+        case FUNCTION: {
+            uint8_t func = (uint8_t)node->value.func;
+            return bin_write(buff, &func, sizeof(func));
+        }
+        default:
+            return false;
+    }
+}
+
+/* preorder, the left subtree before the right one */
+static bool bin_write_node(bin_buff_t* buff, const tree_node_t* root) {
+    const tree_node_t*  local_stack[BIN_LOCAL_STACK] = {};
+    const tree_node_t** stack     = local_stack;
+    size_t              stack_cap = BIN_LOCAL_STACK;
+    size_t              stack_cnt = 0;
+    bool                is_ok     = true;
+
+    stack[stack_cnt++] = root;
+    while(stack_cnt > 0 && is_ok) {
+        const tree_node_t* node = stack[--stack_cnt];
+        is_ok = bin_write_node_value(buff, node);
+        if(is_ok && stack_cnt + 2 > stack_cap) {
+            is_ok = walk_stack_grow((void**)&stack, &stack_cap, local_stack, sizeof(*stack));
+        }
+        if(!is_ok) break;
+        if(node->right) stack[stack_cnt++] = node->right;
+        if(node->left)  stack[stack_cnt++] = node->left;
+    }
+
+    if(stack != local_stack) free(stack);
+    return is_ok;
+}
+
+/* file func code i is ALL_FUNCS[i]; the loader maps the codes back by name */
+static bool bin_write_header(bin_buff_t* buff, const stack_t* var_stack, uint64_t trees_cnt) {
+    uint32_t version   = (uint32_t)FOREST_FILE_VERSION;
+    uint32_t funcs_cnt = (uint32_t)FUNCS_CNT;
+    uint64_t vars_cnt  = var_stack->size;
+    bool     is_ok     = bin_write(buff, FOREST_BIN_MAGIC, sizeof(FOREST_BIN_MAGIC)) &&
+                         bin_write(buff, &version,   sizeof(version))   &&
+                         bin_write(buff, &funcs_cnt, sizeof(funcs_cnt)) &&
+                         bin_write(buff, &vars_cnt,  sizeof(vars_cnt))  &&
+                         bin_write(buff, &trees_cnt, sizeof(trees_cnt));
+    for(size_t i = 0; is_ok && i < FUNCS_CNT; i++) {
+        const char* func_name = tech_get_func_name_by_type(ALL_FUNCS[i]);
+        uint8_t     len       = (uint8_t)strlen(func_name);
+        is_ok = bin_write(buff, &len, sizeof(len)) && bin_write(buff, func_name, len);
+    }
+    for(size_t i = 0; is_ok && i < var_stack->size; i++) is_ok = bin_write_name(buff, var_stack->data[i].str);
+    return is_ok;
+}
+
+//================================================================================
+
+static size_t forest_trees_cnt(const forest_t* forest) {
+    size_t cnt = 0;
+    for(ssize_t idx = forest->tree_list->arr[0].next; idx != 0; idx = forest->tree_list->arr[idx].next) cnt++;
+    return cnt;
+}
+
+static bool file_offset(FILE* file, uint64_t* offset) {
+    long pos = ftell(file);
+    if(pos < 0) return false;
+    *offset = (uint64_t)pos;
+    return true;
+}
+
+/* stubs have no nodes yet, writing them would lose the tree */
+static error_code check_no_stubs(const forest_t* forest) {
+    for(ssize_t idx = forest->tree_list->arr[0].next; idx != 0; idx = forest->tree_list->arr[idx].next) {
+        if(forest->tree_list->arr[idx].val->is_stub) {
+            LOGGER_ERROR("forest_write_to_file: tree '%.*s' is not loaded, call forest_load_all first",
+                         (int)forest->tree_list->arr[idx].val->name.len, forest->tree_list->arr[idx].val->name.ptr);
+            return ERROR_NO_INIT;
+        }
+    }
+    return ERROR_NO;
+}
+
+/* text names sit between quotes on one line and are read back in place, with no unescaping */
+static bool is_text_name(c_string_t name) {
+    for(size_t i = 0; i < name.len; i++) {
+        if(name.ptr[i] == '"' || name.ptr[i] == '\n' || name.ptr[i] == '\r') return false;
+    }
+    return true;
+}
+
+static error_code check_text_names(const forest_t* forest) {
+    for(size_t i = 0; i < forest->var_stack->size; i++) {
+        c_string_t var_name = forest->var_stack->data[i].str;
+        if(!is_text_name(var_name)) {
+            LOGGER_ERROR("forest_write_to_file: var '%.*s' can't be written as text, use the binary format",
+                         (int)var_name.len, var_name.ptr);
+            return ERROR_INCORRECT_ARGS;
+        }
+    }
+    for(ssize_t idx = forest->tree_list->arr[0].next; idx != 0; idx = forest->tree_list->arr[idx].next) {
+        c_string_t tree_name = forest->tree_list->arr[idx].val->name;
+        if(!is_text_name(tree_name)) {
+            LOGGER_ERROR("forest_write_to_file: tree '%.*s' can't be written as text, use the binary format",
+                         (int)tree_name.len, tree_name.ptr);
+            return ERROR_INCORRECT_ARGS;
+        }
+    }
+    return ERROR_NO;
+}
+
+static error_code write_text(const forest_t* forest, FILE* file, forest_index_entry_t* index) {
+    const stack_t* var_stack = forest->var_stack;
+    if(fprintf(file, "%s %d\n%s %zu", FOREST_TEXT_MAGIC, FOREST_FILE_VERSION, FOREST_VARS_TAG, var_stack->size) < 0) {
+        return ERROR_OPEN_FILE;
+    }
+    for(size_t i = 0; i < var_stack->size; i++) {
+        c_string_t var_name = var_stack->data[i].str;
+        if(fprintf(file, " \"%.*s\"", (int)var_name.len, var_name.ptr) < 0) return ERROR_OPEN_FILE;
+    }
+    if(fputc('\n', file) == EOF) return ERROR_OPEN_FILE;
+
+    size_t trees_cnt = 0;
+    for(ssize_t idx = forest->tree_list->arr[0].next; idx != 0; idx = forest->tree_list->arr[idx].next) {
+        const tree_t*         tree  = forest->tree_list->arr[idx].val;
+        forest_index_entry_t* entry = &index[trees_cnt++];
+        uint64_t              end   = 0;
+        if(!file_offset(file, &entry->offset)) return ERROR_OPEN_FILE;
+        if(fprintf(file, "\"%.*s\" ", (int)tree->name.len, tree->name.ptr) < 0) return ERROR_OPEN_FILE;
+        error_code error = tree_write_nodes(tree, file);
+        if(error != ERROR_NO) return error;
+        if(!file_offset(file, &end) || fputc('\n', file) == EOF) return ERROR_OPEN_FILE;
+        entry->len  = end - entry->offset;
+        entry->name = tree->name;
+    }
+
+    uint64_t index_offset = 0;
+    if(!file_offset(file, &index_offset) || fprintf(file, "%s %zu\n", FOREST_INDEX_TAG, trees_cnt) < 0) {
+        return ERROR_OPEN_FILE;
+    }
+    for(size_t i = 0; i < trees_cnt; i++) {
+        if(fprintf(file, "%llu %llu \"%.*s\"\n", (unsigned long long)index[i].offset, (unsigned long long)index[i].len,
+                   (int)index[i].name.len, index[i].name.ptr) < 0) {
+            return ERROR_OPEN_FILE;
+        }
+    }
+    if(fprintf(file, "%s %llu\n", FOREST_INDEX_AT_TAG, (unsigned long long)index_offset) < 0) return ERROR_OPEN_FILE;
+    return ERROR_NO;
+}
+
+static error_code write_binary(const forest_t* forest, FILE* file, forest_index_entry_t* index) {
+    bin_buff_t buff      = {};
+    error_code error     = ERROR_NO;
+    size_t     trees_cnt = 0;
+
+    if(!bin_write_header(&buff, forest->var_stack, forest_trees_cnt(forest))) error = ERROR_MEM_ALLOC;
+    else if(fwrite(buff.data, 1, buff.len, file) != buff.len)              error = ERROR_OPEN_FILE;
+
+    for(ssize_t idx = forest->tree_list->arr[0].next; idx != 0 && error == ERROR_NO; idx = forest->tree_list->arr[idx].next) {
+        const tree_t* tree = forest->tree_list->arr[idx].val;
+
+        /* the record length goes first, so the record is built in memory */
+        buff.len = 0;
+        uint64_t nodes_cnt = tree->root ? count_nodes_recursive(tree->root) : 0;
+        if(!bin_write_name(&buff, tree->name) || !bin_write(&buff, &nodes_cnt, sizeof(nodes_cnt)) ||
+           (tree->root && !bin_write_node(&buff, tree->root))) {
+            error = ERROR_MEM_ALLOC;
+            break;
+        }
+        forest_index_entry_t* entry = &index[trees_cnt++];
+        entry->len  = buff.len;
+        entry->name = tree->name;
+        if(fwrite(&entry->len, sizeof(entry->len), 1, file) != 1 || !file_offset(file, &entry->offset) ||
+           fwrite(buff.data, 1, buff.len, file) != buff.len) {
+            error = ERROR_OPEN_FILE;
+        }
+    }
+
+    uint64_t index_offset = 0;
+    if(error == ERROR_NO && !file_offset(file, &index_offset)) error = ERROR_OPEN_FILE;
+    buff.len = 0;
+    for(size_t i = 0; i < trees_cnt && error == ERROR_NO; i++) {
+        if(!bin_write(&buff, &index[i].offset, sizeof(index[i].offset)) ||
+           !bin_write(&buff, &index[i].len,    sizeof(index[i].len))    ||
+           !bin_write_name(&buff, index[i].name)) {
+            error = ERROR_MEM_ALLOC;
+        }
+    }
+    if(error == ERROR_NO && (!bin_write(&buff, &index_offset, sizeof(index_offset)) ||
+                             !bin_write(&buff, FOREST_INDEX_MAGIC, sizeof(FOREST_INDEX_MAGIC)))) {
+        error = ERROR_MEM_ALLOC;
+    }
+    if(error == ERROR_NO && fwrite(buff.data, 1, buff.len, file) != buff.len) error = ERROR_OPEN_FILE;
+
+    free(buff.data);
+    return error;
+}
+
+error_code forest_write_to_file(const forest_t* forest, const char* filename, forest_file_format_t format) {
+    HARD_ASSERT(forest   != nullptr, "forest is nullptr");
+    HARD_ASSERT(filename != nullptr, "filename is nullptr");
+
+    LOGGER_DEBUG("forest_write_to_file: started, filename=%s", filename);
+
+    error_code error = check_no_stubs(forest);
+    if(error == ERROR_NO && format != FOREST_FILE_BINARY) error = check_text_names(forest);
+    if(error != ERROR_NO) return error;
+
+    forest_index_entry_t* index = (forest_index_entry_t*)calloc(forest_trees_cnt(forest) + 1, sizeof(forest_index_entry_t));
+    if(!index) return ERROR_MEM_ALLOC;
+
+    FILE* file = fopen(filename, format == FOREST_FILE_BINARY ? "wb" : "w");
+    if(!file) {
+        LOGGER_ERROR("forest_write_to_file: failed to open file '%s'", filename);
+        errno = 0;
+        free(index);
+        return ERROR_OPEN_FILE;
+    }
+
+    error = format == FOREST_FILE_BINARY ? write_binary(forest, file, index) : write_text(forest, file, index);
+    if(fclose(file) != 0 && error == ERROR_NO) error = ERROR_CLOSE_FILE;
+    if(error != ERROR_NO) LOGGER_ERROR("forest_write_to_file: writing '%s' failed, error %ld", filename, error);
+    free(index);
+    return error;
+}
+
+//================================================================================
+
+static bool records_push(forest_load_t* load, const char* begin, const char* end, c_string_t name) {
+    if(load->records_cnt == load->records_cap) {
+        size_t           new_cap     = load->records_cap ? 2 * load->records_cap : FOREST_MIN_RECORDS;
+        forest_record_t* new_records = (forest_record_t*)realloc(load->records, new_cap * sizeof(forest_record_t));
+        if(!new_records) return false;
+        load->records     = new_records;
+        load->records_cap = new_cap;
+    }
+    load->records[load->records_cnt++] = {begin, end, name, nullptr, 0, ERROR_NO};
+    return true;
+}
+
+static const char* skip_spaces(const char* curr, const char* end) {
+    while(curr < end && isspace((unsigned char)*curr)) curr++;
+    return curr;
+}
+
+static const char* read_quoted(const char* curr, const char* end, c_string_t* name) {
+    if(curr == end || *curr != '"') return nullptr;
+    const char* name_end = (const char*)memchr(curr + 1, '"', (size_t)(end - curr - 1));
+    if(!name_end) return nullptr;
+    *name = {curr + 1, (size_t)(name_end - curr - 1)};
+    return name_end + 1;
+}
+
+/* the buffer may be a mapping without a NUL at the end, so no strtoul */
+static const char* read_uint(const char* curr, const char* end, uint64_t* val) {
+    while(curr < end && (*curr == ' ' || *curr == '\t')) curr++;
+    if(curr == end || !isdigit((unsigned char)*curr)) return nullptr;
+    *val = 0;
+    for(; curr < end && isdigit((unsigned char)*curr); curr++) *val = *val * 10 + (uint64_t)(*curr - '0');
+    return curr;
+}
+
+static const char* read_tag(const char* curr, const char* end, const char* tag) {
+    size_t tag_len = strlen(tag);
+    if((size_t)(end - curr) < tag_len || memcmp(curr, tag, tag_len) != 0) return nullptr;
+    return curr + tag_len;
+}
+
+/* "#forest_format N", "#vars N" with the names; the vars go to the forest in file order */
+static error_code text_read_header(forest_t* forest, forest_load_t* load, const char** curr_ref, const char* end) {
+    uint64_t    version = 0;
+    const char* curr    = read_tag(*curr_ref, end, FOREST_TEXT_MAGIC);
+    if(curr) curr = read_uint(curr, end, &version);
+    if(!curr || version < 1 || version > (uint64_t)FOREST_FILE_VERSION) {
+        LOGGER_ERROR("forest_read_from_file: not a forest file or unsupported version %llu", (unsigned long long)version);
+        return ERROR_READ_FILE;
+    }
+    load->version = (uint32_t)version;
+
+    uint64_t vars_cnt = 0;
+    curr = read_tag(skip_spaces(curr, end), end, FOREST_VARS_TAG);
+    if(curr) curr = read_uint(curr, end, &vars_cnt);
+    if(!curr) return ERROR_READ_FILE;
+
+    error_code error = ERROR_NO;
+    for(uint64_t i = 0; i < vars_cnt && error == ERROR_NO; i++) {
+        c_string_t var_name = {};
+        curr = read_quoted(skip_spaces(curr, end), end, &var_name);
+        if(!curr) return ERROR_READ_FILE;
+        get_or_add_var_idx(var_name, 0, forest->var_stack, &error);
+    }
+    *curr_ref = curr;
+    return error;
+}
+
+/* one record per non-empty line, up to the index */
+static error_code text_split_records(forest_load_t* load, const char* curr, const char* end) {
+    while((curr = skip_spaces(curr, end)) < end && *curr != '#') {
+        const char* line_end = (const char*)memchr(curr, '\n', (size_t)(end - curr));
+        if(!line_end) line_end = end;
+        if(!records_push(load, curr, line_end, {nullptr, 0})) return ERROR_MEM_ALLOC;
+        curr = line_end;
+    }
+    return ERROR_NO;
+}
+
+/* "#index N", N lines "offset len "name"", then "#index_at offset" as the last line */
+static error_code text_read_index(forest_load_t* load, const char* begin, const char* end) {
+    const char* last_line = end;
+    while(last_line > begin && isspace((unsigned char)last_line[-1])) last_line--;
+    while(last_line > begin && last_line[-1] != '\n') last_line--;
+
+    uint64_t    index_offset = 0;
+    uint64_t    trees_cnt    = 0;
+    const char* curr         = read_tag(last_line, end, FOREST_INDEX_AT_TAG);
+    if(curr)                                         curr = read_uint(curr, end, &index_offset);
+    if(curr && index_offset < (uint64_t)(end - begin)) curr = read_tag(begin + index_offset, end, FOREST_INDEX_TAG);
+    else                                             curr = nullptr;
+    if(curr)                                         curr = read_uint(curr, end, &trees_cnt);
+    if(!curr) return ERROR_READ_FILE;
+
+    for(uint64_t i = 0; i < trees_cnt; i++) {
+        uint64_t   offset = 0;
+        uint64_t   len    = 0;
+        c_string_t name   = {};
+        curr = read_uint(skip_spaces(curr, end), end, &offset);
+        if(curr) curr = read_uint(curr, end, &len);
+        if(curr) curr = read_quoted(skip_spaces(curr, end), end, &name);
+        if(!curr || offset > index_offset || len > index_offset - offset) return ERROR_READ_FILE;
+        if(!records_push(load, begin + offset, begin + offset + len, name)) return ERROR_MEM_ALLOC;
+    }
+    return ERROR_NO;
+}
+
+static void text_parse_record(const forest_load_t* load, forest_record_t* record) {
+    const char* curr = read_quoted(record->begin, record->end, &record->name);
+    if(!curr) {
+        record->error |= ERROR_READ_FILE;
+        return;
+    }
+    record->root = tree_parse_nodes(&curr, record->end, load->var_stack, &record->nodes_cnt, &record->error);
+    if(record->error == ERROR_NO && skip_spaces(curr, record->end) != record->end) record->error |= ERROR_READ_FILE;
+}
+
+//--------------------------------------------------------------------------------
+
+static error_code bin_read_header(forest_t* forest, forest_load_t* load, bin_reader_t* reader, uint64_t* trees_cnt) {
+    char     magic[sizeof(FOREST_BIN_MAGIC)] = {};
+    uint32_t version   = 0;
+    uint32_t funcs_cnt = 0;
+    uint64_t vars_cnt  = 0;
+    if(!bin_read(reader, magic, sizeof(magic)) || memcmp(magic, FOREST_BIN_MAGIC, sizeof(magic)) != 0 ||
+       !bin_read(reader, &version, sizeof(version)) || !bin_read(reader, &funcs_cnt, sizeof(funcs_cnt)) ||
+       !bin_read(reader, &vars_cnt, sizeof(vars_cnt)) || !bin_read(reader, trees_cnt, sizeof(*trees_cnt))) {
+        return ERROR_READ_FILE;
+    }
+    if(version < 1 || version > (uint32_t)FOREST_FILE_VERSION) {
+        LOGGER_ERROR("forest_read_from_file: unsupported format version %u", version);
+        return ERROR_READ_FILE;
+    }
+    if(vars_cnt > (uint64_t)(reader->end - reader->curr) / sizeof(uint32_t)) return ERROR_READ_FILE;
+    load->version = version;
+
+    load->func_map = (ssize_t*)calloc(funcs_cnt ? funcs_cnt : 1, sizeof(ssize_t));
+    load->var_map  = (size_t*) calloc(vars_cnt  ? vars_cnt  : 1, sizeof(size_t));
+    if(!load->func_map || !load->var_map) return ERROR_MEM_ALLOC;
+    load->funcs_cnt = funcs_cnt;
+    load->vars_cnt  = vars_cnt;
+
+    /* a func this build does not know is an error only if a node uses it */
+    for(size_t i = 0; i < funcs_cnt; i++) {
+        uint8_t len = 0;
+        if(!bin_read(reader, &len, sizeof(len)) || (size_t)(reader->end - reader->curr) < len) return ERROR_READ_FILE;
+        func_type_t func = ADD;
+        load->func_map[i] = tree_func_by_name({reader->curr, len}, &func) ? (ssize_t)func : -1;
+        reader->curr += len;
+    }
+
+    error_code error = ERROR_NO;
+    for(size_t i = 0; i < vars_cnt && error == ERROR_NO; i++) {
+        uint32_t len = 0;
+        if(!bin_read(reader, &len, sizeof(len)) || (size_t)(reader->end - reader->curr) < len) return ERROR_READ_FILE;
+        load->var_map[i] = get_or_add_var_idx({reader->curr, len}, 0, forest->var_stack, &error);
+        reader->curr += len;
+    }
+    return error;
+}
+
+/* hops over the length prefixes; since version 2 only the index follows the records */
+static error_code bin_split_records(forest_load_t* load, bin_reader_t* reader, uint64_t trees_cnt) {
+    for(uint64_t i = 0; i < trees_cnt; i++) {
+        uint64_t record_len = 0;
+        if(!bin_read(reader, &record_len, sizeof(record_len)) ||
+           record_len > (uint64_t)(reader->end - reader->curr)) {
+            return ERROR_READ_FILE;
+        }
+        if(!records_push(load, reader->curr, reader->curr + record_len, {nullptr, 0})) return ERROR_MEM_ALLOC;
+        reader->curr += record_len;
+    }
+    if(load->version == 1) return reader->curr == reader->end ? (error_code)ERROR_NO : (error_code)ERROR_READ_FILE;
+
+    size_t footer_len = sizeof(uint64_t) + sizeof(FOREST_INDEX_MAGIC);
+    return (size_t)(reader->end - reader->curr) >= footer_len ? (error_code)ERROR_NO : (error_code)ERROR_READ_FILE;
+}
+
+static error_code bin_read_index(forest_load_t* load, const char* begin, const char* end, uint64_t trees_cnt) {
+    size_t       footer_len   = sizeof(uint64_t) + sizeof(FOREST_INDEX_MAGIC);
+    uint64_t     index_offset = 0;
+    bin_reader_t footer       = {end - footer_len, end};
+    if((size_t)(end - begin) < footer_len || !bin_read(&footer, &index_offset, sizeof(index_offset)) ||
+       memcmp(footer.curr, FOREST_INDEX_MAGIC, sizeof(FOREST_INDEX_MAGIC)) != 0 ||
+       index_offset > (uint64_t)(end - begin) - footer_len) {
+        return ERROR_READ_FILE;
+    }
+
+    bin_reader_t reader = {begin + index_offset, end - footer_len};
+    for(uint64_t i = 0; i < trees_cnt; i++) {
+        uint64_t offset   = 0;
+        uint64_t len      = 0;
+        uint32_t name_len = 0;
+        if(!bin_read(&reader, &offset, sizeof(offset)) || !bin_read(&reader, &len, sizeof(len)) ||
+           !bin_read(&reader, &name_len, sizeof(name_len)) || (size_t)(reader.end - reader.curr) < name_len ||
+           offset > index_offset || len > index_offset - offset) {
+            return ERROR_READ_FILE;
+        }
+        if(!records_push(load, begin + offset, begin + offset + len, {reader.curr, name_len})) return ERROR_MEM_ALLOC;
+        reader.curr += name_len;
+    }
+    return ERROR_NO;
+}
+
+static tree_node_t* bin_read_node_value(const forest_load_t* load, bin_reader_t* reader, uint8_t* children,
+                                        error_code* error) {
+    uint8_t type = 0;
+    if(!bin_read(reader, &type, sizeof(type)) || !bin_read(reader, children, sizeof(*children)) ||
+       *children > (BIN_HAS_LEFT | BIN_HAS_RIGHT)) {
+        *error |= ERROR_READ_FILE;
+        return nullptr;
+    }
+
+    value_t value = {};
+    if(type == CONSTANT) {
+        if(!bin_read(reader, &value.constant, sizeof(value.constant))) *error |= ERROR_READ_FILE;
+    } else if(type == VARIABLE) {
+        uint32_t var_idx = 0;
+        if(!bin_read(reader, &var_idx, sizeof(var_idx)) || var_idx >= load->vars_cnt) *error |= ERROR_INCORRECT_INDEX;
+        else value.var_idx = load->var_map[var_idx];
+    } else if(type == FUNCTION) {
+        uint8_t func = 0;
+        if(!bin_read(reader, &func, sizeof(func)) || func >= load->funcs_cnt || load->func_map[func] < 0) {
+            *error |= ERROR_UNKNOWN_FUNC;
+        } else {
+            value.func = (func_type_t)load->func_map[func];
+        }
+    } else {
+        *error |= ERROR_INVALID_STRUCTURE;
+    }
+    if(*error != ERROR_NO) return nullptr;
+
+    tree_node_t* node = init_node((node_type_t)type, value, nullptr, nullptr);
+    if(!node) *error |= ERROR_MEM_ALLOC;
+    return node;
+}
+
+/* the stack holds the child slots still to be read, the left one on top */
+static tree_node_t* bin_read_node(const forest_load_t* load, bin_reader_t* reader, size_t* nodes_cnt, error_code* error) {
+    tree_node_t**  local_stack[BIN_LOCAL_STACK] = {};
+    tree_node_t*** stack     = local_stack;
+    size_t         stack_cap = BIN_LOCAL_STACK;
+    size_t         stack_cnt = 0;
+    tree_node_t*   root      = nullptr;
+
+    stack[stack_cnt++] = &root;
+    while(stack_cnt > 0 && *error == ERROR_NO) {
+        tree_node_t** slot     = stack[--stack_cnt];
+        uint8_t       children = 0;
+        *slot = bin_read_node_value(load, reader, &children, error);
+        if(!*slot) break;
+        (*nodes_cnt)++;
+
+        if(stack_cnt + 2 > stack_cap && !walk_stack_grow((void**)&stack, &stack_cap, local_stack, sizeof(*stack))) {
+            *error |= ERROR_MEM_ALLOC;
+            break;
+        }
+        if(children & BIN_HAS_RIGHT) stack[stack_cnt++] = &(*slot)->right;
+        if(children & BIN_HAS_LEFT)  stack[stack_cnt++] = &(*slot)->left;
+    }
+
+    if(stack != local_stack) free(stack);
+    if(*error != ERROR_NO) {
+        destroy_node_recursive(root, nullptr);
+        return nullptr;
+    }
+    return root;
+}
+
+static void bin_parse_record(const forest_load_t* load, forest_record_t* record) {
+    bin_reader_t reader    = {record->begin, record->end};
+    uint32_t     name_len  = 0;
+    uint64_t     nodes_cnt = 0;
+    if(!bin_read(&reader, &name_len, sizeof(name_len)) || (size_t)(reader.end - reader.curr) < name_len) {
+        record->error |= ERROR_READ_FILE;
+        return;
+    }
+    record->name = {reader.curr, name_len};
+    reader.curr += name_len;
+    if(!bin_read(&reader, &nodes_cnt, sizeof(nodes_cnt))) {
+        record->error |= ERROR_READ_FILE;
+        return;
+    }
+
+    if(nodes_cnt > 0) record->root = bin_read_node(load, &reader, &record->nodes_cnt, &record->error);
+    if(record->error == ERROR_NO && (record->nodes_cnt != nodes_cnt || reader.curr != reader.end)) {
+        record->error |= ERROR_READ_FILE;
+    }
+}
+
+//--------------------------------------------------------------------------------
+
+static void parse_record(const forest_load_t* load, forest_record_t* record) {
+    if(load->is_binary) bin_parse_record (load, record);
+    else                text_parse_record(load, record);
+
+    if(record->error != ERROR_NO && record->root) {
+        destroy_node_recursive(record->root, nullptr);
+        record->root = nullptr;
+    }
+}
+
+static void parse_record_task(size_t task_idx, void* arg) {
+    forest_load_t* load = (forest_load_t*)arg;
+    parse_record(load, &load->records[task_idx]);
+}
+
+static error_code add_record_trees(forest_t* forest, forest_load_t* load) {
+    error_code error = ERROR_NO;
+    for(size_t i = 0; i < load->records_cnt; i++) {
+        if(load->records[i].error != ERROR_NO) {
+            LOGGER_ERROR("forest_read_from_file: record %zu is broken, error %ld", i, load->records[i].error);
+            error |= load->records[i].error;
+        }
+    }
+
+    for(size_t i = 0; i < load->records_cnt && error == ERROR_NO; i++) {
+        forest_record_t* record = &load->records[i];
+        tree_t*          tree   = forest_add_tree(forest, &error);
+        if(!tree) break;
+
+        tree->root   = record->root;
+        tree->size   = record->nodes_cnt;
+        tree->name   = record->name;
+        tree->buff   = load->is_binary ? c_string_t{nullptr, 0} : c_string_t{record->begin, (size_t)(record->end - record->begin)};
+        record->root = nullptr;
+    }
+
+    /* a broken record adds no trees at all; roots left here were not taken by a tree */
+    for(size_t i = 0; i < load->records_cnt; i++) destroy_node_recursive(load->records[i].root, nullptr);
+    return error;
+}
+
+static bool is_binary_file(const char* begin, size_t len) {
+    return len >= sizeof(FOREST_BIN_MAGIC) && memcmp(begin, FOREST_BIN_MAGIC, sizeof(FOREST_BIN_MAGIC)) == 0;
+}
+
+error_code forest_read_from_file(forest_t* forest, const char* filename, size_t threads_cnt) {
+    HARD_ASSERT(forest   != nullptr, "forest is nullptr");
+    HARD_ASSERT(filename != nullptr, "filename is nullptr");
+
+    LOGGER_DEBUG("forest_read_from_file: started, filename=%s", filename);
+
+    if(forest->file_buff || forest->lazy) {
+        LOGGER_ERROR("forest_read_from_file: the forest already holds a file");
+        return ERROR_INCORRECT_ARGS;
+    }
+
+    string_t   file_buff = {};
+    error_code error     = read_file_to_buffer_by_name(&file_buff, filename);
+    if(error != ERROR_NO) return error;
+    /* var names point into the buffer from the header on, even if the records are broken */
+    forest->file_buff = file_buff.ptr;
+
+    const char*   begin = file_buff.ptr;
+    const char*   end   = file_buff.ptr + file_buff.len;
+    forest_load_t load  = {};
+    load.var_stack      = forest->var_stack;
+    load.is_binary      = is_binary_file(begin, file_buff.len);
+
+    if(load.is_binary) {
+        bin_reader_t reader    = {begin, end};
+        uint64_t     trees_cnt = 0;
+        error = bin_read_header(forest, &load, &reader, &trees_cnt);
+        if(error == ERROR_NO) error = bin_split_records(&load, &reader, trees_cnt);
+    } else {
+        const char* curr = skip_spaces(begin, end);
+        error = text_read_header(forest, &load, &curr, end);
+        if(error == ERROR_NO) error = text_split_records(&load, curr, end);
+    }
+
+    if(error == ERROR_NO) error = parallel_for(load.records_cnt, threads_cnt, parse_record_task, &load);
+    if(error == ERROR_NO) error = add_record_trees(forest, &load);
+    else for(size_t i = 0; i < load.records_cnt; i++) destroy_node_recursive(load.records[i].root, nullptr);
+
+    if(error == ERROR_NO) LOGGER_DEBUG("forest_read_from_file: %zu trees from '%s'", load.records_cnt, filename);
+    else                  LOGGER_ERROR("forest_read_from_file: reading '%s' failed, error %ld", filename, error);
+
+    free(load.records);
+    free(load.var_map);
+    free(load.func_map);
+    return error;
+}
+
+//================================================================================
+
+static error_code lazy_map_file(forest_lazy_t* lazy, const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) {
+        LOGGER_ERROR("forest_open_lazy: failed to open file '%s'", filename);
+        errno = 0;
+        return ERROR_OPEN_FILE;
+    }
+
+    struct stat file_stat = {};
+    if(fstat(fd, &file_stat) != 0 || file_stat.st_size <= 0) {
+        LOGGER_ERROR("forest_open_lazy: '%s' is empty or can not be stat'ed", filename);
+        close(fd);
+        errno = 0;
+        return ERROR_READ_FILE;
+    }
+
+    void* map = mmap(nullptr, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        LOGGER_ERROR("forest_open_lazy: mmap of '%s' failed", filename);
+        errno = 0;
+        return ERROR_READ_FILE;
+    }
+    lazy->map     = map;
+    lazy->map_len = (size_t)file_stat.st_size;
+    return ERROR_NO;
+}
+
+/* O(vars + trees): the records are not touched, except for version 1 files that have no index */
+static error_code lazy_read_index(forest_t* forest, forest_lazy_t* lazy) {
+    forest_load_t* load  = &lazy->load;
+    const char*    begin = (const char*)lazy->map;
+    const char*    end   = begin + lazy->map_len;
+
+    error_code error = ERROR_NO;
+    if(load->is_binary) {
+        bin_reader_t reader    = {begin, end};
+        uint64_t     trees_cnt = 0;
+        error = bin_read_header(forest, load, &reader, &trees_cnt);
+        if(error != ERROR_NO) return error;
+        if(load->version == 1) return bin_split_records(load, &reader, trees_cnt);
+        return bin_read_index(load, begin, end, trees_cnt);
+    }
+
+    const char* curr = skip_spaces(begin, end);
+    error = text_read_header(forest, load, &curr, end);
+    if(error != ERROR_NO) return error;
+    if(load->version == 1) {
+        error = text_split_records(load, curr, end);
+        for(size_t i = 0; i < load->records_cnt && error == ERROR_NO; i++) {
+            if(!read_quoted(load->records[i].begin, load->records[i].end, &load->records[i].name)) error = ERROR_READ_FILE;
+        }
+        return error;
+    }
+    return text_read_index(load, begin, end);
+}
+
+error_code forest_open_lazy(forest_t* forest, const char* filename) {
+    HARD_ASSERT(forest   != nullptr, "forest is nullptr");
+    HARD_ASSERT(filename != nullptr, "filename is nullptr");
+
+    LOGGER_DEBUG("forest_open_lazy: started, filename=%s", filename);
+
+    if(forest->file_buff || forest->lazy) {
+        LOGGER_ERROR("forest_open_lazy: the forest already holds a file");
+        return ERROR_INCORRECT_ARGS;
+    }
+
+    forest_lazy_t* lazy = (forest_lazy_t*)calloc(1, sizeof(forest_lazy_t));
+    if(!lazy) return ERROR_MEM_ALLOC;
+    pthread_mutex_init(&lazy->lock, nullptr);
+    lazy->load.var_stack = forest->var_stack;
+
+    error_code error = lazy_map_file(lazy, filename);
+    if(error != ERROR_NO) {
+        forest_lazy_dest(lazy);
+        return error;
+    }
+    /* as with forest_read_from_file the var names point into the file from here on */
+    forest->lazy = lazy;
+
+    lazy->load.is_binary = is_binary_file((const char*)lazy->map, lazy->map_len);
+    error = lazy_read_index(forest, lazy);
+
+    for(size_t i = 0; i < lazy->load.records_cnt && error == ERROR_NO; i++) {
+        forest_record_t* record = &lazy->load.records[i];
+        tree_t*          tree   = forest_add_tree(forest, &error);
+        if(!tree) break;
+        tree->name    = record->name;
+        tree->buff    = {record->begin, (size_t)(record->end - record->begin)};
+        tree->is_stub = true;
+    }
+
+    if(error == ERROR_NO) LOGGER_DEBUG("forest_open_lazy: %zu stubs from '%s'", lazy->load.records_cnt, filename);
+    else                  LOGGER_ERROR("forest_open_lazy: opening '%s' failed, error %ld", filename, error);
+    return error;
+}
+
+error_code forest_load_tree(forest_t* forest, tree_t* tree) {
+    HARD_ASSERT(forest != nullptr, "forest is nullptr");
+    HARD_ASSERT(tree   != nullptr, "tree is nullptr");
+
+    if(!__atomic_load_n(&tree->is_stub, __ATOMIC_ACQUIRE)) return ERROR_NO;
+    HARD_ASSERT(forest->lazy != nullptr, "stub tree in a forest without a lazy file");
+
+    /* parsed outside the lock, so loads of different trees run in parallel; the loser of a race drops its copy */
+    forest_record_t record = {tree->buff.ptr, tree->buff.ptr + tree->buff.len, {nullptr, 0}, nullptr, 0, ERROR_NO};
+    parse_record(&forest->lazy->load, &record);
+    if(record.error != ERROR_NO) {
+        LOGGER_ERROR("forest_load_tree: record of '%.*s' is broken, error %ld", (int)tree->name.len, tree->name.ptr,
+                     record.error);
+        return record.error;
+    }
+
+    pthread_mutex_lock(&forest->lazy->lock);
+    if(tree->is_stub) {
+        tree->root = record.root;
+        tree->size = record.nodes_cnt;
+        record.root = nullptr;
+        __atomic_store_n(&tree->is_stub, false, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&forest->lazy->lock);
+
+    destroy_node_recursive(record.root, nullptr);
+    return ERROR_NO;
+}
+
+struct load_all_ctx_t {
+    forest_t*   forest;
+    tree_t**    trees;
+    error_code* errors;
+};
+
+static void load_tree_task(size_t task_idx, void* arg) {
+    load_all_ctx_t* ctx = (load_all_ctx_t*)arg;
+    ctx->errors[task_idx] = forest_load_tree(ctx->forest, ctx->trees[task_idx]);
+}
+
+error_code forest_load_all(forest_t* forest, size_t threads_cnt) {
+    HARD_ASSERT(forest != nullptr, "forest is nullptr");
+
+    size_t         trees_cnt = forest_trees_cnt(forest);
+    load_all_ctx_t ctx       = {forest, (tree_t**)calloc(trees_cnt + 1, sizeof(tree_t*)),
+                                (error_code*)calloc(trees_cnt + 1, sizeof(error_code))};
+    error_code     error     = ERROR_NO;
+    if(!ctx.trees || !ctx.errors) error = ERROR_MEM_ALLOC;
+
+    size_t stubs_cnt = 0;
+    for(ssize_t idx = forest->tree_list->arr[0].next; idx != 0 && error == ERROR_NO; idx = forest->tree_list->arr[idx].next) {
+        if(forest->tree_list->arr[idx].val->is_stub) ctx.trees[stubs_cnt++] = forest->tree_list->arr[idx].val;
+    }
+    if(error == ERROR_NO) error = parallel_for(stubs_cnt, threads_cnt, load_tree_task, &ctx);
+    for(size_t i = 0; i < stubs_cnt && ctx.errors; i++) error |= ctx.errors[i];
+
+    free(ctx.trees);
+    free(ctx.errors);
+    return error;
+}
+
+tree_t* forest_find_tree(forest_t* forest, c_string_t name, error_code* error) {
+    HARD_ASSERT(forest != nullptr, "forest is nullptr");
+    HARD_ASSERT(error  != nullptr, "error is nullptr");
+
+    for(ssize_t idx = forest->tree_list->arr[0].next; idx != 0; idx = forest->tree_list->arr[idx].next) {
+        tree_t* tree = forest->tree_list->arr[idx].val;
+        if(my_ssstrcmp(tree->name, name) != 0) continue;
+
+        error_code load_error = forest_load_tree(forest, tree);
+        *error |= load_error;
+        return load_error == ERROR_NO ? tree : nullptr;
+    }
+    return nullptr;
+}
+
+void forest_lazy_dest(forest_lazy_t* lazy) {
+    if(!lazy) return;
+
+    if(lazy->map) munmap(lazy->map, lazy->map_len);
+    pthread_mutex_destroy(&lazy->lock);
+    free(lazy->load.records);
+    free(lazy->load.var_map);
+    free(lazy->load.func_map);
+    free(lazy);
+}
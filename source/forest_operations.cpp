@@ -13,6 +13,7 @@
 #include "forest_info.h"
 #include "file_operations.h"
 #include "tex_io.h"
+#include "forest_file_io.h"
 
 //================================================================================
 
@@ -59,6 +60,13 @@ error_code forest_init(forest_t* forest ON_DEBUG(, ver_info_t ver_info)) {
     forest->var_stack = stack;
     forest->tree_list = list;
     forest->buff = {nullptr, 0};
+    forest->file_buff      = nullptr;
+    forest->lazy           = nullptr;
+    forest->metrics_file   = nullptr;
+    forest->metrics_format = METRICS_FORMAT_TABLE;
+    forest->node_budget    = {};
+    forest->diff_cache     = nullptr;
+    forest->threads_cnt    = 0;
 
     return error;
 }
@@ -83,9 +91,58 @@ error_code forest_dest(forest_t* forest) {
     forest->buff.ptr = nullptr;
     forest->buff.len = 0;
 
+    free(forest->file_buff);
+    forest->file_buff = nullptr;
+    forest_lazy_dest(forest->lazy);
+    forest->lazy = nullptr;
+
+    if(forest->metrics_file) {
+        error |= metrics_dump(forest->metrics_file, forest->metrics_format);
+        forest->metrics_file = nullptr;
+    }
+
     return error;
 }
 
+error_code forest_set_metrics_output(forest_t* forest, FILE* metrics_file, metrics_format_t format) {
+    HARD_ASSERT(forest != nullptr, "Forest is nullptr");
+
+    LOGGER_DEBUG("forest_set_metrics_output: started");
+
+    forest->metrics_file   = metrics_file;
+    forest->metrics_format = format;
+    return ERROR_NO;
+}
+
+error_code forest_set_node_budget(forest_t* forest, size_t max_nodes) {
+    HARD_ASSERT(forest != nullptr, "Forest is nullptr");
+
+    LOGGER_DEBUG("forest_set_node_budget: %zu nodes", max_nodes);
+
+    forest->node_budget.max_nodes   = max_nodes;
+    forest->node_budget.is_exceeded = false;
+    return ERROR_NO;
+}
+
+error_code forest_set_diff_cache(forest_t* forest, diff_cache_t* cache) {
+    HARD_ASSERT(forest != nullptr, "Forest is nullptr");
+
+    LOGGER_DEBUG("forest_set_diff_cache: %p", (void*)cache);
+
+    forest->diff_cache = cache;
+    return ERROR_NO;
+}
+
+/* a forest that already runs on a pool thread should pass 1 rather than oversubscribe the cpus */
+error_code forest_set_threads_cnt(forest_t* forest, size_t threads_cnt) {
+    HARD_ASSERT(forest != nullptr, "Forest is nullptr");
+
+    LOGGER_DEBUG("forest_set_threads_cnt: %zu", threads_cnt);
+
+    forest->threads_cnt = threads_cnt;
+    return ERROR_NO;
+}
+
 tree_t* forest_add_tree(forest_t* forest, error_code* error_ptr) {
     HARD_ASSERT(forest != nullptr, "Forest is nullptr");
     HARD_ASSERT(error_ptr != nullptr, "Error is nullptr");
@@ -134,7 +191,9 @@ error_code forest_delete_tree(forest_t* forest, tree_t* tree) {
 
     error_code error = ERROR_NO;
 
+    node_budget_t* prev_budget = node_budget_enter(&forest->node_budget);
     error |= tree_destroy(tree);
+    node_budget_leave(prev_budget);
     RETURN_IF_ERROR(error);
 
     error |= list_remove(forest->tree_list, tree->list_idx);
@@ -146,6 +205,25 @@ error_code forest_delete_tree(forest_t* forest, tree_t* tree) {
 
 }
 
+/* Deletes every tree but keeps the forest (and its vars) ready for reuse */
+error_code forest_clear_trees(forest_t* forest) {
+    HARD_ASSERT(forest            != nullptr, "Forest is nullptr");
+    HARD_ASSERT(forest->tree_list != nullptr, "Tree list is nullptr");
+
+    LOGGER_DEBUG("forest_clear_trees: started");
+
+    error_code error = ERROR_NO;
+    list_t* list = forest->tree_list;
+    while(list->arr[0].prev != 0) { /* arr[0] is the sentinel */
+        tree_t* tree = list->arr[list->arr[0].prev].val;
+        error |= forest_delete_tree(forest, tree);
+        RETURN_IF_ERROR(error);
+    }
+    /* nothing of this forest is alive any more, whoever allocated it */
+    forest->node_budget.live_nodes = 0;
+    return error;
+}
+
 tree_t* forest_include_tree(forest_t* forest, tree_t* tree, error_code* error_ptr) {
     HARD_ASSERT(forest    != nullptr, "Forest is nullptr");
     HARD_ASSERT(tree      != nullptr, "Tree is nullptr");
@@ -1,5 +1,8 @@
 #include <ctype.h>
 #include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #include "tree_info.h"
 #include "node_info.h"
@@ -7,6 +10,7 @@
 #include "input_parser.h"
 #include "logger.h"
 #include "my_string.h"
+#include "num_literal.h"
 //TODO: init_node_With_Dump
 //================================================================================
 
@@ -157,10 +161,12 @@ static bool parse_func_args(tree_t* tree, const char** str, size_t argc,
 
     if (argc >= 2) {
         if (!expect_char(str, ',')) {
+            destroy_node_recursive(first, nullptr);
             return false;
         }
         second = parse_single_argument(tree, str);
         if (!second) {
+            destroy_node_recursive(first, nullptr);
             return false;
         }
     }
@@ -188,9 +194,7 @@ tree_node_t* get_g(tree_t* tree, const char** str) {
     }
 
     skip_spaces(str);
-    if (!expect_char(str, '$')) {
-        return node;
-    }
+    if (**str == '$') ++*str; /* the terminator is optional: one-line jobs come without it */
     return node;
 }
 
@@ -213,7 +217,8 @@ static tree_node_t* get_expr(tree_t* tree, const char** str) {
         tree_node_t* right = get_term(tree, str); 
         if (!right) { 
             LOGGER_ERROR("get_expr: right operand is nullptr"); 
-            return left; 
+            destroy_node_recursive(left, nullptr);
+            return nullptr; 
         } 
 
         func_type_t func = (op == '+') ? ADD : SUB; 
@@ -246,7 +251,8 @@ static tree_node_t* get_term(tree_t* tree, const char** str) {
         tree_node_t* right = get_power(tree, str); 
         if (!right) { 
             LOGGER_ERROR("get_term: right operand is nullptr"); 
-            return left; 
+            destroy_node_recursive(left, nullptr);
+            return nullptr; 
         } 
 
         func_type_t func = (op == '*') ? MUL : DIV; 
@@ -278,7 +284,8 @@ static tree_node_t* get_power(tree_t* tree, const char** str) {
         tree_node_t* right = get_power(tree, str);
         if (!right) {
             LOGGER_ERROR("get_power: right operand is nullptr");
-            return left;
+            destroy_node_recursive(left, nullptr);
+            return nullptr;
         }
 
         func_type_t func = POW;
@@ -294,25 +301,20 @@ static tree_node_t* get_power(tree_t* tree, const char** str) {
     return left;
 }
 
-// NUM -> [0-9]+
+// NUM -> [0-9]+ [ '.' [0-9]* ] [ ('e' | 'E') ['+' | '-'] [0-9]+ ]
 static tree_node_t* get_num(const char** str) { 
     HARD_ASSERT(str  != nullptr, "str ptr is nullptr");
     HARD_ASSERT(*str != nullptr, "String is nullptr");
 
     skip_spaces(str);
 
-    const char* old_s = *str; 
-    int val = 0; 
-
-    while ('0' <= **str && **str <= '9') { 
-        val = val * 10 + (**str - '0');
-        ++*str;
-    }
-
-    if (*str == old_s) { 
+    const_val_type val = 0;
+    size_t num_len = num_literal_scan(*str, SIZE_MAX, &val);
+    if (num_len == 0) { 
         LOGGER_ERROR("expected digit, but got '%c'", **str); 
         return nullptr; 
     } 
+    *str += num_len;
 
     return init_node(CONSTANT, make_union_const(val), nullptr, nullptr); 
 }
@@ -333,7 +335,8 @@ static tree_node_t* get_primary(tree_t* tree, const char** str) {
 
         skip_spaces(str);
         if (!expect_char(str, ')')) {
-            return node;
+            destroy_node_recursive(node, nullptr);
+            return nullptr;
         }
         return node;
     }
@@ -409,7 +412,9 @@ static tree_node_t* get_func(tree_t* tree, const char** str) {
     skip_spaces(str);
     if (!expect_char(str, ')')) {
         LOGGER_ERROR("get_func: expected ')' after arguments");
-        return left;
+        destroy_node_recursive(left,  nullptr);
+        destroy_node_recursive(right, nullptr);
+        return nullptr;
     }
 
     tree_node_t* node = nullptr;
@@ -429,4 +434,385 @@ static tree_node_t* get_func(tree_t* tree, const char** str) {
 
     return node;
 }
-//Переменная и фнукция не могут иметь одинаковое название
\ No newline at end of file
+//Переменная и фнукция не могут иметь одинаковое название
+
+//================================================================================
+// Streaming parser
+
+static const size_t EXPR_STREAM_MIN_CAP    = 16;
+static const size_t EXPR_STREAM_NAME_BLOCK = 4096;
+
+/* var names outlive the streams that read them: they sit in the var_stack.
+   Each distinct name is copied once per process, so a long-running service keeps at most
+   one copy of every name it has seen rather than one per job */
+struct interned_block_t {
+    interned_block_t* next;
+    size_t            used;
+    size_t            cap;
+    char              data[1];
+};
+
+struct interned_name_t {
+    const char* ptr; /* nullptr marks a free slot */
+    size_t      len;
+    uint64_t    hash;
+};
+
+static const size_t INTERNED_MIN_NAMES = 64;
+
+static pthread_mutex_t   interned_lock      = PTHREAD_MUTEX_INITIALIZER;
+static interned_block_t* interned_blocks    = nullptr;
+static interned_name_t*  interned_names     = nullptr; /* open addressing, kept under half full */
+static size_t            interned_names_cap = 0;
+static size_t            interned_names_cnt = 0;
+
+static void interned_free_all() {
+    while (interned_blocks) {
+        interned_block_t* next = interned_blocks->next;
+        free(interned_blocks);
+        interned_blocks = next;
+    }
+    free(interned_names);
+    interned_names     = nullptr;
+    interned_names_cap = 0;
+    interned_names_cnt = 0;
+}
+
+static interned_name_t* interned_find(const char* name, size_t len, uint64_t hash) {
+    size_t mask = interned_names_cap - 1;
+    for (size_t i = (size_t)hash & mask; ; i = (i + 1) & mask) {
+        interned_name_t* slot = &interned_names[i];
+        if (!slot->ptr) return slot;
+        if (slot->hash == hash && slot->len == len && memcmp(slot->ptr, name, len) == 0) return slot;
+    }
+}
+
+static bool interned_names_reserve() {
+    if (2 * (interned_names_cnt + 1) < interned_names_cap) return true;
+
+    size_t new_cap = interned_names_cap ? interned_names_cap * 2 : INTERNED_MIN_NAMES;
+    interned_name_t* new_names = (interned_name_t*)calloc(new_cap, sizeof(interned_name_t));
+    if (!new_names) return false;
+
+    interned_name_t* old_names = interned_names;
+    size_t           old_cap   = interned_names_cap;
+    interned_names     = new_names;
+    interned_names_cap = new_cap;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old_names[i].ptr) *interned_find(old_names[i].ptr, old_names[i].len, old_names[i].hash) = old_names[i];
+    }
+    free(old_names);
+    return true;
+}
+
+static const char* intern_name(const char* name, size_t len) {
+    pthread_mutex_lock(&interned_lock);
+    static bool is_at_exit_set = false;
+    if (!is_at_exit_set) is_at_exit_set = atexit(interned_free_all) == 0;
+
+    uint64_t hash = hash_bytes(name, len);
+    if (!interned_names_reserve()) {
+        pthread_mutex_unlock(&interned_lock);
+        return nullptr;
+    }
+    interned_name_t* slot = interned_find(name, len, hash);
+    if (slot->ptr) {
+        pthread_mutex_unlock(&interned_lock);
+        return slot->ptr;
+    }
+
+    if (!interned_blocks || interned_blocks->cap - interned_blocks->used < len) {
+        size_t cap = len > EXPR_STREAM_NAME_BLOCK ? len : EXPR_STREAM_NAME_BLOCK;
+        interned_block_t* block = (interned_block_t*)calloc(1, sizeof(interned_block_t) + cap);
+        if (!block) {
+            pthread_mutex_unlock(&interned_lock);
+            return nullptr;
+        }
+        block->cap      = cap;
+        block->next     = interned_blocks;
+        interned_blocks = block;
+    }
+    char* copy = interned_blocks->data + interned_blocks->used;
+    memcpy(copy, name, len);
+    interned_blocks->used += len;
+    *slot = {copy, len, hash};
+    interned_names_cnt++;
+    pthread_mutex_unlock(&interned_lock);
+    return copy;
+}
+
+//--------------------------------------------------------------------------------
+
+static bool stream_reserve(void** arr, size_t* cap, size_t need, size_t elem_size) {
+    if (need <= *cap) return true;
+    size_t new_cap = *cap ? *cap : EXPR_STREAM_MIN_CAP;
+    while (new_cap < need) new_cap *= 2;
+    void* new_arr = realloc(*arr, new_cap * elem_size);
+    if (!new_arr) return false;
+    *arr = new_arr;
+    *cap = new_cap;
+    return true;
+}
+
+static bool stream_fail(expr_stream_t* stream, error_code error, const char* what) {
+    LOGGER_ERROR("expr_stream: %s at byte %zu", what, stream->pos);
+    stream->error |= error;
+    return false;
+}
+
+static bool stream_push_operand(expr_stream_t* stream, tree_node_t* node) {
+    if (!node) return stream_fail(stream, ERROR_MEM_ALLOC, "init_node failed");
+    if (!stream_reserve((void**)&stream->operands, &stream->operands_cap,
+                        stream->operands_cnt + 1, sizeof(tree_node_t*))) {
+        destroy_node_recursive(node, nullptr);
+        return stream_fail(stream, ERROR_MEM_ALLOC, "operand stack is full");
+    }
+    stream->operands[stream->operands_cnt++] = node;
+    stream->is_operand_expected = false;
+    return true;
+}
+
+static bool stream_push_op(expr_stream_t* stream, expr_stream_op_t op) {
+    if (!stream_reserve((void**)&stream->ops, &stream->ops_cap,
+                        stream->ops_cnt + 1, sizeof(expr_stream_op_t))) {
+        return stream_fail(stream, ERROR_MEM_ALLOC, "operator stack is full");
+    }
+    stream->ops[stream->ops_cnt++] = op;
+    stream->is_operand_expected = true;
+    return true;
+}
+
+/* folds the last argc operands into a node of func */
+static bool stream_apply(expr_stream_t* stream, func_type_t func, size_t argc) {
+    HARD_ASSERT(stream->operands_cnt >= argc, "operand stack underflow");
+
+    tree_node_t* right = argc == 2 ? stream->operands[--stream->operands_cnt] : nullptr;
+    tree_node_t* left  = stream->operands[--stream->operands_cnt];
+    tree_node_t* node  = init_node(FUNCTION, make_union_func(func), left, right);
+    if (!node) {
+        destroy_node_recursive(left,  nullptr);
+        destroy_node_recursive(right, nullptr);
+    }
+    return stream_push_operand(stream, node);
+}
+
+static int binary_priority(func_type_t func) {
+    if (func == ADD || func == SUB) return 1;
+    if (func == MUL || func == DIV) return 2;
+    if (func == POW)                return 3;
+    return 0;
+}
+
+/* pops binary operators down to priority min_priority; '^' is right associative */
+static bool stream_reduce(expr_stream_t* stream, int min_priority, bool is_right_assoc) {
+    while (stream->ops_cnt > 0 && stream->ops[stream->ops_cnt - 1].kind == EXPR_STREAM_BINARY) {
+        int top_priority = binary_priority(stream->ops[stream->ops_cnt - 1].func);
+        if (top_priority < min_priority || (top_priority == min_priority && is_right_assoc)) break;
+        stream->ops_cnt--;
+        if (!stream_apply(stream, stream->ops[stream->ops_cnt].func, 2)) return false;
+    }
+    return true;
+}
+
+static bool stream_end_token(expr_stream_t* stream) {
+    expr_stream_token_t kind = stream->token_kind;
+    stream->token_kind = EXPR_STREAM_NONE;
+
+    if (kind == EXPR_STREAM_NUM) {
+        const_val_type val = 0;
+        if (num_literal_scan(stream->token, stream->token_len, &val) != stream->token_len) {
+            return stream_fail(stream, ERROR_INCORRECT_ARGS, "invalid number");
+        }
+        return stream_push_operand(stream, init_node(CONSTANT, make_union_const(val), nullptr, nullptr));
+    }
+    if (kind != EXPR_STREAM_NAME) return true;
+
+    c_string_t  name = {stream->token, stream->token_len};
+    func_type_t func = (func_type_t)0;
+    size_t      argc = 0;
+    if (get_func_info_by_name(name, &func, &argc)) {
+        stream->is_func_pending = true;
+        stream->pending_func    = func;
+        stream->pending_argc    = argc;
+        return true;
+    }
+
+    stack_t* var_stack = stream->tree->var_stack;
+    ssize_t  var_idx   = get_var_idx(name, var_stack);
+    if (var_idx < 0) {
+        const char* interned = intern_name(name.ptr, name.len);
+        if (!interned) return stream_fail(stream, ERROR_MEM_ALLOC, "no memory for var name");
+        error_code error = ERROR_NO;
+        var_idx = (ssize_t)add_var({interned, name.len}, 0, var_stack, &error);
+        if (error != ERROR_NO) return stream_fail(stream, error, "add_var failed");
+    }
+    return stream_push_operand(stream, init_node(VARIABLE, make_union_var((size_t)var_idx), nullptr, nullptr));
+}
+
+static bool stream_token_append(expr_stream_t* stream, char c) {
+    if (!stream_reserve((void**)&stream->token, &stream->token_cap, stream->token_len + 1, sizeof(char))) {
+        return stream_fail(stream, ERROR_MEM_ALLOC, "token buffer is full");
+    }
+    stream->token[stream->token_len++] = c;
+    return true;
+}
+
+static bool stream_token_start(expr_stream_t* stream, expr_stream_token_t kind, char c) {
+    stream->token_kind = kind;
+    stream->token_len  = 0;
+    return stream_token_append(stream, c);
+}
+
+static bool stream_close_paren(expr_stream_t* stream) {
+    if (!stream_reduce(stream, 1, false)) return false;
+    if (stream->ops_cnt == 0) return stream_fail(stream, ERROR_INCORRECT_ARGS, "unmatched ')'");
+
+    expr_stream_op_t op = stream->ops[--stream->ops_cnt];
+    if (op.kind == EXPR_STREAM_PAREN) return true;
+    if (op.args_cnt + 1 != op.argc)   return stream_fail(stream, ERROR_INCORRECT_ARGS, "wrong number of func args");
+    return stream_apply(stream, op.func, op.argc);
+}
+
+static bool stream_comma(expr_stream_t* stream) {
+    if (!stream_reduce(stream, 1, false)) return false;
+
+    expr_stream_op_t* op = stream->ops_cnt ? &stream->ops[stream->ops_cnt - 1] : nullptr;
+    if (!op || op->kind != EXPR_STREAM_FUNC || op->args_cnt + 1 >= op->argc) {
+        return stream_fail(stream, ERROR_INCORRECT_ARGS, "unexpected ','");
+    }
+    op->args_cnt++;
+    stream->is_operand_expected = true;
+    return true;
+}
+
+/* the literal is checked whole by num_literal_scan once it ends */
+static bool is_num_char(const expr_stream_t* stream, char c) {
+    if (isdigit((unsigned char)c) || c == '.' || c == 'e' || c == 'E') return true;
+    char prev = stream->token[stream->token_len - 1];
+    return (c == '+' || c == '-') && (prev == 'e' || prev == 'E');
+}
+
+static bool stream_feed_char(expr_stream_t* stream, char c) {
+    unsigned char uc = (unsigned char)c;
+    if (stream->token_kind == EXPR_STREAM_NUM  && is_num_char(stream, c)) return stream_token_append(stream, c);
+    if (stream->token_kind == EXPR_STREAM_NAME && isalpha(uc)) return stream_token_append(stream, c);
+    if (stream->token_kind != EXPR_STREAM_NONE && !stream_end_token(stream)) return false;
+
+    if (isspace(uc)) return true;
+
+    if (stream->is_func_pending) {
+        if (c != '(') return stream_fail(stream, ERROR_INCORRECT_ARGS, "expected '(' after func name");
+        stream->is_func_pending = false;
+        return stream_push_op(stream, {EXPR_STREAM_FUNC, stream->pending_func, stream->pending_argc, 0});
+    }
+
+    if (stream->is_operand_expected) {
+        if (isdigit(uc)) return stream_token_start(stream, EXPR_STREAM_NUM,  c);
+        if (isalpha(uc)) return stream_token_start(stream, EXPR_STREAM_NAME, c);
+        if (c == '(')    return stream_push_op(stream, {EXPR_STREAM_PAREN, (func_type_t)0, 0, 0});
+        return stream_fail(stream, ERROR_INCORRECT_ARGS, "expected operand");
+    }
+
+    func_type_t func = (func_type_t)0;
+    switch (c) {
+        case '+': func = ADD; break;
+        case '-': func = SUB; break;
+        case '*': func = MUL; break;
+        case '/': func = DIV; break;
+        case '^': func = POW; break;
+        case ')': return stream_close_paren(stream);
+        case ',': return stream_comma(stream);
+        case '$':
+            stream->is_done = true;
+            return true;
+        default:
+            return stream_fail(stream, ERROR_INCORRECT_ARGS, "expected operator");
+    }
+
+    if (!stream_reduce(stream, binary_priority(func), func == POW)) return false;
+    return stream_push_op(stream, {EXPR_STREAM_BINARY, func, 0, 0});
+}
+
+//--------------------------------------------------------------------------------
+
+error_code expr_stream_init(expr_stream_t* stream, tree_t* tree) {
+    HARD_ASSERT(stream != nullptr, "stream is nullptr");
+    HARD_ASSERT(tree   != nullptr, "tree is nullptr");
+
+    *stream = {};
+    stream->tree                = tree;
+    stream->is_operand_expected = true;
+    return ERROR_NO;
+}
+
+error_code expr_stream_feed(expr_stream_t* stream, const char* chunk, size_t len) {
+    HARD_ASSERT(stream != nullptr,            "stream is nullptr");
+    HARD_ASSERT(chunk  != nullptr || len == 0, "chunk is nullptr");
+
+    for (size_t i = 0; i < len && stream->error == ERROR_NO && !stream->is_done; i++, stream->pos++) {
+        stream_feed_char(stream, chunk[i]);
+    }
+    return stream->error;
+}
+
+tree_node_t* expr_stream_finish(expr_stream_t* stream, error_code* error) {
+    HARD_ASSERT(stream != nullptr, "stream is nullptr");
+    HARD_ASSERT(error  != nullptr, "error is nullptr");
+
+    if (stream->error == ERROR_NO && stream_end_token(stream)) {
+        if      (stream->is_func_pending)     stream_fail(stream, ERROR_INCORRECT_ARGS, "expected '(' after func name");
+        else if (stream->is_operand_expected) stream_fail(stream, ERROR_INCORRECT_ARGS, "unexpected end of expression");
+        else if (stream_reduce(stream, 1, false) && stream->ops_cnt > 0) {
+            stream_fail(stream, ERROR_INCORRECT_ARGS, "unclosed '('");
+        }
+    }
+
+    if (stream->error != ERROR_NO) {
+        *error |= stream->error;
+        return nullptr;
+    }
+    HARD_ASSERT(stream->operands_cnt == 1, "operands left after reduce");
+    stream->operands_cnt = 0;
+    return stream->operands[0];
+}
+
+error_code expr_stream_dest(expr_stream_t* stream) {
+    HARD_ASSERT(stream != nullptr, "stream is nullptr");
+
+    error_code error = ERROR_NO;
+    for (size_t i = 0; i < stream->operands_cnt; i++) error |= destroy_node_recursive(stream->operands[i], nullptr);
+    free(stream->operands);
+    free(stream->ops);
+    free(stream->token);
+    *stream = {};
+    return error;
+}
+
+tree_node_t* get_g_from_file(tree_t* tree, FILE* in, error_code* error) {
+    HARD_ASSERT(tree  != nullptr, "tree is nullptr");
+    HARD_ASSERT(in    != nullptr, "in is nullptr");
+    HARD_ASSERT(error != nullptr, "error is nullptr");
+
+    char* chunk = (char*)calloc(EXPR_STREAM_CHUNK_SIZE, sizeof(char));
+    if (!chunk) {
+        *error |= ERROR_MEM_ALLOC;
+        return nullptr;
+    }
+
+    expr_stream_t stream = {};
+    expr_stream_init(&stream, tree);
+
+    size_t read_cnt = 0;
+    while ((read_cnt = fread(chunk, 1, EXPR_STREAM_CHUNK_SIZE, in)) > 0) {
+        if (expr_stream_feed(&stream, chunk, read_cnt) != ERROR_NO || stream.is_done) break;
+    }
+    if (ferror(in)) {
+        LOGGER_ERROR("get_g_from_file: read failed");
+        stream.error |= ERROR_READ_FILE;
+    }
+
+    tree_node_t* root = expr_stream_finish(&stream, error);
+    expr_stream_dest(&stream);
+    free(chunk);
+    return root;
+}
@@ -0,0 +1,342 @@
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+
+#include "asserts.h"
+#include "logger.h"
+#include "interval.h"
+#include "metrics.h"
+
+/* past it sin/tan can't resolve their period, so the whole range is returned */
+static const double INTERVAL_TRIG_MAX_ARG = 1e15;
+static const double INTERVAL_TRIG_SLACK   = 1e-12;
+
+//================================================================================
+
+static bool is_zero(double val) {
+    return !(val < 0) && !(val > 0);
+}
+
+static bool is_integer(double val) {
+    double rounded = nearbyint(val);
+    return !(val < rounded) && !(val > rounded);
+}
+
+static double round_down(double val) {
+    return isfinite(val) ? nextafter(val, -INFINITY) : val;
+}
+
+static double round_up(double val) {
+    return isfinite(val) ? nextafter(val, INFINITY) : val;
+}
+
+interval_t interval_make(double lo, double hi) {
+    return {lo, hi, false, !isfinite(lo) || !isfinite(hi)};
+}
+
+interval_t interval_empty() {
+    return {INFINITY, -INFINITY, true, true};
+}
+
+bool interval_is_void(interval_t a) {
+    return a.is_empty || (isinf(a.lo) && a.lo > 0) || (isinf(a.hi) && a.hi < 0);
+}
+
+interval_t interval_union(interval_t a, interval_t b) {
+    if(a.is_empty) return b;
+    if(b.is_empty) return a;
+    return {fmin(a.lo, b.lo), fmax(a.hi, b.hi), false, a.is_partial || b.is_partial};
+}
+
+/* libm results are off by up to an ulp, so every computed bound is pushed outwards */
+static interval_t interval_finish(double lo, double hi, bool is_partial) {
+    if(isnan(lo)) lo = -INFINITY;
+    if(isnan(hi)) hi =  INFINITY;
+    if(lo > hi) return interval_empty();
+
+    interval_t res = interval_make(round_down(lo), round_up(hi));
+    res.is_partial |= is_partial;
+    return res;
+}
+
+static double min4(double a, double b, double c, double d) { return fmin(fmin(a, b), fmin(c, d)); }
+static double max4(double a, double b, double c, double d) { return fmax(fmax(a, b), fmax(c, d)); }
+
+/* 0 * inf is taken as 0: the other factor is finite wherever the zero is reached */
+static double mul_bound(double a, double b) {
+    return (is_zero(a) || is_zero(b)) ? 0 : a * b;
+}
+
+/* does [lo, hi] reach phase + k * period for some integer k */
+static bool contains_phase(double lo, double hi, double phase, double period) {
+    double slack = INTERVAL_TRIG_SLACK * (1 + fmax(fabs(lo), fabs(hi)));
+    double k     = ceil((lo - slack - phase) / period);
+    return phase + k * period <= hi + slack;
+}
+
+static bool is_trig_wide(interval_t a, double period) {
+    return !(a.hi - a.lo < period) || fmax(fabs(a.lo), fabs(a.hi)) > INTERVAL_TRIG_MAX_ARG;
+}
+
+//================================================================================
+
+static interval_t ADD_interval(interval_t a, interval_t b) {
+    return interval_finish(a.lo + b.lo, a.hi + b.hi, a.is_partial || b.is_partial);
+}
+
+static interval_t SUB_interval(interval_t a, interval_t b) {
+    return interval_finish(a.lo - b.hi, a.hi - b.lo, a.is_partial || b.is_partial);
+}
+
+static interval_t MUL_interval(interval_t a, interval_t b) {
+    double c1 = mul_bound(a.lo, b.lo), c2 = mul_bound(a.lo, b.hi);
+    double c3 = mul_bound(a.hi, b.lo), c4 = mul_bound(a.hi, b.hi);
+    return interval_finish(min4(c1, c2, c3, c4), max4(c1, c2, c3, c4), a.is_partial || b.is_partial);
+}
+
+static interval_t reciprocal(interval_t a) {
+    if(a.lo > 0 || a.hi < 0)            return interval_finish(1 / a.hi, 1 / a.lo, a.is_partial);
+    if(is_zero(a.lo) && is_zero(a.hi)) return interval_finish(-INFINITY, INFINITY, true);
+    if(is_zero(a.lo))                   return interval_finish(1 / a.hi, INFINITY, true);
+    if(is_zero(a.hi))                   return interval_finish(-INFINITY, 1 / a.lo, true);
+    return interval_finish(-INFINITY, INFINITY, true);
+}
+
+static interval_t DIV_interval(interval_t a, interval_t b) {
+    interval_t res = MUL_interval(a, reciprocal(b));
+    res.is_partial |= b.lo <= 0 && b.hi >= 0;
+    return res;
+}
+
+//--------------------------------------------------------------------------------
+
+/* pow over a positive base is monotone in each argument, so the corners bound it */
+static interval_t pow_corners(double base_lo, double base_hi, double exp_lo, double exp_hi, bool is_partial) {
+    double c1 = pow(base_lo, exp_lo), c2 = pow(base_lo, exp_hi);
+    double c3 = pow(base_hi, exp_lo), c4 = pow(base_hi, exp_hi);
+    return interval_finish(min4(c1, c2, c3, c4), max4(c1, c2, c3, c4), is_partial);
+}
+
+static interval_t pow_integer(interval_t a, double power) {
+    if(power < 0) return DIV_interval(interval_make(1, 1), pow_integer(a, -power));
+    if(is_zero(power)) return interval_finish(1, 1, a.is_partial);
+
+    double pow_lo = pow(a.lo, power);
+    double pow_hi = pow(a.hi, power);
+    if(!is_integer(power / 2) || a.lo >= 0) return interval_finish(pow_lo, pow_hi, a.is_partial);
+    if(a.hi <= 0)                           return interval_finish(pow_hi, pow_lo, a.is_partial);
+    return interval_finish(0, fmax(pow_lo, pow_hi), a.is_partial);
+}
+
+static interval_t POW_interval(interval_t a, interval_t b) {
+    if(!(b.lo < b.hi) && is_integer(b.lo)) return pow_integer(a, b.lo);
+
+    bool       is_partial = a.is_partial || b.is_partial;
+    interval_t res        = interval_empty();
+    if(a.hi >= 0) res = pow_corners(fmax(a.lo, 0), a.hi, b.lo, b.hi, is_partial);
+
+    if(a.lo < 0) {
+        /* a negative base only gives a number at integer powers, of either sign */
+        double power_lo = ceil(b.lo);
+        double power_hi = floor(b.hi);
+        if(power_lo <= power_hi) {
+            interval_t mag = pow_corners((a.hi < 0) ? -a.hi : 0, -a.lo, power_lo, power_hi, is_partial);
+            res = interval_union(res, interval_finish(-mag.hi, mag.hi, is_partial));
+        }
+        res.is_partial = true;
+    }
+    return res;
+}
+
+static interval_t LN_interval(interval_t a, interval_t) {
+    if(a.hi < 0) return interval_empty();
+    return interval_finish((a.lo > 0) ? log(a.lo) : -INFINITY, log(a.hi), a.is_partial || a.lo <= 0);
+}
+
+static interval_t LOG_interval(interval_t a, interval_t b) {
+    interval_t ln_base = LN_interval(a, a);
+    interval_t ln_arg  = LN_interval(b, b);
+    if(ln_base.is_empty || ln_arg.is_empty) return interval_empty();
+    return DIV_interval(ln_arg, ln_base);
+}
+
+static interval_t EXP_interval(interval_t a, interval_t) {
+    return interval_finish(exp(a.lo), exp(a.hi), a.is_partial);
+}
+
+//--------------------------------------------------------------------------------
+
+static interval_t SIN_interval(interval_t a, interval_t) {
+    if(is_trig_wide(a, 2 * M_PI)) return interval_finish(-1, 1, a.is_partial);
+
+    double sin_lo = sin(a.lo);
+    double sin_hi = sin(a.hi);
+    return interval_finish(contains_phase(a.lo, a.hi, -M_PI_2, 2 * M_PI) ? -1 : fmin(sin_lo, sin_hi),
+                           contains_phase(a.lo, a.hi,  M_PI_2, 2 * M_PI) ?  1 : fmax(sin_lo, sin_hi),
+                           a.is_partial);
+}
+
+static interval_t COS_interval(interval_t a, interval_t) {
+    if(is_trig_wide(a, 2 * M_PI)) return interval_finish(-1, 1, a.is_partial);
+
+    double cos_lo = cos(a.lo);
+    double cos_hi = cos(a.hi);
+    return interval_finish(contains_phase(a.lo, a.hi, M_PI, 2 * M_PI) ? -1 : fmin(cos_lo, cos_hi),
+                           contains_phase(a.lo, a.hi, 0,    2 * M_PI) ?  1 : fmax(cos_lo, cos_hi),
+                           a.is_partial);
+}
+
+static interval_t TAN_interval(interval_t a, interval_t) {
+    if(is_trig_wide(a, M_PI) || contains_phase(a.lo, a.hi, M_PI_2, M_PI)) {
+        return interval_finish(-INFINITY, INFINITY, true);
+    }
+    return interval_finish(tan(a.lo), tan(a.hi), a.is_partial);
+}
+
+static interval_t CTAN_interval(interval_t a, interval_t) {
+    if(is_trig_wide(a, M_PI) || contains_phase(a.lo, a.hi, 0, M_PI)) {
+        return interval_finish(-INFINITY, INFINITY, true);
+    }
+    return interval_finish(1.0 / tan(a.hi), 1.0 / tan(a.lo), a.is_partial);
+}
+
+//--------------------------------------------------------------------------------
+
+static interval_t ARCSIN_interval(interval_t a, interval_t) {
+    if(a.lo > 1 || a.hi < -1) return interval_empty();
+    return interval_finish(asin(fmax(a.lo, -1)), asin(fmin(a.hi, 1)), a.is_partial || a.lo < -1 || a.hi > 1);
+}
+
+static interval_t ARCCOS_interval(interval_t a, interval_t) {
+    if(a.lo > 1 || a.hi < -1) return interval_empty();
+    return interval_finish(acos(fmin(a.hi, 1)), acos(fmax(a.lo, -1)), a.is_partial || a.lo < -1 || a.hi > 1);
+}
+
+static interval_t ARCTAN_interval(interval_t a, interval_t) {
+    return interval_finish(atan(a.lo), atan(a.hi), a.is_partial);
+}
+
+static interval_t ARCCTAN_interval(interval_t a, interval_t) {
+    return interval_finish(M_PI_2 - atan(a.hi), M_PI_2 - atan(a.lo), a.is_partial);
+}
+
+//--------------------------------------------------------------------------------
+
+static interval_t CH_interval(interval_t a, interval_t) {
+    if(a.lo >= 0) return interval_finish(cosh(a.lo), cosh(a.hi), a.is_partial);
+    if(a.hi <= 0) return interval_finish(cosh(a.hi), cosh(a.lo), a.is_partial);
+    return interval_finish(1, cosh(fmax(-a.lo, a.hi)), a.is_partial);
+}
+
+static interval_t SH_interval(interval_t a, interval_t) {
+    return interval_finish(sinh(a.lo), sinh(a.hi), a.is_partial);
+}
+
+static interval_t ARCSH_interval(interval_t a, interval_t) {
+    return interval_finish(asinh(a.lo), asinh(a.hi), a.is_partial);
+}
+
+static interval_t ARCCH_interval(interval_t a, interval_t) {
+    if(a.hi < 1) return interval_empty();
+    return interval_finish(acosh(fmax(a.lo, 1)), acosh(a.hi), a.is_partial || a.lo < 1);
+}
+
+//================================================================================
+
+error_code interval_bindings_init(interval_bindings_t* bindings, const stack_t* var_stack) {
+    HARD_ASSERT(bindings  != nullptr, "bindings is nullptr");
+    HARD_ASSERT(var_stack != nullptr, "var_stack is nullptr");
+
+    bindings->vals = nullptr;
+    bindings->size = var_stack->size;
+    if(bindings->size == 0) return ERROR_NO;
+
+    bindings->vals = (interval_t*)calloc(bindings->size, sizeof(interval_t));
+    if(!bindings->vals) {
+        LOGGER_ERROR("interval_bindings_init: calloc failed");
+        bindings->size = 0;
+        return ERROR_MEM_ALLOC;
+    }
+
+    for(size_t i = 0; i < bindings->size; i++) {
+        bindings->vals[i] = interval_make(var_stack->data[i].val, var_stack->data[i].val);
+    }
+    return ERROR_NO;
+}
+
+error_code interval_bindings_dest(interval_bindings_t* bindings) {
+    if(!bindings) return ERROR_NO;
+
+    free(bindings->vals);
+    bindings->vals = nullptr;
+    bindings->size = 0;
+    return ERROR_NO;
+}
+
+interval_t bind_var_interval(interval_bindings_t* bindings, size_t var_idx, interval_t value) {
+    HARD_ASSERT(bindings       != nullptr, "bindings is nullptr");
+    HARD_ASSERT(var_idx < bindings->size,  "var_idx is out of range");
+
+    bindings->vals[var_idx] = value;
+    return value;
+}
+
+//================================================================================
+
+interval_t interval_nodes_eval(const tree_node_t* curr_node, const interval_bindings_t* bindings, error_code* error) {
+    HARD_ASSERT(bindings != nullptr, "bindings is nullptr");
+    HARD_ASSERT(error    != nullptr, "Error is nullptr");
+
+    if(curr_node == nullptr) return interval_empty();
+
+    switch(curr_node->type) {
+        case CONSTANT:
+            return interval_make(curr_node->value.constant, curr_node->value.constant);
+        case VARIABLE:
+            if(curr_node->value.var_idx >= bindings->size) {
+                LOGGER_ERROR("interval_nodes_eval: var_idx %zu is out of bindings", curr_node->value.var_idx);
+                *error |= ERROR_INCORRECT_INDEX;
+                return interval_empty();
+            }
+            return bindings->vals[curr_node->value.var_idx];
+        case FUNCTION:
+            break;
+        default:
+            LOGGER_ERROR("Unknown node type");
+            return interval_empty();
+    }
+
+    interval_t left_val  = interval_nodes_eval(curr_node->left, bindings, error);
+    interval_t right_val = curr_node->right ? interval_nodes_eval(curr_node->right, bindings, error)
+                                            : interval_make(0, 0);
+    if(left_val.is_empty || right_val.is_empty) return interval_empty();
+
+    #define HANDLE_FUNC(func_name, ...)                          \
+        case func_name:                                          \
+            return func_name##_interval(left_val, right_val);
+
+    switch(curr_node->value.func) {
+        #include "copy_past_file"
+        default:
+            LOGGER_ERROR("Unknown func op_code");
+            *error |= ERROR_UNKNOWN_FUNC;
+            return interval_empty();
+    }
+
+    #undef HANDLE_FUNC
+}
+
+interval_t interval_tree_eval(const tree_t* tree, const interval_bindings_t* bindings, error_code* error) {
+    HARD_ASSERT(tree     != nullptr, "tree is nullptr");
+    HARD_ASSERT(bindings != nullptr, "bindings is nullptr");
+    HARD_ASSERT(error    != nullptr, "error is nullptr");
+
+    long long begin_ns = metrics_phase_begin();
+    interval_t ans = interval_nodes_eval(tree->root, bindings, error);
+    metrics_phase_end(METRICS_PHASE_EVAL, begin_ns);
+    if(*error != ERROR_NO) {
+        LOGGER_ERROR("interval_tree_eval: interval_nodes_eval failed");
+        return interval_empty();
+    }
+    return ans;
+}
@@ -1,5 +1,9 @@
 #include <stdarg.h>
 #include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <atomic>
 
 #include "asserts.h"
 #include "colors.h"
@@ -10,13 +14,38 @@ static logger_output_type output_type = EXTERNAL_STREAM;
 static int color_enabled = 1;
 
 static const char* logger_mode_string(const logger_mode_type type);
-static void        logger_time_string(char *buff, size_t n);
+static const char* logger_time_string(time_t t);
 static const char* logger_color_on(const logger_mode_type mode);
 
 #if defined(WinV)
     #define localtime_r(T,Tm) (localtime_s(Tm,T) ? nullptr : Tm)
 #endif
 
+//==============================================================================
+// Async mode: bounded MPSC ring (Vyukov), producers only format the message text
+
+static const size_t LOGGER_RING_SIZE   = 1024; /* power of two */
+static const size_t LOGGER_RECORD_TEXT = 496;
+static const long   LOGGER_IDLE_NS     = 200000;
+
+struct logger_record_t {
+    std::atomic<size_t> seq;
+    logger_mode_type    mode;
+    const char*         file;
+    int                 line;
+    time_t              time;
+    char                text[LOGGER_RECORD_TEXT];
+};
+
+static logger_record_t     logger_ring[LOGGER_RING_SIZE];
+static std::atomic<size_t> ring_head(0);       /* next slot to fill        */
+static std::atomic<size_t> ring_tail(0);       /* next slot to write out   */
+static std::atomic<bool>   async_running(false);
+static std::atomic<bool>   async_stop(false);
+static pthread_t           async_thread;
+
+//==============================================================================
+
 static const char* logger_mode_string(const logger_mode_type type) {
     switch (type) {
         case LOGGER_MODE_DEBUG:                   return "DEBUG";
@@ -27,21 +56,27 @@ static const char* logger_mode_string(const logger_mode_type type) {
     }
 }
 
-static void logger_time_string(char *buff, size_t n) {
-    HARD_ASSERT(buff != nullptr, "buff is nullptr");
-    time_t t = time(nullptr);
-    struct tm tmv;
-    localtime_r(&t, &tmv);
-    if(!strftime(buff, n, "%H:%M:%S:%Y-%m-%d", &tmv)) {
-        SOFT_ASSERT(false, "Invalid time input");
+/* strftime runs once per second per thread, the rest reuse the cached string */
+static const char* logger_time_string(time_t t) {
+    static thread_local time_t cached_time    = (time_t)-1;
+    static thread_local char   cached_str[32] = "";
+
+    if (t != cached_time) {
+        struct tm tmv;
+        localtime_r(&t, &tmv);
+        if(!strftime(cached_str, sizeof cached_str, "%H:%M:%S:%Y-%m-%d", &tmv)) {
+            SOFT_ASSERT(false, "Invalid time input");
+        }
+        cached_time = t;
     }
+    return cached_str;
 }
 
 static const char* logger_color_on(const logger_mode_type mode) {
     if (!color_enabled) return "";
     switch (mode) {
         case LOGGER_MODE_DEBUG:   return CYAN_CONSOLE;
-        case LOGGER_MODE_INFO:    return BLUE_CONSOLE; 
+        case LOGGER_MODE_INFO:    return BLUE_CONSOLE;
         case LOGGER_MODE_WARNING: return YELLOW_CONSOLE;
         case LOGGER_MODE_ERROR:   return RED_CONSOLE;
 
@@ -49,6 +84,18 @@ static const char* logger_color_on(const logger_mode_type mode) {
     }
 }
 
+static void logger_write_prefix(logger_mode_type mode, const char *file, int line, time_t t) {
+    const char* time_str = logger_time_string(t);
+    if(output_type != EXTERNAL_STREAM) {
+        fprintf(output_stream, "%s. %s:%d. %s. ",
+            time_str, file, line, logger_mode_string(mode));
+    } else {
+        const char *color_on  = logger_color_on(mode);
+        fprintf(output_stream, "[%s] %s:%d. %s%s%s. ",
+            time_str, file, line, color_on, logger_mode_string(mode), RESET_CONSOLE);
+    }
+}
+
 void logger_initialize_stream(FILE *stream) {
     if (output_type == OWNED_FILE && output_stream) {
         fclose(output_stream);
@@ -70,33 +117,132 @@ int logger_initialize_file(const char *path) {
     return 0;
 }
 
+//==============================================================================
+
+static bool logger_ring_write_one() {
+    size_t pos = ring_tail.load(std::memory_order_relaxed);
+    logger_record_t* record = &logger_ring[pos & (LOGGER_RING_SIZE - 1)];
+    if (record->seq.load(std::memory_order_acquire) != pos + 1) return false;
+
+    logger_write_prefix(record->mode, record->file, record->line, record->time);
+    fputs(record->text, output_stream);
+    fputc('\n', output_stream);
+    if (record->mode == LOGGER_MODE_ERROR) fflush(output_stream);
+
+    record->seq.store(pos + LOGGER_RING_SIZE, std::memory_order_release);
+    ring_tail.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+static void* logger_async_loop(void*) {
+    const timespec idle = {0, LOGGER_IDLE_NS};
+    for (;;) {
+        bool is_written = false;
+        while (logger_ring_write_one()) is_written = true;
+
+        if (is_written) fflush(output_stream);
+        else if (async_stop.load(std::memory_order_acquire)) break;
+        else nanosleep(&idle, nullptr);
+    }
+    while (logger_ring_write_one()) {}
+    fflush(output_stream);
+    return nullptr;
+}
+
+static size_t logger_ring_push(logger_mode_type mode, const char *file, int line,
+                               const char *format, va_list ap) {
+    size_t pos = ring_head.load(std::memory_order_relaxed);
+    logger_record_t* record = nullptr;
+    for (;;) {
+        record = &logger_ring[pos & (LOGGER_RING_SIZE - 1)];
+        size_t   seq  = record->seq.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (ring_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        } else if (diff < 0) { /* full: wait for the writer instead of dropping */
+            sched_yield();
+            pos = ring_head.load(std::memory_order_relaxed);
+        } else {
+            pos = ring_head.load(std::memory_order_relaxed);
+        }
+    }
+
+    record->mode = mode;
+    record->file = file;
+    record->line = line;
+    record->time = time(nullptr);
+    vsnprintf(record->text, sizeof record->text, format, ap);
+
+    record->seq.store(pos + 1, std::memory_order_release);
+    return pos;
+}
+
+static void logger_wait_written(size_t pos) {
+    while (ring_tail.load(std::memory_order_acquire) <= pos) sched_yield();
+}
+
+int logger_start_async() {
+    if (async_running.load(std::memory_order_acquire)) return 0;
+    if (!output_stream) {
+        color_enabled = 0;
+        output_stream = stderr;
+    }
+
+    for (size_t i = 0; i < LOGGER_RING_SIZE; i++) {
+        logger_ring[i].seq.store(i, std::memory_order_relaxed);
+    }
+    ring_head.store(0, std::memory_order_relaxed);
+    ring_tail.store(0, std::memory_order_relaxed);
+    async_stop.store(false, std::memory_order_relaxed);
+
+    if (pthread_create(&async_thread, nullptr, logger_async_loop, nullptr) != 0) return -1;
+    async_running.store(true, std::memory_order_release);
+    return 0;
+}
+
+void logger_flush() {
+    if (async_running.load(std::memory_order_acquire)) {
+        size_t head = ring_head.load(std::memory_order_acquire);
+        if (head) logger_wait_written(head - 1);
+    }
+    if (output_stream) fflush(output_stream);
+}
+
+static void logger_stop_async() {
+    if (!async_running.load(std::memory_order_acquire)) return;
+    async_stop.store(true, std::memory_order_release);
+    pthread_join(async_thread, nullptr);
+    async_running.store(false, std::memory_order_release);
+}
+
+//==============================================================================
+
 void logger_close() {
+    logger_stop_async();
     if (output_type == OWNED_FILE && output_stream) fclose(output_stream);
 }
 
 void logger_log_message(const logger_mode_type mode,
                         const char *file, int line,
                         const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+
+    if (async_running.load(std::memory_order_acquire)) {
+        size_t pos = logger_ring_push(mode, file, line, format, ap);
+        va_end(ap);
+        /* an error may be followed by abort, so it has to reach the output now */
+        if (mode == LOGGER_MODE_ERROR) logger_wait_written(pos);
+        return;
+    }
+
     if (!output_stream) {
         color_enabled = 0;
         output_stream = stderr;
     }
-    char Time[32] = "";
-    logger_time_string(Time, sizeof Time);
-    if(output_type != EXTERNAL_STREAM) {
-        fprintf(output_stream, "%s. %s:%d. %s. ",
-            Time, file, line, logger_mode_string(mode));
-    } else {
-        const char *color_on  = logger_color_on(mode);
-        fprintf(output_stream, "[%s] %s:%d. %s%s%s. ",
-            Time, file, line, color_on, logger_mode_string(mode), RESET_CONSOLE);
-    }
-
-    va_list ap;
-    va_start(ap, format);
+    logger_write_prefix(mode, file, line, time(nullptr));
     vfprintf(output_stream, format, ap);
     va_end(ap);
-    
+
     fputc('\n', output_stream);
 }
-
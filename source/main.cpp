@@ -1,15 +1,51 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "logger.h"
 #include "tree_operations.h"
 #include "tree_verification.h"
 #include "void_stack.h"
+#include "batch_service.h"
+#include "dump_pipeline.h"
 
 int run_tests();
 
-int main() {
+static int run_batch(int argc, char** argv) {
+    batch_opts_t opts = {};
+    const char* in_name = nullptr;
+
+    for(int i = 2; i < argc; i++) {
+        if     (strcmp(argv[i], "--threads")   == 0 && i + 1 < argc) opts.threads_cnt = strtoul(argv[++i], nullptr, 10);
+        else if(strcmp(argv[i], "--max-nodes") == 0 && i + 1 < argc) opts.max_nodes   = strtoul(argv[++i], nullptr, 10);
+        else if(strcmp(argv[i], "--chunk")     == 0 && i + 1 < argc) opts.chunk_jobs  = strtoul(argv[++i], nullptr, 10);
+        else if(strcmp(argv[i], "--cache")     == 0 && i + 1 < argc) opts.cache_nodes = strtoul(argv[++i], nullptr, 10);
+        else if(argv[i][0] != '-' && !in_name)                       in_name          = argv[i];
+        else {
+            fprintf(stderr, "usage: %s --batch [jobs_file] [--threads N] [--max-nodes N] [--chunk N] [--cache N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    FILE* in = in_name ? fopen(in_name, "r") : stdin;
+    if(!in) {
+        fprintf(stderr, "can't open %s\n", in_name);
+        return 1;
+    }
+    error_code error = batch_service_run(in, stdout, &opts);
+    if(in != stdin) fclose(in);
+    return error == ERROR_NO ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
     logger_initialize_stream(stderr);
-    void_stack_t void_stack = {};
-    run_tests();
-    
+    logger_start_async();
+
+    int ret = 0;
+    if(argc > 1 && strcmp(argv[1], "--batch") == 0) ret = run_batch(argc, argv);
+    else                                            run_tests();
+
+    dump_pipeline_stop();
     logger_close();
-    return 0;
-}
\ No newline at end of file
+    return ret;
+}
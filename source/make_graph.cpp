@@ -2,95 +2,868 @@
 #include <stdlib.h>
 #include <math.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <sys/stat.h>
 
 #include "tree_info.h"
 #include "tree_operations.h"
 #include "differentiator.h"
 #include "error_handler.h"
 #include "make_graph.h"
+#include "parallel.h"
+#include "interval.h"
 #include "logger.h"
+#include "file_operations.h"
 
 const int MAX_FILE_NAME = 256;
 
-static void print_dat_header(FILE *gnu_file, const char *data_file_name, const char *png_file_name) {
+static const size_t PLOT_CHUNK_DOTS    = 1 << 14;
+static const size_t PLOT_CHUNKS_PER_THREAD = 4;
+static const size_t PLOT_COPY_BUFF_SIZE = 4096;
+static const size_t PLOT_TEXT_VALUE_LEN = 32;
+
+/* one interval pass decides whether a whole block of dots needs sampling */
+static const size_t PLOT_INTERVAL_BLOCK_DOTS = 256;
+static const size_t PLOT_YRANGE_PIECES       = 256;
+static const double PLOT_YRANGE_MARGIN       = 0.05;
+
+//================================================================================
+
+struct plot_chunk_t {
+    char*      buff;
+    size_t     len;
+    error_code error;
+};
+
+struct plot_range_t {
+    double lo;
+    double hi;
+    bool   is_set;
+};
+
+struct plot_sampler_t {
+    const tree_t* const* trees;
+    size_t             trees_cnt;
+    size_t             var_idx;
+    double             x_min;
+    double             step_size;
+    size_t             dots_cnt;
+    size_t             first_chunk;
+    plot_data_format_t format;
+    plot_chunk_t*      chunks;
+};
+
+//================================================================================
+
+static void print_plot_setup(FILE* gnu_file) {
     fprintf(gnu_file, "set terminal pngcairo size 1280,720\n");
-    fprintf(gnu_file, "set output '%s'\n", png_file_name);
     fprintf(gnu_file, "set grid\n");
     fprintf(gnu_file, "set xlabel 'x'\n");
     fprintf(gnu_file, "set ylabel 'f(x)'\n");
-    fprintf(gnu_file, "plot '%s' using 1:2 with lines title 'f(x)'\n", data_file_name);
+}
+
+static void print_plot_yrange(FILE* gnu_file, const plot_range_t* y_range) {
+    if(y_range && y_range->is_set) fprintf(gnu_file, "set yrange [%.15g:%.15g]\n", y_range->lo, y_range->hi);
+    else                           fprintf(gnu_file, "set autoscale y\n");
+}
+
+/* gnuplot double-quoted strings treat backslash as an escape */
+static void print_plot_title(FILE* gnu_file, const char* title) {
+    fputc('"', gnu_file);
+    for(const char* ch = title; *ch; ch++) {
+        switch(*ch) {
+            case '"':  fputs("\\\"", gnu_file); break;
+            case '\\': fputs("\\\\", gnu_file); break;
+            case '\n': fputs("\\n", gnu_file); break;
+            default:   fputc(*ch, gnu_file); break;
+        }
+    }
+    fputc('"', gnu_file);
+}
+
+static void print_plot_command(FILE* gnu_file, const char* source, plot_data_format_t format, size_t records_cnt,
+                               const char* const* titles, size_t series_cnt) {
+    fprintf(gnu_file, "plot ");
+    for(size_t i = 0; i < series_cnt; i++) {
+        fprintf(gnu_file, "%s%s", i ? ", " : "", source);
+        if(format == PLOT_DATA_BINARY) {
+            fprintf(gnu_file, " binary");
+            if(records_cnt) fprintf(gnu_file, " record=%zu", records_cnt);
+            fprintf(gnu_file, " format='");
+            for(size_t j = 0; j <= series_cnt; j++) fprintf(gnu_file, "%%float64");
+            fprintf(gnu_file, "'");
+        }
+        fprintf(gnu_file, " using 1:%zu with lines title ", i + 2);
+        print_plot_title(gnu_file, (titles && titles[i]) ? titles[i] : "f(x)");
+    }
+    fprintf(gnu_file, "\n");
+}
+
+static void print_dat_header(FILE *gnu_file, const char *data_file_name, const char *png_file_name,
+                             plot_data_format_t format, const char* const* titles, size_t series_cnt,
+                             const plot_range_t* y_range) {
+    print_plot_setup(gnu_file);
+    print_plot_yrange(gnu_file, y_range);
+    fprintf(gnu_file, "set output '%s'\n", png_file_name);
+
+    char source[MAX_FILE_NAME + 2] = {};
+    snprintf(source, sizeof(source), "'%s'", data_file_name);
+    print_plot_command(gnu_file, source, format, 0, titles, series_cnt);
+
     fprintf(gnu_file, "unset output\n");
 }
 
-static void fill_file_name_buff(char* buff, size_t buff_size, const char* file_name, const char* basic_file_name, int file_cnt) {
-    HARD_ASSERT(buff != nullptr, "Buff is nullptr");
+static void fill_file_name_buff(char* buff, size_t buff_size, const char* out_dir, const char* file_name,
+                                const char* basic_name, const char* basic_ext, size_t file_cnt) {
+    HARD_ASSERT(buff    != nullptr, "Buff is nullptr");
+    HARD_ASSERT(out_dir != nullptr, "out_dir is nullptr");
     if(file_name == nullptr) {
-        snprintf(buff, buff_size, basic_file_name, file_cnt);
+        snprintf(buff, buff_size, "%s/%s_%zu.%s", out_dir, basic_name, file_cnt, basic_ext);
     } else {
-        size_t path_len = strlen(file_name);
+        size_t path_len = strlen(out_dir) + 1 + strlen(file_name);
         if(path_len + 1 > buff_size) {
             LOGGER_WARNING("tree_plot_to_gnuplot: len data_path > %d, saved %d symblos", MAX_FILE_NAME, MAX_FILE_NAME - 1);
-            snprintf(buff, buff_size, "graphs/%s", file_name); //REVIEW - Или 2 memcpy
         }
-        snprintf(buff, buff_size, "graphs/%s", file_name);
+        snprintf(buff, buff_size, "%s/%s", out_dir, file_name);
     }
 }
-//REVIEW - aa
-error_code tree_plot_to_gnuplot(tree_t* tree, size_t var_idx,
-                                double x_min, double x_max,
-                                size_t dots_cnt, const char* data_path, const char* png_path) {
-    HARD_ASSERT(tree != nullptr, "tree is nullptr");
-    HARD_ASSERT(tree->var_stack != nullptr, "tree->var_stack is nullptr");
-    HARD_ASSERT(var_idx < tree->var_stack->size, "var_idx is out of range");
-    HARD_ASSERT(data_path != nullptr, "data_path is nullptr");
-    HARD_ASSERT(png_path != nullptr, "png_path is nullptr");
 
-    LOGGER_DEBUG("tree_plot_to_gnuplot: started");
+static error_code make_out_dir(const char* out_dir) {
+    if(mkdir(out_dir, 0755) != 0 && errno != EEXIST) {
+        LOGGER_ERROR("make_out_dir: mkdir '%s' failed", out_dir);
+        errno = 0;
+        return ERROR_OPEN_FILE;
+    }
+    errno = 0;
+    return ERROR_NO;
+}
+
+//================================================================================
 
-    static int fileCounter = 0;
-    system("mkdir -p graphs");
+static bool plot_block_is_void(const tree_t* tree, interval_bindings_t* boxes, size_t var_idx,
+                               double x_lo, double x_hi, error_code* error) {
+    bind_var_interval(boxes, var_idx, interval_make(x_lo, x_hi));
+    return interval_is_void(interval_tree_eval(tree, boxes, error));
+}
 
+static void plot_sample_chunk(size_t task_idx, void* ctx) {
+    plot_sampler_t* sampler = (plot_sampler_t*)ctx;
+    plot_chunk_t*   chunk   = &sampler->chunks[task_idx];
 
-    char data_file_name[MAX_FILE_NAME] = {};
-    char  png_file_name[MAX_FILE_NAME]  = {};
-    fill_file_name_buff(data_file_name, MAX_FILE_NAME, data_path, "graphs/plot_data_%d.dat", fileCounter);
-    fill_file_name_buff(png_file_name,  MAX_FILE_NAME, png_path,  "graphs/plot_png_%d.png",  fileCounter);
-    fileCounter++;
+    chunk->len   = 0;
+    chunk->error = ERROR_NO;
 
-    FILE *data_file = fopen(data_file_name, "w");
-    if (!data_file) {
-        LOGGER_ERROR("fopen data_file_name");
-        return ERROR_OPEN_FILE;
+    size_t first_dot = (sampler->first_chunk + task_idx) * PLOT_CHUNK_DOTS;
+    size_t last_dot  = first_dot + PLOT_CHUNK_DOTS;
+    if(last_dot > sampler->dots_cnt) last_dot = sampler->dots_cnt;
+
+    var_bindings_t      bindings = {};
+    interval_bindings_t boxes    = {};
+    bool*               is_void  = (bool*)calloc(sampler->trees_cnt, sizeof(bool));
+    chunk->error |= var_bindings_init(&bindings, sampler->trees[0]->var_stack);
+    chunk->error |= interval_bindings_init(&boxes, sampler->trees[0]->var_stack);
+    if(!is_void) chunk->error |= ERROR_MEM_ALLOC;
+
+    for(size_t i = first_dot; i < last_dot && chunk->error == ERROR_NO; i++) {
+        double x_value = sampler->x_min + sampler->step_size * (double)i;
+        bind_var_val(&bindings, sampler->var_idx, (var_val_type)x_value);
+
+        if((i - first_dot) % PLOT_INTERVAL_BLOCK_DOTS == 0) {
+            size_t block_last = i + PLOT_INTERVAL_BLOCK_DOTS - 1;
+            if(block_last >= last_dot) block_last = last_dot - 1;
+            double x_block_hi = sampler->x_min + sampler->step_size * (double)block_last;
+            for(size_t j = 0; j < sampler->trees_cnt; j++) {
+                is_void[j] = plot_block_is_void(sampler->trees[j], &boxes, sampler->var_idx,
+                                                x_value, x_block_hi, &chunk->error);
+            }
+        }
+
+        if(sampler->format == PLOT_DATA_BINARY) {
+            memcpy(chunk->buff + chunk->len, &x_value, sizeof(double));
+            chunk->len += sizeof(double);
+        } else {
+            int printed = snprintf(chunk->buff + chunk->len, PLOT_TEXT_VALUE_LEN, "%.15g", x_value);
+            if(printed > 0) chunk->len += (size_t)printed;
+        }
+
+        for(size_t j = 0; j < sampler->trees_cnt; j++) {
+            double y_value = is_void[j] ? NAN : (double)calculate_tree_bound(sampler->trees[j], &bindings, &chunk->error);
+
+            if(sampler->format == PLOT_DATA_BINARY) {
+                memcpy(chunk->buff + chunk->len, &y_value, sizeof(double));
+                chunk->len += sizeof(double);
+            } else {
+                int printed = snprintf(chunk->buff + chunk->len, PLOT_TEXT_VALUE_LEN, " %.15g", y_value);
+                if(printed > 0) chunk->len += (size_t)printed;
+            }
+        }
+
+        if(sampler->format != PLOT_DATA_BINARY) chunk->buff[chunk->len++] = '\n';
+    }
+
+    free(is_void);
+    interval_bindings_dest(&boxes);
+    var_bindings_dest(&bindings);
+}
+
+static error_code plot_write_samples(const tree_t* const* trees, size_t trees_cnt, size_t var_idx,
+                                     double x_min, double x_max, size_t dots_cnt,
+                                     FILE* data_file, plot_opts_t opts) {
+    HARD_ASSERT(trees     != nullptr, "trees is nullptr");
+    HARD_ASSERT(data_file != nullptr, "data_file is nullptr");
+
+    size_t threads_cnt = opts.threads_cnt ? opts.threads_cnt : parallel_threads_cnt();
+    size_t chunks_cnt  = (dots_cnt + PLOT_CHUNK_DOTS - 1) / PLOT_CHUNK_DOTS;
+    size_t window_cnt  = threads_cnt * PLOT_CHUNKS_PER_THREAD;
+    if(window_cnt > chunks_cnt) window_cnt = chunks_cnt;
+
+    size_t dot_size = (trees_cnt + 1) * ((opts.data_format == PLOT_DATA_BINARY) ? sizeof(double) : PLOT_TEXT_VALUE_LEN);
+
+    plot_chunk_t* chunks = (plot_chunk_t*)calloc(window_cnt, sizeof(plot_chunk_t));
+    char*         buffs  = (char*)calloc(window_cnt * PLOT_CHUNK_DOTS, dot_size);
+    if(!chunks || !buffs) {
+        LOGGER_ERROR("plot_write_samples: calloc failed");
+        free(chunks);
+        free(buffs);
+        return ERROR_MEM_ALLOC;
+    }
+    for(size_t i = 0; i < window_cnt; i++) {
+        chunks[i].buff = buffs + i * PLOT_CHUNK_DOTS * dot_size;
     }
 
+    plot_sampler_t sampler = {
+        .trees       = trees,
+        .trees_cnt   = trees_cnt,
+        .var_idx     = var_idx,
+        .x_min       = x_min,
+        .step_size   = (dots_cnt > 1) ? (x_max - x_min) / (double)(dots_cnt - 1) : 0,
+        .dots_cnt    = dots_cnt,
+        .first_chunk = 0,
+        .format      = opts.data_format,
+        .chunks      = chunks,
+    };
+
     error_code error = ERROR_NO;
-    const double step_size = (x_max - x_min) / (double)(dots_cnt - 1);
+    for(size_t first_chunk = 0; first_chunk < chunks_cnt && error == ERROR_NO; first_chunk += window_cnt) {
+        size_t curr_cnt = chunks_cnt - first_chunk;
+        if(curr_cnt > window_cnt) curr_cnt = window_cnt;
+
+        sampler.first_chunk = first_chunk;
+        error |= parallel_for(curr_cnt, threads_cnt, plot_sample_chunk, &sampler);
+
+        for(size_t i = 0; i < curr_cnt && error == ERROR_NO; i++) {
+            error |= chunks[i].error;
+            if(error != ERROR_NO) break;
+            if(fwrite(chunks[i].buff, 1, chunks[i].len, data_file) != chunks[i].len) {
+                LOGGER_ERROR("plot_write_samples: fwrite failed");
+                error |= ERROR_OPEN_FILE;
+            }
+        }
+    }
+
+    free(buffs);
+    free(chunks);
+    return error;
+}
+
+//================================================================================
+
+static const size_t PLOT_ADAPTIVE_MIN_SEGMENTS = 16;
+static const size_t PLOT_ADAPTIVE_MAX_SEGMENTS = 1024;
+static const size_t PLOT_ADAPTIVE_MAX_DEPTH    = 24;
+static const double PLOT_ADAPTIVE_TOLERANCE    = 1e-3;
+static const double PLOT_ADAPTIVE_JUMP_FACTOR  = 0.05;
+
+struct plot_dot_t {
+    double x;
+    double y;
+};
+
+struct plot_segment_t {
+    plot_dot_t* dots;
+    size_t      cnt;
+    size_t      cap;
+    size_t      evals_left; /* its share of the budget, fixed before any thread starts */
+    error_code  error;
+};
 
-    for (size_t i = 0; i < dots_cnt; ++i) {
-        double x_value = x_min + step_size * (double)i;
+struct plot_interval_t {
+    plot_dot_t left;
+    plot_dot_t right;
+    size_t     depth;
+};
 
-        (void)put_var_val(tree, var_idx, (var_val_type)x_value);
+struct plot_refiner_t {
+    const tree_t*   tree;
+    size_t          var_idx;
+    const double*   grid_y;
+    const bool*     void_segments;
+    double          x_min;
+    double          step_size;
+    double          tolerance;
+    double          jump_size;
+    double          visible_lo;
+    double          visible_hi;
+    plot_segment_t* segments;
+};
 
-        var_val_type y_value = calculate_nodes_recursive(tree, tree->root, &error);
-        if (error != ERROR_NO) {
-            fclose(data_file);
-            return error;
+//--------------------------------------------------------------------------------
+
+static error_code plot_segment_push(plot_segment_t* segment, double x, double y) {
+    if(segment->cnt == segment->cap) {
+        size_t new_cap = segment->cap ? segment->cap * 2 : 16;
+        plot_dot_t* new_dots = (plot_dot_t*)realloc(segment->dots, new_cap * sizeof(plot_dot_t));
+        if(!new_dots) {
+            LOGGER_ERROR("plot_segment_push: realloc failed");
+            return ERROR_MEM_ALLOC;
         }
+        segment->dots = new_dots;
+        segment->cap  = new_cap;
+    }
+    segment->dots[segment->cnt++] = {x, y};
+    return ERROR_NO;
+}
+
+static bool plot_need_split(const plot_refiner_t* refiner, plot_dot_t left, plot_dot_t middle, plot_dot_t right) {
+    bool is_left_def   = isfinite(left.y);
+    bool is_middle_def = isfinite(middle.y);
+    bool is_right_def  = isfinite(right.y);
+
+    if(!is_left_def && !is_middle_def && !is_right_def) return false;
+    if(is_left_def != is_middle_def || is_middle_def != is_right_def) return true;
+
+    double lo = fmin(fmin(left.y, middle.y), right.y);
+    double hi = fmax(fmax(left.y, middle.y), right.y);
+    if(lo > refiner->visible_hi || hi < refiner->visible_lo) return false;
 
-        fprintf(data_file, "%.15g %.15g\n", x_value, (double)y_value);
+    return fabs(middle.y - 0.5 * (left.y + right.y)) > refiner->tolerance;
+}
+
+static bool plot_take_eval(size_t* evals_left) {
+    if(*evals_left == 0) return false;
+    (*evals_left)--;
+    return true;
+}
+
+static bool plot_is_jump(plot_dot_t left, plot_dot_t middle, plot_dot_t right, double jump_size) {
+    if(!isfinite(left.y) || !isfinite(right.y)) return false;
+    if(fabs(right.y - left.y) < jump_size)       return false;
+
+    double lo = fmin(left.y, right.y);
+    double hi = fmax(left.y, right.y);
+    return !(lo <= middle.y && middle.y <= hi) || fabs(right.y - left.y) > 1e3 * jump_size;
+}
+
+static void plot_refine_segment(size_t task_idx, void* ctx) {
+    plot_refiner_t* refiner = (plot_refiner_t*)ctx;
+    plot_segment_t* segment = &refiner->segments[task_idx];
+
+    if(refiner->void_segments[task_idx]) {
+        segment->error |= plot_segment_push(segment, refiner->x_min + refiner->step_size * (double)(task_idx + 1), NAN);
+        return;
     }
 
-    fclose(data_file);
+    var_bindings_t bindings = {};
+    segment->error |= var_bindings_init(&bindings, refiner->tree->var_stack);
+    if(segment->error != ERROR_NO) return;
+
+    plot_interval_t stack[PLOT_ADAPTIVE_MAX_DEPTH + 2] = {};
+    size_t          stack_size = 0;
+
+    stack[stack_size++] = {
+        {refiner->x_min + refiner->step_size * (double) task_idx,      refiner->grid_y[task_idx]},
+        {refiner->x_min + refiner->step_size * (double)(task_idx + 1), refiner->grid_y[task_idx + 1]},
+        0
+    };
+
+    while(stack_size > 0 && segment->error == ERROR_NO) {
+        plot_interval_t curr = stack[--stack_size];
+
+        if(!plot_take_eval(&segment->evals_left)) {
+            segment->error |= plot_segment_push(segment, curr.right.x, curr.right.y);
+            continue;
+        }
+
+        plot_dot_t middle = {0.5 * (curr.left.x + curr.right.x), 0};
+        bind_var_val(&bindings, refiner->var_idx, (var_val_type)middle.x);
+        middle.y = (double)calculate_tree_bound(refiner->tree, &bindings, &segment->error);
+
+        bool is_split = plot_need_split(refiner, curr.left, middle, curr.right);
+        if(is_split && curr.depth < PLOT_ADAPTIVE_MAX_DEPTH && segment->evals_left > 0) {
+            stack[stack_size++] = {middle,    curr.right, curr.depth + 1};
+            stack[stack_size++] = {curr.left, middle,     curr.depth + 1};
+            continue;
+        }
+
+        if(is_split && plot_is_jump(curr.left, middle, curr.right, refiner->jump_size)) {
+            segment->error |= plot_segment_push(segment, middle.x, NAN);
+        } else {
+            segment->error |= plot_segment_push(segment, middle.x, middle.y);
+        }
+        segment->error |= plot_segment_push(segment, curr.right.x, curr.right.y);
+    }
+
+    var_bindings_dest(&bindings);
+}
+
+//--------------------------------------------------------------------------------
+
+static int double_ascending(const void* a, const void* b) {
+    double lhs = *(const double*)a;
+    double rhs = *(const double*)b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+static void plot_robust_band(const double* ys, size_t ys_cnt, double* band_lo, double* band_hi) {
+    *band_lo = -1.0;
+    *band_hi =  1.0;
+
+    double* finite_ys = (double*)calloc(ys_cnt, sizeof(double));
+    if(!finite_ys) return;
+
+    size_t finite_cnt = 0;
+    for(size_t i = 0; i < ys_cnt; i++) {
+        if(isfinite(ys[i])) finite_ys[finite_cnt++] = ys[i];
+    }
+
+    if(finite_cnt > 1) {
+        qsort(finite_ys, finite_cnt, sizeof(double), double_ascending);
+        double lo = finite_ys[finite_cnt *  5 / 100];
+        double hi = finite_ys[finite_cnt * 95 / 100];
+        if(hi > lo) {
+            *band_lo = lo;
+            *band_hi = hi;
+        } else {
+            *band_lo = lo - 1.0;
+            *band_hi = hi + 1.0;
+        }
+    }
+    free(finite_ys);
+}
+
+/* A segment's coarse error: its grid jump clipped to the band, plus an even share that keeps smooth
+   segments refined; a non-finite end counts as a full band */
+static double plot_segment_weight(const double* grid_y, size_t segment_idx, size_t segments_cnt, double y_scale) {
+    double jump = fabs(grid_y[segment_idx + 1] - grid_y[segment_idx]);
+    return y_scale / (double)segments_cnt + (isfinite(jump) ? fmin(jump, y_scale) : y_scale);
+}
+
+/* Splits evals_cnt between segments in proportion to their coarse error up front,
+   so the dots don't depend on which thread gets to a segment first */
+static void plot_split_evals(plot_segment_t* segments, size_t segments_cnt, const double* grid_y,
+                             const bool* void_segments, double y_scale, size_t evals_cnt) {
+    double weight_sum = 0;
+    for(size_t i = 0; i < segments_cnt; i++) {
+        if(!void_segments[i]) weight_sum += plot_segment_weight(grid_y, i, segments_cnt, y_scale);
+    }
+    if(!(weight_sum > 0)) return;
+
+    size_t given_cnt = 0;
+    for(size_t i = 0; i < segments_cnt; i++) {
+        if(void_segments[i]) continue;
+        double share = plot_segment_weight(grid_y, i, segments_cnt, y_scale) / weight_sum;
+        segments[i].evals_left = (size_t)((double)evals_cnt * share);
+        given_cnt += segments[i].evals_left;
+    }
+    for(size_t i = 0; given_cnt < evals_cnt && i < segments_cnt; i++) { /* rounding leftovers */
+        if(void_segments[i]) continue;
+        segments[i].evals_left++;
+        given_cnt++;
+    }
+}
+
+static error_code plot_write_dots(FILE* data_file, const plot_dot_t* dots, size_t dots_cnt, plot_data_format_t format,
+                                  bool* is_broken) {
+    if(format == PLOT_DATA_BINARY) {
+        if(fwrite(dots, sizeof(plot_dot_t), dots_cnt, data_file) != dots_cnt) {
+            LOGGER_ERROR("plot_write_dots: fwrite failed");
+            return ERROR_OPEN_FILE;
+        }
+        return ERROR_NO;
+    }
 
+    for(size_t i = 0; i < dots_cnt; i++) {
+        if(isfinite(dots[i].y)) {
+            fprintf(data_file, "%.15g %.15g\n", dots[i].x, dots[i].y);
+            *is_broken = false;
+        } else if(!*is_broken) {
+            fputc('\n', data_file);
+            *is_broken = true;
+        }
+    }
+    return ERROR_NO;
+}
+
+static error_code plot_write_adaptive(const tree_t* tree, size_t var_idx,
+                                      double x_min, double x_max, size_t evals_budget,
+                                      FILE* data_file, plot_opts_t opts) {
+    HARD_ASSERT(tree      != nullptr, "tree is nullptr");
+    HARD_ASSERT(data_file != nullptr, "data_file is nullptr");
+
+    if(evals_budget < 2) {
+        LOGGER_ERROR("plot_write_adaptive: budget of %zu evaluations can't cover both ends", evals_budget);
+        return ERROR_INCORRECT_ARGS;
+    }
+
+    /* the grid alone takes segments_cnt + 1 evaluations */
+    size_t segments_cnt = evals_budget / 16;
+    if(segments_cnt < PLOT_ADAPTIVE_MIN_SEGMENTS) segments_cnt = PLOT_ADAPTIVE_MIN_SEGMENTS;
+    if(segments_cnt > PLOT_ADAPTIVE_MAX_SEGMENTS) segments_cnt = PLOT_ADAPTIVE_MAX_SEGMENTS;
+    if(segments_cnt > evals_budget - 1)           segments_cnt = evals_budget - 1;
+
+    double*             grid_y        = (double*)calloc(segments_cnt + 1, sizeof(double));
+    bool*               void_segments = (bool*)calloc(segments_cnt, sizeof(bool));
+    plot_segment_t*     segments      = (plot_segment_t*)calloc(segments_cnt, sizeof(plot_segment_t));
+    var_bindings_t      bindings      = {};
+    interval_bindings_t boxes         = {};
+    error_code          error         = var_bindings_init(&bindings, tree->var_stack);
+    error |= interval_bindings_init(&boxes, tree->var_stack);
+    if(!grid_y || !void_segments || !segments || error != ERROR_NO) {
+        LOGGER_ERROR("plot_write_adaptive: allocation failed");
+        free(grid_y);
+        free(void_segments);
+        free(segments);
+        var_bindings_dest(&bindings);
+        interval_bindings_dest(&boxes);
+        return error | ERROR_MEM_ALLOC;
+    }
+
+    const double step_size = (x_max - x_min) / (double)segments_cnt;
+    for(size_t i = 0; i < segments_cnt && error == ERROR_NO; i++) {
+        void_segments[i] = plot_block_is_void(tree, &boxes, var_idx, x_min + step_size * (double)i,
+                                              x_min + step_size * (double)(i + 1), &error);
+    }
+    interval_bindings_dest(&boxes);
+
+    for(size_t i = 0; i <= segments_cnt && error == ERROR_NO; i++) {
+        bool is_left_void  = (i == 0)            || void_segments[i - 1];
+        bool is_right_void = (i == segments_cnt) || void_segments[i];
+        if(is_left_void && is_right_void) {
+            grid_y[i] = NAN;
+            continue;
+        }
+        bind_var_val(&bindings, var_idx, (var_val_type)(x_min + step_size * (double)i));
+        grid_y[i] = (double)calculate_tree_bound(tree, &bindings, &error);
+    }
+    var_bindings_dest(&bindings);
+
+    double band_lo = 0;
+    double band_hi = 0;
+    plot_robust_band(grid_y, segments_cnt + 1, &band_lo, &band_hi);
+    double y_scale = band_hi - band_lo;
+
+    plot_refiner_t refiner = {
+        .tree              = tree,
+        .var_idx           = var_idx,
+        .grid_y            = grid_y,
+        .void_segments     = void_segments,
+        .x_min             = x_min,
+        .step_size         = step_size,
+        .tolerance         = PLOT_ADAPTIVE_TOLERANCE   * y_scale,
+        .jump_size         = PLOT_ADAPTIVE_JUMP_FACTOR * y_scale,
+        .visible_lo        = band_lo - y_scale,
+        .visible_hi        = band_hi + y_scale,
+        .segments          = segments,
+    };
+    if(error == ERROR_NO) {
+        plot_split_evals(segments, segments_cnt, grid_y, void_segments, y_scale, evals_budget - segments_cnt - 1);
+        error |= parallel_for(segments_cnt, opts.threads_cnt, plot_refine_segment, &refiner);
+    }
+
+    bool       is_broken = true;
+    plot_dot_t first_dot = {x_min, grid_y[0]};
+    if(error == ERROR_NO) error |= plot_write_dots(data_file, &first_dot, 1, opts.data_format, &is_broken);
+
+    size_t dots_cnt = 1;
+    for(size_t i = 0; i < segments_cnt; i++) {
+        error |= segments[i].error;
+        if(error == ERROR_NO) error |= plot_write_dots(data_file, segments[i].dots, segments[i].cnt, opts.data_format, &is_broken);
+        dots_cnt += segments[i].cnt;
+        free(segments[i].dots);
+    }
+    LOGGER_DEBUG("plot_write_adaptive: %zu dots written for budget %zu", dots_cnt, evals_budget);
+
+    free(segments);
+    free(void_segments);
+    free(grid_y);
+    return error;
+}
+
+//================================================================================
+
+/* shared by every one-shot plot, concurrent ones included: plots_cnt only moves by __atomic_fetch_add */
+static plot_session_t oneshot_session = {nullptr, "graphs", 0};
+
+static error_code plot_open_data_file(plot_session_t* session, const char* data_path, const char* png_path,
+                                      plot_data_format_t format,
+                                      char* data_file_name, char* png_file_name, FILE** data_file) {
+    error_code error = make_out_dir(session->out_dir);
+    if(error != ERROR_NO) return error;
+
+    size_t plot_idx = __atomic_fetch_add(&session->plots_cnt, 1, __ATOMIC_RELAXED);
+    fill_file_name_buff(data_file_name, MAX_FILE_NAME, session->out_dir, data_path, "plot_data", "dat", plot_idx);
+    fill_file_name_buff(png_file_name,  MAX_FILE_NAME, session->out_dir, png_path,  "plot_png",  "png", plot_idx);
+
+    *data_file = fopen(data_file_name, (format == PLOT_DATA_BINARY) ? "wb" : "w");
+    if (!*data_file) {
+        LOGGER_ERROR("fopen data_file_name");
+        return ERROR_OPEN_FILE;
+    }
+    return ERROR_NO;
+}
+
+static error_code plot_run_gnuplot(const char* data_file_name, const char* png_file_name, plot_data_format_t format,
+                                   const char* const* titles, size_t series_cnt, const plot_range_t* y_range) {
+    /* a gnuplot that dies mid-plot must surface as a write error, not kill the host */
+    ignore_sigpipe();
     FILE *gnu_file = popen("gnuplot", "w");
     if (!gnu_file) {
         LOGGER_ERROR("popen gnuplot");
         return ERROR_OPEN_FILE;
     }
 
-    print_dat_header(gnu_file, data_file_name, png_file_name);
+    print_dat_header(gnu_file, data_file_name, png_file_name, format, titles, series_cnt, y_range);
 
-    fflush(gnu_file);
+    error_code error = ERROR_NO;
+    if(fflush(gnu_file) != 0 || ferror(gnu_file)) {
+        LOGGER_ERROR("plot_run_gnuplot: gnuplot closed its pipe");
+        error |= ERROR_CLOSE_FILE;
+    }
     pclose(gnu_file);
+    return error;
+}
+
+static error_code plot_check_trees(const tree_t* const* trees, size_t trees_cnt, size_t var_idx) {
+    HARD_ASSERT(trees     != nullptr, "trees is nullptr");
+    HARD_ASSERT(trees_cnt != 0,       "trees_cnt is 0");
+    HARD_ASSERT(trees[0]  != nullptr, "tree is nullptr");
+    HARD_ASSERT(trees[0]->var_stack != nullptr, "tree->var_stack is nullptr");
+    HARD_ASSERT(var_idx < trees[0]->var_stack->size, "var_idx is out of range");
+
+    for(size_t i = 1; i < trees_cnt; i++) {
+        HARD_ASSERT(trees[i] != nullptr, "tree is nullptr");
+        if(trees[i]->var_stack != trees[0]->var_stack) {
+            LOGGER_ERROR("plot_check_trees: trees must share one var_stack");
+            return ERROR_INCORRECT_ARGS;
+        }
+    }
+    return ERROR_NO;
+}
+
+/* union of the bounded enclosures over pieces of [x_min, x_max]; pieces around poles are left out */
+static error_code plot_pick_yrange(const tree_t* const* trees, size_t trees_cnt, size_t var_idx,
+                                   double x_min, double x_max, plot_range_t* y_range) {
+    *y_range = {};
+
+    interval_bindings_t boxes = {};
+    error_code error = interval_bindings_init(&boxes, trees[0]->var_stack);
+    if(error != ERROR_NO) return error;
+
+    interval_t total      = interval_empty();
+    double     piece_size = (x_max - x_min) / (double)PLOT_YRANGE_PIECES;
+    for(size_t i = 0; i < PLOT_YRANGE_PIECES && error == ERROR_NO; i++) {
+        double piece_hi = (i + 1 == PLOT_YRANGE_PIECES) ? x_max : x_min + piece_size * (double)(i + 1);
+        bind_var_interval(&boxes, var_idx, interval_make(x_min + piece_size * (double)i, piece_hi));
+
+        for(size_t j = 0; j < trees_cnt; j++) {
+            interval_t piece = interval_tree_eval(trees[j], &boxes, &error);
+            if(!piece.is_empty && isfinite(piece.lo) && isfinite(piece.hi)) total = interval_union(total, piece);
+        }
+    }
+    interval_bindings_dest(&boxes);
+    if(error != ERROR_NO || total.is_empty) return error;
+
+    double margin = PLOT_YRANGE_MARGIN * (total.hi - total.lo);
+    if(!(margin > 0)) margin = 1;
+    *y_range = {total.lo - margin, total.hi + margin, true};
+    LOGGER_DEBUG("plot_pick_yrange: [%g, %g]", y_range->lo, y_range->hi);
+    return ERROR_NO;
+}
+
+static error_code plot_write_series(const tree_t* const* trees, size_t trees_cnt, size_t var_idx,
+                                    double x_min, double x_max, size_t dots_cnt,
+                                    FILE* data_file, plot_opts_t opts, plot_range_t* y_range) {
+    error_code error = plot_pick_yrange(trees, trees_cnt, var_idx, x_min, x_max, y_range);
+    if(error != ERROR_NO) return error;
+
+    if(opts.sampling == PLOT_SAMPLING_ADAPTIVE) {
+        if(trees_cnt == 1) return plot_write_adaptive(trees[0], var_idx, x_min, x_max, dots_cnt, data_file, opts);
+        LOGGER_WARNING("plot_write_series: adaptive sampling needs a single series, shared uniform grid is used");
+    }
+    return plot_write_samples(trees, trees_cnt, var_idx, x_min, x_max, dots_cnt, data_file, opts);
+}
+
+//================================================================================
+//REVIEW - aa
+error_code tree_plot_to_gnuplot(tree_t* tree, size_t var_idx,
+                                double x_min, double x_max,
+                                size_t dots_cnt, const char* data_path, const char* png_path) {
+    return tree_plot_to_gnuplot_opts(tree, var_idx, x_min, x_max, dots_cnt, data_path, png_path,
+                                     {PLOT_DATA_TEXT, 0});
+}
+
+error_code tree_plot_to_gnuplot_opts(const tree_t* tree, size_t var_idx,
+                                     double x_min, double x_max,
+                                     size_t dots_cnt, const char* data_path, const char* png_path,
+                                     plot_opts_t opts) {
+    HARD_ASSERT(tree != nullptr, "tree is nullptr");
+
+    const char* title = "f(x)";
+    return trees_plot_to_gnuplot(&tree, &title, 1, var_idx, x_min, x_max, dots_cnt, data_path, png_path, opts);
+}
+
+error_code trees_plot_to_gnuplot(const tree_t* const* trees, const char* const* titles, size_t trees_cnt,
+                                 size_t var_idx, double x_min, double x_max,
+                                 size_t dots_cnt, const char* data_path, const char* png_path,
+                                 plot_opts_t opts) {
+    HARD_ASSERT(data_path != nullptr, "data_path is nullptr");
+    HARD_ASSERT(png_path  != nullptr, "png_path is nullptr");
+
+    LOGGER_DEBUG("trees_plot_to_gnuplot: started for %zu series", trees_cnt);
+
+    error_code error = plot_check_trees(trees, trees_cnt, var_idx);
+    if(error != ERROR_NO) return error;
+
+    char  data_file_name[MAX_FILE_NAME] = {};
+    char  png_file_name[MAX_FILE_NAME]  = {};
+    FILE* data_file = nullptr;
+    error |= plot_open_data_file(&oneshot_session, data_path, png_path, opts.data_format,
+                                 data_file_name, png_file_name, &data_file);
+    if(error != ERROR_NO) return error;
+
+    plot_range_t y_range = {};
+    error |= plot_write_series(trees, trees_cnt, var_idx, x_min, x_max, dots_cnt, data_file, opts, &y_range);
+    fclose(data_file);
+    if(error != ERROR_NO) {
+        LOGGER_ERROR("trees_plot_to_gnuplot: sampling failed");
+        return error;
+    }
+
+    return plot_run_gnuplot(data_file_name, png_file_name, opts.data_format, titles, trees_cnt, &y_range);
+}
+
+//================================================================================
+
+error_code plot_session_open(plot_session_t* session, const char* out_dir) {
+    HARD_ASSERT(session != nullptr, "session is nullptr");
+    HARD_ASSERT(out_dir != nullptr, "out_dir is nullptr");
+
+    LOGGER_DEBUG("plot_session_open: started");
+
+    session->gnu_pipe  = nullptr;
+    session->out_dir   = out_dir;
+    session->plots_cnt = 0;
+
+    error_code error = make_out_dir(out_dir);
+    if(error != ERROR_NO) return error;
+
+    ignore_sigpipe();
+    session->gnu_pipe = popen("gnuplot", "w");
+    if(!session->gnu_pipe) {
+        LOGGER_ERROR("plot_session_open: popen gnuplot failed");
+        return ERROR_OPEN_FILE;
+    }
+
+    print_plot_setup(session->gnu_pipe);
+    return ERROR_NO;
+}
+
+static error_code plot_session_stream_binary(FILE* gnu_pipe, const tree_t* const* trees, const char* const* titles,
+                                             size_t trees_cnt, size_t var_idx, double x_min, double x_max,
+                                             size_t dots_cnt, plot_opts_t opts) {
+    FILE* block = tmpfile();
+    if(!block) {
+        LOGGER_ERROR("plot_session_stream_binary: tmpfile failed");
+        return ERROR_OPEN_FILE;
+    }
+
+    plot_range_t y_range    = {};
+    error_code   error      = plot_write_series(trees, trees_cnt, var_idx, x_min, x_max, dots_cnt, block, opts, &y_range);
+    size_t       block_size = (size_t)ftell(block);
+    if(error != ERROR_NO || block_size == 0) {
+        fclose(block);
+        return error;
+    }
+
+    print_plot_yrange(gnu_pipe, &y_range);
+
+    print_plot_command(gnu_pipe, "'-'", PLOT_DATA_BINARY, block_size / ((trees_cnt + 1) * sizeof(double)),
+                       titles, trees_cnt);
+
+    char copy_buff[PLOT_COPY_BUFF_SIZE] = {};
+    for(size_t i = 0; i < trees_cnt && error == ERROR_NO; i++) {
+        rewind(block);
+        size_t read_cnt = 0;
+        while((read_cnt = fread(copy_buff, 1, sizeof(copy_buff), block)) > 0) {
+            if(fwrite(copy_buff, 1, read_cnt, gnu_pipe) != read_cnt) {
+                LOGGER_ERROR("plot_session_stream_binary: fwrite to gnuplot failed");
+                error |= ERROR_OPEN_FILE;
+                break;
+            }
+        }
+    }
+
+    fclose(block);
+    return error;
+}
+
+error_code plot_session_plot(plot_session_t* session,
+                             const tree_t* const* trees, const char* const* titles, size_t trees_cnt,
+                             size_t var_idx, double x_min, double x_max, size_t dots_cnt,
+                             const char* png_name, plot_opts_t opts) {
+    HARD_ASSERT(session           != nullptr, "session is nullptr");
+    HARD_ASSERT(session->gnu_pipe != nullptr, "session is not opened");
+
+    LOGGER_DEBUG("plot_session_plot: plot #%zu started", session->plots_cnt);
+
+    error_code error = plot_check_trees(trees, trees_cnt, var_idx);
+    if(error != ERROR_NO) return error;
+
+    char png_file_name[MAX_FILE_NAME] = {};
+    fill_file_name_buff(png_file_name, MAX_FILE_NAME, session->out_dir, png_name, "plot_png", "png", session->plots_cnt);
+    session->plots_cnt++;
+
+    FILE* gnu_pipe = session->gnu_pipe;
+    fprintf(gnu_pipe, "set output '%s'\n", png_file_name);
+
+    if(opts.data_format == PLOT_DATA_BINARY) {
+        error |= plot_session_stream_binary(gnu_pipe, trees, titles, trees_cnt, var_idx, x_min, x_max, dots_cnt, opts);
+    } else {
+        plot_range_t y_range = {};
+        fprintf(gnu_pipe, "$plot_data << EOD\n");
+        error |= plot_write_series(trees, trees_cnt, var_idx, x_min, x_max, dots_cnt, gnu_pipe, opts, &y_range);
+        fprintf(gnu_pipe, "EOD\n");
+        if(error == ERROR_NO) {
+            print_plot_yrange(gnu_pipe, &y_range);
+            print_plot_command(gnu_pipe, "$plot_data", PLOT_DATA_TEXT, 0, titles, trees_cnt);
+        }
+    }
+
+    fprintf(gnu_pipe, "unset output\n");
+    if(fflush(gnu_pipe) != 0 || ferror(gnu_pipe)) {
+        LOGGER_ERROR("plot_session_plot: gnuplot closed its pipe");
+        error |= ERROR_CLOSE_FILE;
+    }
+
+    if(error != ERROR_NO) LOGGER_ERROR("plot_session_plot: sampling failed");
+    return error;
+}
+
+error_code plot_session_close(plot_session_t* session) {
+    HARD_ASSERT(session != nullptr, "session is nullptr");
+
+    LOGGER_DEBUG("plot_session_close: %zu plots done", session->plots_cnt);
+    if(!session->gnu_pipe) {
+        LOGGER_WARNING("plot_session_close: session is not opened");
+        return ERROR_NO;
+    }
+
+    fprintf(session->gnu_pipe, "quit\n");
+    int status = pclose(session->gnu_pipe);
+    session->gnu_pipe = nullptr;
+    if(status != 0) {
+        LOGGER_ERROR("plot_session_close: gnuplot exited with status %d", status);
+        return ERROR_CLOSE_FILE;
+    }
     return ERROR_NO;
 }
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "asserts.h"
+#include "logger.h"
+#include "metrics.h"
+
+metrics_state_t metrics_state = {};
+
+#define METRICS_NAME_ITEM(name, str_name) str_name,
+
+static const char* METRICS_COUNTER_NAMES[METRICS_COUNTERS_CNT] = {
+    METRICS_COUNTERS(METRICS_NAME_ITEM)
+};
+
+static const char* METRICS_PHASE_NAMES[METRICS_PHASES_CNT] = {
+    METRICS_PHASES(METRICS_NAME_ITEM)
+};
+
+#undef METRICS_NAME_ITEM
+
+//================================================================================
+
+void metrics_enable(bool is_enabled) {
+    LOGGER_DEBUG("metrics_enable: %d", (int)is_enabled);
+    metrics_state.is_enabled.store(is_enabled, std::memory_order_relaxed);
+}
+
+void metrics_reset() {
+    for(size_t i = 0; i < METRICS_COUNTERS_CNT; i++) {
+        metrics_state.counters[i].store(0, std::memory_order_relaxed);
+    }
+    for(size_t i = 0; i < METRICS_PHASES_CNT; i++) {
+        metrics_state.phase_ns[i].store(0, std::memory_order_relaxed);
+        metrics_state.phase_calls[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+long long metrics_now_ns() {
+    timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    /* never 0, so that metrics_phase_begin can use 0 as "disabled" */
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec + 1;
+}
+
+void metrics_phase_add(metrics_phase_t phase, long long elapsed_ns) {
+    HARD_ASSERT(phase < METRICS_PHASES_CNT, "phase is out of range");
+    metrics_state.phase_ns[phase].fetch_add(elapsed_ns, std::memory_order_relaxed);
+    metrics_state.phase_calls[phase].fetch_add(1, std::memory_order_relaxed);
+}
+
+size_t metrics_counter_get(metrics_counter_t counter) {
+    HARD_ASSERT(counter < METRICS_COUNTERS_CNT, "counter is out of range");
+    return metrics_state.counters[counter].load(std::memory_order_relaxed);
+}
+
+size_t metrics_phase_calls(metrics_phase_t phase) {
+    HARD_ASSERT(phase < METRICS_PHASES_CNT, "phase is out of range");
+    return metrics_state.phase_calls[phase].load(std::memory_order_relaxed);
+}
+
+long long metrics_phase_ns(metrics_phase_t phase) {
+    HARD_ASSERT(phase < METRICS_PHASES_CNT, "phase is out of range");
+    return metrics_state.phase_ns[phase].load(std::memory_order_relaxed);
+}
+
+//================================================================================
+
+static void metrics_dump_table(FILE* out) {
+    fprintf(out, "%-18s %14s\n", "counter", "value");
+    for(size_t i = 0; i < METRICS_COUNTERS_CNT; i++) {
+        fprintf(out, "%-18s %14zu\n", METRICS_COUNTER_NAMES[i], metrics_counter_get((metrics_counter_t)i));
+    }
+
+    fprintf(out, "\n%-18s %14s %14s\n", "phase", "calls", "total_ms");
+    for(size_t i = 0; i < METRICS_PHASES_CNT; i++) {
+        fprintf(out, "%-18s %14zu %14.3f\n", METRICS_PHASE_NAMES[i], metrics_phase_calls((metrics_phase_t)i),
+                (double)metrics_phase_ns((metrics_phase_t)i) / 1e6);
+    }
+}
+
+static void metrics_dump_json(FILE* out) {
+    fprintf(out, "{\n  \"counters\": {");
+    for(size_t i = 0; i < METRICS_COUNTERS_CNT; i++) {
+        fprintf(out, "%s\n    \"%s\": %zu", i ? "," : "", METRICS_COUNTER_NAMES[i],
+                metrics_counter_get((metrics_counter_t)i));
+    }
+
+    fprintf(out, "\n  },\n  \"phases\": {");
+    for(size_t i = 0; i < METRICS_PHASES_CNT; i++) {
+        fprintf(out, "%s\n    \"%s\": {\"calls\": %zu, \"ns\": %lld}", i ? "," : "", METRICS_PHASE_NAMES[i],
+                metrics_phase_calls((metrics_phase_t)i), metrics_phase_ns((metrics_phase_t)i));
+    }
+    fprintf(out, "\n  }\n}\n");
+}
+
+error_code metrics_dump(FILE* out, metrics_format_t format) {
+    HARD_ASSERT(out != nullptr, "out is nullptr");
+
+    switch(format) {
+        case METRICS_FORMAT_TABLE: metrics_dump_table(out); break;
+        case METRICS_FORMAT_JSON:  metrics_dump_json(out);  break;
+        default:
+            LOGGER_ERROR("metrics_dump: unknown format %d", (int)format);
+            return ERROR_INCORRECT_ARGS;
+    }
+
+    fflush(out);
+    return ERROR_NO;
+}
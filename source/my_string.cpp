@@ -1,12 +1,17 @@
 #include "../include/my_string.h"
 
+/* the common prefix first, then the shorter string goes first: "x" != "xy" */
+static int my_lenstrcmp(const char* str1, size_t len1, const char* str2, size_t len2) {
+    size_t common_len = len1 < len2 ? len1 : len2;
+    int    cmp        = common_len ? memcmp(str1, str2, common_len) : 0;
+    if(cmp != 0) return cmp;
+    return (len1 > len2) - (len1 < len2);
+}
+
 int my_ssstrcmp(c_string_t str1, c_string_t str2) {
-    if(str1.len > str2.len) return strncmp(str1.ptr, str2.ptr, str1.len);
-    return strncmp(str1.ptr, str2.ptr, str1.len);
+    return my_lenstrcmp(str1.ptr, str1.len, str2.ptr, str2.len);
 }
 
 int my_scstrcmp(c_string_t str1, const char* str2) {
-    size_t str2_len = strlen(str2);
-    if(str1.len > str2_len) return strncmp(str1.ptr, str2, str1.len);
-    return strncmp(str1.ptr, str2, str1.len);
+    return my_lenstrcmp(str1.ptr, str1.len, str2, strlen(str2));
 }
@@ -0,0 +1,120 @@
+#include <charconv>
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+
+#include "asserts.h"
+#include "num_literal.h"
+
+//================================================================================
+
+static const size_t   NUM_MAX_DIGITS        = 19;          /* still fit in uint64_t      */
+static const uint64_t NUM_FAST_MAX_MANTISSA = 1ull << 53;  /* exact in a double          */
+static const long     NUM_MAX_EXP10         = 100000;      /* far past the double range  */
+
+/* every power here is exact in a double */
+static const double POW10_EXACT[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static const long NUM_FAST_MAX_EXP10 = (long)(sizeof(POW10_EXACT) / sizeof(POW10_EXACT[0])) - 1;
+
+//================================================================================
+
+static bool is_digit_at(const char* str, size_t pos, size_t max_len) {
+    return pos < max_len && '0' <= str[pos] && str[pos] <= '9';
+}
+
+size_t num_literal_scan(const char* str, size_t max_len, double* val) {
+    HARD_ASSERT(str != nullptr, "str is nullptr");
+    HARD_ASSERT(val != nullptr, "val is nullptr");
+
+    size_t   pos          = 0;
+    uint64_t mantissa     = 0;
+    size_t   digits_cnt   = 0;     /* significant digits in mantissa */
+    long     exp10        = 0;
+    bool     is_truncated = false; /* digits past NUM_MAX_DIGITS were dropped */
+
+    if (!is_digit_at(str, 0, max_len)) return 0;
+
+    for (; is_digit_at(str, pos, max_len); pos++) {
+        uint64_t digit = (uint64_t)(str[pos] - '0');
+        if (mantissa == 0 && digit == 0) continue;
+        if (digits_cnt < NUM_MAX_DIGITS) {
+            mantissa = mantissa * 10 + digit;
+            digits_cnt++;
+        } else {
+            exp10++;
+            is_truncated = true;
+        }
+    }
+
+    if (pos < max_len && str[pos] == '.') {
+        for (pos++; is_digit_at(str, pos, max_len); pos++) {
+            uint64_t digit = (uint64_t)(str[pos] - '0');
+            if (mantissa == 0 && digit == 0) {
+                exp10--;
+                continue;
+            }
+            if (digits_cnt < NUM_MAX_DIGITS) {
+                mantissa = mantissa * 10 + digit;
+                digits_cnt++;
+                exp10--;
+            } else {
+                is_truncated = true;
+            }
+        }
+    }
+
+    if (pos < max_len && (str[pos] == 'e' || str[pos] == 'E')) {
+        size_t exp_pos  = pos + 1;
+        bool   is_minus = false;
+        if (exp_pos < max_len && (str[exp_pos] == '+' || str[exp_pos] == '-')) {
+            is_minus = str[exp_pos] == '-';
+            exp_pos++;
+        }
+        if (is_digit_at(str, exp_pos, max_len)) { /* otherwise 'e' is not part of the literal */
+            long exp_val = 0;
+            for (; is_digit_at(str, exp_pos, max_len); exp_pos++) {
+                if (exp_val < NUM_MAX_EXP10) exp_val = exp_val * 10 + (str[exp_pos] - '0');
+            }
+            exp10 += is_minus ? -exp_val : exp_val;
+            pos = exp_pos;
+        }
+    }
+
+    if (mantissa == 0) {
+        *val = 0;
+        return pos;
+    }
+    /* Clinger: both operands are exact, so the one rounding of * or / is the correct one */
+    if (!is_truncated && mantissa <= NUM_FAST_MAX_MANTISSA && -NUM_FAST_MAX_EXP10 <= exp10 && exp10 <= NUM_FAST_MAX_EXP10) {
+        *val = exp10 < 0 ? (double)mantissa / POW10_EXACT[-exp10] : (double)mantissa * POW10_EXACT[exp10];
+        return pos;
+    }
+
+    std::from_chars_result res = std::from_chars(str, str + pos, *val, std::chars_format::general);
+    if (res.ec == std::errc::result_out_of_range) *val = exp10 > 0 ? HUGE_VAL : 0;
+    return pos;
+}
+
+size_t num_literal_print(double val, char* buf) {
+    HARD_ASSERT(buf != nullptr, "buf is nullptr");
+
+    if (isnan(val)) {
+        buf[0] = '\0';
+        return 0;
+    }
+    if (isinf(val)) { /* scans back to HUGE_VAL, there is no inf in the grammar */
+        const char* inf_str = val > 0 ? "1e999" : "-1e999";
+        size_t      len     = strlen(inf_str);
+        memcpy(buf, inf_str, len + 1);
+        return len;
+    }
+
+    std::to_chars_result res = std::to_chars(buf, buf + NUM_LITERAL_MAX_LEN - 1, val);
+    HARD_ASSERT(res.ec == std::errc(), "NUM_LITERAL_MAX_LEN is too small");
+    *res.ptr = '\0';
+    return (size_t)(res.ptr - buf);
+}
@@ -0,0 +1,67 @@
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "asserts.h"
+#include "logger.h"
+#include "parallel.h"
+
+//================================================================================
+
+static const size_t MAX_THREADS_CNT = 64;
+
+struct parallel_ctx_t {
+    parallel_task_func_t task_func;
+    void*                ctx;
+    size_t               tasks_cnt;
+    size_t               next_task;
+};
+
+//================================================================================
+
+size_t parallel_threads_cnt() {
+    long cpu_cnt = sysconf(_SC_NPROCESSORS_ONLN);
+    if(cpu_cnt < 1) return 1;
+    if((size_t)cpu_cnt > MAX_THREADS_CNT) return MAX_THREADS_CNT;
+    return (size_t)cpu_cnt;
+}
+
+static void* parallel_worker(void* arg) {
+    parallel_ctx_t* parallel_ctx = (parallel_ctx_t*)arg;
+
+    while(true) {
+        size_t task_idx = __atomic_fetch_add(&parallel_ctx->next_task, 1, __ATOMIC_RELAXED);
+        if(task_idx >= parallel_ctx->tasks_cnt) break;
+        parallel_ctx->task_func(task_idx, parallel_ctx->ctx);
+    }
+    return nullptr;
+}
+
+error_code parallel_for(size_t tasks_cnt, size_t threads_cnt, parallel_task_func_t task_func, void* ctx) {
+    HARD_ASSERT(task_func != nullptr, "task_func is nullptr");
+
+    if(tasks_cnt == 0) return ERROR_NO;
+
+    if(threads_cnt == 0)              threads_cnt = parallel_threads_cnt();
+    if(threads_cnt > tasks_cnt)       threads_cnt = tasks_cnt;
+    if(threads_cnt > MAX_THREADS_CNT) threads_cnt = MAX_THREADS_CNT;
+
+    parallel_ctx_t parallel_ctx = {task_func, ctx, tasks_cnt, 0};
+
+    pthread_t workers[MAX_THREADS_CNT] = {};
+    size_t    started_cnt = 0;
+    for(size_t i = 1; i < threads_cnt; i++) {
+        if(pthread_create(&workers[started_cnt], nullptr, parallel_worker, &parallel_ctx) != 0) {
+            LOGGER_WARNING("parallel_for: pthread_create failed, continuing with %zu threads", started_cnt + 1);
+            break;
+        }
+        started_cnt++;
+    }
+
+    parallel_worker(&parallel_ctx);
+
+    for(size_t i = 0; i < started_cnt; i++) {
+        pthread_join(workers[i], nullptr);
+    }
+    return ERROR_NO;
+}
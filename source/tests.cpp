@@ -25,6 +25,15 @@
 #include "input_parser.h"
 #include "teylor.h"
 #include "make_graph.h"
+#include "expr_generator.h"
+#include "metrics.h"
+#include "batch_service.h"
+#include "diff_cache.h"
+#include "interval.h"
+#include "dump_pipeline.h"
+#include "tree_check.h"
+#include "num_literal.h"
+#include "forest_file_io.h"
 
 static double CMP_PRECISION = 1e-9;
 
@@ -499,6 +508,359 @@ static void test_write_complex_tree() {
     LOGGER_INFO("Тест пройден: запись сложного дерева\n");
 }
 
+static error_code parse_text_to_tree(tree_t* tree, const char* text) {
+    destroy_node_recursive(tree->root, nullptr);
+    tree->root = nullptr;
+    tree->size = 0;
+    tree->buff = {text, strlen(text)};
+    return tree_parse_from_buffer(tree);
+}
+
+static void test_parse_iterative() {
+    LOGGER_INFO("=== Тест: чтение дерева без рекурсии ===");
+
+    const size_t terms_cnt  = 5000;
+    const size_t term_len   = 32;
+    static char  expr[terms_cnt * term_len] = {};
+
+    error_code error = ERROR_NO;
+
+    forest_t forest = {};
+    error |= forest_init(&forest ON_DEBUG(, VER_INIT));
+    HARD_ASSERT(error == ERROR_NO, "forest_init failed");
+    tree_t* tree      = forest_add_tree(&forest, &error);
+    tree_t* read_tree = forest_add_tree(&forest, &error);
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+
+    size_t expr_len = 0;
+    for(size_t i = 0; i < terms_cnt; i++) {
+        expr_len += (size_t)snprintf(expr + expr_len, sizeof(expr) - expr_len, i ? " + %zu.5 * sin(x ^ y)" : "%zu.5 * sin(x ^ y)", i);
+    }
+    const char*  cur  = expr;
+    tree_node_t* root = get_g(tree, &cur);
+    HARD_ASSERT(root != nullptr, "get_g failed");
+    tree_replace_root(tree, root);
+    tree->size = count_nodes_recursive(root);
+
+    const char* filename = "test_parse_iterative.tree";
+    error |= tree_write_to_file(tree, filename);
+    string_t file_buff = {};
+    error |= read_file_to_buffer_by_name(&file_buff, filename);
+    HARD_ASSERT(error == ERROR_NO, "writing and reading back failed");
+
+    /* the chain of sums is terms_cnt deep */
+    read_tree->buff = {file_buff.ptr, file_buff.len};
+    error = tree_parse_from_buffer(read_tree);
+    HARD_ASSERT(error == ERROR_NO, "tree_parse_from_buffer failed");
+    HARD_ASSERT(read_tree->size == tree->size && subtree_equal(read_tree->root, tree->root), "deep tree is read wrong");
+
+    const char* text = "(+ (\"x\" nil nil) (sin (\"new_var\" nil nil) nil))";
+    error = parse_text_to_tree(read_tree, text);
+    HARD_ASSERT(error == ERROR_NO && read_tree->size == 4, "small tree is read wrong");
+    HARD_ASSERT(get_var_idx({"new_var", 7}, forest.var_stack) >= 0, "new var is not added");
+    tree_node_t* fast_root = read_tree->root;
+    read_tree->root = nullptr;
+    error = tree_parse_from_buffer_stepwise(read_tree);
+    HARD_ASSERT(error == ERROR_NO && subtree_equal(read_tree->root, fast_root), "readers disagree");
+    destroy_node_recursive(fast_root, nullptr);
+
+    const char* broken_texts[] = {
+        "(+ (\"x\" nil nil) nil",
+        "(+ (\"x\" nil nil) nil nil)",
+        "(foo nil nil)",
+        "(+ (\"x nil nil) nil)",
+        "(+ (1.5.5 nil nil) nil)",
+        "(",
+        "x",
+    };
+    for(size_t i = 0; i < sizeof(broken_texts) / sizeof(broken_texts[0]); i++) {
+        HARD_ASSERT(parse_text_to_tree(read_tree, broken_texts[i]) != ERROR_NO && read_tree->root == nullptr,
+                    "broken text is read");
+    }
+    read_tree->buff = {nullptr, 0};
+
+    error = forest_dest(&forest);
+    HARD_ASSERT(error == ERROR_NO, "forest_dest failed");
+    free(file_buff.ptr);
+    remove(filename);
+    LOGGER_INFO("Тест пройден: чтение дерева без рекурсии\n");
+}
+
+static void test_write_real_constants() {
+    LOGGER_INFO("=== Тест: запись вещественных констант без потерь ===");
+
+    uint64_t bits_seed = 46;
+    for(size_t i = 0; i < 100000; i++) {
+        bits_seed ^= bits_seed << 13;
+        bits_seed ^= bits_seed >> 7;
+        bits_seed ^= bits_seed << 17;
+        double val = 0;
+        memcpy(&val, &bits_seed, sizeof(val));
+        if(isnan(val)) continue;
+
+        char   buff[NUM_LITERAL_MAX_LEN] = {};
+        size_t len      = num_literal_print(val, buff);
+        size_t sign_len = buff[0] == '-' ? 1 : 0;
+        double read_val = 0;
+        HARD_ASSERT(num_literal_scan(buff + sign_len, SIZE_MAX, &read_val) + sign_len == len, "printed literal is not read whole");
+        if(sign_len) read_val = -read_val;
+        HARD_ASSERT(memcmp(&val, &read_val, sizeof(val)) == 0, "double does not round-trip");
+    }
+
+    char buff[NUM_LITERAL_MAX_LEN] = {};
+    HARD_ASSERT(num_literal_print(0.1, buff) == 3 && strcmp(buff, "0.1") == 0, "output is not the shortest");
+    HARD_ASSERT(num_literal_print(NAN, buff) == 0, "nan was printed");
+
+    long long begin_ns = metrics_now_ns();
+    for(size_t i = 0; i < 100000; i++) num_literal_print(M_E * (double)i, buff);
+    long long print_ns = metrics_now_ns() - begin_ns;
+    begin_ns = metrics_now_ns();
+    for(size_t i = 0; i < 100000; i++) snprintf(buff, sizeof(buff), "%.17g", M_E * (double)i);
+    long long printf_ns = metrics_now_ns() - begin_ns;
+    LOGGER_INFO("100000 doubles: num_literal_print %.1f ms, %%.17g %.1f ms", (double)print_ns / 1e6, (double)printf_ns / 1e6);
+
+    error_code error = ERROR_NO;
+
+    forest_t forest = {};
+    error |= forest_init(&forest ON_DEBUG(, VER_INIT));
+    HARD_ASSERT(error == ERROR_NO, "forest_init failed");
+    tree_t* test_tree = forest_add_tree(&forest, &error);
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+
+    const double constants[] = {M_E, 0.5, 1.0 / 3, 1.0 / 120, -0.0, -2.75, 1e300, 5e-324, 2.2250738585072014e-308,
+                                123456789.125, HUGE_VAL, -HUGE_VAL};
+    tree_node_t* root = init_node(CONSTANT, make_union_const(constants[0]), nullptr, nullptr);
+    for(size_t i = 1; i < sizeof(constants) / sizeof(constants[0]); i++) {
+        tree_node_t* leaf = init_node(CONSTANT, make_union_const(constants[i]), nullptr, nullptr);
+        root = init_node(FUNCTION, make_union_func(ADD), root, leaf);
+    }
+    tree_replace_root(test_tree, root);
+
+    const char* filename = "test_write_real.tree";
+    error = tree_write_to_file(test_tree, filename);
+    HARD_ASSERT(error == ERROR_NO, "tree_write_to_file failed");
+
+    forest_t read_forest = {};
+    error |= forest_init(&read_forest ON_DEBUG(, VER_INIT));
+    HARD_ASSERT(error == ERROR_NO, "forest_init failed");
+    tree_t* read_tree = forest_add_tree(&read_forest, &error);
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+    error = tree_read_from_file(read_tree, filename);
+    HARD_ASSERT(error == ERROR_NO, "tree_read_from_file failed");
+    HARD_ASSERT(subtree_equal(test_tree->root, read_tree->root), "constants changed after write and read");
+    free(const_cast<char*>(read_tree->buff.ptr));
+
+    tree_t* nan_tree = forest_add_tree(&forest, &error);
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+    tree_replace_root(nan_tree, init_node(CONSTANT, make_union_const(NAN), nullptr, nullptr));
+    HARD_ASSERT(tree_write_to_file(nan_tree, filename) == ERROR_NAN_CONST, "nan constant was written");
+
+    FILE* test_file = fopen(filename, "w");
+    HARD_ASSERT(test_file != nullptr, "failed to create test file");
+    fprintf(test_file, "%s %d\n(1.5 nil nil)", TREE_FILE_MAGIC, TREE_FILE_VERSION + 1);
+    fclose(test_file);
+    tree_t* future_tree = forest_add_tree(&read_forest, &error);
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+    HARD_ASSERT(tree_read_from_file(future_tree, filename) != ERROR_NO, "unknown format version was read");
+    free(const_cast<char*>(future_tree->buff.ptr));
+
+    forest_dest(&forest);
+    forest_dest(&read_forest);
+    remove(filename);
+    LOGGER_INFO("Тест пройден: запись вещественных констант без потерь\n");
+}
+
+static bool forests_equal(const forest_t* first, const forest_t* second) {
+    ssize_t first_idx  = first->tree_list->arr[0].next;
+    ssize_t second_idx = second->tree_list->arr[0].next;
+    for(; first_idx != 0 && second_idx != 0; first_idx  = first->tree_list->arr[first_idx].next,
+                                             second_idx = second->tree_list->arr[second_idx].next) {
+        const tree_t* first_tree  = first->tree_list->arr[first_idx].val;
+        const tree_t* second_tree = second->tree_list->arr[second_idx].val;
+        if(my_ssstrcmp(first_tree->name, second_tree->name) != 0 || first_tree->size != second_tree->size ||
+           !subtree_equal(first_tree->root, second_tree->root)) {
+            return false;
+        }
+    }
+    return first_idx == 0 && second_idx == 0;
+}
+
+static void test_forest_file() {
+    LOGGER_INFO("=== Тест: файлы леса из многих деревьев ===");
+
+    const size_t trees_cnt = 300;
+    static char  names[trees_cnt][16] = {};
+    static char  exprs[trees_cnt][64] = {}; /* var names point into the text */
+
+    error_code error = ERROR_NO;
+
+    forest_t forest = {};
+    error |= forest_init(&forest ON_DEBUG(, VER_INIT));
+    HARD_ASSERT(error == ERROR_NO, "forest_init failed");
+
+    for(size_t i = 0; i < trees_cnt; i++) {
+        char* expr = exprs[i];
+        snprintf(expr, sizeof(exprs[i]), i % 3 ? "%zu.25 * x + sin(y) ^ %zu" : "log(2, z + %zu.5e-3) - x / %zu", i, i % 7);
+        tree_t*      tree = forest_add_tree(&forest, &error);
+        const char*  cur  = expr;
+        tree_node_t* root = get_g(tree, &cur);
+        HARD_ASSERT(error == ERROR_NO && root != nullptr, "get_g failed");
+        tree_replace_root(tree, root);
+        tree->size = count_nodes_recursive(root);
+        snprintf(names[i], sizeof(names[i]), "expr_%zu", i);
+        tree->name = {names[i], strlen(names[i])};
+    }
+    forest_add_tree(&forest, &error); /* empty tree without a name */
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+
+    const char*          filenames[] = {"forest_test.txt", "forest_test.bin"};
+    forest_file_format_t formats[]   = {FOREST_FILE_TEXT, FOREST_FILE_BINARY};
+    for(size_t i = 0; i < 2; i++) {
+        error = forest_write_to_file(&forest, filenames[i], formats[i]);
+        HARD_ASSERT(error == ERROR_NO, "forest_write_to_file failed");
+
+        forest_t read_forest = {};
+        error |= forest_init(&read_forest ON_DEBUG(, VER_INIT));
+        error |= forest_read_from_file(&read_forest, filenames[i], 4);
+        HARD_ASSERT(error == ERROR_NO, "forest_read_from_file failed");
+        HARD_ASSERT(forests_equal(&forest, &read_forest), "read forest differs from the written one");
+
+        /* vars the forest had keep their indices, new ones follow in file order */
+        forest_t merged_forest = {};
+        error |= forest_init(&merged_forest ON_DEBUG(, VER_INIT));
+        add_var({"w", 1}, 0, merged_forest.var_stack, &error);
+        add_var({"z", 1}, 0, merged_forest.var_stack, &error);
+        error |= forest_read_from_file(&merged_forest, filenames[i], 1);
+        HARD_ASSERT(error == ERROR_NO, "forest_read_from_file into a forest with vars failed");
+        HARD_ASSERT(merged_forest.var_stack->size == 4 && get_var_idx({"z", 1}, merged_forest.var_stack) == 1 &&
+                    get_var_idx({"x", 1}, merged_forest.var_stack) == 2 &&
+                    get_var_idx({"y", 1}, merged_forest.var_stack) == 3, "vars are merged wrong");
+        HARD_ASSERT(get_var_idx({"xy", 2}, merged_forest.var_stack) == -1, "var is found by its prefix");
+
+        error |= forest_dest(&merged_forest);
+        error |= forest_dest(&read_forest);
+        HARD_ASSERT(error == ERROR_NO, "forest_dest failed");
+    }
+
+    /* a quote or a newline would break the text record, binary names are length-prefixed */
+    tree_t*    first_tree = forest.tree_list->arr[forest.tree_list->arr[0].next].val;
+    c_string_t first_name = first_tree->name;
+    first_tree->name = {"say \"hi\"\n", 10};
+    HARD_ASSERT(forest_write_to_file(&forest, filenames[0], FOREST_FILE_TEXT) == ERROR_INCORRECT_ARGS,
+                "name with a quote was written as text");
+    error = forest_write_to_file(&forest, filenames[1], FOREST_FILE_BINARY);
+    forest_t quoted_forest = {};
+    error |= forest_init(&quoted_forest ON_DEBUG(, VER_INIT));
+    error |= forest_read_from_file(&quoted_forest, filenames[1], 2);
+    HARD_ASSERT(error == ERROR_NO && forests_equal(&forest, &quoted_forest), "binary name with a quote differs");
+    error |= forest_dest(&quoted_forest);
+    first_tree->name = first_name;
+
+    FILE* test_file = fopen(filenames[0], "w");
+    HARD_ASSERT(test_file != nullptr, "failed to create test file");
+    fprintf(test_file, "%s %d\n#vars 1 \"x\"\n\"good\" (\"x\" nil nil)\n\"bad\" (\"y\" nil nil)\n",
+            FOREST_TEXT_MAGIC, FOREST_FILE_VERSION);
+    fclose(test_file);
+    forest_t bad_forest = {};
+    error |= forest_init(&bad_forest ON_DEBUG(, VER_INIT));
+    HARD_ASSERT(forest_read_from_file(&bad_forest, filenames[0], 2) & ERROR_INCORRECT_INDEX, "undeclared var was read");
+    HARD_ASSERT(bad_forest.tree_list->arr[0].next == 0, "broken file added trees");
+    error |= forest_dest(&bad_forest);
+
+    error |= forest_dest(&forest);
+    HARD_ASSERT(error == ERROR_NO, "forest_dest failed");
+    remove(filenames[0]);
+    remove(filenames[1]);
+    LOGGER_INFO("Тест пройден: файлы леса из многих деревьев\n");
+}
+
+static void test_forest_lazy() {
+    LOGGER_INFO("=== Тест: ленивое открытие файла леса ===");
+
+    const size_t trees_cnt = 300;
+    static char  names[trees_cnt][16] = {};
+    static char  exprs[trees_cnt][64] = {};
+
+    error_code error = ERROR_NO;
+
+    forest_t forest = {};
+    error |= forest_init(&forest ON_DEBUG(, VER_INIT));
+    HARD_ASSERT(error == ERROR_NO, "forest_init failed");
+
+    const tree_t* tree_17 = nullptr;
+    for(size_t i = 0; i < trees_cnt; i++) {
+        snprintf(exprs[i], sizeof(exprs[i]), "%zu * x - cos(y ^ %zu.5)", i, i % 5);
+        tree_t*      tree = forest_add_tree(&forest, &error);
+        const char*  cur  = exprs[i];
+        tree_node_t* root = get_g(tree, &cur);
+        HARD_ASSERT(error == ERROR_NO && root != nullptr, "get_g failed");
+        tree_replace_root(tree, root);
+        tree->size = count_nodes_recursive(root);
+        snprintf(names[i], sizeof(names[i]), "expr_%zu", i);
+        tree->name = {names[i], strlen(names[i])};
+        if(i == 17) tree_17 = tree;
+    }
+
+    const char*          filenames[] = {"forest_lazy_test.txt", "forest_lazy_test.bin"};
+    forest_file_format_t formats[]   = {FOREST_FILE_TEXT, FOREST_FILE_BINARY};
+    for(size_t i = 0; i < 2; i++) {
+        error = forest_write_to_file(&forest, filenames[i], formats[i]);
+        HARD_ASSERT(error == ERROR_NO, "forest_write_to_file failed");
+
+        forest_t lazy_forest = {};
+        error |= forest_init(&lazy_forest ON_DEBUG(, VER_INIT));
+        error |= forest_open_lazy(&lazy_forest, filenames[i]);
+        HARD_ASSERT(error == ERROR_NO, "forest_open_lazy failed");
+
+        size_t stubs_cnt = 0;
+        for(ssize_t idx = lazy_forest.tree_list->arr[0].next; idx != 0; idx = lazy_forest.tree_list->arr[idx].next) {
+            const tree_t* tree = lazy_forest.tree_list->arr[idx].val;
+            HARD_ASSERT(tree->is_stub && tree->root == nullptr && tree->name.len > 0, "tree is not a named stub");
+            stubs_cnt++;
+        }
+        HARD_ASSERT(stubs_cnt == trees_cnt, "wrong number of stubs");
+        HARD_ASSERT(forest_write_to_file(&lazy_forest, "forest_lazy_out.txt", FOREST_FILE_TEXT) == ERROR_NO_INIT,
+                    "stubs were written");
+
+        tree_t* tree = forest_find_tree(&lazy_forest, {"expr_17", 7}, &error);
+        HARD_ASSERT(error == ERROR_NO && tree != nullptr && !tree->is_stub, "forest_find_tree failed");
+        HARD_ASSERT(tree->size == tree_17->size && subtree_equal(tree->root, tree_17->root), "loaded tree differs");
+        HARD_ASSERT(forest_find_tree(&lazy_forest, {"expr_1000", 9}, &error) == nullptr && error == ERROR_NO,
+                    "missing tree is found");
+
+        error |= forest_load_all(&lazy_forest, 4);
+        HARD_ASSERT(error == ERROR_NO, "forest_load_all failed");
+        HARD_ASSERT(forests_equal(&forest, &lazy_forest), "lazy forest differs from the written one");
+
+        error |= forest_dest(&lazy_forest);
+        HARD_ASSERT(error == ERROR_NO, "forest_dest failed");
+    }
+
+    /* version 1 has no index, the records are found by scanning; a broken record stays a stub */
+    FILE* test_file = fopen(filenames[0], "w");
+    HARD_ASSERT(test_file != nullptr, "failed to create test file");
+    fprintf(test_file, "%s 1\n#vars 1 \"x\"\n\"good\" (\"x\" nil nil)\n\"bad\" (\"y\" nil nil)\n", FOREST_TEXT_MAGIC);
+    fclose(test_file);
+    forest_t old_forest = {};
+    error |= forest_init(&old_forest ON_DEBUG(, VER_INIT));
+    error |= forest_open_lazy(&old_forest, filenames[0]);
+    HARD_ASSERT(error == ERROR_NO, "forest_open_lazy of a version 1 file failed");
+    tree_t* good = forest_find_tree(&old_forest, {"good", 4}, &error);
+    HARD_ASSERT(error == ERROR_NO && good != nullptr && good->size == 1, "tree of a version 1 file is not loaded");
+    tree_t* bad = forest_find_tree(&old_forest, {"bad", 3}, &error);
+    HARD_ASSERT(bad == nullptr && (error & ERROR_INCORRECT_INDEX), "broken record is loaded");
+    bad = old_forest.tree_list->arr[old_forest.tree_list->arr[0].prev].val;
+    HARD_ASSERT(bad->is_stub && bad->root == nullptr, "broken record is not a stub");
+    error = forest_dest(&old_forest);
+
+    error |= forest_dest(&forest);
+    HARD_ASSERT(error == ERROR_NO, "forest_dest failed");
+    remove(filenames[0]);
+    remove(filenames[1]);
+    remove("forest_lazy_out.txt");
+    LOGGER_INFO("Тест пройден: ленивое открытие файла леса\n");
+}
+
 //================================================================================
 
 static void test_dump_empty_tree() {
@@ -567,6 +929,220 @@ static void test_dump_copied_tree() {
     LOGGER_INFO("Тест пройден: дамп скопированного дерева\n");
 }
 
+static void test_dump_pipeline() {
+    LOGGER_INFO("=== Тест: конвейер дампов ===");
+
+    error_code error = ERROR_NO;
+
+    forest_t forest = {};
+    error |= forest_init(&forest ON_DEBUG(, VER_INIT));
+    error |= forest_open_dump_file(&forest, "dump_pipeline.html");
+    HARD_ASSERT(error == ERROR_NO, "forest_init failed");
+
+    tree_t* tree = forest_add_tree(&forest, &error);
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+    const char* expr = "sin(x) * x + 2$";
+    tree_replace_root(tree, get_g(tree, &expr));
+
+    dump_pipeline_flush();
+    dump_pipeline_stats_t before = dump_pipeline_stats();
+    for(int i = 0; i < 8; i++) {
+        error |= tree_dump(tree, VER_INIT, true, "same tree #%d", i);
+    }
+    HARD_ASSERT(error == ERROR_NO, "tree_dump failed");
+
+    const char dot_text[] = "digraph T{\n  a -> b;\n}\n";
+    char first_path[DUMP_PIPELINE_PATH_SIZE]  = {};
+    char second_path[DUMP_PIPELINE_PATH_SIZE] = {};
+    error |= dump_pipeline_submit(dot_text, sizeof(dot_text) - 1, first_path,  sizeof(first_path));
+    error |= dump_pipeline_submit(dot_text, sizeof(dot_text) - 1, second_path, sizeof(second_path));
+    HARD_ASSERT(error == ERROR_NO, "dump_pipeline_submit failed");
+    HARD_ASSERT(strcmp(first_path, second_path) == 0, "identical graphs got different svg paths");
+    const char other_text[] = "digraph T{\n  b -> a;\n}\n";
+    error |= dump_pipeline_submit(other_text, sizeof(other_text) - 1, second_path, sizeof(second_path));
+    HARD_ASSERT(error == ERROR_NO && strcmp(first_path, second_path) != 0, "different graphs share an svg path");
+
+    dump_pipeline_flush();
+    dump_pipeline_stats_t after = dump_pipeline_stats();
+    size_t submitted    = after.submitted    - before.submitted;
+    size_t deduplicated = after.deduplicated - before.deduplicated;
+    size_t finished     = after.rendered + after.failed - before.rendered - before.failed;
+    HARD_ASSERT(submitted == 11,   "not every dump reached the pipeline");
+    HARD_ASSERT(deduplicated >= 8, "identical graphs were rendered twice");
+    HARD_ASSERT(finished == submitted - deduplicated, "flush returned before renders finished");
+
+    error |= forest_dest(&forest);
+    HARD_ASSERT(error == ERROR_NO, "forest_dest failed");
+    remove("dump_pipeline.html");
+    LOGGER_INFO("Тест пройден: конвейер дампов \n");
+}
+
+static void test_dump_big_tree() {
+    LOGGER_INFO("=== Тест: дамп большого дерева ===");
+
+    error_code error = ERROR_NO;
+
+    forest_t forest = {};
+    error |= forest_init(&forest ON_DEBUG(, VER_INIT));
+    error |= forest_open_dump_file(&forest, "big_dump.html");
+    HARD_ASSERT(error == ERROR_NO, "forest_init failed");
+
+    tree_t* tree = forest_add_tree(&forest, &error);
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+    const char* expr = "x$";
+    tree_replace_root(tree, get_g(tree, &expr));
+    size_t x_idx = tree->root->value.var_idx;
+
+    const size_t leaves_cnt = (size_t)1 << 19;
+    tree_node_t** level = (tree_node_t**)calloc(leaves_cnt, sizeof(tree_node_t*));
+    HARD_ASSERT(level != nullptr, "calloc failed");
+    for(size_t i = 0; i < leaves_cnt; i++) level[i] = init_node(VARIABLE, make_union_var(x_idx), nullptr, nullptr);
+    for(size_t level_cnt = leaves_cnt; level_cnt > 1; level_cnt /= 2) {
+        for(size_t i = 0; i < level_cnt / 2; i++) {
+            level[i] = init_node(FUNCTION, make_union_func(ADD), level[2 * i], level[2 * i + 1]);
+        }
+    }
+    tree_replace_root(tree, level[0]);
+    free(level);
+    HARD_ASSERT(count_nodes_recursive(tree->root) == 2 * leaves_cnt - 1, "big tree was not built");
+
+    tree_dump_set_limits({16, 1024});
+    long long begin_ns = metrics_now_ns();
+    error |= tree_dump(tree, VER_INIT, true, "big tree");
+    long long dump_ns = metrics_now_ns() - begin_ns;
+    HARD_ASSERT(error == ERROR_NO, "big tree dump failed");
+    LOGGER_INFO("dump of %zu nodes took %.1f ms", 2 * leaves_cnt - 1, (double)dump_ns / 1e6);
+
+    tree_node_t* shared = tree->root->left->left;
+    tree_node_t* right  = tree->root->left->right;
+    tree->root->left->right = shared;
+    error |= tree_dump(tree, VER_INIT, true, "shared subtree");
+    tree->root->left->right = right;
+
+    /* 2^100 paths through 101 nodes: every node is emitted or summarized once */
+    const size_t dag_levels = 100;
+    tree_node_t* tree_root  = tree->root;
+    tree_node_t* dag        = init_node(VARIABLE, make_union_var(x_idx), nullptr, nullptr);
+    for(size_t i = 0; i < dag_levels; i++) dag = init_node(FUNCTION, make_union_func(ADD), dag, dag);
+    tree->root = dag;
+    tree_dump_set_limits({64, 4096});
+    error |= tree_dump(tree, VER_INIT, true, "dag");
+    tree->root = tree_root;
+    while(dag) {
+        tree_node_t* next = dag->left;
+        node_free(dag);
+        dag = next;
+    }
+    tree_dump_set_limits({0, 0});
+
+    error |= forest_dest(&forest);
+    HARD_ASSERT(error == ERROR_NO, "forest_dest failed");
+
+    FILE* html = fopen("big_dump.html", "r");
+    HARD_ASSERT(html != nullptr, "big_dump.html is missing");
+    size_t rows_cnt = 0, collapsed_cnt = 0, shared_cnt = 0, summaries_cnt = 0;
+    bool   has_dag_summary = false;
+    char line[256] = {};
+    while(fgets(line, sizeof(line), html)) {
+        if(strstr(line, "36 nodes, depth 36")) has_dag_summary = true;
+        if(sscanf(line, "rows: %zu, collapsed subtrees: %zu, shared nodes: %zu", &rows_cnt, &collapsed_cnt, &shared_cnt) == 3) {
+            summaries_cnt++;
+            if(summaries_cnt == 1) {
+                HARD_ASSERT(rows_cnt <= 1024 + collapsed_cnt, "dump exceeded its node limit");
+                HARD_ASSERT(collapsed_cnt > 0 && shared_cnt == 0, "big tree was not collapsed");
+            }
+            if(summaries_cnt == 2) HARD_ASSERT(shared_cnt == 1, "shared subtree was not shown once");
+        }
+    }
+    fclose(html);
+    HARD_ASSERT(summaries_cnt == 3 && collapsed_cnt == 1, "collapsed dag subtree was not shown once");
+    HARD_ASSERT(has_dag_summary, "dag summary counts paths instead of nodes");
+
+    remove("big_dump.html");
+    LOGGER_INFO("Тест пройден: дамп большого дерева \n");
+}
+
+static void test_tree_check() {
+    LOGGER_INFO("=== Тест: проверка структуры дерева ===");
+
+    error_code error = ERROR_NO;
+
+    forest_t forest = {};
+    error |= forest_init(&forest ON_DEBUG(, VER_INIT));
+    HARD_ASSERT(error == ERROR_NO, "forest_init failed");
+
+    tree_t* tree = forest_add_tree(&forest, &error);
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+    const char* expr = "sin(x) * y + ln(x ^ 2)$";
+    tree_replace_root(tree, get_g(tree, &expr));
+    HARD_ASSERT(tree->root != nullptr, "parse failed");
+
+    tree_check_report_t report = {};
+    error = tree_check(tree, 0, &report);
+    HARD_ASSERT(error == ERROR_NO && report.nodes_cnt == tree->size, "valid tree failed the check");
+
+    tree_node_t* sin_node = tree->root->left->left;
+    tree_node_t* x_node   = sin_node->left;
+    tree_node_t* y_node   = tree->root->left->right;
+
+    sin_node->right = y_node;
+    error = tree_check(tree, 0, &report);
+    HARD_ASSERT(error == (ERROR_SHARED_NODE | ERROR_BAD_ARITY) && report.shared_cnt == 1, "shared node missed");
+    sin_node->right = nullptr;
+
+    x_node->left = tree->root;
+    error = tree_check(tree, 0, &report);
+    HARD_ASSERT((error & ERROR_SHARED_NODE) && (error & ERROR_BAD_ARITY), "cycle missed");
+    x_node->left = nullptr;
+
+    size_t x_idx = x_node->value.var_idx;
+    x_node->value.var_idx = tree->var_stack->size;
+    error = tree_check(tree, 0, &report);
+    HARD_ASSERT(error == ERROR_INCORRECT_INDEX && report.var_idx_cnt == 1, "bad var_idx missed");
+    x_node->value.var_idx = x_idx;
+
+    y_node->type           = CONSTANT;
+    y_node->value.constant = NAN;
+    error = tree_check(tree, 0, &report);
+    HARD_ASSERT(error == ERROR_NAN_CONST && report.nan_cnt == 1, "nan constant missed");
+
+    tree->size++;
+    error = tree_check(tree, 0, &report);
+    HARD_ASSERT(error == (ERROR_NAN_CONST | ERROR_SIZE_MISMATCH), "size mismatch missed");
+    tree->size--;
+
+    const size_t leaves_cnt = (size_t)1 << 19;
+    tree_node_t** level = (tree_node_t**)calloc(leaves_cnt, sizeof(tree_node_t*));
+    HARD_ASSERT(level != nullptr, "calloc failed");
+    for(size_t i = 0; i < leaves_cnt; i++) level[i] = init_node(CONSTANT, make_union_const((double)i), nullptr, nullptr);
+    for(size_t level_cnt = leaves_cnt; level_cnt > 1; level_cnt /= 2) {
+        for(size_t i = 0; i < level_cnt / 2; i++) {
+            level[i] = init_node(FUNCTION, make_union_func(MUL), level[2 * i], level[2 * i + 1]);
+        }
+    }
+    tree_replace_root(tree, level[0]);
+    tree->size = count_nodes_recursive(tree->root);
+    free(level);
+
+    long long begin_ns = metrics_now_ns();
+    error = tree_check(tree, 4, &report);
+    long long check_ns = metrics_now_ns() - begin_ns;
+    HARD_ASSERT(error == ERROR_NO && report.nodes_cnt == 2 * leaves_cnt - 1, "big tree failed the check");
+    HARD_ASSERT(report.tasks_cnt > 1, "big tree was not split between threads");
+    LOGGER_INFO("check of %zu nodes in %zu tasks took %.1f ms", report.nodes_cnt, report.tasks_cnt, (double)check_ns / 1e6);
+
+    tree_node_t* deep = tree->root->right->right->right->left->left;
+    tree_node_t* own  = deep->left;
+    deep->left = tree->root->left->left;
+    error = tree_check(tree, 4, &report);
+    HARD_ASSERT(error == ERROR_SHARED_NODE && report.shared_cnt == 1, "shared node missed in big tree");
+    deep->left = own;
+
+    error = forest_dest(&forest);
+    HARD_ASSERT(error == ERROR_NO, "forest_dest failed");
+    LOGGER_INFO("Тест пройден: проверка структуры дерева \n");
+}
+
 static void test_calculate_tree_without_vars() {
     LOGGER_INFO("=== Тест: подсчет дерева без переменных ===");
     
@@ -640,6 +1216,47 @@ static void test_calculate_tree_with_vars() {
     LOGGER_INFO("Тест пройден: подсчет дерева с переменными \n");
 }
 
+static void test_calculate_tree_bound() {
+    LOGGER_INFO("=== Тест: подсчет дерева с привязкой переменных ===");
+
+    error_code error = ERROR_NO;
+
+    forest_t forest = {};
+    error |= forest_init(&forest ON_DEBUG(, VER_INIT));
+    HARD_ASSERT(error == ERROR_NO, "forest_init failed");
+
+    tree_t* tree = forest_add_tree(&forest, &error);
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+
+    tree_node_t* new_root = ADD_(MUL_(v("x"), v("x")), v("y"));
+    tree_replace_root(tree, new_root);
+
+    var_bindings_t first  = {};
+    var_bindings_t second = {};
+    error |= var_bindings_init(&first,  forest.var_stack);
+    error |= var_bindings_init(&second, forest.var_stack);
+    HARD_ASSERT(error == ERROR_NO, "var_bindings_init failed");
+
+    size_t x_idx = (size_t)get_var_idx({"x", 1}, forest.var_stack);
+    size_t y_idx = (size_t)get_var_idx({"y", 1}, forest.var_stack);
+    bind_var_val(&first,  x_idx, 2);
+    bind_var_val(&first,  y_idx, 1);
+    bind_var_val(&second, x_idx, 3);
+    bind_var_val(&second, y_idx, -4);
+
+    var_val_type first_ans  = calculate_tree_bound(tree, &first,  &error);
+    var_val_type second_ans = calculate_tree_bound(tree, &second, &error);
+    HARD_ASSERT(error == ERROR_NO, "calculate_tree_bound failed");
+    HARD_ASSERT(double_cmp(first_ans,  5) == 0, "first answer should be 5");
+    HARD_ASSERT(double_cmp(second_ans, 5) == 0, "second answer should be 5");
+    HARD_ASSERT(double_cmp(forest.var_stack->data[x_idx].val, 0) == 0, "var_stack should stay untouched");
+
+    var_bindings_dest(&first);
+    var_bindings_dest(&second);
+    forest_dest(&forest);
+    LOGGER_INFO("Тест пройден: подсчет дерева с привязкой переменных \n");
+}
+
 static void test_calculate_tree_diff() {
     LOGGER_INFO("=== Тест: подсчет производной сложного дерева ===");
     
@@ -920,6 +1537,991 @@ static void test_tree_hard_tex() {
     LOGGER_INFO("Тест пройден: множественный тех \n");
 }
 
+static void test_expr_generator() {
+    LOGGER_INFO("=== Тест: генератор выражений ===");
+
+    error_code error = ERROR_NO;
+
+    forest_t forest = {};
+    error |= forest_init(&forest ON_DEBUG(, VER_INIT));
+    HARD_ASSERT(error == ERROR_NO, "forest_init failed");
+
+    const expr_shape_t shapes[] = {EXPR_SHAPE_RANDOM, EXPR_SHAPE_CHAIN, EXPR_SHAPE_WIDE_SUM,
+                                   EXPR_SHAPE_NESTED, EXPR_SHAPE_POLYNOMIAL};
+    const var_val_type var_vals[] = {0.3, -0.7, 1.1};
+
+    for(size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+        expr_gen_opts_t opts = {
+            .seed           = 42 + i,
+            .shape          = shapes[i],
+            .nodes_cnt      = 200,
+            .max_depth      = 12,
+            .vars_cnt       = 3,
+            .ops_mask       = 0,
+            .is_domain_safe = true,
+        };
+
+        tree_t* generated = forest_add_tree(&forest, &error);
+        HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+        tree_node_t* root = expr_generate(generated, &opts, &error);
+        HARD_ASSERT(error == ERROR_NO && root != nullptr, "expr_generate failed");
+        tree_replace_root(generated, root);
+        HARD_ASSERT(generated->size >= 20, "generated tree is too small");
+
+        char* text       = expr_generate_text(generated, &opts, &error);
+        char* text_again = expr_generate_text(generated, &opts, &error);
+        HARD_ASSERT(error == ERROR_NO && text && text_again, "expr_generate_text failed");
+        HARD_ASSERT(strcmp(text, text_again) == 0, "same seed gave different expressions");
+
+        tree_t* parsed = forest_add_tree(&forest, &error);
+        HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+        const char* str = text;
+        tree_replace_root(parsed, get_g(parsed, &str));
+        HARD_ASSERT(parsed->size == generated->size, "parsed text differs from generated tree");
+
+        for(size_t j = 0; j < opts.vars_cnt; j++) put_var_val(generated, j, var_vals[j]);
+        var_val_type val = calculate_tree(generated, false);
+        HARD_ASSERT(isfinite(val), "generated expr is not finite");
+        HARD_ASSERT(double_cmp(val, calculate_tree(parsed, false)) == 0, "parsed text evaluates differently");
+
+        size_t x_idx = 0;
+        tree_t* diff = forest_add_tree(&forest, &error);
+        HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+        tree_replace_root(diff, get_diff(generated->root, {&x_idx, 1} ON_TEX_CREATION_DEBUG(, generated)));
+        HARD_ASSERT(isfinite(calculate_tree(diff, false)), "derivative of generated expr is not finite");
+
+        free(text);
+        free(text_again);
+    }
+
+    forest_dest(&forest);
+    LOGGER_INFO("Тест пройден: генератор выражений \n");
+}
+
+static tree_node_t* stream_parse_by_chunks(tree_t* tree, const char* text, size_t chunk_size, error_code* error) {
+    expr_stream_t stream = {};
+    expr_stream_init(&stream, tree);
+    size_t text_len = strlen(text);
+    for(size_t pos = 0; pos < text_len; pos += chunk_size) {
+        size_t len = text_len - pos < chunk_size ? text_len - pos : chunk_size;
+        if(expr_stream_feed(&stream, text + pos, len) != ERROR_NO) break;
+    }
+    tree_node_t* root = expr_stream_finish(&stream, error);
+    expr_stream_dest(&stream);
+    return root;
+}
+
+static void test_expr_stream() {
+    LOGGER_INFO("=== Тест: потоковый парсер ===");
+
+    error_code error = ERROR_NO;
+
+    forest_t forest = {};
+    error |= forest_init(&forest ON_DEBUG(, VER_INIT));
+    HARD_ASSERT(error == ERROR_NO, "forest_init failed");
+    tree_t* tree = forest_add_tree(&forest, &error);
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+
+    const char* valid[] = {
+        "sin(x) * y + ln(x ^ 2)$",
+        "2 ^ 3 ^ 2 - 8 / 4 / 2",
+        "log(2, x + 1) - (x - y) / 3 * z$ this is ignored",
+        "  ( ( alpha ) )  ",
+        "exp(sin(cos(x)) ^ (1 + y)) * 1234567",
+    };
+    for(size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+        const char*  cur      = valid[i];
+        tree_node_t* expected = get_g(tree, &cur);
+        tree_node_t* by_char  = stream_parse_by_chunks(tree, valid[i], 1, &error);
+        tree_node_t* by_block = stream_parse_by_chunks(tree, valid[i], 5, &error);
+        HARD_ASSERT(error == ERROR_NO && expected != nullptr, "stream parse failed");
+        HARD_ASSERT(subtree_equal(expected, by_char) && subtree_equal(expected, by_block), "stream parse differs from get_g");
+        destroy_node_recursive(expected, nullptr);
+        destroy_node_recursive(by_char,  nullptr);
+        destroy_node_recursive(by_block, nullptr);
+    }
+
+    const char* invalid[] = {"sin x", "(x + 1", "x +", "log(x)", "", "x y", "2, 3", "x)", "sin(x, y)"};
+    for(size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        error_code   parse_error = ERROR_NO;
+        tree_node_t* root        = stream_parse_by_chunks(tree, invalid[i], 2, &parse_error);
+        HARD_ASSERT(root == nullptr && parse_error != ERROR_NO, "invalid expression was accepted");
+    }
+
+    /* a name new to every forest is still copied once per process */
+    forest_t other_forest = {};
+    error |= forest_init(&other_forest ON_DEBUG(, VER_INIT));
+    tree_t*      other_tree = forest_add_tree(&other_forest, &error);
+    tree_node_t* first      = stream_parse_by_chunks(tree,       "omega + 1", 3, &error);
+    tree_node_t* second     = stream_parse_by_chunks(other_tree, "omega + 1", 3, &error);
+    HARD_ASSERT(error == ERROR_NO && first && second, "stream parse in two forests failed");
+    const char* first_name  = tree->var_stack->data[first->left->value.var_idx].str.ptr;
+    const char* second_name = other_tree->var_stack->data[second->left->value.var_idx].str.ptr;
+    HARD_ASSERT(first_name == second_name, "var name was interned twice");
+    destroy_node_recursive(first,  nullptr);
+    destroy_node_recursive(second, nullptr);
+    error |= forest_dest(&other_forest);
+
+    expr_gen_opts_t opts = {};
+    opts.seed      = 44;
+    opts.shape     = EXPR_SHAPE_WIDE_SUM;
+    opts.nodes_cnt = 1 << 17;
+    opts.vars_cnt  = 3;
+    char* text = expr_generate_text(tree, &opts, &error);
+    HARD_ASSERT(error == ERROR_NO && text != nullptr, "expr_generate_text failed");
+
+    long long    begin_ns   = metrics_now_ns();
+    const char*  cur        = text;
+    tree_node_t* expected   = get_g(tree, &cur);
+    long long    get_g_ns   = metrics_now_ns() - begin_ns;
+    begin_ns                = metrics_now_ns();
+    tree_node_t* by_chunks  = stream_parse_by_chunks(tree, text, 4093, &error);
+    long long    stream_ns  = metrics_now_ns() - begin_ns;
+    HARD_ASSERT(error == ERROR_NO && subtree_equal(expected, by_chunks), "big stream parse differs from get_g");
+    LOGGER_INFO("%zu bytes: get_g %.1f ms, stream %.1f ms", strlen(text), (double)get_g_ns / 1e6, (double)stream_ns / 1e6);
+    destroy_node_recursive(by_chunks, nullptr);
+
+    FILE* pipe_file = tmpfile();
+    HARD_ASSERT(pipe_file != nullptr, "tmpfile failed");
+    fputs(text, pipe_file);
+    rewind(pipe_file);
+    tree_node_t* from_file = get_g_from_file(tree, pipe_file, &error);
+    fclose(pipe_file);
+    HARD_ASSERT(error == ERROR_NO && subtree_equal(expected, from_file), "get_g_from_file differs from get_g");
+    destroy_node_recursive(from_file, nullptr);
+    destroy_node_recursive(expected,  nullptr);
+    free(text);
+
+    error = forest_dest(&forest);
+    HARD_ASSERT(error == ERROR_NO, "forest_dest failed");
+    LOGGER_INFO("Тест пройден: потоковый парсер \n");
+}
+
+static bool double_same(double a, double b) {
+    return !(a < b) && !(a > b);
+}
+
+static void test_num_literal() {
+    LOGGER_INFO("=== Тест: вещественные литералы ===");
+
+    const char* literals[] = {
+        "0", "007", "0.1", "3.25e-7", "2.5E+3", "1.", "123456789012345678901234", "9007199254740993",
+        "0.30000000000000004", "2.2250738585072014e-308", "4.9e-324", "1.7976931348623157e308", "1e400", "1e-400",
+        "0.000000000000000000000000000000000000001", "179769313486231580793728971405303415079934132710037826936173"
+    };
+    for(size_t i = 0; i < sizeof(literals) / sizeof(literals[0]); i++) {
+        double val = -1;
+        size_t len = num_literal_scan(literals[i], SIZE_MAX, &val);
+        HARD_ASSERT(len == strlen(literals[i]), "literal is not read whole");
+        HARD_ASSERT(double_same(val, strtod(literals[i], nullptr)), "literal is not correctly rounded");
+    }
+
+    double val = 0;
+    HARD_ASSERT(num_literal_scan("12e", SIZE_MAX, &val) == 2 && double_same(val, 12), "'e' without digits was read");
+    HARD_ASSERT(num_literal_scan("1.5e+x", SIZE_MAX, &val) == 3, "'e+' without digits was read");
+    HARD_ASSERT(num_literal_scan("2.5e10", 3, &val) == 3 && double_same(val, 2.5), "max_len is not respected");
+    HARD_ASSERT(num_literal_scan(".5", SIZE_MAX, &val) == 0 && num_literal_scan("-1", SIZE_MAX, &val) == 0,
+                "literal without leading digit was read");
+
+    error_code error = ERROR_NO;
+
+    forest_t forest = {};
+    error |= forest_init(&forest ON_DEBUG(, VER_INIT));
+    HARD_ASSERT(error == ERROR_NO, "forest_init failed");
+    tree_t* tree = forest_add_tree(&forest, &error);
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+
+    const char*  expr     = "3.25e-7 * x + 0.5 ^ 2E1$";
+    const char*  cur      = expr;
+    tree_node_t* expected = get_g(tree, &cur);
+    HARD_ASSERT(expected != nullptr, "get_g failed");
+    HARD_ASSERT(expected->left->left->type == CONSTANT && double_same(expected->left->left->value.constant, 3.25e-7),
+                "3.25e-7 is not one constant");
+    tree_node_t* by_char = stream_parse_by_chunks(tree, expr, 1, &error);
+    HARD_ASSERT(error == ERROR_NO && subtree_equal(expected, by_char), "stream parse of literals differs from get_g");
+    destroy_node_recursive(expected, nullptr);
+    destroy_node_recursive(by_char,  nullptr);
+
+    error_code parse_error = ERROR_NO;
+    HARD_ASSERT(!stream_parse_by_chunks(tree, "1.2.3 + x", 2, &parse_error) && parse_error != ERROR_NO,
+                "broken literal was accepted");
+
+    const char* filename = "Real_const_test.tree";
+    FILE* test_file = fopen(filename, "w");
+    HARD_ASSERT(test_file != nullptr, "failed to create test file");
+    fprintf(test_file, "(+ (-1.5 nil nil) (2.5e-3 nil nil))");
+    fclose(test_file);
+
+    string_t forest_buff = {};
+    error = read_file_to_buffer_by_name(&forest_buff, filename);
+    HARD_ASSERT(error == ERROR_NO, "read_file_to_buffer_by_name failed");
+    forest.buff = {.ptr = forest_buff.ptr, .len = forest_buff.len};
+    tree_t* file_tree = forest_add_tree(&forest, &error);
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+    error = tree_parse_from_buffer(file_tree);
+    HARD_ASSERT(error == ERROR_NO, "tree_parse_from_buffer failed");
+    HARD_ASSERT(double_same(file_tree->root->left->value.constant,  -1.5) &&
+                double_same(file_tree->root->right->value.constant, 2.5e-3), "real constants are read wrong");
+
+    free(forest_buff.ptr);
+    error = forest_dest(&forest);
+    HARD_ASSERT(error == ERROR_NO, "forest_dest failed");
+    remove(filename);
+    LOGGER_INFO("Тест пройден: вещественные литералы \n");
+}
+
+static void test_plot_parallel() {
+    LOGGER_INFO("=== Тест: параллельное построение графика ===");
+
+    error_code error = ERROR_NO;
+
+    forest_t forest = {};
+    error |= forest_init(&forest ON_DEBUG(, VER_INIT));
+    HARD_ASSERT(error == ERROR_NO, "forest_init failed");
+
+    tree_t* tree = forest_add_tree(&forest, &error);
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+
+    const char* expr = "sin(x) * x + 3$";
+    tree_node_t* new_root = get_g(tree, &expr);
+    HARD_ASSERT(new_root != nullptr, "get_g failed");
+    tree_replace_root(tree, new_root);
+
+    size_t x_idx = (size_t)get_var_idx({"x", 1}, tree->var_stack);
+    const size_t dots_cnt = 100003;
+
+    error = tree_plot_to_gnuplot_opts(tree, x_idx, -10, 10, dots_cnt, "parallel_plot.bin", "parallel_plot.png",
+                                      {PLOT_DATA_BINARY, 4});
+    HARD_ASSERT(error == ERROR_NO, "binary plot failed");
+
+    FILE* data_file = fopen("graphs/parallel_plot.bin", "rb");
+    HARD_ASSERT(data_file != nullptr, "binary data file is missing");
+    double dots[4] = {};
+    HARD_ASSERT(fread(dots, sizeof(double), 4, data_file) == 4, "binary data file is too short");
+    HARD_ASSERT(double_cmp(dots[0], -10) == 0, "first x should be x_min");
+    HARD_ASSERT(double_cmp(dots[1], sin(-10) * -10 + 3) == 0, "first y is wrong");
+    fseek(data_file, 0, SEEK_END);
+    HARD_ASSERT((size_t)ftell(data_file) == dots_cnt * 2 * sizeof(double), "binary data file has wrong size");
+    fclose(data_file);
+
+    error = tree_plot_to_gnuplot_opts(tree, x_idx, -10, 10, dots_cnt, "parallel_plot.dat", "parallel_plot_text.png",
+                                      {PLOT_DATA_TEXT, 0});
+    HARD_ASSERT(error == ERROR_NO, "text plot failed");
+
+    remove("graphs/parallel_plot.bin");
+    remove("graphs/parallel_plot.dat");
+    forest_dest(&forest);
+    LOGGER_INFO("Тест пройден: параллельное построение графика \n");
+}
+
+static void test_plot_adaptive() {
+    LOGGER_INFO("=== Тест: адаптивное построение графика ===");
+
+    error_code error = ERROR_NO;
+
+    forest_t forest = {};
+    error |= forest_init(&forest ON_DEBUG(, VER_INIT));
+    HARD_ASSERT(error == ERROR_NO, "forest_init failed");
+
+    tree_t* tree = forest_add_tree(&forest, &error);
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+
+    const char* expr = "tan(x)$";
+    tree_node_t* new_root = get_g(tree, &expr);
+    HARD_ASSERT(new_root != nullptr, "get_g failed");
+    tree_replace_root(tree, new_root);
+
+    size_t x_idx = (size_t)get_var_idx({"x", 1}, tree->var_stack);
+    const size_t evals_budget = 2000;
+
+    error = tree_plot_to_gnuplot_opts(tree, x_idx, -5, 5, evals_budget, "adaptive_plot.dat", "adaptive_plot.png",
+                                      {PLOT_DATA_TEXT, 0, PLOT_SAMPLING_ADAPTIVE});
+    HARD_ASSERT(error == ERROR_NO, "adaptive plot failed");
+
+    FILE* data_file = fopen("graphs/adaptive_plot.dat", "r");
+    HARD_ASSERT(data_file != nullptr, "adaptive data file is missing");
+    size_t lines_cnt  = 0;
+    size_t breaks_cnt = 0;
+    char line[128] = {};
+    while(fgets(line, sizeof(line), data_file)) {
+        lines_cnt++;
+        if(line[0] == '\n') breaks_cnt++;
+    }
+    fclose(data_file);
+
+    HARD_ASSERT(lines_cnt <= 2 * evals_budget, "adaptive sampler exceeded budget");
+    HARD_ASSERT(breaks_cnt == 4, "adaptive sampler should split at every pole of tan on [-5, 5]");
+
+    /* the budget is split before the threads start, so their count doesn't change the dots */
+    string_t single_dots = {};
+    string_t many_dots   = {};
+    error |= read_file_to_buffer_by_name(&single_dots, "graphs/adaptive_plot.dat");
+    error |= tree_plot_to_gnuplot_opts(tree, x_idx, -5, 5, evals_budget, "adaptive_plot.dat", "adaptive_plot.png",
+                                       {PLOT_DATA_TEXT, 4, PLOT_SAMPLING_ADAPTIVE});
+    error |= read_file_to_buffer_by_name(&many_dots, "graphs/adaptive_plot.dat");
+    HARD_ASSERT(error == ERROR_NO, "multithreaded adaptive plot failed");
+    HARD_ASSERT(single_dots.len == many_dots.len && memcmp(single_dots.ptr, many_dots.ptr, single_dots.len) == 0,
+                "adaptive dots depend on the threads count");
+    free(single_dots.ptr);
+    free(many_dots.ptr);
+
+    const size_t tiny_budget = 5;
+    error |= tree_plot_to_gnuplot_opts(tree, x_idx, -5, 5, tiny_budget, "adaptive_plot.dat", "adaptive_plot.png",
+                                       {PLOT_DATA_TEXT, 0, PLOT_SAMPLING_ADAPTIVE});
+    HARD_ASSERT(error == ERROR_NO, "adaptive plot with a tiny budget failed");
+    data_file = fopen("graphs/adaptive_plot.dat", "r");
+    HARD_ASSERT(data_file != nullptr, "adaptive data file is missing");
+    lines_cnt = 0;
+    while(fgets(line, sizeof(line), data_file)) if(line[0] != '\n') lines_cnt++;
+    fclose(data_file);
+    HARD_ASSERT(lines_cnt <= tiny_budget, "tiny budget was exceeded");
+
+    remove("graphs/adaptive_plot.dat");
+    forest_dest(&forest);
+    LOGGER_INFO("Тест пройден: адаптивное построение графика \n");
+}
+
+static void test_plot_multi() {
+    LOGGER_INFO("=== Тест: несколько графиков за один проход ===");
+
+    error_code error = ERROR_NO;
+
+    forest_t forest = {};
+    error |= forest_init(&forest ON_DEBUG(, VER_INIT));
+    HARD_ASSERT(error == ERROR_NO, "forest_init failed");
+
+    tree_t* tree = forest_add_tree(&forest, &error);
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+
+    const char* expr = "sin(x) * x$";
+    tree_node_t* new_root = get_g(tree, &expr);
+    HARD_ASSERT(new_root != nullptr, "get_g failed");
+    tree_replace_root(tree, new_root);
+
+    size_t x_idx = (size_t)get_var_idx({"x", 1}, tree->var_stack);
+
+    tree_t* first_diff = forest_add_tree(&forest, &error);
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+    tree_replace_root(first_diff, get_diff(tree->root, {&x_idx, 1} ON_TEX_CREATION_DEBUG(, tree)));
+    error |= tree_optimize(first_diff);
+
+    tree_t* second_diff = forest_add_tree(&forest, &error);
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+    tree_replace_root(second_diff, get_diff(first_diff->root, {&x_idx, 1} ON_TEX_CREATION_DEBUG(, first_diff)));
+    error |= tree_optimize(second_diff);
+    HARD_ASSERT(error == ERROR_NO, "tree_optimize failed");
+
+    tree_t* tree_teylor = make_teylor(&forest, tree, x_idx, 0, &error);
+    HARD_ASSERT(tree_teylor != nullptr, "make_teylor failed");
+
+    const tree_t* trees[]  = {tree, first_diff, second_diff, tree_teylor};
+    const char*   titles[] = {"f(x)", "f'(x)", "f''(x)", "teylor f(x)"};
+    const size_t  dots_cnt = 201;
+    error = trees_plot_to_gnuplot(trees, titles, 4, x_idx, -2, 2, dots_cnt, "multi_plot.dat", "multi_plot.png",
+                                  {PLOT_DATA_TEXT, 0});
+    HARD_ASSERT(error == ERROR_NO, "multi plot failed");
+
+    FILE* data_file = fopen("graphs/multi_plot.dat", "r");
+    HARD_ASSERT(data_file != nullptr, "multi data file is missing");
+    size_t rows_cnt = 0;
+    double row[5] = {};
+    while(fscanf(data_file, "%lf %lf %lf %lf %lf", &row[0], &row[1], &row[2], &row[3], &row[4]) == 5) {
+        HARD_ASSERT(double_cmp(row[1], sin(row[0]) * row[0]) == 0,                          "f column is wrong");
+        HARD_ASSERT(double_cmp(row[2], cos(row[0]) * row[0] + sin(row[0])) == 0,            "f' column is wrong");
+        HARD_ASSERT(double_cmp(row[3], 2 * cos(row[0]) - sin(row[0]) * row[0]) == 0,       "f'' column is wrong");
+        rows_cnt++;
+    }
+    fclose(data_file);
+    HARD_ASSERT(rows_cnt == dots_cnt, "multi data file has wrong rows count");
+
+    remove("graphs/multi_plot.dat");
+    forest_dest(&forest);
+    LOGGER_INFO("Тест пройден: несколько графиков за один проход \n");
+}
+
+static void test_plot_session() {
+    LOGGER_INFO("=== Тест: сессия gnuplot на несколько графиков ===");
+
+    error_code error = ERROR_NO;
+
+    forest_t forest = {};
+    error |= forest_init(&forest ON_DEBUG(, VER_INIT));
+    HARD_ASSERT(error == ERROR_NO, "forest_init failed");
+
+    const char* exprs[] = {"sin(x)$", "x ^ 2 - 1$", "tan(x)$"};
+    const size_t trees_cnt = sizeof(exprs) / sizeof(exprs[0]);
+    tree_t* trees[trees_cnt] = {};
+    for(size_t i = 0; i < trees_cnt; i++) {
+        trees[i] = forest_add_tree(&forest, &error);
+        HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+        const char* expr = exprs[i];
+        tree_node_t* new_root = get_g(trees[i], &expr);
+        HARD_ASSERT(new_root != nullptr, "get_g failed");
+        tree_replace_root(trees[i], new_root);
+    }
+    size_t x_idx = (size_t)get_var_idx({"x", 1}, trees[0]->var_stack);
+
+    plot_session_t session = {};
+    error |= plot_session_open(&session, "graphs");
+    HARD_ASSERT(error == ERROR_NO, "plot_session_open failed");
+
+    const char* title = "f(x)";
+    for(size_t i = 0; i < trees_cnt; i++) {
+        const tree_t* plot_tree = trees[i];
+        error |= plot_session_plot(&session, &plot_tree, &title, 1, x_idx, -3, 3, 500, nullptr,
+                                   {(i % 2) ? PLOT_DATA_BINARY : PLOT_DATA_TEXT, 0, PLOT_SAMPLING_UNIFORM});
+    }
+    const tree_t* all_trees[] = {trees[0], trees[1]};
+    const char*   titles[]    = {"sin(x)", "x^2 - 1"};
+    error |= plot_session_plot(&session, all_trees, titles, 2, x_idx, -3, 3, 500, "session_both.png",
+                               {PLOT_DATA_BINARY, 0, PLOT_SAMPLING_UNIFORM});
+    HARD_ASSERT(error == ERROR_NO, "plot_session_plot failed");
+    HARD_ASSERT(session.plots_cnt == trees_cnt + 1, "plots_cnt is wrong");
+
+    error |= plot_session_close(&session);
+    HARD_ASSERT(error == ERROR_NO, "plot_session_close failed");
+    HARD_ASSERT(session.gnu_pipe == nullptr, "gnu_pipe is not closed");
+
+    forest_dest(&forest);
+    LOGGER_INFO("Тест пройден: сессия gnuplot на несколько графиков \n");
+}
+
+static void test_interval_eval() {
+    LOGGER_INFO("=== Тест: интервальная арифметика ===");
+
+    error_code error = ERROR_NO;
+
+    forest_t forest = {};
+    error |= forest_init(&forest ON_DEBUG(, VER_INIT));
+    HARD_ASSERT(error == ERROR_NO, "forest_init failed");
+
+    const char* exprs[] = {
+        "x * x - 2 * x + 1$", "(x - 1) / (x + 1 / 2)$", "x ^ 3 - x ^ 2$", "x ^ (0 - 2)$", "2 ^ x$", "x ^ (1 / 2)$",
+        "x ^ x$", "log(x, 2)$", "ln(x)$", "exp(x) * sin(x)$", "cos(3 * x)$", "tan(x)$", "ctan(x)$",
+        "asin(x / 2)$", "acos(x / 2)$", "atan(x) + actan(x)$", "ch(x) - sh(x)$", "ash(x)$", "ach(x)$",
+    };
+    const double boxes_arr[][2] = {{-3, -1}, {-1.5, 0.5}, {-0.25, 0.25}, {0, 2}, {0.5, 4}, {1.6, 1.55 + M_PI}};
+
+    for(size_t i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++) {
+        tree_t* tree = forest_add_tree(&forest, &error);
+        HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+        const char* expr = exprs[i];
+        tree_replace_root(tree, get_g(tree, &expr));
+        HARD_ASSERT(tree->root != nullptr, "get_g failed");
+        size_t x_idx = (size_t)get_var_idx({"x", 1}, tree->var_stack);
+
+        var_bindings_t      bindings = {};
+        interval_bindings_t boxes    = {};
+        error |= var_bindings_init(&bindings, tree->var_stack);
+        error |= interval_bindings_init(&boxes, tree->var_stack);
+
+        for(size_t j = 0; j < sizeof(boxes_arr) / sizeof(boxes_arr[0]); j++) {
+            double x_lo = boxes_arr[j][0];
+            double x_hi = boxes_arr[j][1];
+            bind_var_interval(&boxes, x_idx, interval_make(x_lo, x_hi));
+            interval_t range = interval_tree_eval(tree, &boxes, &error);
+
+            for(size_t k = 0; k <= 400; k++) {
+                double x_value = x_lo + (x_hi - x_lo) * (double)k / 400;
+                bind_var_val(&bindings, x_idx, x_value);
+                double y_value = calculate_tree_bound(tree, &bindings, &error);
+                if(!isfinite(y_value)) continue;
+
+                if(interval_is_void(range) || y_value < range.lo || y_value > range.hi) {
+                    LOGGER_ERROR("%s at x = %g gives %g outside [%g, %g]", exprs[i], x_value, y_value, range.lo, range.hi);
+                    HARD_ASSERT(false, "interval does not enclose the function");
+                }
+            }
+        }
+        var_bindings_dest(&bindings);
+        interval_bindings_dest(&boxes);
+    }
+    HARD_ASSERT(error == ERROR_NO, "interval evaluation failed");
+
+    tree_t* tree = forest_add_tree(&forest, &error);
+    const char* expr = "asin(x / 2)$";
+    tree_replace_root(tree, get_g(tree, &expr));
+    size_t x_idx = (size_t)get_var_idx({"x", 1}, tree->var_stack);
+
+    interval_bindings_t boxes = {};
+    error |= interval_bindings_init(&boxes, tree->var_stack);
+    bind_var_interval(&boxes, x_idx, interval_make(2.5, 3));
+    HARD_ASSERT(interval_tree_eval(tree, &boxes, &error).is_empty, "asin out of its domain is not empty");
+    bind_var_interval(&boxes, x_idx, interval_make(1, 3));
+    interval_t range = interval_tree_eval(tree, &boxes, &error);
+    HARD_ASSERT(!range.is_empty && range.is_partial && range.hi >= M_PI_2, "asin on its domain edge is wrong");
+    interval_bindings_dest(&boxes);
+
+    const size_t dots_cnt = 1001;
+    metrics_reset();
+    metrics_enable(true);
+    error |= tree_plot_to_gnuplot_opts(tree, x_idx, -5, 5, dots_cnt, "interval_plot.dat", "interval_plot.png",
+                                       {PLOT_DATA_TEXT, 1, PLOT_SAMPLING_UNIFORM});
+    metrics_enable(false);
+    HARD_ASSERT(error == ERROR_NO, "plot failed");
+    HARD_ASSERT(metrics_counter_get(METRICS_EVALUATIONS) < dots_cnt, "blocks outside the domain were sampled");
+    metrics_reset();
+
+    FILE* data_file = fopen("graphs/interval_plot.dat", "r");
+    HARD_ASSERT(data_file != nullptr, "interval data file is missing");
+    size_t nan_cnt = 0;
+    char line[128] = {};
+    while(fgets(line, sizeof(line), data_file)) {
+        if(strstr(line, "nan")) nan_cnt++;
+    }
+    fclose(data_file);
+    HARD_ASSERT(nan_cnt > dots_cnt / 2, "void blocks were not written as gaps");
+
+    remove("graphs/interval_plot.dat");
+    forest_dest(&forest);
+    LOGGER_INFO("Тест пройден: интервальная арифметика \n");
+}
+
+static void test_metrics() {
+    LOGGER_INFO("=== Тест: метрики ===");
+
+    error_code error = ERROR_NO;
+
+    metrics_reset();
+    metrics_enable(true);
+
+    char*  metrics_text     = nullptr;
+    size_t metrics_text_len = 0;
+    FILE*  metrics_file     = open_memstream(&metrics_text, &metrics_text_len);
+    HARD_ASSERT(metrics_file != nullptr, "open_memstream failed");
+
+    forest_t forest = {};
+    error |= forest_init(&forest ON_DEBUG(, VER_INIT));
+    HARD_ASSERT(error == ERROR_NO, "forest_init failed");
+    error |= forest_set_metrics_output(&forest, metrics_file, METRICS_FORMAT_JSON);
+
+    tree_t* tree = forest_add_tree(&forest, &error);
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+    const char* expr = "sin(x) * x * x + 0 * x + 2 * 3$";
+    tree_replace_root(tree, get_g(tree, &expr));
+    size_t x_idx = (size_t)get_var_idx({"x", 1}, tree->var_stack);
+
+    tree_t* diff = forest_add_tree(&forest, &error);
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+    tree_replace_root(diff, get_diff(tree->root, {&x_idx, 1} ON_TEX_CREATION_DEBUG(, tree)));
+    error |= tree_optimize(diff);
+    HARD_ASSERT(error == ERROR_NO, "tree_optimize failed");
+
+    put_var_val(tree, x_idx, 0.5);
+    calculate_tree(diff, false);
+    tree_t* teylor = make_teylor(&forest, tree, x_idx, 0, &error);
+    HARD_ASSERT(teylor != nullptr, "make_teylor failed");
+
+    error |= forest_dest(&forest);
+    fclose(metrics_file);
+    metrics_enable(false);
+    HARD_ASSERT(error == ERROR_NO, "forest_dest failed");
+
+    HARD_ASSERT(metrics_counter_get(METRICS_NODES_ALLOCATED) > 0, "no nodes counted");
+    HARD_ASSERT(metrics_counter_get(METRICS_NODES_ALLOCATED) == metrics_counter_get(METRICS_NODES_FREED),
+                "allocated and freed nodes differ after forest_dest");
+    HARD_ASSERT(metrics_counter_get(METRICS_NODES_FOLDED)  > 0, "no folded nodes counted");
+    HARD_ASSERT(metrics_counter_get(METRICS_NODES_NEUTRAL) > 0, "no neutral nodes counted");
+    HARD_ASSERT(metrics_counter_get(METRICS_DEEP_COPIES)   > 0, "no deep copies counted");
+    HARD_ASSERT(metrics_counter_get(METRICS_EVALUATIONS)   >= 1 + 4, "evaluations are not counted");
+    HARD_ASSERT(metrics_phase_calls(METRICS_PHASE_DIFF)   == 1 + 3, "diff phase calls are wrong");
+    HARD_ASSERT(metrics_phase_calls(METRICS_PHASE_TEYLOR) == 1,     "teylor phase calls are wrong");
+    HARD_ASSERT(metrics_phase_ns(METRICS_PHASE_TEYLOR) >= metrics_phase_ns(METRICS_PHASE_DIFF) / 2, "phase times are wrong");
+
+    HARD_ASSERT(strstr(metrics_text, "\"nodes_allocated\"") != nullptr, "json dump has no counters");
+    HARD_ASSERT(strstr(metrics_text, "\"teylor\": {\"calls\": 1") != nullptr, "json dump has no phases");
+    free(metrics_text);
+
+    metrics_reset();
+    LOGGER_INFO("Тест пройден: метрики \n");
+}
+
+static void test_subtree_hash_index() {
+    LOGGER_INFO("=== Тест: хеши и равенство поддеревьев ===");
+
+    error_code error = ERROR_NO;
+
+    forest_t forest = {};
+    error |= forest_init(&forest ON_DEBUG(, VER_INIT));
+    HARD_ASSERT(error == ERROR_NO, "forest_init failed");
+    tree_t* tree = forest_add_tree(&forest, &error);
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+
+    const char* expr = "sin(x * y) + (x * y) ^ 2 - ln(x * y)$";
+    tree_replace_root(tree, get_g(tree, &expr));
+    HARD_ASSERT(tree->root != nullptr, "get_g failed");
+
+    const tree_node_t* root = tree->root;
+    HARD_ASSERT(subtree_hash(root) == node_hash_combine(root, subtree_hash(root->left), subtree_hash(root->right)),
+                "hash is not incremental");
+
+    subtree_hash_index_t index = {};
+    error = subtree_hash_index_build(&index, root);
+    HARD_ASSERT(error == ERROR_NO && index.entries_cnt == count_nodes_recursive(root), "index_build failed");
+    const subtree_hash_entry_t* entry = subtree_hash_index_find(&index, root->left);
+    HARD_ASSERT(entry && entry->hash == subtree_hash(root->left) && entry->size == count_nodes_recursive(root->left),
+                "index entry is wrong");
+    subtree_hash_index_dest(&index);
+
+    /* the walks do not recurse: a chain deeper than a few thousand frames */
+    const size_t depth      = 10000;
+    tree_node_t* chain      = init_node(VARIABLE, make_union_var(0), nullptr, nullptr);
+    tree_node_t* same_chain = init_node(VARIABLE, make_union_var(0), nullptr, nullptr);
+    for(size_t i = 0; i < depth; i++) {
+        chain      = init_node(FUNCTION, make_union_func(SIN), chain,      nullptr);
+        same_chain = init_node(FUNCTION, make_union_func(SIN), same_chain, nullptr);
+        HARD_ASSERT(chain && same_chain, "init_node failed");
+    }
+    HARD_ASSERT(subtree_hash(chain) == subtree_hash(same_chain) && subtree_equal(chain, same_chain), "deep chains differ");
+    uint64_t chain_hash = 0;
+    size_t   chain_size = 0;
+    HARD_ASSERT(subtree_hash_walk(chain, nullptr, &chain_hash, &chain_size) == ERROR_NO && chain_size == depth + 1,
+                "subtree_hash_walk size is wrong");
+    tree_node_t* leaf = same_chain;
+    while(leaf->left) leaf = leaf->left;
+    leaf->value.var_idx = 1;
+    HARD_ASSERT(!subtree_equal(chain, same_chain) && subtree_hash(chain) != subtree_hash(same_chain), "deep chains are equal");
+    destroy_node_recursive(chain,      nullptr);
+    destroy_node_recursive(same_chain, nullptr);
+
+    tree_node_t* zero     = init_node(CONSTANT, make_union_const(0.0),  nullptr, nullptr);
+    tree_node_t* neg_zero = init_node(CONSTANT, make_union_const(-0.0), nullptr, nullptr);
+    HARD_ASSERT(subtree_equal(zero, neg_zero) && subtree_hash(zero) == subtree_hash(neg_zero), "-0.0 differs from 0.0");
+    node_free(zero);
+    node_free(neg_zero);
+
+    /* a walk with an index takes the indexed subtrees from it instead of walking them again */
+    error = subtree_hash_index_build(&index, root->left);
+    HARD_ASSERT(error == ERROR_NO, "index_build failed");
+    uint64_t root_hash = 0;
+    size_t   root_size = 0;
+    error = subtree_hash_walk(root, &index, &root_hash, &root_size);
+    HARD_ASSERT(error == ERROR_NO && root_hash == subtree_hash(root) && root_size == count_nodes_recursive(root),
+                "walk over a partial index is wrong");
+    subtree_hash_index_t stale = {};
+    error = subtree_hash_index_build(&stale, root->left);
+    HARD_ASSERT(error == ERROR_NO, "index_build failed");
+    for(size_t i = 0; i < stale.slots_cap; i++) if(stale.slots[i].node == root->left) stale.slots[i].hash++;
+    error = subtree_hash_walk(root, &stale, &root_hash, nullptr);
+    HARD_ASSERT(error == ERROR_NO && root_hash != subtree_hash(root), "walk rehashed an indexed subtree");
+    subtree_hash_index_dest(&stale);
+    subtree_hash_index_dest(&index);
+
+    /* optimize carries the hashes up without recursing, u - u is left alone */
+    tree_node_t* sum_chain = init_node(VARIABLE, make_union_var(0), nullptr, nullptr);
+    for(size_t i = 0; i < 10 * depth; i++) {
+        sum_chain = init_node(FUNCTION, make_union_func(ADD), sum_chain,
+                              init_node(CONSTANT, make_union_const(0.0), nullptr, nullptr));
+        HARD_ASSERT(sum_chain != nullptr, "init_node failed");
+    }
+    sum_chain = optimize_subtree_recursive(sum_chain, &error);
+    HARD_ASSERT(error == ERROR_NO && sum_chain->type == VARIABLE && !sum_chain->left, "deep x + 0 chain is not folded");
+    node_free(sum_chain);
+    expr = "sin(x * y) - sin(x * y)$";
+    tree_replace_root(tree, get_g(tree, &expr));
+    error = tree_optimize(tree);
+    HARD_ASSERT(error == ERROR_NO && tree->size == 9, "u - u was folded");
+    expr = "(x * 1 + 0) * sin(y ^ 1) + (2 + 3) * (0 * z + x)$";
+    tree_replace_root(tree, get_g(tree, &expr));
+    uint64_t optimized_hash = 0;
+    tree->root = optimize_subtree_hashed(tree->root, &error, &optimized_hash);
+    HARD_ASSERT(error == ERROR_NO, "optimize_subtree_hashed failed");
+    HARD_ASSERT(optimized_hash == subtree_hash(tree->root), "carried hash differs from subtree_hash");
+
+    error = forest_dest(&forest);
+    HARD_ASSERT(error == ERROR_NO, "forest_dest failed");
+    LOGGER_INFO("Тест пройден: хеши и равенство поддеревьев\n");
+}
+
+static void test_teylor_profile() {
+    LOGGER_INFO("=== Тест: профиль роста производных ===");
+
+    error_code error = ERROR_NO;
+
+    forest_t forest = {};
+    error |= forest_init(&forest ON_DEBUG(, VER_INIT));
+    HARD_ASSERT(error == ERROR_NO, "forest_init failed");
+
+    tree_t* tree = forest_add_tree(&forest, &error);
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+    const char* expr = "x * x + x * x$";
+    tree_replace_root(tree, get_g(tree, &expr));
+    HARD_ASSERT(subtree_max_depth(tree->root) == 3, "subtree_max_depth is wrong");
+    HARD_ASSERT(subtree_equal(tree->root->left, tree->root->right), "subtree_equal missed equal subtrees");
+    HARD_ASSERT(!subtree_equal(tree->root, tree->root->left), "subtree_equal matched different subtrees");
+    HARD_ASSERT(count_distinct_subtrees(tree->root, &error) == 3, "count_distinct_subtrees is wrong");
+
+    expr = "sin(x) * x * x + cos(x) * x$";
+    tree_replace_root(tree, get_g(tree, &expr));
+    size_t x_idx = (size_t)get_var_idx({"x", 1}, tree->var_stack);
+
+    teylor_profile_t profile = {};
+    tree_t* profiled = make_teylor_profiled(&forest, tree, x_idx, 0.5, &profile, &error);
+    HARD_ASSERT(error == ERROR_NO && profiled != nullptr, "make_teylor_profiled failed");
+    tree_t* plain = make_teylor(&forest, tree, x_idx, 0.5, &error);
+    HARD_ASSERT(subtree_equal(profiled->root, plain->root), "profiled teylor differs from make_teylor");
+
+    HARD_ASSERT(profile.orders_cnt == 1 + 3, "orders_cnt is wrong");
+    for(size_t i = 0; i < profile.orders_cnt; i++) {
+        const teylor_order_stats_t* stats = &profile.orders[i];
+        HARD_ASSERT(stats->predicted_nodes   == stats->raw_nodes,       "get_diff_size prediction is not exact");
+        HARD_ASSERT(stats->optimized_nodes   <= stats->raw_nodes,       "optimize grew the tree");
+        HARD_ASSERT(stats->distinct_subtrees <= stats->optimized_nodes, "distinct subtrees exceed nodes");
+        HARD_ASSERT(stats->max_depth         >= 1,                      "max_depth is wrong");
+    }
+    HARD_ASSERT(profile.predicted_peak_mem > 0 && !profile.is_rejected, "peak memory is wrong");
+
+    char*  dump_text     = nullptr;
+    size_t dump_text_len = 0;
+    FILE*  dump_file     = open_memstream(&dump_text, &dump_text_len);
+    HARD_ASSERT(dump_file != nullptr, "open_memstream failed");
+    error |= teylor_profile_dump(dump_file, &profile);
+    fclose(dump_file);
+    HARD_ASSERT(strstr(dump_text, "predicted peak") != nullptr, "profile dump is wrong");
+    free(dump_text);
+
+    size_t trees_cnt = forest.tree_list->size;
+    teylor_profile_t small_profile = {};
+    small_profile.mem_budget = profile.orders[0].mem_bytes + TEYLOR_NODE_MEM_BYTES;
+    tree_t* rejected = make_teylor_profiled(&forest, tree, x_idx, 0.5, &small_profile, &error);
+    HARD_ASSERT(rejected == nullptr && (error & ERROR_BIG_SIZE), "budget was not enforced");
+    HARD_ASSERT(small_profile.is_rejected && small_profile.orders_cnt == 1, "rejection is not reported");
+    HARD_ASSERT(forest.tree_list->size == trees_cnt, "rejected teylor leaked trees");
+
+    error = forest_dest(&forest);
+    HARD_ASSERT(error == ERROR_NO, "forest_dest failed");
+    LOGGER_INFO("Тест пройден: профиль роста производных \n");
+}
+
+static void test_teylor_bound() {
+    LOGGER_INFO("=== Тест: остаточный член Тейлора ===");
+
+    error_code error = ERROR_NO;
+
+    forest_t forest = {};
+    error |= forest_init(&forest ON_DEBUG(, VER_INIT));
+    HARD_ASSERT(error == ERROR_NO, "forest_init failed");
+
+    tree_t* tree = forest_add_tree(&forest, &error);
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+    const char* expr = "sin(x) * exp(x)$";
+    tree_replace_root(tree, get_g(tree, &expr));
+    size_t x_idx = (size_t)get_var_idx({"x", 1}, tree->var_stack);
+
+    const double target_val = 0.5;
+    teylor_bound_t fixed = {};
+    fixed.radius = 0.25;
+    tree_t* bounded = make_teylor_bounded(&forest, tree, x_idx, target_val, &fixed, &error);
+    HARD_ASSERT(error == ERROR_NO && bounded != nullptr, "make_teylor_bounded failed");
+    tree_t* plain = make_teylor(&forest, tree, x_idx, target_val, &error);
+    HARD_ASSERT(subtree_equal(bounded->root, plain->root), "bounded teylor differs from make_teylor");
+    HARD_ASSERT(fixed.used_order == 3 && isfinite(fixed.remainder), "default order remainder is wrong");
+
+    teylor_bound_t adaptive = {};
+    adaptive.radius    = 0.25;
+    adaptive.tolerance = 1e-6;
+    adaptive.max_order = 10;
+    tree_t* precise = make_teylor_bounded(&forest, tree, x_idx, target_val, &adaptive, &error);
+    HARD_ASSERT(error == ERROR_NO && precise != nullptr, "adaptive make_teylor_bounded failed");
+    HARD_ASSERT(adaptive.remainder <= adaptive.tolerance, "adaptive search missed the tolerance");
+    HARD_ASSERT(adaptive.used_order > fixed.used_order && adaptive.used_order < adaptive.max_order,
+                "adaptive order is wrong");
+
+    var_bindings_t bindings = {};
+    error |= var_bindings_init(&bindings, tree->var_stack);
+    for(size_t i = 0; i <= 200; i++) {
+        double x_value = target_val - fixed.radius + 2 * fixed.radius * (double)i / 200;
+        bind_var_val(&bindings, x_idx, x_value);
+        double f_value = calculate_tree_bound(tree, &bindings, &error);
+        HARD_ASSERT(fabs(f_value - calculate_tree_bound(bounded, &bindings, &error)) <= fixed.remainder,
+                    "fixed order remainder is not a bound");
+        HARD_ASSERT(fabs(f_value - calculate_tree_bound(precise, &bindings, &error)) <= adaptive.remainder,
+                    "adaptive remainder is not a bound");
+    }
+    var_bindings_dest(&bindings);
+
+    error |= forest_dest(&forest);
+    HARD_ASSERT(error == ERROR_NO, "forest_dest failed");
+    LOGGER_INFO("Тест пройден: остаточный член Тейлора \n");
+}
+
+static void test_node_budget() {
+    LOGGER_INFO("=== Тест: бюджет узлов ===");
+
+    error_code error = ERROR_NO;
+
+    metrics_reset();
+    metrics_enable(true);
+
+    forest_t forest = {};
+    error |= forest_init(&forest ON_DEBUG(, VER_INIT));
+    HARD_ASSERT(error == ERROR_NO, "forest_init failed");
+
+    tree_t* tree = forest_add_tree(&forest, &error);
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+    const char* expr = "sin(x * x) * cos(x) * exp(x) + x * x * x$";
+    tree_replace_root(tree, get_g(tree, &expr));
+    size_t x_idx = (size_t)get_var_idx({"x", 1}, tree->var_stack);
+    size_t diff_size = get_diff_size(tree->root, {&x_idx, 1});
+
+    error |= forest_set_node_budget(&forest, diff_size - 1);
+    size_t nodes_before = metrics_counter_get(METRICS_NODES_ALLOCATED) - metrics_counter_get(METRICS_NODES_FREED);
+    tree_node_t* diff = get_diff_safe(tree->root, {&x_idx, 1}, &forest.node_budget, &error
+                                      ON_TEX_CREATION_DEBUG(, tree));
+    size_t nodes_after  = metrics_counter_get(METRICS_NODES_ALLOCATED) - metrics_counter_get(METRICS_NODES_FREED);
+    HARD_ASSERT(diff == nullptr && (error & ERROR_MEM_BUDGET), "budget was not enforced");
+    HARD_ASSERT(nodes_before == nodes_after, "partial derivative leaked");
+    HARD_ASSERT(forest.node_budget.live_nodes == 0, "budget still counts freed nodes");
+    HARD_ASSERT(forest.node_budget.peak_nodes == diff_size - 1, "budget peak is wrong");
+
+    error = ERROR_NO;
+    error |= forest_set_node_budget(&forest, diff_size);
+    diff = get_diff_safe(tree->root, {&x_idx, 1}, &forest.node_budget, &error ON_TEX_CREATION_DEBUG(, tree));
+    HARD_ASSERT(diff != nullptr && error == ERROR_NO, "derivative within budget failed");
+    HARD_ASSERT(forest.node_budget.live_nodes == diff_size, "budget lost track of live nodes");
+    tree_node_t* foreign = init_node(CONSTANT, make_union_const((const_val_type)1), nullptr, nullptr);
+    node_budget_t* prev_budget = node_budget_enter(&forest.node_budget);
+    node_free(foreign);
+    HARD_ASSERT(forest.node_budget.live_nodes == diff_size, "budget uncounted a node it never counted");
+    destroy_node_recursive(diff, nullptr);
+    node_budget_leave(prev_budget);
+    HARD_ASSERT(forest.node_budget.live_nodes == 0, "budget missed freed nodes");
+
+    error |= forest_set_node_budget(&forest, 3 * diff_size);
+    size_t trees_cnt = forest.tree_list->size;
+    tree_t* teylor = make_teylor(&forest, tree, x_idx, 0.5, &error);
+    HARD_ASSERT(teylor == nullptr, "teylor within a tiny budget succeeded");
+    HARD_ASSERT(error & ERROR_MEM_BUDGET, "teylor abort lost ERROR_MEM_BUDGET");
+    error = ERROR_NO;
+    HARD_ASSERT(forest.tree_list->size < trees_cnt + 3, "aborted teylor kept its tree");
+
+    error |= forest_set_node_budget(&forest, 0);
+    teylor = make_teylor(&forest, tree, x_idx, 0.5, &error);
+    HARD_ASSERT(teylor != nullptr && error == ERROR_NO, "teylor without a budget failed");
+
+    error |= forest_dest(&forest);
+    metrics_enable(false);
+    HARD_ASSERT(error == ERROR_NO, "forest_dest failed");
+    HARD_ASSERT(metrics_counter_get(METRICS_NODES_ALLOCATED) == metrics_counter_get(METRICS_NODES_FREED),
+                "aborted differentiation leaked nodes");
+
+    metrics_reset();
+    LOGGER_INFO("Тест пройден: бюджет узлов \n");
+}
+
+static void test_diff_cache() {
+    LOGGER_INFO("=== Тест: кэш производных ===");
+
+    error_code error = ERROR_NO;
+
+    metrics_reset();
+    metrics_enable(true);
+
+    forest_t forest = {};
+    error |= forest_init(&forest ON_DEBUG(, VER_INIT));
+    HARD_ASSERT(error == ERROR_NO, "forest_init failed");
+
+    tree_t* tree = forest_add_tree(&forest, &error);
+    HARD_ASSERT(error == ERROR_NO, "add_tree failed");
+    /* every sin(x * x * x) tops its size class, so whichever is differentiated first gets stored */
+    const char* expr = "sin(x * x * x) * cos(x) + sin(x * x * x) * exp(x) + y * sin(x * x * x)$";
+    tree_replace_root(tree, get_g(tree, &expr));
+    size_t x_idx = (size_t)get_var_idx({"x", 1}, tree->var_stack);
+
+    tree_node_t* plain = get_diff(tree->root, {&x_idx, 1} ON_TEX_CREATION_DEBUG(, tree));
+    HARD_ASSERT(plain != nullptr, "plain diff failed");
+
+    diff_cache_t cache = {};
+    error |= diff_cache_init(&cache, 10000);
+    HARD_ASSERT(error == ERROR_NO, "diff_cache_init failed");
+
+    diff_cache_t* prev_cache = diff_cache_enter(&cache);
+    tree_node_t* cached = get_diff(tree->root, {&x_idx, 1} ON_TEX_CREATION_DEBUG(, tree));
+    HARD_ASSERT(cached != nullptr && subtree_equal(plain, cached), "cached diff differs");
+    HARD_ASSERT(cache.hits > 0, "repeated subtree was not served from the cache");
+    destroy_node_recursive(cached, nullptr);
+
+    size_t misses = cache.misses;
+    cached = get_diff(tree->root, {&x_idx, 1} ON_TEX_CREATION_DEBUG(, tree));
+    HARD_ASSERT(cached != nullptr && subtree_equal(plain, cached), "diff from a warm cache differs");
+    HARD_ASSERT(cache.misses == misses, "warm cache missed the whole tree");
+    destroy_node_recursive(cached, nullptr);
+    diff_cache_leave(prev_cache);
+    destroy_node_recursive(plain, nullptr);
+
+    diff_cache_t small = {};
+    error |= diff_cache_init(&small, 60);
+    prev_cache = diff_cache_enter(&small);
+    cached = get_diff(tree->root, {&x_idx, 1} ON_TEX_CREATION_DEBUG(, tree));
+    diff_cache_leave(prev_cache);
+    HARD_ASSERT(cached != nullptr, "diff with a small cache failed");
+    HARD_ASSERT(small.nodes_cnt <= 60, "cache grew past its limit");
+    HARD_ASSERT(small.evictions > 0, "small cache never evicted");
+    destroy_node_recursive(cached, nullptr);
+    diff_cache_dest(&small);
+
+    tree_t* teylor_plain = make_teylor(&forest, tree, x_idx, 0.5, &error);
+    error |= forest_set_diff_cache(&forest, &cache);
+    tree_t* teylor_cached = make_teylor(&forest, tree, x_idx, 0.5, &error);
+    HARD_ASSERT(teylor_plain && teylor_cached, "make_teylor failed");
+    HARD_ASSERT(subtree_equal(teylor_plain->root, teylor_cached->root), "cached teylor differs");
+
+    error |= forest_dest(&forest);
+    diff_cache_dest(&cache);
+    metrics_enable(false);
+    HARD_ASSERT(error == ERROR_NO, "forest_dest failed");
+    HARD_ASSERT(metrics_counter_get(METRICS_NODES_ALLOCATED) == metrics_counter_get(METRICS_NODES_FREED),
+                "cache leaked nodes");
+
+    metrics_reset();
+    LOGGER_INFO("Тест пройден: кэш производных \n");
+}
+
+static void test_batch_service() {
+    LOGGER_INFO("=== Тест: пакетный сервис ===");
+
+    char jobs[] =
+        "# comment\n"
+        "eval x=1,y=2|x=3,y=4 : x * y\n"
+        "diff x,y : x * y + sin(x)\n"
+        "\n"
+        "simplify : 0 * x + 2 * 3\n"
+        "simplify : x +\n"
+        "frob : x\n"
+        "teylor x=0 : x * x + 1\n"
+        "eval x=2 : x * x * x\n"
+        "teylor x=0 : 1 / x\n"
+        "simplify : 0.0025 * x + 0 - 0.0025\n";
+
+    FILE* in = fmemopen(jobs, sizeof(jobs) - 1, "r");
+    HARD_ASSERT(in != nullptr, "fmemopen failed");
+    char*  out_text = nullptr;
+    size_t out_len  = 0;
+    FILE*  out      = open_memstream(&out_text, &out_len);
+    HARD_ASSERT(out != nullptr, "open_memstream failed");
+
+    batch_opts_t opts = {.threads_cnt = 3, .max_nodes = 1000, .chunk_jobs = 2};
+    error_code error = batch_service_run(in, out, &opts);
+    fclose(in);
+    fclose(out);
+    HARD_ASSERT(error == ERROR_NO, "batch_service_run failed");
+
+    const char expected[] =
+        "2\tok\t2 12\n"
+        "3\tok\tx: (y + cos(x)); y: x\n"
+        "5\tok\t6\n"
+        "6\terror\tsyntax error at column 15\n"
+        "7\terror\tunknown op 'frob'\n"
+        "8\tok\t";
+    HARD_ASSERT(strncmp(out_text, expected, sizeof(expected) - 1) == 0, "batch output is wrong or out of order");
+    HARD_ASSERT(strstr(out_text, "\n9\tok\t8\n") != nullptr, "eval job is missing");
+    HARD_ASSERT(strstr(out_text, "\n10\terror\tseries is not finite\n") != nullptr, "garbage series was ok");
+    HARD_ASSERT(strstr(out_text, "\n11\tok\t((0.0025 * x) - 0.0025)\n") != nullptr, "constants are not the shortest");
+    free(out_text);
+
+    LOGGER_INFO("Тест пройден: пакетный сервис \n");
+}
+
 static void test_teylor() {
     LOGGER_INFO("=== Тест: тейлор ===");
 
@@ -958,7 +2560,7 @@ static void test_teylor() {
     tree_dump(tree, VER_INIT, false, "AAAAAAAAAAA");
     HARD_ASSERT(error == ERROR_NO, "ask for vars failed");
 
-    tree_t* tree_teylor = make_teylor(&forest, tree, x_idx, 1);
+    tree_t* tree_teylor = make_teylor(&forest, tree, x_idx, 1, &error);
     HARD_ASSERT(error == ERROR_NO, "tree optimize failed");
     error = print_tex_expr(tree_teylor, tree_teylor->root, "teylor f(x)|dx = ");
 
@@ -1011,7 +2613,7 @@ static void test_main() {
     HARD_ASSERT(temp != -1, "Failed to find x");
     size_t x_idx = (size_t)temp; 
     
-    tree_t* tree_teylor = make_teylor(&forest, tree, x_idx, 1);
+    tree_t* tree_teylor = make_teylor(&forest, tree, x_idx, 1, &error);
     HARD_ASSERT(error == ERROR_NO, "tree optimize failed");
 
     print_tex_H2(forest.tex_file, "Полный план сражения с Тейлором-Боблином");
@@ -1024,7 +2626,10 @@ static void test_main() {
     forest_close_dump_file(&forest);
     forest_close_tex_file(&forest);
     )
-    tree_plot_to_gnuplot(tree, x_idx, -5, 5, 100, "teylor_plot.dat", "teylor_plot.png");
+    const tree_t* plot_trees[]  = {tree, tree_teylor};
+    const char*   plot_titles[] = {"f(x)", "teylor f(x)"};
+    trees_plot_to_gnuplot(plot_trees, plot_titles, 2, x_idx, -5, 5, 100, "teylor_plot.dat", "teylor_plot.png",
+                          {PLOT_DATA_TEXT, 0});
     free(forest_buff.ptr);
     forest_dest(&forest);
     LOGGER_INFO("Тест пройден: тейлор \n"); 
@@ -1047,19 +2652,42 @@ int run_tests() {
     test_write_constant_tree();
     test_write_variable_tree();
     test_write_complex_tree();
+    test_parse_iterative();
+    test_write_real_constants();
+    test_forest_file();
+    test_forest_lazy();
     
     test_dump_empty_tree();
     test_DSL();
     test_dump_copied_tree();
+    test_dump_pipeline();
+    test_dump_big_tree();
+    test_tree_check();
     test_diff_big_tree();
     test_calculate_tree_without_vars();
     test_calculate_tree_with_vars();
+    test_calculate_tree_bound();
     test_calculate_tree_diff();
     test_calculate_tree_nth_diff();
     test_tree_optimize();
     test_tree_tex_print();
     test_tree_input();
     test_tree_hard_tex();
+    test_expr_generator();
+    test_expr_stream();
+    test_num_literal();
+    test_plot_parallel();
+    test_plot_adaptive();
+    test_plot_multi();
+    test_plot_session();
+    test_interval_eval();
+    test_metrics();
+    test_subtree_hash_index();
+    test_teylor_profile();
+    test_teylor_bound();
+    test_node_budget();
+    test_diff_cache();
+    test_batch_service();
     test_teylor();
     test_main();
     
@@ -17,6 +17,7 @@
 #include "my_string.h"
 #include "file_operations.h"
 #include "tex_io.h"
+#include "metrics.h"
 
 //================================================================================
 
@@ -403,7 +404,7 @@ void print_tex_introduction(FILE* tex) {
 struct comment_t {
     const char* const* arr;
     size_t             size;
-    size_t             curr_idx;
+    size_t             curr_idx; /* shared by --batch workers, only touched atomically */
 };
 
 //--------------------------------------------------------------------------------
@@ -411,10 +412,8 @@ struct comment_t {
 static const char* get_next_comment(comment_t* comments) {
     if (!comments || !comments->arr || comments->size == 0) return nullptr;
 
-    if (comments->curr_idx >= comments->size)
-        comments->curr_idx = 0;
-
-    return comments->arr[comments->curr_idx++];
+    size_t idx = __atomic_fetch_add(&comments->curr_idx, 1, __ATOMIC_RELAXED);
+    return comments->arr[idx % comments->size];
 }
 
 static const char* const comments_arr_zero[] = {
@@ -498,6 +497,7 @@ error_code print_tex_expr(const tree_t* tree, tree_node_t*  node, const char* fm
         return ERROR_NO;
     }
     FILE* tex = *tree->tex_file;
+    long long begin_ns = metrics_phase_begin();
 
     if (fmt && *fmt) {
         va_list args = {};
@@ -518,6 +518,7 @@ error_code print_tex_expr(const tree_t* tree, tree_node_t*  node, const char* fm
     }
      
     fflush(tex);
+    metrics_phase_end(METRICS_PHASE_TEX, begin_ns);
 
     return error;
 }
@@ -534,6 +535,7 @@ error_code print_diff_step(const tree_t* tree, tree_node_t* node, const char* pa
 
     FILE* tex = *tree->tex_file;
     error_code error = ERROR_NO;
+    long long begin_ns = metrics_phase_begin();
 
     if (fprintf(tex, EXPR_HEAD) < 0) {
         LOGGER_ERROR("print_diff_step: begin failed");
@@ -573,5 +575,6 @@ error_code print_diff_step(const tree_t* tree, tree_node_t* node, const char* pa
     }
 
     fflush(tex);
+    metrics_phase_end(METRICS_PHASE_TEX, begin_ns);
     return error;
 }
@@ -11,8 +11,13 @@
 #include "tree_verification.h"
 #include "list_verification.h"
 #include "tex_io.h"
+#include "metrics.h"
+#include "diff_cache.h"
+#include "interval.h"
+#include "tree_check.h"
 
 #include <math.h>
+#include <float.h>
 
 static const int TEYLOR_DEPTH  = 4;
 
@@ -25,7 +30,15 @@ static unsigned long long calc_fact(int n) {
     return ans;
 }
 
-static tree_t* add_diff(forest_t* forest, tree_t* target_tree, args_arr_t args_arr, error_code* error) {
+static void profile_order_stats(teylor_order_stats_t* stats, const tree_node_t* root, error_code* error) {
+    stats->optimized_nodes   = count_nodes_recursive(root);
+    stats->max_depth         = subtree_max_depth(root);
+    stats->distinct_subtrees = count_distinct_subtrees(root, error);
+    stats->mem_bytes         = stats->optimized_nodes * TEYLOR_NODE_MEM_BYTES;
+}
+
+static tree_t* add_diff(forest_t* forest, tree_t* target_tree, args_arr_t args_arr,
+                        teylor_order_stats_t* stats, error_code* error) {
     HARD_ASSERT(forest      != nullptr, "forest is nullptr");
     HARD_ASSERT(target_tree != nullptr, "target_tree is nullptr");
     HARD_ASSERT(error       != nullptr, "error is nullptr");
@@ -38,34 +51,57 @@ static tree_t* add_diff(forest_t* forest, tree_t* target_tree, args_arr_t args_a
     print_tex_expr(target_tree, target_tree->root, "Текущий ход событий: ");
     print_tex_delimeter(forest->tex_file);
     LOGGER_DEBUG("add_diff: get_diff started");
-    tree_node_t* diff_root = get_diff(target_tree->root, args_arr ON_TEX_CREATION_DEBUG(, target_tree));
+    long long diff_begin_ns = stats ? metrics_now_ns() : 0;
+    tree_node_t* diff_root = get_diff_safe(target_tree->root, args_arr, &forest->node_budget, error
+                                           ON_TEX_CREATION_DEBUG(, target_tree));
     if(diff_root == nullptr) {
         *error |= ERROR_GET_DIFF;
         LOGGER_ERROR("add_diff: failed to take diff");
+        forest_delete_tree(forest, diff_tree);
         return nullptr;
     }
+    if(stats) {
+        stats->diff_ns   = metrics_now_ns() - diff_begin_ns;
+        stats->raw_nodes = count_nodes_recursive(diff_root);
+    }
 
     LOGGER_DEBUG("add_diff: optimize_subtree started");
+    long long opt_begin_ns = stats ? metrics_now_ns() : 0;
+    long long begin_ns = metrics_phase_begin();
     tree_node_t* optimized_root = optimize_subtree_recursive(diff_root, error);
+    metrics_phase_end(METRICS_PHASE_OPTIMIZE, begin_ns);
+    if(*error == ERROR_NO && stats) {
+        stats->optimize_ns = metrics_now_ns() - opt_begin_ns;
+        profile_order_stats(stats, optimized_root, error);
+    }
     if(*error != ERROR_NO) {
         LOGGER_ERROR("add_diff: failed to optimize tree");
+        destroy_node_recursive(optimized_root, nullptr);
+        forest_delete_tree(forest, diff_tree);
         return nullptr;
     }
 
     tree_replace_root(diff_tree, optimized_root);
+    /* a nan constant is a legit value of the series, only damage to the structure fails */
+    *error |= tree_check(diff_tree, forest->threads_cnt, nullptr) & ~(error_code)ERROR_NAN_CONST;
+    if(*error != ERROR_NO) {
+        LOGGER_ERROR("add_diff: derivative failed the structure check");
+        forest_delete_tree(forest, diff_tree);
+        return nullptr;
+    }
 
     return diff_tree;
 }
 
 
 static const_val_type add_and_calculate_diff(forest_t* forest,    tree_t* target_tree, tree_t** diff_out_tree,
-                                             args_arr_t args_arr, error_code* error) {
+                                             args_arr_t args_arr, teylor_order_stats_t* stats, error_code* error) {
     HARD_ASSERT(forest      != nullptr, "Forest is nullptr");
     HARD_ASSERT(target_tree != nullptr, "Target_tree is nullptr");
     HARD_ASSERT(error       != nullptr, "error si nullptr");
 
     LOGGER_DEBUG("Add_and_calculate_diff: started");
-    *diff_out_tree = add_diff(forest, target_tree, args_arr, error);
+    *diff_out_tree = add_diff(forest, target_tree, args_arr, stats, error);
     if(*error != ERROR_NO) {
         LOGGER_ERROR("make_teylor: failed make diff");
         return NAN;
@@ -78,44 +114,209 @@ static const_val_type add_and_calculate_diff(forest_t* forest,    tree_t* target
 
 static tree_t* teylor_add_summand(tree_t* teylor_tree, tree_node_t* summand) {
     HARD_ASSERT(teylor_tree != nullptr, "forest is nullptr");
-    HARD_ASSERT(summand     != nullptr, "Summand is nullptr");
 
+    if(summand == nullptr) return nullptr;
     tree_node_t* new_root = init_node(FUNCTION, make_union_func(ADD), teylor_tree->root, summand);
+    if(new_root == nullptr) {
+        destroy_node_recursive(summand, nullptr);
+        return nullptr;
+    }
     tree_change_root(teylor_tree, new_root);
     return teylor_tree;
 }
 
+/* remainder of the degree diff_order - 1 polynomial, diff_tree is f^(diff_order) */
+static double teylor_remainder(const tree_t* diff_tree, size_t var_idx, const_val_type target_val,
+                               const_val_type radius, size_t diff_order, error_code* error) {
+    interval_bindings_t boxes = {};
+    *error |= interval_bindings_init(&boxes, diff_tree->var_stack);
+    if(*error != ERROR_NO) return INFINITY;
+
+    double diff_sup   = 0;
+    double piece_size = 2 * radius / (double)TEYLOR_BOUND_PIECES;
+    for(size_t i = 0; i < TEYLOR_BOUND_PIECES; i++) {
+        double piece_lo = target_val - radius + piece_size * (double)i;
+        double piece_hi = (i + 1 == TEYLOR_BOUND_PIECES) ? target_val + radius : piece_lo + piece_size;
+        bind_var_interval(&boxes, var_idx, interval_make(piece_lo, piece_hi));
+
+        interval_t range = interval_tree_eval(diff_tree, &boxes, error);
+        if(range.is_empty || range.is_partial) {
+            diff_sup = INFINITY;
+            break;
+        }
+        diff_sup = fmax(diff_sup, fmax(fabs(range.lo), fabs(range.hi)));
+    }
+    interval_bindings_dest(&boxes);
+
+    /* three more roundings on the way, each under an ulp */
+    double remainder = diff_sup * pow(radius, (double)diff_order) / (double)calc_fact((int)diff_order);
+    return remainder * (1 + 4 * DBL_EPSILON);
+}
+
+static tree_t* teylor_abort(forest_t* forest, tree_t* teylor_tree, node_budget_t* prev_budget,
+                            diff_cache_t* prev_cache, long long begin_ns) {
+    if(teylor_tree) forest_delete_tree(forest, teylor_tree);
+    node_budget_leave(prev_budget);
+    diff_cache_leave(prev_cache);
+    metrics_phase_end(METRICS_PHASE_TEYLOR, begin_ns);
+    return nullptr;
+}
+
+
+static void profile_start(teylor_profile_t* profile, const tree_t* root_tree, error_code* error) {
+    HARD_ASSERT(TEYLOR_DEPTH <= (int)TEYLOR_PROFILE_MAX_ORDERS, "profile can't hold all orders");
+
+    profile->orders_cnt         = 1;
+    profile->orders[0]          = {};
+    profile->is_rejected        = false;
+    profile->predicted_peak_mem = 0;
+
+    teylor_order_stats_t* input_stats = &profile->orders[0];
+    profile_order_stats(input_stats, root_tree->root, error);
+    input_stats->predicted_nodes = input_stats->optimized_nodes;
+    input_stats->raw_nodes       = input_stats->optimized_nodes;
+    profile->live_nodes          = input_stats->optimized_nodes;
+}
 
-tree_t* make_teylor(forest_t* forest, tree_t* root_tree, size_t var_idx, const_val_type target_val) { //TODO - Обнаруживание функций 2-х переменных
+/* get_diff_size is exact, so the peak of the next order is known before any node of it is allocated */
+static bool profile_admit_order(teylor_profile_t* profile, const tree_t* target_tree, size_t var_idx) {
+    teylor_order_stats_t* stats = &profile->orders[profile->orders_cnt];
+    *stats = {};
+    stats->predicted_nodes = get_diff_size(target_tree->root, {&var_idx, 1});
+
+    size_t peak_mem = (profile->live_nodes + stats->predicted_nodes) * TEYLOR_NODE_MEM_BYTES;
+    if(peak_mem > profile->predicted_peak_mem) profile->predicted_peak_mem = peak_mem;
+
+    if(profile->mem_budget && peak_mem > profile->mem_budget) {
+        LOGGER_WARNING("make_teylor: order %zu needs ~%zu bytes, budget is %zu",
+                       profile->orders_cnt, peak_mem, profile->mem_budget);
+        profile->is_rejected = true;
+        return false;
+    }
+    return true;
+}
+
+static tree_t* make_teylor_impl(forest_t* forest, tree_t* root_tree, size_t var_idx, const_val_type target_val,
+                                teylor_profile_t* profile, teylor_bound_t* bound, error_code* error_ptr) {
     HARD_ASSERT(forest    != nullptr, "forest is nullptr");
     HARD_ASSERT(root_tree != nullptr, "tree is nullptr");
+    HARD_ASSERT(error_ptr != nullptr, "error is nullptr");
 
     LOGGER_DEBUG("make_teylor: started");
 
     error_code error = ERROR_NO;
+    if(profile) profile_start(profile, root_tree, &error);
+    long long begin_ns = metrics_phase_begin();
+    node_budget_t* prev_budget = node_budget_enter(&forest->node_budget);
+    diff_cache_t*  prev_cache  = diff_cache_enter(forest->diff_cache);
     print_tex_H1(forest->tex_file, "Прибывает Тейлор и куча дальних родственников");
     tree_t* teylor_tree = forest_add_tree(forest, &error);
     if(error != ERROR_NO) {
         LOGGER_ERROR("add_tree failed");
-        return nullptr;
+        *error_ptr |= error;
+        return teylor_abort(forest, nullptr, prev_budget, prev_cache, begin_ns);
     }
     print_tex_expr(teylor_tree, root_tree->root, "Текущий ход событий: "); //REVIEW - СТоит ли делать отдельный парсер
     put_var_val(teylor_tree, var_idx, target_val);
 
     const_val_type first_val = calculate_tree(root_tree, false);
 
-    tree_init_root(teylor_tree, CONSTANT, make_union_const(first_val));
+    if(tree_init_root(teylor_tree, CONSTANT, make_union_const(first_val)) == nullptr) {
+        *error_ptr |= ERROR_MEM_BUDGET;
+        return teylor_abort(forest, teylor_tree, prev_budget, prev_cache, begin_ns);
+    }
+
+    size_t max_order = (size_t)TEYLOR_DEPTH - 1;
+    if(bound) {
+        if(bound->order)          max_order = bound->order;
+        if(bound->tolerance > 0)  max_order = bound->max_order ? bound->max_order : TEYLOR_MAX_ORDER;
+        if(max_order > TEYLOR_MAX_ORDER) max_order = TEYLOR_MAX_ORDER;
+        bound->used_order = 0;
+        bound->remainder  = INFINITY;
+    }
+
+    /* with a bound, one extra derivative is taken for the remainder only */
+    size_t diffs_cnt = max_order + (bound ? 1 : 0);
+    for(size_t i = 1; i <= diffs_cnt; i++) {
+        LOGGER_DEBUG("make_teylor: making %zu diff", i);
+        teylor_order_stats_t* stats = nullptr;
+        if(profile) {
+            if(!profile_admit_order(profile, root_tree, var_idx)) {
+                *error_ptr |= ERROR_BIG_SIZE;
+                return teylor_abort(forest, teylor_tree, prev_budget, prev_cache, begin_ns);
+            }
+            stats = &profile->orders[profile->orders_cnt];
+        }
 
-    for(int i = 1; i < TEYLOR_DEPTH; i++) {
-        LOGGER_DEBUG("make_teylor: making %d diff", i);
-        print_tex_H2(forest->tex_file, "Прибывает %d-ая волна родственников Тейлора-Боблина", i);
-        const_val_type res = add_and_calculate_diff(forest, root_tree, &root_tree, {&var_idx, 1}, &error);
+        print_tex_H2(forest->tex_file, "Прибывает %zu-ая волна родственников Тейлора-Боблина", i);
+        const_val_type res = add_and_calculate_diff(forest, root_tree, &root_tree, {&var_idx, 1}, stats, &error);
+        if(error != ERROR_NO) {
+            LOGGER_ERROR("make_teylor: failed to make diff %zu", i);
+            *error_ptr |= error;
+            return teylor_abort(forest, teylor_tree, prev_budget, prev_cache, begin_ns);
+        }
+        if(profile) {
+            profile->live_nodes += stats->optimized_nodes;
+            profile->orders_cnt++;
+        }
+        if(bound && (i == diffs_cnt || bound->tolerance > 0)) {
+            bound->used_order = i - 1;
+            bound->remainder  = teylor_remainder(root_tree, var_idx, target_val, bound->radius, i, &error);
+            if(error != ERROR_NO) {
+                *error_ptr |= error;
+                return teylor_abort(forest, teylor_tree, prev_budget, prev_cache, begin_ns);
+            }
+            LOGGER_DEBUG("make_teylor: degree %zu remainder <= %g", i - 1, bound->remainder);
+            if(i == diffs_cnt || (bound->tolerance > 0 && bound->remainder <= bound->tolerance)) break;
+        }
 
+        ON_DUMP_CREATION_DEBUG(const tree_t* tree = teylor_tree;) /* the DSL dumps every node it makes to tree */
         tree_node_t* target_var = init_node(VARIABLE, make_union_var(var_idx), nullptr, nullptr);
-        tree_node_t* summand = MUL_(DIV_(c(res), c((double)calc_fact(i))),
+        tree_node_t* summand = MUL_(DIV_(c(res), c((double)calc_fact((int)i))),
                                     POW_(SUB_(target_var, c(target_val)),
-                                         c(i)));
-        teylor_add_summand(teylor_tree, summand);
+                                         c((double)i)));
+        if(teylor_add_summand(teylor_tree, summand) == nullptr) {
+            *error_ptr |= ERROR_MEM_BUDGET;
+            return teylor_abort(forest, teylor_tree, prev_budget, prev_cache, begin_ns);
+        }
     }
+    node_budget_leave(prev_budget);
+    diff_cache_leave(prev_cache);
+    metrics_phase_end(METRICS_PHASE_TEYLOR, begin_ns);
     return teylor_tree;
+}
+
+tree_t* make_teylor(forest_t* forest, tree_t* root_tree, size_t var_idx, const_val_type target_val,
+                    error_code* error) { //TODO - Обнаруживание функций 2-х переменных
+    return make_teylor_impl(forest, root_tree, var_idx, target_val, nullptr, nullptr, error);
+}
+
+tree_t* make_teylor_profiled(forest_t* forest, tree_t* root_tree, size_t var_idx, const_val_type target_val,
+                             teylor_profile_t* profile, error_code* error) {
+    HARD_ASSERT(profile != nullptr, "profile is nullptr");
+    return make_teylor_impl(forest, root_tree, var_idx, target_val, profile, nullptr, error);
+}
+
+tree_t* make_teylor_bounded(forest_t* forest, tree_t* root_tree, size_t var_idx, const_val_type target_val,
+                            teylor_bound_t* bound, error_code* error) {
+    HARD_ASSERT(bound        != nullptr, "bound is nullptr");
+    HARD_ASSERT(bound->radius > 0,       "radius must be positive");
+    return make_teylor_impl(forest, root_tree, var_idx, target_val, nullptr, bound, error);
+}
+
+error_code teylor_profile_dump(FILE* out, const teylor_profile_t* profile) {
+    HARD_ASSERT(out     != nullptr, "out is nullptr");
+    HARD_ASSERT(profile != nullptr, "profile is nullptr");
+
+    fprintf(out, "%5s %10s %10s %10s %8s %10s %12s %12s %12s\n", "order", "predicted", "raw", "optimized",
+            "depth", "distinct", "diff_us", "optimize_us", "mem_bytes");
+    for(size_t i = 0; i < profile->orders_cnt; i++) {
+        const teylor_order_stats_t* stats = &profile->orders[i];
+        fprintf(out, "%5zu %10zu %10zu %10zu %8zu %10zu %12.1f %12.1f %12zu\n", i, stats->predicted_nodes,
+                stats->raw_nodes, stats->optimized_nodes, stats->max_depth, stats->distinct_subtrees,
+                (double)stats->diff_ns / 1e3, (double)stats->optimize_ns / 1e3, stats->mem_bytes);
+    }
+    fprintf(out, "predicted peak: %zu bytes%s\n", profile->predicted_peak_mem,
+            profile->is_rejected ? ", rejected: over budget" : "");
+    return ERROR_NO;
 }
\ No newline at end of file
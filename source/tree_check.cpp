@@ -0,0 +1,288 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "asserts.h"
+#include "logger.h"
+#include "parallel.h"
+#include "tree_check.h"
+
+//================================================================================
+
+static const size_t TREE_CHECK_PARALLEL_MIN     = 1 << 14; /* smaller trees are walked by one thread  */
+static const size_t TREE_CHECK_TASKS_PER_THREAD = 8;
+static const size_t TREE_CHECK_SPLIT_MAX_POPS   = 64;      /* per wanted task, for degenerate trees    */
+static const size_t TREE_CHECK_MIN_SET_CAP      = 64;
+static const size_t TREE_CHECK_MAX_SET_HINT     = 1 << 22; /* size is not trusted for the first guess */
+static const size_t TREE_CHECK_MIN_STACK        = 64;
+
+#define HANDLE_FUNC(op_code, str_name, impl_func, args_cnt, ...) args_cnt,
+static const size_t FUNC_ARGS_CNT[] = {
+    #include "copy_past_file"
+};
+#undef HANDLE_FUNC
+
+static const size_t FUNCS_CNT = sizeof(FUNC_ARGS_CNT) / sizeof(FUNC_ARGS_CNT[0]);
+
+enum check_insert_t {
+    CHECK_NEW,
+    CHECK_SEEN,
+    CHECK_FULL
+};
+
+struct check_set_t {
+    const tree_node_t** slots;   /* open addressing, slots are claimed with CAS */
+    size_t              cap;
+    size_t              cnt;
+    bool                is_full; /* walkers stop, the check is rerun with a bigger set */
+};
+
+struct check_task_t {
+    const tree_node_t*  root;
+    tree_check_report_t report;
+    error_code          error;
+};
+
+struct check_ctx_t {
+    check_set_t   set;
+    check_task_t* tasks;
+    size_t        tasks_cnt;
+    size_t        vars_cnt;
+    bool          has_vars;
+};
+
+//================================================================================
+
+static check_insert_t check_set_insert(check_set_t* set, const tree_node_t* node) {
+    uint64_t hash = (uint64_t)((uintptr_t)node >> 4) * 0x9E3779B97F4A7C15ull;
+    size_t   mask = set->cap - 1;
+    size_t   slot = (size_t)(hash ^ (hash >> 32)) & mask;
+
+    for(size_t probes = 0; probes < set->cap; probes++, slot = (slot + 1) & mask) {
+        const tree_node_t* curr = __atomic_load_n(&set->slots[slot], __ATOMIC_RELAXED);
+        if(!curr) {
+            if(4 * __atomic_load_n(&set->cnt, __ATOMIC_RELAXED) >= 3 * set->cap) break;
+            if(__atomic_compare_exchange_n(&set->slots[slot], &curr, node, false,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                __atomic_fetch_add(&set->cnt, 1, __ATOMIC_RELAXED);
+                return CHECK_NEW;
+            }
+        }
+        if(curr == node) return CHECK_SEEN;
+    }
+    __atomic_store_n(&set->is_full, true, __ATOMIC_RELAXED);
+    return CHECK_FULL;
+}
+
+/* false if the children can not be trusted */
+static bool check_node(const check_ctx_t* ctx, const tree_node_t* node, check_task_t* task) {
+    task->report.nodes_cnt++;
+    bool is_leaf = !node->left && !node->right;
+
+    switch(node->type) {
+        case FUNCTION: {
+            size_t func = (size_t)node->value.func;
+            if(func >= FUNCS_CNT) {
+                task->report.bad_func_cnt++;
+                task->error |= ERROR_UNKNOWN_FUNC;
+                return false;
+            }
+            bool has_args = node->left && (FUNC_ARGS_CNT[func] == 2) == (node->right != nullptr);
+            if(!has_args) {
+                task->report.arity_cnt++;
+                task->error |= ERROR_BAD_ARITY;
+            }
+            return true;
+        }
+        case CONSTANT:
+            if(isnan(node->value.constant)) {
+                task->report.nan_cnt++;
+                task->error |= ERROR_NAN_CONST;
+            }
+            break;
+        case VARIABLE:
+            if(ctx->has_vars && node->value.var_idx >= ctx->vars_cnt) {
+                task->report.var_idx_cnt++;
+                task->error |= ERROR_INCORRECT_INDEX;
+            }
+            break;
+        default:
+            task->report.bad_type_cnt++;
+            task->error |= ERROR_INVALID_STRUCTURE;
+            return false;
+    }
+
+    if(!is_leaf) {
+        task->report.arity_cnt++;
+        task->error |= ERROR_BAD_ARITY;
+    }
+    return true;
+}
+
+static void check_walk(check_ctx_t* ctx, check_task_t* task) {
+    size_t              stack_cap = TREE_CHECK_MIN_STACK;
+    size_t              stack_cnt = 0;
+    const tree_node_t** stack     = (const tree_node_t**)calloc(stack_cap, sizeof(tree_node_t*));
+    if(!stack) {
+        task->error |= ERROR_MEM_ALLOC;
+        return;
+    }
+
+    stack[stack_cnt++] = task->root;
+    while(stack_cnt > 0 && !__atomic_load_n(&ctx->set.is_full, __ATOMIC_RELAXED)) {
+        const tree_node_t* node = stack[--stack_cnt];
+
+        check_insert_t inserted = check_set_insert(&ctx->set, node);
+        if(inserted == CHECK_FULL) break;
+        if(inserted == CHECK_SEEN) {
+            task->report.shared_cnt++;
+            task->error |= ERROR_SHARED_NODE;
+            continue;
+        }
+        if(!check_node(ctx, node, task)) continue;
+
+        if(stack_cnt + 2 > stack_cap) {
+            const tree_node_t** new_stack = (const tree_node_t**)realloc(stack, 2 * stack_cap * sizeof(tree_node_t*));
+            if(!new_stack) {
+                task->error |= ERROR_MEM_ALLOC;
+                break;
+            }
+            stack      = new_stack;
+            stack_cap *= 2;
+        }
+        if(node->right) stack[stack_cnt++] = node->right;
+        if(node->left)  stack[stack_cnt++] = node->left;
+    }
+    free(stack);
+}
+
+static void check_task_func(size_t task_idx, void* arg) {
+    check_ctx_t* ctx = (check_ctx_t*)arg;
+    check_walk(ctx, &ctx->tasks[task_idx]);
+}
+
+//--------------------------------------------------------------------------------
+
+/* Breadth first from the root until the frontier has tasks_want subtrees; the nodes
+   above the frontier are checked here, into split_task. */
+static error_code check_split(check_ctx_t* ctx, const tree_node_t* root, size_t tasks_want,
+                              check_task_t* split_task) {
+    size_t              ring_cap = tasks_want + 2;
+    const tree_node_t** ring     = (const tree_node_t**)calloc(ring_cap, sizeof(tree_node_t*));
+    if(!ring) return ERROR_MEM_ALLOC;
+
+    size_t head = 0, live_cnt = 0;
+    ring[live_cnt++] = root;
+    for(size_t pops = 0; live_cnt > 0 && live_cnt < tasks_want && pops < TREE_CHECK_SPLIT_MAX_POPS * tasks_want; pops++) {
+        const tree_node_t* node = ring[head];
+        head = (head + 1) % ring_cap;
+        live_cnt--;
+
+        check_insert_t inserted = check_set_insert(&ctx->set, node);
+        if(inserted == CHECK_FULL) break;
+        if(inserted == CHECK_SEEN) {
+            split_task->report.shared_cnt++;
+            split_task->error |= ERROR_SHARED_NODE;
+            continue;
+        }
+        if(!check_node(ctx, node, split_task)) continue;
+
+        if(node->left)  ring[(head + live_cnt++) % ring_cap] = node->left;
+        if(node->right) ring[(head + live_cnt++) % ring_cap] = node->right;
+    }
+
+    ctx->tasks = (check_task_t*)calloc(live_cnt ? live_cnt : 1, sizeof(check_task_t));
+    if(!ctx->tasks) {
+        free(ring);
+        return ERROR_MEM_ALLOC;
+    }
+    for(size_t i = 0; i < live_cnt; i++) ctx->tasks[i].root = ring[(head + i) % ring_cap];
+    ctx->tasks_cnt = live_cnt;
+
+    free(ring);
+    return ERROR_NO;
+}
+
+static void report_add(tree_check_report_t* sum, const tree_check_report_t* part) {
+    sum->nodes_cnt    += part->nodes_cnt;
+    sum->shared_cnt   += part->shared_cnt;
+    sum->arity_cnt    += part->arity_cnt;
+    sum->bad_func_cnt += part->bad_func_cnt;
+    sum->bad_type_cnt += part->bad_type_cnt;
+    sum->var_idx_cnt  += part->var_idx_cnt;
+    sum->nan_cnt      += part->nan_cnt;
+}
+
+/* one full pass with a set of set_cap slots, is_full on return means it was too small */
+static error_code check_pass(check_ctx_t* ctx, const tree_node_t* root, size_t threads_cnt, size_t set_cap,
+                             tree_check_report_t* report) {
+    ctx->set = {};
+    ctx->set.slots = (const tree_node_t**)calloc(set_cap, sizeof(tree_node_t*));
+    if(!ctx->set.slots) return ERROR_MEM_ALLOC;
+    ctx->set.cap = set_cap;
+
+    check_task_t split_task = {};
+    size_t       tasks_want = threads_cnt > 1 ? threads_cnt * TREE_CHECK_TASKS_PER_THREAD : 1;
+    error_code   error      = check_split(ctx, root, tasks_want, &split_task);
+    if(error == ERROR_NO) error = parallel_for(ctx->tasks_cnt, threads_cnt, check_task_func, ctx);
+
+    *report = {};
+    report_add(report, &split_task.report);
+    error |= split_task.error;
+    for(size_t i = 0; i < ctx->tasks_cnt; i++) {
+        report_add(report, &ctx->tasks[i].report);
+        error |= ctx->tasks[i].error;
+    }
+    report->tasks_cnt = ctx->tasks_cnt;
+
+    free(ctx->tasks);
+    ctx->tasks     = nullptr;
+    ctx->tasks_cnt = 0;
+    free(ctx->set.slots);
+    ctx->set.slots = nullptr;
+    return error;
+}
+
+//================================================================================
+
+error_code tree_check(const tree_t* tree, size_t threads_cnt, tree_check_report_t* report) {
+    if(!tree) return ERROR_NULL_ARG;
+
+    tree_check_report_t local_report = {};
+    if(!report) report = &local_report;
+    *report = {};
+
+    if(!tree->root) return tree->size == 0 ? (error_code)ERROR_NO : (error_code)ERROR_SIZE_MISMATCH;
+
+    if(threads_cnt == 0)                    threads_cnt = parallel_threads_cnt();
+    if(tree->size < TREE_CHECK_PARALLEL_MIN) threads_cnt = 1;
+
+    size_t hint    = tree->size < TREE_CHECK_MAX_SET_HINT ? tree->size : TREE_CHECK_MAX_SET_HINT;
+    size_t set_cap = TREE_CHECK_MIN_SET_CAP;
+    while(set_cap < 2 * hint) set_cap *= 2;
+
+    check_ctx_t ctx = {};
+    ctx.has_vars = tree->var_stack != nullptr;
+    ctx.vars_cnt = ctx.has_vars ? tree->var_stack->size : 0;
+
+    error_code error = ERROR_NO;
+    while(true) {
+        error = check_pass(&ctx, tree->root, threads_cnt, set_cap, report);
+        if(!ctx.set.is_full || (error & ERROR_MEM_ALLOC)) break;
+        LOGGER_DEBUG("tree_check: visited set of %zu slots is full, retrying", set_cap);
+        set_cap *= 4;
+    }
+
+    /* with shared nodes size counts paths, not nodes, and can not be compared */
+    if(!(error & (ERROR_SHARED_NODE | ERROR_MEM_ALLOC)) && report->nodes_cnt != tree->size) {
+        error |= ERROR_SIZE_MISMATCH;
+    }
+
+    if(error != ERROR_NO) {
+        LOGGER_DEBUG("tree_check: error %ld: nodes %zu (size %zu), shared %zu, arity %zu, func %zu, type %zu, "
+                     "var_idx %zu, nan %zu", error, report->nodes_cnt, tree->size, report->shared_cnt,
+                     report->arity_cnt, report->bad_func_cnt, report->bad_type_cnt, report->var_idx_cnt,
+                     report->nan_cnt);
+    }
+    return error;
+}
@@ -15,6 +15,7 @@
 #include "../libs/StackDead-main/stack.h"
 #include "my_string.h"
 #include "file_operations.h"
+#include "num_literal.h"
 
 //================================================================================
 
@@ -34,15 +35,39 @@ static func_struct op_codes[] = {
 
 const int op_codes_num = sizeof(op_codes) / sizeof(func_struct);
 
+#define HANDLE_FUNC(op_code, str_name, ...) \
+    sizeof(#str_name) - 1,
+
+static const size_t op_name_lens[] = {
+    #include "copy_past_file"
+};
+
+#undef HANDLE_FUNC
+
+static const size_t NODES_PARSE_MIN_STACK = 64;
+
+struct parse_frame_t {
+    tree_node_t* node;
+    int          children_read; /* 0, 1 or 2, then ')' is expected */
+};
+
 //================================================================================
 
-static func_type_t get_op_code(c_string_t func_str, error_code* error) {
-    HARD_ASSERT(func_str.ptr != nullptr, "func_name nullptr");
-    LOGGER_DEBUG("A: %d", op_codes_num);
+/* lengths are compared first, so no strlen per candidate */
+static bool find_op_code(c_string_t func_str, func_type_t* func) {
     for(size_t i = 0; i < op_codes_num; i++) {
-        LOGGER_DEBUG("AA: %d и %s", op_codes[i].func_type, op_codes[i].func_name);
-        if(my_scstrcmp(func_str, op_codes[i].func_name) == 0) return op_codes[i].func_type;
+        if(op_name_lens[i] == func_str.len && memcmp(func_str.ptr, op_codes[i].func_name, func_str.len) == 0) {
+            *func = op_codes[i].func_type;
+            return true;
+        }
     }
+    return false;
+}
+
+static func_type_t get_op_code(c_string_t func_str, error_code* error) {
+    HARD_ASSERT(func_str.ptr != nullptr, "func_name nullptr");
+    func_type_t func = ADD;
+    if(find_op_code(func_str, &func)) return func;
 
     LOGGER_ERROR("Func doesn`t found");
     *error |= ERROR_UNKNOWN_FUNC;
@@ -127,6 +152,35 @@ static error_code debug_print_buffer_remainder(tree_t* tree, const char* value_s
 
 //================================================================================
 
+/* constant or function name in [start, end), anything but a quoted variable; nothing past end is read */
+static bool parse_bare_value(const char* start, const char* end, node_type_t* node_type_ptr, value_t* node_value_ptr,
+                             error_code* error) {
+    const char* number_ptr = start;
+    if (*number_ptr == '-' || *number_ptr == '+') number_ptr++;
+    const_val_type numeric_val = 0;
+    size_t number_len = num_literal_scan(number_ptr, (size_t)(end - number_ptr), &numeric_val);
+    if(number_len > 0 && number_ptr + number_len != end) {
+        LOGGER_ERROR("read_node: invalid constant '%.*s'", (int)(end - start), start);
+        *error |= ERROR_READ_FILE;
+        return false;
+    }
+
+    if (number_len > 0) {
+        *node_type_ptr = CONSTANT;
+        node_value_ptr->constant = *start == '-' ? -numeric_val : numeric_val;
+        return true;
+    }
+
+    *node_type_ptr = FUNCTION;
+    node_value_ptr->func = get_op_code({start, (unsigned long)(end - start)}, error);
+    if(*error & ERROR_UNKNOWN_FUNC) {
+        LOGGER_ERROR("try_parse_node_value: invalid function '%.*s'", (int)(end - start), start);
+        *error |= ERROR_READ_FILE;
+        return false;
+    }
+    return true;
+}
+
 static int try_parse_node_value(tree_t* tree_ptr, node_type_t* node_type_ptr, value_t* node_value_ptr,
                                 const char** value_start_ptr_ref,  const char** value_end_ptr_ref,  const char** current_ptr_ref,
                                 error_code* error)
@@ -174,25 +228,13 @@ static int try_parse_node_value(tree_t* tree_ptr, node_type_t* node_type_ptr, va
             scan_pointer++;
         }
         value_end_ptr = scan_pointer;
-        char* number_end_ptr = nullptr;
-        long long numeric_val = strtoll(value_start_ptr, &number_end_ptr, 10);
-        if(errno != 0 || (number_end_ptr != value_start_ptr && *number_end_ptr == '\0')) {
-            LOGGER_ERROR("read_node: invalid constant '%s'", value_start_ptr);
+        if (*value_end_ptr == '\0') {
+            LOGGER_ERROR("read_node: unexpected end after '%s'", value_start_ptr);
             *error |= ERROR_READ_FILE;
             return 0;
         }
-
-        if (number_end_ptr != value_start_ptr) {
-            *node_type_ptr = CONSTANT;
-            node_value_ptr->constant = (const_val_type)numeric_val;
-        } else {
-            *node_type_ptr = FUNCTION;
-            node_value_ptr->func = get_op_code({value_start_ptr, (unsigned long)(value_end_ptr - value_start_ptr)}, error);
-            if(errno != 0) {
-                LOGGER_ERROR("try_parse_node_value: invalid function '%s'", value_start_ptr);
-                *error |= ERROR_READ_FILE;
-                return 0;
-            }
+        if (!parse_bare_value(value_start_ptr, value_end_ptr, node_type_ptr, node_value_ptr, error)) {
+            return 0;
         }
         current_ptr = value_end_ptr;
     }
@@ -300,21 +342,170 @@ static tree_node_t* read_node(tree_t* tree_ptr, tree_node_t* parent_node_ptr,
 
 //================================================================================
 
-error_code tree_parse_from_buffer(tree_t* tree) {
+/* "(" value, the var is searched in lookup_stack or, if add_stack is set, added to it */
+static const char* parse_node_value(const char* curr, const char* end, const stack_t* lookup_stack, stack_t* add_stack,
+                                    node_type_t* node_type, value_t* node_value, error_code* error) {
+    while (curr < end && isspace((unsigned char)*curr)) curr++;
+
+    if (curr < end && *curr == '\"') {
+        const char* name_end = (const char*)memchr(curr + 1, '\"', (size_t)(end - curr - 1));
+        if (!name_end) {
+            LOGGER_ERROR("tree_parse_nodes: missing closing '\"' for variable");
+            *error |= ERROR_READ_FILE;
+            return nullptr;
+        }
+        c_string_t var_name = {curr + 1, (size_t)(name_end - curr - 1)};
+        ssize_t    var_idx  = add_stack ? (ssize_t)get_or_add_var_idx(var_name, 0, add_stack, error)
+                                        : get_var_idx(var_name, lookup_stack);
+        if (*error != ERROR_NO) return nullptr;
+        if (var_idx < 0) {
+            LOGGER_ERROR("tree_parse_nodes: variable '%.*s' is not declared", (int)var_name.len, var_name.ptr);
+            *error |= ERROR_INCORRECT_INDEX;
+            return nullptr;
+        }
+        *node_type          = VARIABLE;
+        node_value->var_idx = (size_t)var_idx;
+        return name_end + 1;
+    }
+
+    const char* value_end = curr;
+    while (value_end < end && !isspace((unsigned char)*value_end)) value_end++;
+    if (value_end == curr || !parse_bare_value(curr, value_end, node_type, node_value, error)) {
+        *error |= ERROR_READ_FILE;
+        return nullptr;
+    }
+    return value_end;
+}
+
+/*
+ * One pass over the text with an explicit stack of open nodes, so nesting depth is not limited
+ * by the call stack. Each node is linked to its parent as soon as it is made: on error the
+ * root owns everything built so far.
+ */
+static tree_node_t* parse_nodes_iterative(const char** curr_ref, const char* end, const stack_t* lookup_stack,
+                                          stack_t* add_stack, size_t* nodes_cnt, error_code* error) {
+    size_t         stack_cap = NODES_PARSE_MIN_STACK;
+    size_t         stack_cnt = 0;
+    parse_frame_t* stack     = (parse_frame_t*)calloc(stack_cap, sizeof(parse_frame_t));
+    if (!stack) {
+        *error |= ERROR_MEM_ALLOC;
+        return nullptr;
+    }
+
+    tree_node_t* root = nullptr;
+    const char*  curr = *curr_ref;
+    do {
+        while (curr < end && isspace((unsigned char)*curr)) curr++;
+
+        parse_frame_t* top = stack_cnt ? &stack[stack_cnt - 1] : nullptr;
+        if (top && top->children_read == 2) {
+            if (curr == end || *curr != ')') {
+                LOGGER_ERROR("tree_parse_nodes: expected ')' after children");
+                *error |= ERROR_READ_FILE;
+                break;
+            }
+            curr++;
+            stack_cnt--;
+            if (stack_cnt) stack[stack_cnt - 1].children_read++;
+            continue;
+        }
+
+        tree_node_t** slot = !top ? &root : top->children_read == 0 ? &top->node->left : &top->node->right;
+        if (end - curr >= 3 && memcmp(curr, "nil", 3) == 0) {
+            curr += (end - curr >= 4 && curr[3] == 'l') ? 4 : 3;
+            if (top) top->children_read++;
+            continue;
+        }
+        if (curr == end || *curr != '(') {
+            LOGGER_ERROR("tree_parse_nodes: expected '(' or 'nil'");
+            *error |= ERROR_READ_FILE;
+            break;
+        }
+
+        node_type_t node_type  = {};
+        value_t     node_value = {};
+        curr = parse_node_value(curr + 1, end, lookup_stack, add_stack, &node_type, &node_value, error);
+        if (!curr) break;
+
+        *slot = init_node(node_type, node_value, nullptr, nullptr);
+        if (!*slot) {
+            *error |= ERROR_MEM_ALLOC;
+            break;
+        }
+        (*nodes_cnt)++;
+
+        if (stack_cnt == stack_cap) {
+            parse_frame_t* new_stack = (parse_frame_t*)realloc(stack, 2 * stack_cap * sizeof(parse_frame_t));
+            if (!new_stack) {
+                *error |= ERROR_MEM_ALLOC;
+                break;
+            }
+            stack      = new_stack;
+            stack_cap *= 2;
+        }
+        stack[stack_cnt++] = {*slot, 0};
+    } while (stack_cnt > 0);
+
+    free(stack);
+    if (*error != ERROR_NO) {
+        destroy_node_recursive(root, nullptr);
+        return nullptr;
+    }
+    *curr_ref = curr;
+    return root;
+}
+
+//================================================================================
+
+/* skips the "#tree_format N" line if there is one, no line means version 1 */
+static error_code read_format_header(const char** curr_ref) {
+    const char* curr = *curr_ref;
+    if (*curr != '#') return ERROR_NO;
+
+    size_t magic_len = strlen(TREE_FILE_MAGIC);
+    if (strncmp(curr, TREE_FILE_MAGIC, magic_len) != 0) {
+        LOGGER_ERROR("read_format_header: unknown header");
+        return ERROR_READ_FILE;
+    }
+    curr += magic_len;
+
+    char* version_end = nullptr;
+    long  version     = strtol(curr, &version_end, 10);
+    if (version_end == curr || version < 1 || version > TREE_FILE_VERSION) {
+        LOGGER_ERROR("read_format_header: unsupported format version %ld", version);
+        errno = 0;
+        return ERROR_READ_FILE;
+    }
+
+    *curr_ref = skip_whitespace(version_end);
+    return ERROR_NO;
+}
+
+static error_code parse_tree_buffer(tree_t* tree, bool is_stepwise) {
     HARD_ASSERT(tree           != nullptr, "tree is nullptr");
     HARD_ASSERT(tree->buff.ptr != nullptr, "buffer is nullptr");
     LOGGER_DEBUG("tree_parse_from_buffer: started");
 
     const char* curr = skip_whitespace(tree->buff.ptr);
+    if (read_format_header(&curr) != ERROR_NO) {
+        return ERROR_INVALID_STRUCTURE;
+    }
     
     if (*curr == '\0') {
         LOGGER_DEBUG("tree_parse_from_buffer: empty file, returning empty tree");
         return ERROR_NO;
     }
     
-    error_code parse_error = 0;
-
-    tree_node_t* root = read_node(tree, nullptr, &parse_error, &curr, tree->buff);
+    error_code   parse_error = 0;
+    size_t       nodes_cnt   = 0;
+    tree_node_t* root        = nullptr;
+    if (is_stepwise) {
+        root      = read_node(tree, nullptr, &parse_error, &curr, tree->buff);
+        nodes_cnt = parse_error ? 0 : count_nodes_recursive(root);
+    } else {
+        root = parse_nodes_iterative(&curr, tree->buff.ptr + tree->buff.len, tree->var_stack, tree->var_stack,
+                                     &nodes_cnt, &parse_error);
+    }
 
     if (parse_error) {
         LOGGER_ERROR("parse_tree_from_buffer: failed to parse tree");
@@ -328,12 +519,25 @@ error_code tree_parse_from_buffer(tree_t* tree) {
     }
 
     tree->root = root;
-    tree->size = count_nodes_recursive(root);
-    ON_DEBUG(fflush(*tree->dump_file);)
+    tree->size = nodes_cnt;
+    ON_DEBUG(if (is_stepwise) fflush(*tree->dump_file);)
     LOGGER_DEBUG("parse_tree_from_buffer: successfully parsed tree with %zu nodes", tree->size);
     return ERROR_NO;
 }
 
+error_code tree_parse_from_buffer(tree_t* tree) {
+    HARD_ASSERT(tree != nullptr, "tree is nullptr");
+
+    /* the per node dumps are only worth their cost when somebody reads them */
+    bool is_stepwise = false;
+    ON_DEBUG(is_stepwise = tree->dump_file && *tree->dump_file;)
+    return parse_tree_buffer(tree, is_stepwise);
+}
+
+error_code tree_parse_from_buffer_stepwise(tree_t* tree) {
+    return parse_tree_buffer(tree, true);
+}
+
 error_code tree_read_from_file(tree_t* tree, const char* filename) {
     HARD_ASSERT(tree != nullptr, "tree pointer is nullptr");
     HARD_ASSERT(filename != nullptr, "filename is nullptr");
@@ -354,6 +558,11 @@ error_code tree_read_from_file(tree_t* tree, const char* filename) {
     if (error != ERROR_NO) {
         return error;
     }
+    if (fclose(file) != 0) {
+        LOGGER_ERROR("tree_read_from_file: failed to close file");
+        free(buff_str.ptr);
+        return ERROR_CLOSE_FILE;
+    }
 
     tree->buff = {.ptr = buff_str.ptr, .len = buff_str.len};
 
@@ -366,6 +575,24 @@ error_code tree_read_from_file(tree_t* tree, const char* filename) {
     return ERROR_NO;
 }
 
+//================================================================================
+
+bool tree_func_by_name(c_string_t name, func_type_t* func) {
+    HARD_ASSERT(func != nullptr, "func is nullptr");
+
+    return find_op_code(name, func);
+}
+
+tree_node_t* tree_parse_nodes(const char** curr_ref, const char* end, const stack_t* var_stack, size_t* nodes_cnt,
+                              error_code* error) {
+    HARD_ASSERT(curr_ref  != nullptr, "curr_ref is nullptr");
+    HARD_ASSERT(var_stack != nullptr, "var_stack is nullptr");
+    HARD_ASSERT(nodes_cnt != nullptr, "nodes_cnt is nullptr");
+    HARD_ASSERT(error     != nullptr, "error is nullptr");
+
+    return parse_nodes_iterative(curr_ref, end, var_stack, nullptr, nodes_cnt, error);
+}
+
 const char* tech_get_func_name_by_type(func_type_t func_type_value) {
     for (size_t index_value = 0; index_value < (size_t)op_codes_num; ++index_value) {
         if (op_codes[index_value].func_type == func_type_value) {
@@ -381,15 +608,15 @@ static error_code write_node(const tree_t* tree_ptr, FILE* file_ptr, tree_node_t
     HARD_ASSERT(file_ptr != nullptr, "file is nullptr");
     
     if (node_ptr == nullptr) {
-        if (fprintf(file_ptr, "nil") < 0) {
-            LOGGER_ERROR("write_node: fprintf failed for nil");
+        if (fputs("nil", file_ptr) == EOF) {
+            LOGGER_ERROR("write_node: fputs failed for nil");
             return ERROR_OPEN_FILE;
         }
         return ERROR_NO;
     }
     
-    if (fprintf(file_ptr, "(") < 0) {
-        LOGGER_ERROR("write_node: fprintf failed for opening");
+    if (fputc('(', file_ptr) == EOF) {
+        LOGGER_ERROR("write_node: fputc failed for opening");
         return ERROR_OPEN_FILE;
     }
     
@@ -400,42 +627,55 @@ static error_code write_node(const tree_t* tree_ptr, FILE* file_ptr, tree_node_t
             return ERROR_OPEN_FILE;
         }
     } else if (node_ptr->type == CONSTANT) {
-        if (fprintf(file_ptr, "%llu", (unsigned long long)node_ptr->value.constant) < 0) {
-            LOGGER_ERROR("write_node: fprintf failed for constant");
+        char   num_buff[NUM_LITERAL_MAX_LEN] = {};
+        size_t num_len = num_literal_print(node_ptr->value.constant, num_buff);
+        if (num_len == 0) {
+            LOGGER_ERROR("write_node: nan constant can not be written");
+            return ERROR_NAN_CONST;
+        }
+        if (fwrite(num_buff, 1, num_len, file_ptr) != num_len) {
+            LOGGER_ERROR("write_node: fwrite failed for constant");
             return ERROR_OPEN_FILE;
         }
     } else if (node_ptr->type == FUNCTION) {
         const char* func_name_ptr = tech_get_func_name_by_type(node_ptr->value.func);
-        if (fprintf(file_ptr, "%s", func_name_ptr) < 0) {
-            LOGGER_ERROR("write_node: fprintf failed for function");
+        if (fputs(func_name_ptr, file_ptr) == EOF) {
+            LOGGER_ERROR("write_node: fputs failed for function");
             return ERROR_OPEN_FILE;
         }
     }
 
-    if (fprintf(file_ptr, " ") < 0) {
-        LOGGER_ERROR("write_node: fprintf failed for space after value");
+    if (fputc(' ', file_ptr) == EOF) {
+        LOGGER_ERROR("write_node: fputc failed for space after value");
         return ERROR_OPEN_FILE;
     }
 
     error_code error_value = write_node(tree_ptr, file_ptr, node_ptr->left);
     if (error_value != ERROR_NO) return error_value;
     
-    if (fprintf(file_ptr, " ") < 0) {
-        LOGGER_ERROR("write_node: fprintf failed for space between children");
+    if (fputc(' ', file_ptr) == EOF) {
+        LOGGER_ERROR("write_node: fputc failed for space between children");
         return ERROR_OPEN_FILE;
     }
     
     error_value = write_node(tree_ptr, file_ptr, node_ptr->right);
     if (error_value != ERROR_NO) return error_value;
     
-    if (fprintf(file_ptr, ")") < 0) {
-        LOGGER_ERROR("write_node: fprintf failed for closing paren");
+    if (fputc(')', file_ptr) == EOF) {
+        LOGGER_ERROR("write_node: fputc failed for closing paren");
         return ERROR_OPEN_FILE;
     }
     
     return ERROR_NO;
 }
 
+error_code tree_write_nodes(const tree_t* tree, FILE* file) {
+    HARD_ASSERT(tree != nullptr, "tree pointer is nullptr");
+    HARD_ASSERT(file != nullptr, "file is nullptr");
+
+    return write_node(tree, file, tree->root);
+}
+
 error_code tree_write_to_file(const tree_t* tree, const char* filename) {
     HARD_ASSERT(tree != nullptr, "tree pointer is nullptr");
     HARD_ASSERT(filename != nullptr, "filename is nullptr");
@@ -451,7 +691,12 @@ error_code tree_write_to_file(const tree_t* tree, const char* filename) {
     
     error_code error = ERROR_NO;
     if (tree->root != nullptr) {
-        error = write_node(tree, file, tree->root);
+        if (fprintf(file, "%s %d\n", TREE_FILE_MAGIC, TREE_FILE_VERSION) < 0) {
+            LOGGER_ERROR("tree_write_to_file: fprintf failed for header");
+            error = ERROR_OPEN_FILE;
+        } else {
+            error = write_node(tree, file, tree->root);
+        }
     }
     
     if (fclose(file) != 0) {
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <stdarg.h>
 #include <math.h>
+#include <atomic>
 
 #include "debug_meta.h"
 #include "asserts.h"
@@ -15,6 +16,7 @@
 #include "../libs/StackDead-main/stack.h" //КАК
 #include "forest_operations.h"
 #include "forest_info.h"
+#include "metrics.h"
 
 
 //================================================================================
@@ -64,23 +66,88 @@ value_t make_union_universal(node_type_t type, ...) {
     return val;
 }
 
+static thread_local node_budget_t* active_node_budget = nullptr;
+static std::atomic<uint32_t>       node_budget_ids{0};
+
+/* Returns the previously active budget, hand it back to node_budget_leave */
+node_budget_t* node_budget_enter(node_budget_t* budget) {
+    node_budget_t* prev_budget = active_node_budget;
+    if(budget) {
+        budget->is_exceeded = false;
+        while(budget->id == 0) budget->id = ++node_budget_ids; /* skips 0 on wrap-around */
+    }
+    active_node_budget = budget;
+    return prev_budget;
+}
+
+void node_budget_leave(node_budget_t* prev_budget) {
+    active_node_budget = prev_budget;
+}
+
+static bool node_budget_take(uint32_t* budget_id) {
+    node_budget_t* budget = active_node_budget;
+    *budget_id = 0;
+    if(!budget) return true;
+
+    if(budget->is_exceeded || (budget->max_nodes && budget->live_nodes >= budget->max_nodes)) {
+        if(!budget->is_exceeded) LOGGER_WARNING("init_node: node budget of %zu nodes exceeded", budget->max_nodes);
+        budget->is_exceeded = true;
+        return false;
+    }
+    budget->live_nodes++;
+    if(budget->live_nodes > budget->peak_nodes) budget->peak_nodes = budget->live_nodes;
+    *budget_id = budget->id;
+    return true;
+}
+
+/* Only the budget that counted a node uncounts it: nodes made outside it don't shrink live_nodes */
+static void node_budget_release(uint32_t budget_id) {
+    node_budget_t* budget = active_node_budget;
+    if(budget && budget_id != 0 && budget_id == budget->id && budget->live_nodes) budget->live_nodes--;
+}
+
 tree_node_t* init_node(node_type_t node_type, value_t value, tree_node_t* left, tree_node_t* right) {
+    uint32_t budget_id = 0;
+    if (!node_budget_take(&budget_id)) return nullptr;
+
     tree_node_t* node = (tree_node_t*)calloc(1, sizeof(tree_node_t));
     if (node == nullptr) {
         LOGGER_ERROR("allocate_node: calloc failed");
+        node_budget_release(budget_id);
+        if(active_node_budget) active_node_budget->is_exceeded = true;
         return nullptr;
     }
+    node->budget_id = budget_id;
     node->type   = node_type;
     node->value  = value;
     node->left   = left;
     node->right  = right;
+    metrics_count(METRICS_NODES_ALLOCATED, 1);
     return node;
 }
 
+/* Owns left and right: they are destroyed if the node can't be made, so nested DSL builders don't leak */
+tree_node_t* init_node_taking(node_type_t node_type, value_t value, tree_node_t* left, tree_node_t* right) {
+    tree_node_t* node = init_node(node_type, value, left, right);
+    if (node == nullptr) {
+        destroy_node_recursive(left,  nullptr);
+        destroy_node_recursive(right, nullptr);
+    }
+    return node;
+}
+
+void node_free(tree_node_t* node) {
+    if(!node) return;
+    node_budget_release(node->budget_id);
+    metrics_count(METRICS_NODES_FREED, 1);
+    free(node);
+}
+
 tree_node_t* init_node_with_dump(node_type_t node_type, value_t value, tree_node_t* left, tree_node_t* right, const tree_t* tree) {
     HARD_ASSERT(tree  != nullptr, "tree is nullptr");
 
-    tree_node_t* node = init_node(node_type, value, left, right);
+    tree_node_t* node = init_node_taking(node_type, value, left, right);
+    if (node == nullptr) return nullptr;
     tree_t tree_clone = {};
     tree_clone = *tree;
     tree_change_root(&tree_clone, node);
@@ -102,7 +169,7 @@ error_code destroy_node_recursive(tree_node_t* node, size_t* removed_out) {
     size_t right_removed = 0;
     error |= destroy_node_recursive(node->right, &right_removed);
 
-    free(node);
+    node_free(node);
     removed_local = 1 + left_removed + right_removed;
     if (removed_out != nullptr) *removed_out = removed_local;
     return error;
@@ -147,16 +214,22 @@ tree_node_t* subtree_deep_copy(const tree_node_t* node, error_code* error ON_DUM
     if (error != nullptr && *error != ERROR_NO) return nullptr;
     if (node == nullptr) return nullptr;
 
-    tree_node_t* left_copy  = subtree_deep_copy(node->left,  error ON_DUMP_CREATION_DEBUG(, tree));
+    tree_node_t* left_copy = subtree_deep_copy(node->left, error ON_DUMP_CREATION_DEBUG(, tree));
+    if (node->left != nullptr && left_copy == nullptr) {
+        if(error != nullptr) *error |= ERROR_MEM_ALLOC;
+        return nullptr;
+    }
     tree_node_t* right_copy = subtree_deep_copy(node->right, error ON_DUMP_CREATION_DEBUG(, tree));
-
-    if (error != nullptr && *error != ERROR_NO) {
+    if (node->right != nullptr && right_copy == nullptr) {
+        destroy_node_recursive(left_copy, nullptr);
+        if(error != nullptr) *error |= ERROR_MEM_ALLOC;
         return nullptr;
     }
+
     #ifdef CREATION_DEBUG
         tree_node_t* copy = init_node_with_dump(node->type, node->value, left_copy, right_copy, tree);
     #else 
-        tree_node_t* copy = init_node(node->type, node->value, left_copy, right_copy);
+        tree_node_t* copy = init_node_taking(node->type, node->value, left_copy, right_copy);
     #endif
 
     if (!copy) {
@@ -178,6 +251,318 @@ size_t count_nodes_recursive(const tree_node_t* node) {
     return 1 + count_nodes_recursive(node->left) + count_nodes_recursive(node->right);
 }
 
+size_t subtree_max_depth(const tree_node_t* node) {
+    if (node == nullptr) return 0;
+    size_t left_depth  = subtree_max_depth(node->left);
+    size_t right_depth = subtree_max_depth(node->right);
+    return 1 + (left_depth > right_depth ? left_depth : right_depth);
+}
+
+//================================================================================
+
+static const uint64_t HASH_NULL_NODE = 0x6A09E667F3BCC909ull;
+static const size_t   SUBTREE_WALK_LOCAL_STACK = 32;  /* pending nodes kept in the frame before the heap is used */
+static const size_t   SUBTREE_INDEX_MIN_SLOTS  = 64;
+
+struct hash_walk_frame_t {
+    const tree_node_t* node;
+    bool               is_expanded; /* children are pushed, the node is combined when met again */
+};
+
+struct hash_walk_result_t {
+    uint64_t hash;
+    size_t   size;
+};
+
+struct node_pair_t {
+    const tree_node_t* first;
+    const tree_node_t* second;
+};
+
+uint64_t hash_mix(uint64_t hash, uint64_t value) {
+    hash ^= value + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2);
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+uint64_t hash_bytes(const void* data, size_t len) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+/* bit pattern with -0.0 folded into 0.0, so that equal constants hash equally */
+static uint64_t const_bits(const_val_type constant) {
+    const_val_type normalized = constant + 0.0;
+    uint64_t bits = 0;
+    memcpy(&bits, &normalized, sizeof(bits));
+    return bits;
+}
+
+static uint64_t node_value_bits(const tree_node_t* node) {
+    switch (node->type) {
+        case CONSTANT: return const_bits(node->value.constant);
+        case VARIABLE: return (uint64_t)node->value.var_idx;
+        case FUNCTION: return (uint64_t)node->value.func;
+        default:
+            LOGGER_ERROR("node_value_bits: unknown node type %d", (int)node->type);
+            return 0;
+    }
+}
+
+/* doubles the stack; the first one lives in the caller frame and is copied, not freed */
+bool walk_stack_grow(void** stack, size_t* cap, const void* local_stack, size_t elem_size) {
+    void* new_stack = *stack == local_stack ? malloc(2 * *cap * elem_size)
+                                            : realloc(*stack, 2 * *cap * elem_size);
+    if (!new_stack) return false;
+    if (*stack == local_stack) memcpy(new_stack, local_stack, *cap * elem_size);
+    *stack = new_stack;
+    *cap  *= 2;
+    return true;
+}
+
+/* subtree_hash(node) == node_hash_combine(node, subtree_hash(left), subtree_hash(right)) */
+uint64_t node_hash_combine(const tree_node_t* node, uint64_t left_hash, uint64_t right_hash) {
+    if (node == nullptr) return HASH_NULL_NODE;
+
+    uint64_t hash = hash_mix((uint64_t)node->type, node_value_bits(node));
+    hash = hash_mix(hash, left_hash);
+    hash = hash_mix(hash, right_hash);
+    return hash;
+}
+
+uint64_t subtree_hash(const tree_node_t* node) {
+    if (node == nullptr) return HASH_NULL_NODE;
+
+    uint64_t hash = 0;
+    if (subtree_hash_walk(node, nullptr, &hash, nullptr) != ERROR_NO) return 0;
+    return hash;
+}
+
+bool subtree_equal(const tree_node_t* first, const tree_node_t* second) {
+    node_pair_t  local_pairs[SUBTREE_WALK_LOCAL_STACK];
+    node_pair_t* pairs     = local_pairs;
+    size_t       pairs_cap = SUBTREE_WALK_LOCAL_STACK;
+    size_t       pairs_cnt = 0;
+
+    bool is_equal = true;
+    pairs[pairs_cnt++] = {first, second};
+    while (pairs_cnt > 0 && is_equal) {
+        node_pair_t pair = pairs[--pairs_cnt];
+        if (pair.first == pair.second) continue;
+        if (pair.first == nullptr || pair.second == nullptr || pair.first->type != pair.second->type ||
+            node_value_bits(pair.first) != node_value_bits(pair.second)) {
+            is_equal = false;
+            break;
+        }
+
+        if (pairs_cnt + 2 > pairs_cap && !walk_stack_grow((void**)&pairs, &pairs_cap, local_pairs, sizeof(node_pair_t))) {
+            LOGGER_ERROR("subtree_equal: out of memory, subtrees are reported different");
+            is_equal = false;
+            break;
+        }
+        pairs[pairs_cnt++] = {pair.first->right, pair.second->right};
+        pairs[pairs_cnt++] = {pair.first->left,  pair.second->left};
+    }
+
+    if (pairs != local_pairs) free(pairs);
+    return is_equal;
+}
+
+//--------------------------------------------------------------------------------
+
+static size_t hash_index_pos(const subtree_hash_index_t* index, const tree_node_t* node) {
+    return (size_t)(((uintptr_t)node >> 4) * 0x9E3779B97F4A7C15ull) & (index->slots_cap - 1);
+}
+
+static void hash_index_put(subtree_hash_index_t* index, subtree_hash_entry_t entry) {
+    size_t pos = hash_index_pos(index, entry.node);
+    while (index->slots[pos].node != nullptr && index->slots[pos].node != entry.node) {
+        pos = (pos + 1) & (index->slots_cap - 1);
+    }
+    if (index->slots[pos].node == nullptr) index->entries_cnt++;
+    index->slots[pos] = entry;
+}
+
+/* load is kept under 1/2, the probes stay short */
+static error_code hash_index_reserve(subtree_hash_index_t* index, size_t entries_cnt) {
+    if (2 * entries_cnt < index->slots_cap) return ERROR_NO;
+
+    size_t new_cap = index->slots_cap ? index->slots_cap : SUBTREE_INDEX_MIN_SLOTS;
+    while (2 * entries_cnt >= new_cap) new_cap *= 2;
+    subtree_hash_entry_t* new_slots = (subtree_hash_entry_t*)calloc(new_cap, sizeof(subtree_hash_entry_t));
+    if (!new_slots) {
+        LOGGER_ERROR("subtree_hash_index: calloc failed");
+        return ERROR_MEM_ALLOC;
+    }
+
+    subtree_hash_entry_t* old_slots = index->slots;
+    size_t                old_cap   = index->slots_cap;
+    index->slots       = new_slots;
+    index->slots_cap   = new_cap;
+    index->entries_cnt = 0;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old_slots[i].node) hash_index_put(index, old_slots[i]);
+    }
+    free(old_slots);
+    return ERROR_NO;
+}
+
+error_code subtree_hash_walk(const tree_node_t* root, subtree_hash_index_t* index, uint64_t* hash, size_t* size) {
+    HARD_ASSERT(hash != nullptr, "hash is nullptr");
+
+    hash_walk_frame_t  local_frames [SUBTREE_WALK_LOCAL_STACK];
+    hash_walk_result_t local_results[SUBTREE_WALK_LOCAL_STACK];
+    hash_walk_frame_t*  frames      = local_frames;
+    hash_walk_result_t* results     = local_results;
+    size_t              frames_cap  = SUBTREE_WALK_LOCAL_STACK;
+    size_t              results_cap = SUBTREE_WALK_LOCAL_STACK;
+    size_t              frames_cnt  = 0;
+    size_t              results_cnt = 0;
+
+    /* an expanded frame is met again after both children, their results are on top of results */
+    error_code error = ERROR_NO;
+    frames[frames_cnt++] = {root, false};
+    while (frames_cnt > 0) {
+        hash_walk_frame_t frame = frames[--frames_cnt];
+        if (frame.node == nullptr || frame.is_expanded) {
+            hash_walk_result_t result = {HASH_NULL_NODE, 0};
+            if (frame.node) {
+                hash_walk_result_t right = results[--results_cnt];
+                hash_walk_result_t left  = results[--results_cnt];
+                result = {node_hash_combine(frame.node, left.hash, right.hash), 1 + left.size + right.size};
+                if (index) {
+                    error = hash_index_reserve(index, index->entries_cnt + 1);
+                    if (error != ERROR_NO) break;
+                    hash_index_put(index, {frame.node, result.hash, result.size});
+                }
+            }
+            if (results_cnt == results_cap &&
+                !walk_stack_grow((void**)&results, &results_cap, local_results, sizeof(hash_walk_result_t))) {
+                error = ERROR_MEM_ALLOC;
+                break;
+            }
+            results[results_cnt++] = result;
+            continue;
+        }
+
+        const subtree_hash_entry_t* entry = index ? subtree_hash_index_find(index, frame.node) : nullptr;
+        if (entry) { /* known from an earlier walk, its subtree is not walked again */
+            if (results_cnt == results_cap &&
+                !walk_stack_grow((void**)&results, &results_cap, local_results, sizeof(hash_walk_result_t))) {
+                error = ERROR_MEM_ALLOC;
+                break;
+            }
+            results[results_cnt++] = {entry->hash, entry->size};
+            continue;
+        }
+
+        if (frames_cnt + 3 > frames_cap &&
+            !walk_stack_grow((void**)&frames, &frames_cap, local_frames, sizeof(hash_walk_frame_t))) {
+            error = ERROR_MEM_ALLOC;
+            break;
+        }
+        frames[frames_cnt++] = {frame.node, true};
+        frames[frames_cnt++] = {frame.node->right, false};
+        frames[frames_cnt++] = {frame.node->left,  false};
+    }
+
+    if (error == ERROR_NO) {
+        *hash = results[0].hash;
+        if (size) *size = results[0].size;
+    } else {
+        LOGGER_ERROR("subtree_hash_walk: out of memory");
+    }
+    if (frames  != local_frames)  free(frames);
+    if (results != local_results) free(results);
+    return error;
+}
+
+error_code subtree_hash_index_build(subtree_hash_index_t* index, const tree_node_t* root) {
+    HARD_ASSERT(index != nullptr, "index is nullptr");
+
+    uint64_t root_hash = 0;
+    return subtree_hash_walk(root, index, &root_hash, nullptr);
+}
+
+const subtree_hash_entry_t* subtree_hash_index_find(const subtree_hash_index_t* index, const tree_node_t* node) {
+    HARD_ASSERT(index != nullptr, "index is nullptr");
+    if (!node || index->entries_cnt == 0) return nullptr;
+
+    for (size_t pos = hash_index_pos(index, node); index->slots[pos].node; pos = (pos + 1) & (index->slots_cap - 1)) {
+        if (index->slots[pos].node == node) return &index->slots[pos];
+    }
+    return nullptr;
+}
+
+void subtree_hash_index_dest(subtree_hash_index_t* index) {
+    if (!index) return;
+    free(index->slots);
+    *index = {};
+}
+
+struct hashed_node_t {
+    uint64_t           hash;
+    const tree_node_t* node;
+};
+
+static int hashed_node_cmp(const void* first, const void* second) {
+    uint64_t first_hash  = ((const hashed_node_t*)first)->hash;
+    uint64_t second_hash = ((const hashed_node_t*)second)->hash;
+    return (first_hash > second_hash) - (first_hash < second_hash);
+}
+
+size_t count_distinct_subtrees(const tree_node_t* root, error_code* error) {
+    HARD_ASSERT(error != nullptr, "error is nullptr");
+
+    if (root == nullptr) return 0;
+
+    subtree_hash_index_t index = {};
+    error_code index_error = subtree_hash_index_build(&index, root);
+    hashed_node_t* nodes = index_error == ERROR_NO ? (hashed_node_t*)calloc(index.entries_cnt, sizeof(hashed_node_t)) : nullptr;
+    if (!nodes) {
+        LOGGER_ERROR("count_distinct_subtrees: out of memory");
+        subtree_hash_index_dest(&index);
+        *error |= ERROR_MEM_ALLOC;
+        return 0;
+    }
+
+    size_t collected_cnt = 0;
+    for (size_t i = 0; i < index.slots_cap; i++) {
+        if (index.slots[i].node) nodes[collected_cnt++] = {index.slots[i].hash, index.slots[i].node};
+    }
+    subtree_hash_index_dest(&index);
+    qsort(nodes, collected_cnt, sizeof(hashed_node_t), &hashed_node_cmp);
+
+    /* inside a run of equal hashes the first nodes of every distinct shape are moved to the front */
+    size_t distinct_cnt = 0;
+    for (size_t group_start = 0; group_start < collected_cnt; ) {
+        size_t group_end = group_start + 1;
+        while (group_end < collected_cnt && nodes[group_end].hash == nodes[group_start].hash) group_end++;
+
+        size_t reps_end = group_start + 1;
+        for (size_t i = group_start + 1; i < group_end; i++) {
+            bool is_new = true;
+            for (size_t j = group_start; j < reps_end && is_new; j++) {
+                if (subtree_equal(nodes[i].node, nodes[j].node)) is_new = false;
+            }
+            if (is_new) nodes[reps_end++] = nodes[i];
+        }
+
+        distinct_cnt += reps_end - group_start;
+        group_start   = group_end;
+    }
+
+    free(nodes);
+    return distinct_cnt;
+}
+
 //================================================================================
 
 tree_node_t* tree_init_root(tree_t* tree, node_type_t node_type, value_t value) {
@@ -319,6 +704,46 @@ var_val_type put_var_val(tree_t* tree, size_t var_idx, var_val_type value) {
 
 //--------------------------------------------------------------------------------
 
+error_code var_bindings_init(var_bindings_t* bindings, const stack_t* var_stack) {
+    HARD_ASSERT(bindings  != nullptr, "bindings is nullptr");
+    HARD_ASSERT(var_stack != nullptr, "var_stack is nullptr");
+
+    bindings->vals = nullptr;
+    bindings->size = var_stack->size;
+    if(bindings->size == 0) return ERROR_NO;
+
+    bindings->vals = (var_val_type*)calloc(bindings->size, sizeof(var_val_type));
+    if(!bindings->vals) {
+        LOGGER_ERROR("var_bindings_init: calloc failed");
+        bindings->size = 0;
+        return ERROR_MEM_ALLOC;
+    }
+
+    for(size_t i = 0; i < bindings->size; i++) {
+        bindings->vals[i] = var_stack->data[i].val;
+    }
+    return ERROR_NO;
+}
+
+error_code var_bindings_dest(var_bindings_t* bindings) {
+    if(!bindings) return ERROR_NO;
+
+    free(bindings->vals);
+    bindings->vals = nullptr;
+    bindings->size = 0;
+    return ERROR_NO;
+}
+
+var_val_type bind_var_val(var_bindings_t* bindings, size_t var_idx, var_val_type value) {
+    HARD_ASSERT(bindings         != nullptr, "bindings is nullptr");
+    HARD_ASSERT(var_idx < bindings->size,    "var_idx is out of range");
+
+    bindings->vals[var_idx] = value;
+    return value;
+}
+
+//--------------------------------------------------------------------------------
+
 static void clear_input_buff() {
     int ch = 0;
     while ((ch = getchar()) != '\n' && ch != EOF) {}
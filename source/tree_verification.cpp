@@ -3,10 +3,14 @@
 #include "asserts.h"
 #include "tree_operations.h"
 #include "tree_file_io.h"
+#include "metrics.h"
+#include "dump_pipeline.h"
+#include "tree_check.h"
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <time.h>
 
 #ifndef VERIFY_DEBUG
@@ -27,6 +31,10 @@ error_code tree_dump(const tree_t* tree,
     return ERROR_NO;
 }
 
+void tree_dump_set_limits(tree_dump_limits_t limits) {
+    (void)limits;
+}
+
 #else
 
 //================================================================================
@@ -34,7 +42,6 @@ error_code tree_dump(const tree_t* tree,
 #define BUFFER_SIZE_TIME  64
 #define BUFFER_SIZE_PATH  256
 #define BUFFER_SIZE_CMD   512
-#define MAX_NODES_COLLECT 4096
 
 //================================================================================
 
@@ -69,6 +76,8 @@ error_code tree_dump(const tree_t* tree,
 #define HEAD_FILL       LIGHT2_BLUE
 #define LEAF_COLOR      LIGHT1_GREEN
 #define LEAF_FILL       LIGHT2_GREEN
+#define MORE_COLOR      LIGHT3_RED
+#define MORE_FILL       LIGHT1_RED
 
 //================================================================================
 
@@ -87,49 +96,6 @@ static void vfmt(char* buf, size_t cap, const char* fmt, va_list ap) {
     vsnprintf(buf, cap, fmt, ap);
 }
 
-static int run_dot_to_svg(const char *dot_path, const char *svg_path) {
-    char cmd[BUFFER_SIZE_CMD] = {};
-    snprintf(cmd, sizeof(cmd), "dot -Tsvg \"%s\" -o \"%s\"", dot_path, svg_path);
-    return system(cmd) == 0;
-}
-
-static error_code collect_recursive(const tree_node_t* node, const tree_node_t** arr, size_t* n) {
-    if (node == nullptr) return ERROR_NO;
-    
-    arr[(*n)++] = node;
-    error_code error = ERROR_NO;
-    error |= collect_recursive(node->left, arr, n);
-    error |= collect_recursive(node->right, arr, n);
-    return error;
-}
-
-static error_code collect_nodes_dynamic(const tree_node_t* root, const tree_node_t*** nodes_out, size_t* count_out) {
-    if (root == nullptr) {
-        *nodes_out = nullptr;
-        *count_out = 0;
-        return ERROR_NO;
-    }
-    
-    size_t count = count_nodes_recursive(root);
-    if (count > MAX_NODES_COLLECT) {
-        LOGGER_ERROR("collect_nodes_dynamic: too many nodes (%zu > %d)", count, MAX_NODES_COLLECT);
-        return ERROR_BIG_SIZE;
-    }
-    
-    const tree_node_t** nodes = (const tree_node_t**)calloc(count, sizeof(const tree_node_t*));
-    if (nodes == nullptr) {
-        LOGGER_ERROR("collect_nodes_dynamic: failed to allocate memory");
-        return ERROR_MEM_ALLOC;
-    }
-    
-    size_t n = 0;
-    error_code error = collect_recursive(root, nodes, &n);
-    
-    *nodes_out = nodes;
-    *count_out = n;
-    return error;
-}
-
 static const char* node_val_to_str(const tree_t* tree, const tree_node_t* node,
                                    char* buf, size_t buf_size)
 {
@@ -204,46 +170,225 @@ static void print_node_label(const tree_t* tree, const tree_node_t* node, FILE*
 
 
 
-static int dump_make_graphviz_svg(const tree_t* tree, const char* base) {
-    if (!tree || !tree->root) return 0;
-    char dot_path[BUFFER_SIZE_PATH] = {};
-    char svg_path[BUFFER_SIZE_PATH] = {};
-    snprintf(dot_path, sizeof(dot_path), "%s.dot", base);
-    snprintf(svg_path, sizeof(svg_path), "%s.svg", base);
-
-    FILE* file = fopen(dot_path, "w");
-    if (!file) return 0;
-
-    fprintf(file, "digraph T{\n");
-    fprintf(file, "  node [fontname=\"Fira Mono\",shape=record,style=\"filled,rounded\",fontsize=12];\n");
-    fprintf(file, "  graph [splines=true, nodesep=0.6, ranksep=0.6];\n");
-
-    const tree_node_t** nodes = nullptr;
-    size_t n = 0;
-    error_code error = collect_nodes_dynamic(tree->root, &nodes, &n);
-    if (error != ERROR_NO || nodes == nullptr) {
-        fclose(file);
-        return 0;
+static const char* node_type_to_string(node_type_t type) {
+    switch (type) {
+        case FUNCTION: return "FUNCTION";
+        case CONSTANT: return "CONSTANT";
+        case VARIABLE: return "VARIABLE";
+        default: return "UNKNOWN";
+    }
+}
+
+//================================================================================
+// One preorder pass writes the HTML rows and the dot graph together. Only nodes up to
+// max_depth are walked with the frame stack, so it never holds more than max_depth + 3
+// frames; deeper or over-limit subtrees become one summary node each.
+
+struct dump_frame_t {
+    const tree_node_t* node;
+    const tree_node_t* parent;
+    size_t             depth;
+};
+
+struct dump_stream_t {
+    const tree_t*       tree;
+    FILE*               html;
+    FILE*               dot;          /* nullptr => no graph */
+    const tree_node_t** shown;        /* open addressing set of emitted and collapsed nodes */
+    bool*               is_shown_collapsed; /* per slot of shown */
+    size_t              shown_cap;
+    size_t              shown_cnt;
+    size_t              rows_cnt;
+    size_t              collapsed_cnt;
+    size_t              shared_cnt;
+};
+
+static tree_dump_limits_t dump_limits = {TREE_DUMP_DEFAULT_MAX_DEPTH, TREE_DUMP_DEFAULT_MAX_NODES};
+
+void tree_dump_set_limits(tree_dump_limits_t limits) {
+    dump_limits.max_depth = limits.max_depth ? limits.max_depth : TREE_DUMP_DEFAULT_MAX_DEPTH;
+    dump_limits.max_nodes = limits.max_nodes ? limits.max_nodes : TREE_DUMP_DEFAULT_MAX_NODES;
+}
+
+/* the slot holding node, or the free slot it would go to */
+static size_t shown_find(const dump_stream_t* stream, const tree_node_t* node) {
+    size_t slot = ((uintptr_t)node >> 4) & (stream->shown_cap - 1);
+    while (stream->shown[slot] && stream->shown[slot] != node) slot = (slot + 1) & (stream->shown_cap - 1);
+    return slot;
+}
+
+struct summary_slot_t {
+    const tree_node_t* node;
+    size_t             depth; /* 0 while the node is on the stack */
+};
+
+struct summary_set_t {
+    summary_slot_t* slots;
+    size_t          cap;
+    size_t          cnt;
+};
+
+static summary_slot_t* summary_find(const summary_set_t* set, const tree_node_t* node) {
+    size_t slot = ((uintptr_t)node >> 4) & (set->cap - 1);
+    while (set->slots[slot].node && set->slots[slot].node != node) slot = (slot + 1) & (set->cap - 1);
+    return &set->slots[slot];
+}
+
+static bool summary_reserve(summary_set_t* set) {
+    if (2 * (set->cnt + 1) < set->cap) return true;
+
+    summary_set_t new_set = {(summary_slot_t*)calloc(2 * set->cap, sizeof(summary_slot_t)), 2 * set->cap, set->cnt};
+    if (!new_set.slots) return false;
+    for (size_t i = 0; i < set->cap; i++) {
+        if (set->slots[i].node) *summary_find(&new_set, set->slots[i].node) = set->slots[i];
     }
+    free(set->slots);
+    *set = new_set;
+    return true;
+}
 
-    size_t i = 0;
-    for (i = 0; i < n; ++i) {
-        const tree_node_t* node = nodes[i];
-        if(node == tree->root)               print_node_label(tree, node, file, NODE_ROOT);
-        else if(!node->left && !node->right) print_node_label(tree, node, file, NODE_LEAF);
-        else                                 print_node_label(tree, node, file, NODE_BASIC);
+/* Distinct nodes and the longest path. Every node is expanded once, so a DAG with shared
+   subtrees costs its node count, not its path count. */
+static void subtree_summary(const tree_node_t* root, size_t* nodes_cnt, size_t* depth) {
+    *nodes_cnt = 0;
+    *depth     = 0;
+
+    summary_set_t set    = {(summary_slot_t*)calloc(64, sizeof(summary_slot_t)), 64, 0};
+    size_t        cap    = 64;
+    size_t        size   = 0;
+    dump_frame_t* frames = (dump_frame_t*)calloc(cap, sizeof(dump_frame_t));
+    if (!set.slots || !frames) {
+        free(set.slots);
+        free(frames);
+        return;
     }
-    for (i = 0; i < n; ++i) {
-        const tree_node_t* node = nodes[i];
-        if (node->left)  fprintf(file, "  node_%p -> node_%p [color=\"%s\"];\n", node, node->left,  EDGE_COLOR);
-        if (node->right) fprintf(file, "  node_%p -> node_%p [color=\"%s\"];\n", node, node->right, EDGE_COLOR);
+
+    /* parent is the node itself on the second visit, after its children are done */
+    frames[size++] = {root, nullptr, 0};
+    while (size > 0) {
+        dump_frame_t frame = frames[--size];
+        if (frame.parent) {
+            size_t left_depth  = frame.node->left  ? summary_find(&set, frame.node->left)->depth  : 0;
+            size_t right_depth = frame.node->right ? summary_find(&set, frame.node->right)->depth : 0;
+            summary_find(&set, frame.node)->depth = 1 + (left_depth > right_depth ? left_depth : right_depth);
+            continue;
+        }
+        if (summary_find(&set, frame.node)->node) continue;
+
+        if (!summary_reserve(&set)) break;
+        *summary_find(&set, frame.node) = {frame.node, 0};
+        set.cnt++;
+
+        if (size + 3 > cap) {
+            dump_frame_t* new_frames = (dump_frame_t*)realloc(frames, 2 * cap * sizeof(dump_frame_t));
+            if (!new_frames) break;
+            frames = new_frames;
+            cap   *= 2;
+        }
+        frames[size++] = {frame.node, frame.node, 0};
+        if (frame.node->right) frames[size++] = {frame.node->right, nullptr, 0};
+        if (frame.node->left)  frames[size++] = {frame.node->left,  nullptr, 0};
     }
-    fprintf(file, "}\n");
-    fclose(file);
-    
-    int result = run_dot_to_svg(dot_path, svg_path);
-    free(nodes);
-    return result;
+
+    *nodes_cnt = set.cnt;
+    *depth     = summary_find(&set, root)->depth;
+    free(set.slots);
+    free(frames);
+}
+
+static void dump_html_row(dump_stream_t* stream, const tree_node_t* node, const char* type_str, const char* value) {
+    fprintf(stream->html, "%-4zu  %-14p  %-14s  %-14p  %-14p  %s\n",
+            stream->rows_cnt++, node, type_str, node->left, node->right, value);
+}
+
+static void dump_emit_node(dump_stream_t* stream, const tree_node_t* node) {
+    char str_buf[MAX_STRLEN_VALUE] = {};
+    dump_html_row(stream, node, node_type_to_string(node->type),
+                  node_val_to_str(stream->tree, node, str_buf, MAX_STRLEN_VALUE));
+    if (!stream->dot) return;
+
+    if (node == stream->tree->root)          print_node_label(stream->tree, node, stream->dot, NODE_ROOT);
+    else if (!node->left && !node->right)    print_node_label(stream->tree, node, stream->dot, NODE_LEAF);
+    else                                     print_node_label(stream->tree, node, stream->dot, NODE_BASIC);
+}
+
+static void dump_emit_summary(dump_stream_t* stream, const tree_node_t* node) {
+    size_t nodes_cnt = 0;
+    size_t depth     = 0;
+    subtree_summary(node, &nodes_cnt, &depth);
+    stream->collapsed_cnt++;
+
+    char summary[MAX_STRLEN_VALUE] = {};
+    snprintf(summary, sizeof(summary), "%zu nodes, depth %zu", nodes_cnt, depth);
+    dump_html_row(stream, node, "COLLAPSED", summary);
+    if (!stream->dot) return;
+
+    fprintf(stream->dot,
+            "  more_%p[shape=record,label=\"{ {subtree: %p} | {%s} }\","
+            "color=\"" MORE_COLOR "\",fillcolor=\"" MORE_FILL "\"];\n",
+            node, node, summary);
+}
+
+static error_code dump_stream_nodes(dump_stream_t* stream) {
+    const tree_node_t* root = stream->tree->root;
+    if (root == nullptr) return ERROR_NO;
+
+    size_t         frames_cap = dump_limits.max_depth + 3;
+    dump_frame_t*  frames     = (dump_frame_t*)calloc(frames_cap, sizeof(dump_frame_t));
+    /* max_nodes emitted nodes have at most 2 * max_nodes + 1 collapsed children */
+    stream->shown_cap = 1;
+    while (stream->shown_cap < 2 * (3 * dump_limits.max_nodes + 1)) stream->shown_cap *= 2;
+    stream->shown              = (const tree_node_t**)calloc(stream->shown_cap, sizeof(const tree_node_t*));
+    stream->is_shown_collapsed = (bool*)calloc(stream->shown_cap, sizeof(bool));
+    if (!frames || !stream->shown || !stream->is_shown_collapsed) {
+        LOGGER_ERROR("dump_stream_nodes: calloc failed");
+        free(frames);
+        free(stream->shown);
+        free(stream->is_shown_collapsed);
+        stream->shown              = nullptr;
+        stream->is_shown_collapsed = nullptr;
+        return ERROR_MEM_ALLOC;
+    }
+
+    size_t frames_cnt = 0;
+    frames[frames_cnt++] = {root, nullptr, 0};
+    while (frames_cnt > 0) {
+        dump_frame_t frame = frames[--frames_cnt];
+        const tree_node_t* node = frame.node;
+
+        size_t slot         = shown_find(stream, node);
+        bool   is_shared    = stream->shown[slot] != nullptr;
+        bool   is_collapsed = is_shared ? stream->is_shown_collapsed[slot]
+                                        : frame.depth > dump_limits.max_depth || stream->shown_cnt >= dump_limits.max_nodes;
+        if (stream->dot && frame.parent) {
+            fprintf(stream->dot, "  node_%p -> %s_%p [color=\"%s\"%s];\n", frame.parent,
+                    is_collapsed ? "more" : "node", node, EDGE_COLOR, is_shared ? ",style=dashed" : "");
+        }
+
+        if (is_shared) {
+            stream->shared_cnt++;
+            continue;
+        }
+        stream->shown[slot]              = node;
+        stream->is_shown_collapsed[slot] = is_collapsed;
+        if (is_collapsed) {
+            dump_emit_summary(stream, node);
+            continue;
+        }
+
+        stream->shown_cnt++;
+        dump_emit_node(stream, node);
+        HARD_ASSERT(frames_cnt + 2 <= frames_cap, "dump frame stack overflow");
+        if (node->right) frames[frames_cnt++] = {node->right, node, frame.depth + 1};
+        if (node->left)  frames[frames_cnt++] = {node->left,  node, frame.depth + 1};
+    }
+
+    free(frames);
+    free(stream->shown);
+    free(stream->is_shown_collapsed);
+    stream->shown              = nullptr;
+    stream->is_shown_collapsed = nullptr;
+    return ERROR_NO;
 }
 
 error_code tree_verify(const tree_t* tree,
@@ -251,33 +396,16 @@ error_code tree_verify(const tree_t* tree,
                        tree_dump_mode_t mode,
                        const char* fmt, ...) {
     (void)fmt;
-    error_code error = ERROR_NO;
     if (!tree) return ERROR_NULL_ARG;
-    if (tree->root && tree->size == 0) error |= ERROR_INVALID_STRUCTURE;
+    error_code error = tree_check(tree, 0, nullptr);
     if (error != ERROR_NO && mode != TREE_DUMP_NO) {
-        tree_dump(tree, ver_info, true, "verify fail");
+        tree_dump(tree, ver_info, mode == TREE_DUMP_IMG, "verify fail: error %ld", error);
     }
     return error;
 }
-static const char* node_type_to_string(node_type_t type) {
-    switch (type) {
-        case FUNCTION: return "FUNCTION";
-        case CONSTANT: return "CONSTANT";
-        case VARIABLE: return "VARIABLE";
-        default: return "UNKNOWN";
-    }
-}
-static error_code write_html(const tree_t* tree,
-                             ver_info_t ver_info_called,
-                             int idx, const char* comment,
-                             const char* svg_path, int is_visual) {
-    if (!tree || !tree->dump_file || !*tree->dump_file) {
-        LOGGER_ERROR("write_html: null args");
-        return ERROR_NULL_ARG;
-    }
-    
-    FILE* html = *tree->dump_file;
-    
+static void write_html_header(const tree_t* tree, FILE* html,
+                              ver_info_t ver_info_called,
+                              int idx, const char* comment) {
     time_t t = time(nullptr);
     char ts[BUFFER_SIZE_TIME] = {};
     strftime(ts, sizeof ts, "%Y-%m-%d %H:%M:%S", localtime(&t));
@@ -319,30 +447,11 @@ static error_code write_html(const tree_t* tree,
 
     fprintf(html, "\nIDX   NODE PTR          TYPE          LEFT PTR        RIGHT PTR           VALUE\n");
     fprintf(html, "----  --------------  --------------  --------------  --------------  --------------------\n");
+}
 
-    const tree_node_t** nodes = nullptr;
-    size_t n = 0;
-    error_code error = collect_nodes_dynamic(tree->root, &nodes, &n);
-    if (error != ERROR_NO) {
-        fprintf(html, "Error collecting nodes\n");
-        return error;
-    }
-    
-    size_t i = 0;
-    for (i = 0; i < n; ++i) {
-        const tree_node_t* node = nodes[i];
-        char  str_buf[MAX_STRLEN_VALUE] = {};
-        const char* value = node_val_to_str(tree, node, str_buf, MAX_STRLEN_VALUE);
-        const char* type_str = node ? node_type_to_string(node->type) : "NULL";
-        fprintf(html, "%-4zu  %-14p  %-14s  %-14p  %-14p  %s\n",
-                i, node,
-                type_str,
-                (node ? node->left   : nullptr),
-                (node ? node->right  : nullptr),
-                value);
-    }
-
-    free(nodes);
+static void write_html_footer(FILE* html, const dump_stream_t* stream, const char* svg_path, int is_visual) {
+    fprintf(html, "\nrows: %zu, collapsed subtrees: %zu, shared nodes: %zu (limits: depth %zu, nodes %zu)\n",
+            stream->rows_cnt, stream->collapsed_cnt, stream->shared_cnt, dump_limits.max_depth, dump_limits.max_nodes);
     fprintf(html, "\nSVG: %s\n", svg_path ? svg_path : "");
     fprintf(html, "</pre>\n");
     if (svg_path && svg_path[0] && is_visual) {
@@ -353,8 +462,38 @@ static error_code write_html(const tree_t* tree,
     }
     fprintf(html, "\n<hr>\n");
     fflush(html);
+}
 
-    return ERROR_NO;
+/* the svg is rendered by the dump pipeline later, svg_path is where it will appear */
+static error_code dump_stream_tree(const tree_t* tree, FILE* html, bool is_visual,
+                                   dump_stream_t* stream, char* svg_path, size_t svg_path_size) {
+    char*  dot_text = nullptr;
+    size_t dot_len  = 0;
+
+    *stream = {};
+    stream->tree = tree;
+    stream->html = html;
+    if (is_visual && tree->root) {
+        stream->dot = open_memstream(&dot_text, &dot_len);
+        if (!stream->dot) LOGGER_WARNING("tree_dump: open_memstream failed, graph skipped");
+    }
+    if (stream->dot) {
+        fprintf(stream->dot, "digraph T{\n");
+        fprintf(stream->dot, "  node [fontname=\"Fira Mono\",shape=record,style=\"filled,rounded\",fontsize=12];\n");
+        fprintf(stream->dot, "  graph [splines=true, nodesep=0.6, ranksep=0.6];\n");
+    }
+
+    error_code error = dump_stream_nodes(stream);
+    if (error != ERROR_NO) fprintf(html, "Error collecting nodes\n");
+
+    if (stream->dot) {
+        fprintf(stream->dot, "}\n");
+        fclose(stream->dot);
+        stream->dot = nullptr;
+        if (error == ERROR_NO) error |= dump_pipeline_submit(dot_text, dot_len, svg_path, svg_path_size);
+        free(dot_text);
+    }
+    return error;
 }
 
 error_code tree_dump(const tree_t* tree,
@@ -363,8 +502,12 @@ error_code tree_dump(const tree_t* tree,
                      const char* fmt, ...) {
     LOGGER_DEBUG("Dump started");
     if (!tree) return ERROR_NULL_ARG;
+    if (!tree->dump_file || !*tree->dump_file) {
+        LOGGER_ERROR("tree_dump: dump file is not opened");
+        return ERROR_NULL_ARG;
+    }
+    long long begin_ns = metrics_phase_begin();
     static int dump_idx = 0;
-    system("mkdir -p dumps");
 
     char comment[BUFFER_SIZE_CMD] = {};
     va_list ap = {};
@@ -372,21 +515,16 @@ error_code tree_dump(const tree_t* tree,
     vfmt(comment, sizeof(comment), fmt, ap);
     va_end(ap);
 
-    char base[BUFFER_SIZE_PATH] = {};
-    snprintf(base, sizeof base, "dumps/tree_dump_%03d", dump_idx);
-    char svg_path[BUFFER_SIZE_PATH + 5] = {};
-    if (is_visual && tree->root) {
-        if (dump_make_graphviz_svg(tree, base)) {
-            snprintf(svg_path, sizeof svg_path, "%s.svg", base);
-            LOGGER_DEBUG("tree_dump: SVG generated successfully: %s", svg_path);
-        } else {
-            LOGGER_WARNING("tree_dump: failed to generate SVG");
-        }
-    } else {
-        LOGGER_DEBUG("tree_dump: SVG not generated: is_visual=%d, root=%p", is_visual, tree->root);
-    }
+    FILE* html = *tree->dump_file;
+    write_html_header(tree, html, ver_info, dump_idx, comment);
+
+    dump_stream_t stream = {};
+    char svg_path[BUFFER_SIZE_PATH] = {};
+    error_code error = dump_stream_tree(tree, html, is_visual, &stream, svg_path, sizeof svg_path);
+    if (svg_path[0]) LOGGER_DEBUG("tree_dump: SVG queued: %s", svg_path);
+    else             LOGGER_DEBUG("tree_dump: SVG not generated: is_visual=%d, root=%p", is_visual, tree->root);
 
-    error_code error = write_html(tree, ver_info, dump_idx, comment, svg_path, is_visual);
+    write_html_footer(html, &stream, svg_path, is_visual);
     if(!error) {
         LOGGER_INFO("Dump #%d written%s%s", dump_idx,
                     svg_path[0] ? " with SVG: " : "",
@@ -395,6 +533,7 @@ error_code tree_dump(const tree_t* tree,
         LOGGER_INFO("Dump #%d failed to be written", dump_idx);
     }
     dump_idx++;
+    metrics_phase_end(METRICS_PHASE_DUMP, begin_ns);
     return error;
 }
 